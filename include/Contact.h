@@ -4,8 +4,21 @@
 #include <list>
 #include <functional> // for std::function
 #include <utility>
+#include <memory>
+#include <type_traits>
+#include <string_view>
+#include <chrono>
 
 #include <threadclass.h>
+#include <contactstore.h>
+#include <contactarena.h>
+#include <contacthash.h>
+#include <phonetrie.h>
+#include <phonekey.h>
+#include <phonenormalize.h>
+#include <fuzzyindex.h>
+#include <contactwal.h>
+#include <mappedstore.h>
 
 using namespace Threading;
 
@@ -30,6 +43,14 @@ namespace User
 		{
 		}
 
+		// Copy of a stored record's attributes
+		explicit Contact(const StoredContact& contact_) :
+			_first(contact_.getfirstname()),
+			_last(contact_.getlastname()),
+			_phone(contact_.getphone())
+		{
+		}
+
 		const std::string& getfirstname() const
 		{
 			return _first;
@@ -66,30 +87,234 @@ namespace User
 		}
 	};
 
-	class hash_name {
+	// Hash of a contact's three attributes through the FieldHash policy ( contacthash.h ), a phone that packs
+	// ( phonekey.h ) is hashed by its key
+	template <typename FieldHash>
+	class basic_hash_name {
 	 public:
 		std::size_t operator()(const User::Contact& name_) const
 		{
-			return std::hash<std::string>()(name_.getfirstname()) ^ std::hash<std::string>()(name_.getlastname())
-				^ std::hash<std::string>()(name_.getphone());
+			uint64_t phonekey = PackPhone(name_.getphone());
+
+			if (phonekey != 0)
+				return FieldHash()(name_.getfirstname(), name_.getlastname(), phonekey);
+
+			return FieldHash()(name_.getfirstname(), name_.getlastname(), name_.getphone());
+		}
+	};
+
+	using hash_name = basic_hash_name<ContactFieldHash>;
+
+	// Non owning view of a contact's attributes. Observers get views that are only valid for the duration of
+	// the callback, the store keys its records by views into the records themselves. The phone is carried as a
+	// PhoneKey, packed once when the view is made from text and taken from the record otherwise
+	class ContactView
+	{
+	private:
+		std::string_view _first;
+		std::string_view _last;
+		PhoneKey _phone;
+
+	public:
+		ContactView() {}
+
+		ContactView(std::string_view first_, std::string_view last_, std::string_view phone_) :
+			_first(first_), _last(last_), _phone(phone_)
+		{}
+
+		explicit ContactView(const Contact& contact_) :
+			_first(contact_.getfirstname()), _last(contact_.getlastname()), _phone(contact_.getphone())
+		{}
+
+		explicit ContactView(const StoredContact& contact_) :
+			_first(contact_.getfirstname()), _last(contact_.getlastname()), _phone(contact_.phonekey(), contact_.getphone())
+		{}
+
+		std::string_view getfirstname() const { return _first; }
+
+		std::string_view getlastname() const { return _last; }
+
+		std::string_view getphone() const { return _phone.text(); }
+
+		const PhoneKey& getphonekey() const { return _phone; }
+
+		bool operator==(const ContactView& p_) const
+		{
+			return _phone == p_._phone && _first == p_._first && _last == p_._last;
 		}
 	};
 
-	enum ContactEvents { ADD, UPDATE, NONE};
+	// Same value as basic_hash_name for the viewed contact, the store selects its hash policy through this type
+	template <typename FieldHash>
+	class basic_hash_contactview {
+	 public:
+		std::size_t operator()(const User::ContactView& name_) const
+		{
+			if (name_.getphonekey().packed() != 0)
+				return FieldHash()(name_.getfirstname(), name_.getlastname(), name_.getphonekey().packed());
+
+			return FieldHash()(name_.getfirstname(), name_.getlastname(), name_.getphone());
+		}
+	};
+
+	using hash_contactview = basic_hash_contactview<ContactFieldHash>;
+
+	// Order of the name index: last name, first name, then phone number so that every contact has its own position
+	class name_order {
+	 public:
+		bool operator()(const User::ContactView& lhs_, const User::ContactView& rhs_) const
+		{
+			if (int cmp = lhs_.getlastname().compare(rhs_.getlastname()))
+				return cmp < 0;
+			if (int cmp = lhs_.getfirstname().compare(rhs_.getfirstname()))
+				return cmp < 0;
+			return lhs_.getphone() < rhs_.getphone();
+		}
+	};
+
+	// Immutable contact shared by the store and every notification about it, events only copy the pointer.
+	// The attributes live in the store's ContactArena ( contactarena.h )
+	using ContactRecord = std::shared_ptr<const StoredContact>;
+
+	// Key of a record in the store, a view into the record itself
+	class contact_key {
+	 public:
+		ContactView operator()(const ContactRecord& contact_) const { return ContactView(*contact_); }
+	};
+
+	// ( first, last ) name of a record for the fuzzy name index
+	class contact_names {
+	 public:
+		std::pair<std::string_view, std::string_view> operator()(const ContactRecord& contact_) const
+		{
+			return { contact_->getfirstname(), contact_->getlastname() };
+		}
+	};
+
+	// What Contacts::syncFromJSON found and changed
+	struct sync_report
+	{
+		size_t parsed{ 0 }; // contacts in the input
+		size_t invalid{ 0 }; // rejected like addContact rejects them, they do not keep a stored contact either
+		size_t duplicates{ 0 }; // repeated in the input
+		size_t unchanged{ 0 }; // in the input and already in the store
+		size_t added{ 0 };
+		size_t removed{ 0 }; // in the store but not in the input
+		double parsems{ 0 };
+		double applyms{ 0 }; // diff and apply, shards in parallel
+		double totalms{ 0 };
+	};
+
+	// Result of Contacts::fuzzySearch, distance is the edit distance of the query to "first last"
+	struct FuzzyMatch
+	{
+		ContactRecord contact;
+		unsigned int distance;
+	};
+
+	enum ContactEvents { ADD, UPDATE, REMOVE, NONE};
 	enum CustomerAttr { FIRST, LAST, PHONE };
+	enum ContactAddResult { ADDED, DUPLICATE, INVALID, FAILED }; // per contact result of a batch add, FAILED: added but not made durable
+	enum SortOrder { ASCENDING, DESCENDING }; // by last name, first name, phone number
+
+	// Position of a paged listing, a default constructed cursor starts at the first contact. It stores the last
+	// contact returned, so pages stay correct when contacts are added or updated between two calls
+	class ContactCursor
+	{
+	private:
+		friend class Contacts;
+
+		std::string _first;
+		std::string _last;
+		std::string _phone;
+		bool _started{ false };
+		bool _end{ false };
+
+	public:
+		ContactCursor() {}
+
+		// True once a listing returned its last page
+		bool atend() const { return _end; }
+	};
+
+	// Non owning view over contiguous elements ( std::span is C++20 only )
+	template <typename T>
+	class Span
+	{
+	private:
+		T* _data{ nullptr };
+		size_t _size{ 0 };
+
+	public:
+		Span() {}
+
+		Span(T* data_, size_t size_) : _data(data_), _size(size_)
+		{}
+
+		Span(const std::vector<typename std::remove_const<T>::type>& vec_) : _data(vec_.data()), _size(vec_.size())
+		{}
+
+		template <size_t N>
+		Span(T(&array_)[N]) : _data(array_), _size(N)
+		{}
+
+		T* data() const { return _data; }
+		size_t size() const { return _size; }
+		bool empty() const { return _size == 0; }
+		T& operator[](size_t idx_) const { return _data[idx_]; }
+		T* begin() const { return _data; }
+		T* end() const { return _data + _size; }
+	};
+
+	using ContactBatch = std::shared_ptr<const std::vector<ContactRecord>>;
 
 	constexpr uint8_t numevents = 255;
 	constexpr size_t MAXATTRIBUTES = 3;
+	constexpr size_t DEFAULTSHARDS = 16; // number of independently locked sub maps of the contact store
+	constexpr size_t DEFAULTQUEUECAPACITY = 65536; // notification events buffered before the full queue policy applies
+
+	// Notification settings of a Contacts instance
+	struct NotifyConfig
+	{
+		size_t threads{ 1 }; // observer callback threads, can be changed later with resizeNotifyPool
+		size_t maxthreads{ 0 }; // upper bound for resizeNotifyPool, 0 = max( threads, hardware threads )
+		std::vector<unsigned int> cpus; // optional affinity, notification thread i runs on cpus[ i % cpus.size() ]
+		size_t queuecapacity{ DEFAULTQUEUECAPACITY }; // total events buffered, split over maxthreads queues
+		QueueFullPolicy queuepolicy{ QueueFullPolicy::BLOCK }; // what add/update do when observers fall behind
+		size_t observerqueuecapacity{ DEFAULTQUEUECAPACITY }; // events buffered per registered observer
+		// what happens to a slow observer's events once its queue is full, BLOCK eventually throttles every
+		// observer, DROP_OLDEST / FAIL keep the others real time at the cost of losing events for the slow one
+		QueueFullPolicy observerqueuepolicy{ QueueFullPolicy::BLOCK };
+	};
+
+	// Persistence of a Contacts instance
+	struct StoreConfig
+	{
+		std::string path; // memory mapped store ( mappedstore.h ) the contacts live in, empty = memory only
+		size_t stripes{ 0 }; // files of a new store, 0 = one per shard. An existing store keeps its own
+		// true: the stored contacts are read in by background threads right away. Either way an operation first
+		// reads in what it needs, a single contact only its own stripe
+		bool preload{ true };
+	};
 
+	// Notification event, references the contact record(s) instead of copying the attributes. Copying an event
+	// only bumps reference counts
 	class ContactEventMsg
 	{
 	private:
 		ContactEvents _event{ ContactEvents::NONE };
-		std::string  _first;
-		std::string  _last;
-		std::string  _phone;
+		ContactRecord _contact;
+		ContactBatch _batch; // set for batched events, _contact is unused then
 	public:
-		ContactEventMsg(const std::string first_, const std::string last_, const std::string phone_, const ContactEvents event_) :_first(first_), _last(last_), _phone(phone_), _event(event_)
+		ContactEventMsg(const std::string first_, const std::string last_, const std::string phone_, const ContactEvents event_) :
+			_event(event_), _contact(ContactArena::single(first_, last_, phone_))
+		{}
+
+		ContactEventMsg(ContactRecord contact_, const ContactEvents event_) :_event(event_), _contact(std::move(contact_))
+		{}
+
+		// One message for a whole batch, the contacts are shared instead of copied through the queue
+		ContactEventMsg(ContactBatch batch_, const ContactEvents event_) :_event(event_), _batch(std::move(batch_))
 		{}
 
 		ContactEventMsg() {}
@@ -100,38 +325,142 @@ namespace User
 			{
 				case ContactEvents::ADD: return 0;
 				case ContactEvents::UPDATE: return 1;
+				case ContactEvents::REMOVE: return 2;
 			}
 		}
 
 		ContactEvents getEvent() const { return _event; }
 
-		const std::string& getfirstname() const
+		const StoredContact& getcontact() const { return *_contact; }
+
+		std::string_view getfirstname() const
 		{
-			return _first;
+			return _contact->getfirstname();
 		}
 
-		const std::string& getlastname() const
+		std::string_view getlastname() const
 		{
-			return _last;
+			return _contact->getlastname();
 		}
 
-		const std::string& getphone() const
+		std::string_view getphone() const
 		{
-			return _phone;
+			return _contact->getphone();
 		}
+
+		bool isbatch() const { return _batch != nullptr; }
+
+		const std::vector<ContactRecord>& getbatch() const { return *_batch; }
 	};
 
+	// Contacts are passed as views of the stored record, copy them ( Contact ) to keep them past the callback
 	class ContactObserver
 	{
 	public:
-		virtual void OnContactAdded(Contact contact_) 
+		virtual void OnContactAdded(const ContactView& contact_) 
 		{
 			std::cout << "\nDefault Add..";
 		}
-		virtual void OnContactUpdated(Contact contact_) 
+		virtual void OnContactUpdated(const ContactView& contact_) 
 		{
 			std::cout << "\n Default Update..";
 		}
+		// Called once for all contacts added by one addContacts call, override to consume them as a batch.
+		// Default forwards every contact to OnContactAdded
+		virtual void OnContactsAdded(const std::vector<ContactRecord>& contacts_)
+		{
+			for (const auto& contact : contacts_)
+				OnContactAdded(ContactView(*contact));
+		}
+		// Contacts removed by a sync ( Contacts::syncFromJSON ), ignored unless overridden
+		virtual void OnContactRemoved(const ContactView& contact_) {}
+		// Called once per notification lane for the contacts one sync removed, default forwards to OnContactRemoved
+		virtual void OnContactsRemoved(const std::vector<ContactRecord>& contacts_)
+		{
+			for (const auto& contact : contacts_)
+				OnContactRemoved(ContactView(*contact));
+		}
+
+		// Signatures of earlier versions, deleted so an observer still overriding one fails to compile instead of
+		// silently never being called
+		virtual void OnContactAdded(Contact contact_) = delete;
+		virtual void OnContactAdded(const Contact& contact_) = delete;
+		virtual void OnContactUpdated(Contact contact_) = delete;
+		virtual void OnContactUpdated(const Contact& contact_) = delete;
+	};
+
+	// Observer receiving contacts in batches, one virtual call per batch and no copies of the contacts.
+	// Adds and updates are delivered in arrival order, a run of adds followed by updates gives two callbacks
+	class ContactBatchObserver
+	{
+	public:
+		virtual ~ContactBatchObserver() {}
+
+		virtual void OnContactsAdded(Span<const ContactView> contacts_) {}
+
+		// views of the contacts as they were before the update
+		virtual void OnContactsUpdated(Span<const ContactView> contacts_) {}
+
+		virtual void OnContactsRemoved(Span<const ContactView> contacts_) {}
+	};
+
+	// How a ContactBatchObserver's queue is drained
+	struct BatchConfig
+	{
+		size_t maxbatch{ 1024 }; // contacts per callback at most
+		std::chrono::microseconds maxlinger{ 2000 }; // wait for the batch to fill up once the first event arrived
+	};
+
+	// Delivery queue and thread of one registered observer, either a ContactObserver / ContactBatchObserver
+	// ( all events ) or a function registered for one event. A slow observer only delays its own channel
+	class ObserverChannel
+	{
+	private:
+		ContactObserver* _observer{ nullptr };
+		ContactBatchObserver* _batchobserver{ nullptr };
+		std::function<void()> _function;
+		ContactEvents _event{ ContactEvents::NONE };
+		size_t _maxbatch{ 1 };
+		std::vector<ContactView> _views; // reused between batches
+		dispatch_channel<ContactEventMsg> _channel;
+
+		void deliver(const ContactEventMsg& data_);
+		void deliverbatch(std::vector<ContactEventMsg>& events_);
+		void flushviews(ContactEvents event_);
+
+	public:
+		ObserverChannel(ContactObserver* observer_, size_t capacity_, QueueFullPolicy policy_) :
+			_observer(observer_),
+			_channel(capacity_, policy_, [this](ContactEventMsg& data_) { deliver(data_); })
+		{}
+
+		ObserverChannel(ContactBatchObserver* observer_, const BatchConfig& batch_, size_t capacity_, QueueFullPolicy policy_) :
+			_batchobserver(observer_),
+			_maxbatch(std::max<size_t>(1, batch_.maxbatch)),
+			_channel(capacity_, policy_, [this](std::vector<ContactEventMsg>& events_) { deliverbatch(events_); }, batch_.maxbatch, batch_.maxlinger)
+		{}
+
+		ObserverChannel(ContactEvents event_, std::function<void()> function_, size_t capacity_, QueueFullPolicy policy_) :
+			_function(std::move(function_)),
+			_event(event_),
+			_channel(capacity_, policy_, [this](ContactEventMsg& data_) { deliver(data_); })
+		{}
+
+		bool wants(ContactEvents event_) const { return _observer != nullptr || _batchobserver != nullptr || _event == event_; }
+
+		const void* observer() const { return _observer ? static_cast<const void*>(_observer) : static_cast<const void*>(_batchobserver); }
+
+		const std::function<void()>& function() const { return _function; }
+
+		ContactEvents event() const { return _event; }
+
+		bool push(const ContactEventMsg& data_) { return _channel.push(data_); }
+
+		bool idle() const { return _channel.idle(); }
+
+		dispatch_stats stats() const { return _channel.stats(); }
+
+		void stop() { _channel.stop(); }
 	};
 
 	class Contacts
@@ -139,73 +468,220 @@ namespace User
 	private:
 		bool isContactvalid(const Contact& contact_);
 
-		// observers applicable to all supported events and specific to ContactObservers only
-		std::vector<ContactObserver*> _observerlist;
-		// specific event observers, observer can be anything like function, lamda expression, class method etc
-		std::unordered_map<ContactEvents, std::vector<std::function<void()>>> _observerseventlist;
-
-		using ContactMap = std::unordered_map<Contact, bool, hash_name>;
+		// one channel per registered observer ( ContactObservers and event specific function observers ).
+		// Copy on write: notification threads take a snapshot, register / unregister publish a new vector
+		using ObserverChannels = std::vector<std::shared_ptr<ObserverChannel>>;
+		std::shared_ptr<const ObserverChannels> _channels;
+		std::mutex _registermutex;
+		size_t _observerqueuecapacity;
+		QueueFullPolicy _observerqueuepolicy;
+
+		std::shared_ptr<const ObserverChannels> observerChannels() const { return std::atomic_load(&_channels); }
+		void addChannel(std::shared_ptr<ObserverChannel> channel_);
+		void removeChannels(const std::function<bool(const ObserverChannel&)>& match_);
+		bool notificationsPending() const;
+		bool observerStats(const void* observer_, dispatch_stats& stats_) const;
+
+		// attributes of every record: phone numbers appended to chunks, names interned once ( namedictionary.h )
+		ContactArena _arena;
+		std::mutex _compactmutex; // one compaction at a time
+
+		// records keyed by a view into the record itself, the attributes are stored once. The shards are flat tables
+		// of record pointers
+		using ContactMap = ShardedMap<ContactView, ContactRecord, hash_contactview, contact_key>;
 		ContactMap _contactmap;
 
-		threadsafe_queue<ContactEventMsg> _eventqueue;
+		// secondary indexes by attribute, changed under the _contactmap shard lock of the contact
+		ShardedIndex<ContactRecord> _firstindex;
+		ShardedIndex<ContactRecord> _lastindex;
+		ShardedIndex<ContactRecord, PhoneKey, phonekey_hash> _phoneindex; // packed phone keys
+		ShardedPhoneTrie<ContactRecord> _phonetrie; // prefix queries
+		ShardedOrderedIndex<ContactView, ContactRecord, hash_contactview, name_order> _nameindex; // sorted listings
+		ShardedTrigramIndex<ContactRecord, contact_names> _fuzzyindex; // approximate name search
+
+		// contacts written through to memory mapped files, optional ( StoreConfig ). The store is the contacts of
+		// the instance: a stripe is read into the map and indexes above once, before anything uses its contacts
+		std::unique_ptr<MappedContactStore> _store;
+		bool _storefailed{ false }; // StoreConfig::path could not be opened
+		std::thread _hydrator; // StoreConfig::preload
+
+		// durability of adds and updates, optional. Declared before _threads so the update thread is joined
+		// ( _joiner ) before the log is destroyed
+		std::unique_ptr<ContactWal> _wal;
 
 		std::atomic<bool> _done = false;
 		static uint8_t constexpr QUEUERETRY = 3;
+		std::vector<unsigned int> _notifycpus;
+		// events are routed to a pool lane by contact so events of one contact are delivered in order
+		keyed_worker_pool<ContactEventMsg> _notifypool;
 		std::vector<std::thread> _threads;
 		join_threads _joiner;
 		std::atomic<bool> _serverupdate = false;
-		mutable std::mutex  _contactmutex;
 		unsigned int _updatetimer{ 1000 };
-
-		void writetoNotificationQueue(const Contact& contact_, ContactEvents event_);
-		void notifyObservers();
-		void StartNotifyThreads();
+		std::atomic<bool> _normalizephones{ false };
+		std::atomic<unsigned int> _defaultcountry{ 0 };
+
+		bool hasObservers(ContactEvents event_) const;
+		size_t notifyLane(const ContactView& contact_) const;
+		void writetoNotificationQueue(const ContactRecord& contact_, ContactEvents event_);
+		void notifyObservers(ContactEventMsg& data);
+		void PinNotifyThread(size_t worker_);
 		void StartUpdateThread();
 		void UpdateContactTimerInterval(unsigned int interval);
+		bool parseContactsParallel(const char* data_, size_t size_, size_t& count_, unsigned int threads_);
+		bool syncContacts(const char* data_, size_t size_, sync_report& report_, unsigned int threads_);
+		void notifyBatch(const std::vector<ContactRecord>& records_, ContactEvents event_);
+		bool insertRecords(const std::vector<ContactView>& keys_, const std::function<ContactRecord(size_t)>& make_, bool* inserted_, size_t& added_);
+		std::vector<ContactRecord> listPage(const std::string* prefix_, ContactCursor& cursor_, size_t pagesize_, SortOrder order_) const;
+		void compactIfDue();
+		bool storedPhone(const std::string& phone_, char* buffer_, std::string_view& stored_) const;
+		void openStore(const StoreConfig& store_);
+		void loadStripe(size_t stripe_);
+		void loadStore() const;
+
+		// Reads in the stripe of the contact before it is looked up or changed
+		void loadContact(const ContactView& contact_)
+		{
+			if (_store)
+				loadStripe(_store->stripeof(contact_.getfirstname(), contact_.getlastname(), contact_.getphone()));
+		}
+
+		// phone_ is the phone number as stored, see storedPhone
+		ContactRecord makeRecord(const Contact& contact_, std::string_view phone_)
+		{
+			return _arena.make(contact_.getfirstname(), contact_.getlastname(), phone_);
+		}
 
-		bool addtoContactMap(const Contact& contact_)
+		void indexContact(const ContactRecord& contact_)
 		{
-			std::lock_guard<std::mutex> lk(_contactmutex);
+			_firstindex.insert(contact_->getfirstname(), contact_);
+			_lastindex.insert(contact_->getlastname(), contact_);
+			_phoneindex.insert(PhoneKey(contact_->phonekey(), contact_->getphone()), contact_);
+			_phonetrie.insert(contact_->getphone(), contact_);
+			_nameindex.insert(ContactView(*contact_), contact_);
+			_fuzzyindex.insert(contact_);
+		}
 
-			auto it = _contactmap.find(contact_);
+		void unindexContact(const ContactRecord& contact_)
+		{
+			_firstindex.erase(contact_->getfirstname(), contact_);
+			_lastindex.erase(contact_->getlastname(), contact_);
+			_phoneindex.erase(PhoneKey(contact_->phonekey(), contact_->getphone()), contact_);
+			_phonetrie.erase(contact_->getphone(), contact_);
+			_nameindex.erase(ContactView(*contact_));
+			_fuzzyindex.erase(contact_);
+		}
 
-			if (it == _contactmap.end())
+		// The record of contact_ is made by make_() only once the contact is known to be new, a duplicate leaves
+		// nothing in the arena. logged_ receives the log position of the change ( 0 without a write-ahead log ),
+		// stored_ is cleared if the mapped store could not write it
+		template <typename Make>
+		bool addtoContactMap(const ContactView& contact_, Make&& make_, uint64_t& logged_, bool& stored_)
+		{
+			// locks only the shard owning the contact
+			return _contactmap.insertwith(contact_, std::forward<Make>(make_),
+				[this, &logged_, &stored_](const ContactRecord& added_)
 			{
-				_contactmap[contact_] = true; // just added a bit to indicate valid contact
-				return true;
+				indexContact(added_);
+				logged_ = logContact(nullptr, *added_);
+				stored_ = storeContact(nullptr, added_.get());
+			});
+		}
+
+		// oldrecord_ receives the stored record of the old contact. The record of the new contact is made by make_()
+		// only once the update is known to go through, a failed update leaves nothing in the arena
+		template <typename Make>
+		bool updateContactMap(const ContactView& oldcontact_, const ContactView& newcontact_, Make&& make_, ContactRecord& oldrecord_,
+			uint64_t& logged_, bool& stored_)
+		{
+			// erase old contact and add new one atomically, locks both shards if they differ
+			return _contactmap.replacewith(oldcontact_, newcontact_, std::forward<Make>(make_), &oldrecord_,
+				[this, &logged_, &stored_](const ContactRecord& old_, const ContactRecord& new_)
+			{
+				unindexContact(old_);
+				indexContact(new_);
+				logged_ = logContact(old_.get(), *new_);
+				stored_ = storeContact(old_.get(), new_.get());
+			});
+		}
+
+		// Appends the change to the write-ahead log, under the shard lock so the log orders the changes of a contact
+		// like the store. Returns the log position, 0 without a log
+		uint64_t logContact(const StoredContact* old_, const StoredContact& new_)
+		{
+			if (!_wal)
+				return 0;
+
+			std::string_view fields[6];
+			size_t count = 0;
+
+			if (old_ != nullptr)
+			{
+				fields[count++] = old_->getfirstname();
+				fields[count++] = old_->getlastname();
+				fields[count++] = old_->getphone();
 			}
-		
-			return false;
+
+			fields[count++] = new_.getfirstname();
+			fields[count++] = new_.getlastname();
+			fields[count++] = new_.getphone();
+
+			return _wal->append(old_ != nullptr ? WalOp::UPDATE : WalOp::ADD, fields, count);
+		}
+
+		// Removal of contact_, same rules as logContact
+		uint64_t logRemoval(const StoredContact& contact_)
+		{
+			if (!_wal)
+				return 0;
+
+			std::string_view fields[3] = { contact_.getfirstname(), contact_.getlastname(), contact_.getphone() };
+
+			return _wal->append(WalOp::REMOVE, fields, 3);
 		}
 
-		bool updateContactMap(const Contact& oldcontact_, const Contact& newcontact_)
+		// Writes a change through to the mapped store, under the shard lock like logContact: old_ is erased and
+		// new_ stored, either may be null. The store mirrors the map, so a contact missing from it / already in it
+		// means it failed. Returns false if the change could not be written
+		bool storeContact(const StoredContact* old_, const StoredContact* new_)
 		{
-			std::lock_guard<std::mutex> lk(_contactmutex);
+			if (!_store)
+				return true;
 
-			auto it1 = _contactmap.find(oldcontact_); // no race condition here
+			bool stored = true;
 
-			if (it1 == _contactmap.end())
-				return false;// contact not found to update
+			if (old_ != nullptr)
+				stored = _store->erase(old_->getfirstname(), old_->getlastname(), old_->getphone());
 
-			auto it2 = _contactmap.find(newcontact_); // no race condition here as well
+			if (new_ != nullptr)
+				stored = _store->insert(new_->getfirstname(), new_->getlastname(), new_->getphone()) && stored;
 
-			if (it2 != _contactmap.end())
-				return false;// new contact already exists, let the user try with some other new contact
+			return stored;
+		}
 
-			_contactmap.erase(it1); // erase old contact that already exists
+		// Returns once the change logged at position_ is on disk ( group commit, see ContactWal ), outside of any lock.
+		// Returns false if the log failed, the change is then made in memory only
+		bool syncLog(uint64_t position_)
+		{
+			return position_ == 0 || _wal->wait(position_);
+		}
 
-			_contactmap[newcontact_] = true; // just added a bit to indicate valid contact
+		// The write-ahead log or the mapped store failed, changes are not persisted any more
+		bool writesFailed() const { return (_wal && _wal->stats().failed) || (_store && _store->failed()); }
 
-			return true;
+		// Swaps a record for its copy ( same attributes ) unless it was updated meanwhile
+		bool relocateContact(const ContactRecord& record_, const ContactRecord& copy_)
+		{
+			return _contactmap.exchange(ContactView(*record_), record_, copy_,
+				[this](const ContactRecord& old_, const ContactRecord& new_) { unindexContact(old_); indexContact(new_); });
 		}
 
 		std::list<Contact> contactLists() const
 		{
 			std::list<Contact> contacts;
-			std::lock_guard<std::mutex> lk(_contactmutex);
 
-			for (auto& clist : _contactmap)
-				contacts.emplace_back(clist.first);
+			loadStore();
+			_contactmap.foreach([&contacts](const ContactView&, const ContactRecord& contact_) { contacts.emplace_back(*contact_); });
 
 			return contacts; // Return value optimization
 		}
@@ -216,62 +692,199 @@ namespace User
 		template <typename Observer>
 		void registerObserver(const ContactEvents& event_, Observer&& observer_)
 		{
-			_observerseventlist[event_].push_back(std::forward<Observer>(observer_));
+			addChannel(std::make_shared<ObserverChannel>(event_, std::function<void()>(std::forward<Observer>(observer_)),
+				_observerqueuecapacity, _observerqueuepolicy));
 		}
 
+		// Only works for observers that can be compared, like function pointers
 		template <typename Observer>
 		void UnregisterObserver(const ContactEvents& event_, Observer&& observer_)
 		{
-			auto it = _observerseventlist(event_);
-
-			if (it == _observerseventlist.end())
-				return;
-
-			auto& vec = it->second;
-
-			auto it1 = std::find(vec.begin(), vec.end(), observer_);
-
-			if (it != vec.end())
-				vec.erase(it1);
+			using Target = typename std::decay<Observer>::type;
 
-			return;
+			removeChannels([&event_, &observer_](const ObserverChannel& channel_)
+			{
+				const Target* target = channel_.function().template target<Target>();
+				return channel_.event() == event_ && target != nullptr && *target == observer_;
+			});
 		}
 
 	public:
-		Contacts(bool serverupdate_ = false);
+		// store_.path set: the contacts are kept in a memory mapped store ( StoreConfig ), reopening it restores them
+		// without a load, see storeStats. The map and indexes are still built from the stored contacts, which are
+		// held twice: in the files and in memory. A change the store cannot write stays in memory and its call fails
+		// like one the write-ahead log cannot make durable ( see openWriteAheadLog ), a store that cannot be opened
+		// leaves the instance in memory only
+		Contacts(bool serverupdate_ = false, size_t shards_ = DEFAULTSHARDS, const NotifyConfig& notify_ = NotifyConfig(),
+			const StoreConfig& store_ = StoreConfig());
 
 		~Contacts()
 		{
-			uint8_t ii = 0;
-			while (!_eventqueue.empty() && ++ii <= QUEUERETRY)
+			// give observers up to QUEUERETRY seconds to receive the pending events
+			auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(QUEUERETRY);
+			while (notificationsPending() && std::chrono::steady_clock::now() < deadline)
 			{
-				std::this_thread::sleep_for(std::chrono::seconds(1));
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
 			}
 
-			_eventqueue.stop();
 			_done = true;
+			_notifypool.stop();
+
+			if (_hydrator.joinable())
+				_hydrator.join();
+
+			for (const auto& channel : *observerChannels())
+				channel->stop();
 		}
 
 		// Add a new contact by first name, last name, phone number
 		// Returns true ( contact added ) / false ( contact already exists )
 		bool addContact(const Contact& contact_);
 
+		// Add many contacts at once, every shard lock is taken at most once and the added contacts are
+		// delivered to observers as a single batched ADD event ( ContactObserver::OnContactsAdded )
+		// Returns one result per input contact, in input order
+		std::vector<ContactAddResult> addContacts(Span<const Contact> contacts_);
+
 		// Update a old contact to new contact
 		// Returns true ( contact updated ) / false ( contact cannot be updated )
 		bool updateContact(const Contact& oldcontact_, const Contact& newcontact_); // updates contact's first name or last name or phone number
+
+		// Remove a contact, observers get a REMOVE event
+		// Returns true ( contact removed ) / false ( no such contact )
+		bool removeContact(const Contact& contact_);
 		
 		// Returns a list of Contact
 		std::list<Contact> listContacts() const; // currently list all the contacts by first name, last name, phone num
 										   // in the future it should list based upon first name or last name or phone number
 
+		// One page of at most pagesize_ contacts sorted by last name, first name, phone number, continuing after
+		// cursor_ which is advanced past the page. Cost O( log N + pagesize_ ), nothing else is copied
+		std::vector<ContactRecord> listContacts(ContactCursor& cursor_, size_t pagesize_, SortOrder order_ = SortOrder::ASCENDING) const;
+
+		// Paged range scan over the contacts whose last name starts with prefix_, same order and cursor as above
+		std::vector<ContactRecord> findByLastNamePrefix(const std::string& prefix_, ContactCursor& cursor_, size_t pagesize_,
+			SortOrder order_ = SortOrder::ASCENDING) const;
+
+		// Exact match lookups through the secondary indexes, cost O( matches ) instead of a scan of the store.
+		// The returned records are immutable snapshots, later updates do not change them
+		std::vector<ContactRecord> findByFirstName(const std::string& first_) const;
+		std::vector<ContactRecord> findByLastName(const std::string& last_) const;
+		std::vector<ContactRecord> findByPhone(const std::string& phone_) const;
+
+		// Up to limit_ contacts whose phone number starts with prefix_, only digits are compared so "+1617",
+		// "1617" and "+1 617" are the same prefix. Cost O( shards * prefix length + matches returned )
+		std::vector<ContactRecord> findByPhonePrefix(const std::string& prefix_, size_t limit_) const;
+
+		// Bytes used by the phone prefix index
+		size_t phonePrefixIndexMemory() const { return _phonetrie.memory(); }
+
+		// Chunks and bytes of the phone number storage
+		arena_stats contactStorageStats() const { return _arena.stats(); }
+
+		// Distinct first / last names against the names stored, the dedup ratio is lookupbytes / bytes
+		name_stats nameDictionaryStats() const { return _arena.names().stats(); }
+
+		// Copies the contacts of chunks left mostly dead by updates into new chunks and frees the old ones, returns
+		// the number of contacts moved. Updates run it on their own once the dead bytes outweigh the live ones
+		size_t compactContactStorage();
+
+		// Up to limit_ contacts whose "first last" name is within maxdistance_ edits of query_ ( case insensitive
+		// for ASCII ), closest first. Candidates come from a trigram index and are verified with a SIMD bounded
+		// Levenshtein, so the cost follows the number of names sharing rare trigrams with the query, not the store
+		std::vector<FuzzyMatch> fuzzySearch(const std::string& query_, unsigned int maxdistance_, size_t limit_) const;
+
 		bool loadContactsFromJSON(const std::string& str_, size_t& count_);
 
+		// Streaming variant of loadContactsFromJSON, contacts are added while the input is parsed and
+		// memory use does not depend on the input size. Same count_ semantics, returns false on a parse
+		// error or if the top level value is not an array ( contacts parsed before the error stay added )
+		bool loadContactsFromStream(std::istream& stream_, size_t& count_);
+
+		// Loads contacts directly from a file without reading it into a string first. Regular files are
+		// memory mapped and parsed in place, pipes and other non mappable files are streamed through a
+		// fixed size buffer. Same count_ and return semantics as loadContactsFromStream
+		bool loadContactsFromFile(const std::string& path_, size_t& count_);
+
+		// Parallel loaders for a top level JSON array or NDJSON ( one contact object per line ). The input is
+		// split at object boundaries, chunks are parsed on threads_ workers ( 0 = hardware concurrency ) and
+		// inserted with one lock acquisition per shard and chunk. Same count_ semantics as the loaders above,
+		// ADD notifications are not ordered like the input
+		bool loadContactsParallel(const std::string& str_, size_t& count_, unsigned int threads_ = 0);
+		bool loadContactsFromFileParallel(const std::string& path_, size_t& count_, unsigned int threads_ = 0);
+
+		// Makes the store hold exactly the contacts of a full JSON export ( array or NDJSON, as loadContactsParallel ):
+		// the input is parsed on threads_ workers and diffed against every shard in parallel, each shard under one
+		// hold of its lock. Contacts missing from the store are added and the ones missing from the input removed,
+		// observers get batched ADD / REMOVE events for those only, unchanged contacts keep their record and cause
+		// no event. A contact whose phone number changed is a removal and an add. Returns false and changes nothing
+		// if the input does not parse, false without events if the write-ahead log failed ( see openWriteAheadLog ).
+		// report_ receives the diff sizes and the time spent
+		bool syncFromJSON(const std::string& str_, sync_report& report_, unsigned int threads_ = 0);
+		bool syncFromFile(const std::string& path_, sync_report& report_, unsigned int threads_ = 0);
+
+		// Writes every contact as the JSON array loadContactsFromJSON reads, straight from the store: the records of
+		// one shard are copied under its lock and serialized after it is released, memory use does not grow with
+		// the store. count_ is increased by the contacts written, returns false if the output cannot be written
+		bool exportContactsJSON(std::ostream& stream_, size_t& count_) const;
+		bool exportContactsJSON(const std::string& path_, size_t& count_) const;
+
+		// Writes every contact to a binary snapshot ( contactsnapshot.h ): distinct names once, fixed width records
+		// and a checksum. Shards are copied one at a time, contacts changed while saving may be in either version.
+		// The file is written next to path_, synced and renamed over it. Returns false if it cannot be written
+		bool saveSnapshot(const std::string& path_) const;
+
+		// Adds the contacts of a snapshot written by saveSnapshot, the file is memory mapped and restored on threads_
+		// workers ( 0 = hardware concurrency ) without parsing text. Phone numbers are taken as stored, normalization
+		// is not applied again. Returns false and adds nothing if the file is not a snapshot of this version or
+		// its checksum does not match, count_ is increased by the contacts added ( duplicates are skipped )
+		bool loadSnapshot(const std::string& path_, size_t& count_, unsigned int threads_ = 0);
+
+		// Makes adds, updates and removals durable: every successful change is appended to the write-ahead log at path_
+		// and addContact / addContacts / updateContact / removeContact ( and the loaders and syncs ) return once it
+		// is on disk. Concurrent writers share one fsync per config_.groupcommit. Once the log cannot be written the
+		// changes are still made in memory, but the calls return false ( addContacts: FAILED ) and observers get no
+		// event for them. The changes already in the log are replayed first ( replayed_ receives their number ),
+		// after loadSnapshot of the last checkpoint if there is one. Call it before the store is shared with other
+		// threads. Returns false if the log cannot be opened or is not a log
+		bool openWriteAheadLog(const std::string& path_, size_t& replayed_, const WalConfig& config_ = WalConfig());
+
+		// Syncs what is logged and stops logging, same threading rule as openWriteAheadLog
+		void closeWriteAheadLog();
+
+		// Saves a snapshot to snapshotpath_ ( saveSnapshot ) and drops the log entries it holds, replay then starts
+		// from the snapshot. Entries logged while the snapshot is written stay in the log
+		bool checkpoint(const std::string& snapshotpath_);
+
+		// Entries, syncs and batching of the write-ahead log, failed is set once the log could not be written
+		wal_stats writeAheadLogStats() const { return _wal ? _wal->stats() : wal_stats(); }
+
+		// Contacts, file bytes and rewrites of the memory mapped store, failed is set once it could not be opened or
+		// written ( the instance goes on in memory only )
+		mapped_store_stats storeStats() const;
+
+		// Forces the changes of the mapped store to disk, they survive a crash of the process without it. Returns
+		// false on an I/O error or without a store
+		bool flushStore();
+
 		// Register a contactObserver to notify if contacts are added/updated, Multiple observers allowed
 		void registerObserver(ContactObserver* observer_); // Register the ContactObserver overriden methods defined
 														   // in the interface
 		// Unregister a prev registered observer
 		void unregisterObserver(ContactObserver* observer_); // Unregister the ContactObserver overriden methods defined
 														     // in the interface
+														     // no callback reaches the observer once it returns,
+														     // must not be called from the observer's own callback
+
+		// Delivery statistics of a registered observer ( queue depth, lag, dropped events )
+		// Returns false if the observer is not registered
+		bool getObserverStats(const ContactObserver* observer_, dispatch_stats& stats_) const;
+
+		// Register / unregister an observer receiving contacts in batches, drained as configured by batch_
+		void registerObserver(ContactBatchObserver* observer_, const BatchConfig& batch_ = BatchConfig());
+		void unregisterObserver(ContactBatchObserver* observer_);
+		bool getObserverStats(const ContactBatchObserver* observer_, dispatch_stats& stats_) const;
+
 		void EnableServerupdate() 
 		{
 			if (!_serverupdate)
@@ -293,5 +906,23 @@ namespace User
 		}
 
 		void DisableServerupdate() { _serverupdate = false; }
+
+		// Phone numbers of added, updated and looked up contacts are brought to E.164 first ( NormalizePhone ),
+		// "+1 (617) 000-0001" and "+16170000001" are then the same contact and contacts whose number is not valid
+		// are rejected. Numbers without '+' or "00" belong to defaultcountry_ ( 0 = they are rejected ). Off by
+		// default, contacts stored before the change keep their phone number as it was
+		void EnablePhoneNormalization(unsigned int defaultcountry_ = 0)
+		{
+			_defaultcountry = defaultcountry_;
+			_normalizephones = true;
+		}
+
+		void DisablePhoneNormalization() { _normalizephones = false; }
+
+		// Changes the number of threads running observer callbacks ( 1 .. NotifyConfig::maxthreads ).
+		// Events of the same contact stay in order across the change. Must not be called from an observer
+		void resizeNotifyPool(size_t threads_) { _notifypool.resize(threads_); }
+
+		size_t notifyPoolSize() const { return _notifypool.workers(); }
 	};
 }
\ No newline at end of file
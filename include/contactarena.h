@@ -0,0 +1,345 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <unordered_set>
+#include <string_view>
+#include <thread>
+#include <functional>
+#include <new>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+
+#include <namedictionary.h>
+#include <phonekey.h>
+
+namespace User
+{
+	// Block of contact phone number bytes, filled front to back and never rewritten. The bytes follow the header in the
+	// same allocation. Every record stored in the chunk holds a reference, the chunk is freed with the last one.
+	// The chunk keeps the name dictionary of its records alive, records may outlive their arena
+	class ArenaChunk
+	{
+	private:
+		std::atomic<size_t> _refs{ 1 }; // the creator's reference
+		std::atomic<size_t> _used{ 0 }; // written under the owning stripe lock, read by the arena statistics
+		std::atomic<size_t> _deadbytes{ 0 }; // bytes of the records already released
+		size_t _capacity;
+		std::shared_ptr<const NameDictionary> _names;
+
+		ArenaChunk(size_t capacity_, std::shared_ptr<const NameDictionary> names_) : _capacity(capacity_), _names(std::move(names_)) {}
+
+		char* bytes() { return reinterpret_cast<char*>(this + 1); }
+
+	public:
+		ArenaChunk(const ArenaChunk&) = delete;
+		ArenaChunk& operator=(const ArenaChunk&) = delete;
+
+		static ArenaChunk* create(size_t capacity_, std::shared_ptr<const NameDictionary> names_)
+		{
+			void* memory = ::operator new(sizeof(ArenaChunk) + capacity_);
+			return new (memory) ArenaChunk(capacity_, std::move(names_));
+		}
+
+		const char* data() const { return reinterpret_cast<const char*>(this + 1); }
+
+		const NameDictionary& names() const { return *_names; }
+
+		size_t capacity() const { return _capacity; }
+
+		size_t room() const { return _capacity - _used.load(std::memory_order_relaxed); }
+
+		size_t livebytes() const { return _used.load(std::memory_order_relaxed) - _deadbytes.load(std::memory_order_relaxed); }
+
+		// True once more than half of the bytes written belong to released records
+		bool sparse() const { return livebytes() * 2 < _used.load(std::memory_order_relaxed); }
+
+		// Appends the bytes and returns their offset, the caller checked room()
+		uint32_t append(std::string_view bytes_)
+		{
+			size_t offset = _used.load(std::memory_order_relaxed);
+
+			std::memcpy(bytes() + offset, bytes_.data(), bytes_.size());
+
+			_used.store(offset + bytes_.size(), std::memory_order_relaxed);
+			return static_cast<uint32_t>(offset);
+		}
+
+		void addref() { _refs.fetch_add(1, std::memory_order_relaxed); }
+
+		size_t refs() const { return _refs.load(std::memory_order_acquire); }
+
+		// Releases the reference of a record of bytes_ bytes
+		void release(size_t bytes_ = 0)
+		{
+			if (bytes_ != 0)
+				_deadbytes.fetch_add(bytes_, std::memory_order_relaxed);
+
+			if (_refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			{
+				this->~ArenaChunk();
+				::operator delete(this);
+			}
+		}
+	};
+
+	// Immutable contact: the phone number lives in an ArenaChunk, first and last name are ids of the chunk's
+	// NameDictionary and the packed phone key ( phonekey.h, 0 for phones that do not pack ) is kept next to them.
+	// 32 bytes and no allocation per attribute instead of three std::string. The record owns one reference of its
+	// chunk. Created by ContactArena only
+	class StoredContact
+	{
+	private:
+		ArenaChunk* _chunk;
+		uint64_t _phonekey;
+		uint32_t _offset;
+		uint32_t _phone; // length of the phone number
+		uint32_t _first; // name ids
+		uint32_t _last;
+
+	public:
+		// Takes over a reference of chunk_ held by the caller
+		StoredContact(ArenaChunk* chunk_, uint32_t offset_, size_t phone_, uint64_t phonekey_, uint32_t first_, uint32_t last_) :
+			_chunk(chunk_), _phonekey(phonekey_), _offset(offset_), _phone(static_cast<uint32_t>(phone_)), _first(first_), _last(last_)
+		{}
+
+		~StoredContact() { _chunk->release(size()); }
+
+		StoredContact(const StoredContact&) = delete;
+		StoredContact& operator=(const StoredContact&) = delete;
+
+		std::string_view getfirstname() const { return _chunk->names().name(_first); }
+
+		std::string_view getlastname() const { return _chunk->names().name(_last); }
+
+		std::string_view getphone() const { return std::string_view(_chunk->data() + _offset, _phone); }
+
+		uint64_t phonekey() const { return _phonekey; }
+
+		uint32_t firstnameid() const { return _first; }
+
+		uint32_t lastnameid() const { return _last; }
+
+		// Records of the same dictionary compare names by id, packed phones compare as integers
+		bool operator==(const StoredContact& p_) const
+		{
+			if (PhoneKey(_phonekey, getphone()) != PhoneKey(p_._phonekey, p_.getphone()))
+				return false;
+
+			if (&_chunk->names() == &p_._chunk->names())
+				return _first == p_._first && _last == p_._last;
+
+			return getfirstname() == p_.getfirstname() && getlastname() == p_.getlastname();
+		}
+
+		// Bytes in the arena
+		size_t size() const { return _phone; }
+
+		const ArenaChunk* chunk() const { return _chunk; }
+	};
+
+	struct arena_stats
+	{
+		size_t chunks{ 0 };
+		size_t bytes{ 0 }; // capacity of the chunks
+		size_t livebytes{ 0 }; // bytes of records still referenced, the rest is free space or update churn
+	};
+
+	// Append only storage of contact attributes. Names are interned in the arena's NameDictionary, the phone number
+	// is appended to the current chunk of one of N lock striped stripes ( picked by thread, so concurrent writers
+	// rarely share a lock ). A record costs no allocation besides the record itself. Released records leave dead
+	// bytes behind: sweep() frees the chunks no record references, a compaction copies the records of sparse chunks
+	// into new ones ( ContactArena::sparsechunks ) so the old chunks can be swept
+	class ContactArena
+	{
+	public:
+		static constexpr size_t CHUNKSIZE = static_cast<size_t>(1) << 20;
+		static constexpr size_t DEDICATED = CHUNKSIZE / 8; // larger records get a chunk of their own
+
+	private:
+		struct alignas(64) Stripe
+		{
+			std::mutex mut;
+			ArenaChunk* chunk{ nullptr }; // current chunk, with a reference of the stripe
+		};
+
+		std::shared_ptr<NameDictionary> _names;
+		std::vector<std::unique_ptr<Stripe>> _stripes;
+		mutable std::mutex _chunkmut; // taken after a stripe lock, never before
+		std::vector<ArenaChunk*> _chunks; // every chunk of the arena, with a reference of the arena
+		std::atomic<bool> _grown{ false }; // a chunk was added since the last compactdue()
+
+		Stripe& stripe() const
+		{
+			return *_stripes[std::hash<std::thread::id>()(std::this_thread::get_id()) % _stripes.size()];
+		}
+
+		// The chunk must already hold a reference besides the arena's one, sweep() frees chunks with a single reference
+		void addchunk(ArenaChunk* chunk_)
+		{
+			std::lock_guard<std::mutex> lk(_chunkmut);
+
+			_chunks.push_back(chunk_);
+			_grown.store(true, std::memory_order_relaxed);
+		}
+
+	public:
+		explicit ContactArena(size_t stripes_) : _names(std::make_shared<NameDictionary>())
+		{
+			if (stripes_ == 0)
+				stripes_ = 1;
+
+			_stripes.reserve(stripes_);
+			for (size_t ii = 0; ii < stripes_; ++ii)
+				_stripes.push_back(std::make_unique<Stripe>());
+		}
+
+		ContactArena(const ContactArena&) = delete;
+		ContactArena& operator=(const ContactArena&) = delete;
+
+		// Records still referenced elsewhere keep their chunk alive
+		~ContactArena()
+		{
+			for (const auto& stripe : _stripes)
+			{
+				if (stripe->chunk != nullptr)
+					stripe->chunk->release();
+			}
+
+			for (ArenaChunk* chunk : _chunks)
+				chunk->release();
+		}
+
+		std::shared_ptr<const StoredContact> make(std::string_view first_, std::string_view last_, std::string_view phone_)
+		{
+			return make(_names->intern(first_), _names->intern(last_), phone_, PackPhone(phone_));
+		}
+
+		// Record of names already interned in names() and a phone number packed by the caller ( phonekey_ must be
+		// PackPhone( phone_ ) ), restoring a snapshot skips both steps this way
+		std::shared_ptr<const StoredContact> make(uint32_t first_, uint32_t last_, std::string_view phone_, uint64_t phonekey_)
+		{
+			size_t size = phone_.size();
+			ArenaChunk* chunk;
+			uint32_t offset;
+
+			if (size > DEDICATED)
+			{
+				chunk = ArenaChunk::create(size, _names);
+				offset = chunk->append(phone_);
+				chunk->addref(); // the record's, the creator's one becomes the arena's
+				addchunk(chunk);
+			}
+			else
+			{
+				Stripe& current = stripe();
+				std::lock_guard<std::mutex> lk(current.mut);
+
+				if (current.chunk == nullptr || current.chunk->room() < size)
+				{
+					if (current.chunk != nullptr)
+						current.chunk->release();
+
+					current.chunk = ArenaChunk::create(CHUNKSIZE, _names);
+					current.chunk->addref(); // the stripe's
+					addchunk(current.chunk);
+				}
+
+				chunk = current.chunk;
+				offset = chunk->append(phone_);
+				chunk->addref();
+			}
+
+			return std::make_shared<const StoredContact>(chunk, offset, size, phonekey_, first_, last_);
+		}
+
+		// Record in a chunk of its own outside of any arena, freed with the record. The names go to a dictionary
+		// shared by all such records
+		static std::shared_ptr<const StoredContact> single(std::string_view first_, std::string_view last_, std::string_view phone_)
+		{
+			static const std::shared_ptr<NameDictionary> names = std::make_shared<NameDictionary>();
+
+			uint32_t first = names->intern(first_);
+			uint32_t last = names->intern(last_);
+			ArenaChunk* chunk = ArenaChunk::create(phone_.size(), names);
+			uint32_t offset = chunk->append(phone_);
+
+			return std::make_shared<const StoredContact>(chunk, offset, phone_.size(), PackPhone(phone_), first, last);
+		}
+
+		const NameDictionary& names() const { return *_names; }
+
+		uint32_t intern(std::string_view name_) { return _names->intern(name_); }
+
+		// Frees the chunks no record references any more, returns their bytes
+		size_t sweep()
+		{
+			std::lock_guard<std::mutex> lk(_chunkmut);
+			size_t freed = 0;
+			size_t kept = 0;
+
+			for (ArenaChunk* chunk : _chunks)
+			{
+				if (chunk->refs() == 1) // only the arena's, no new reference can appear
+				{
+					freed += chunk->capacity();
+					chunk->release();
+				}
+				else
+				{
+					_chunks[kept++] = chunk;
+				}
+			}
+
+			_chunks.resize(kept);
+			return freed;
+		}
+
+		// Chunks whose records are mostly released, the current chunks of the stripes excluded
+		std::unordered_set<const ArenaChunk*> sparsechunks() const
+		{
+			std::unordered_set<const ArenaChunk*> current;
+			std::unordered_set<const ArenaChunk*> sparse;
+
+			for (const auto& stripe : _stripes)
+			{
+				std::lock_guard<std::mutex> lk(stripe->mut);
+				current.insert(stripe->chunk);
+			}
+
+			std::lock_guard<std::mutex> lk(_chunkmut);
+
+			for (const ArenaChunk* chunk : _chunks)
+			{
+				if (chunk->sparse() && current.count(chunk) == 0)
+					sparse.insert(chunk);
+			}
+
+			return sparse;
+		}
+
+		// True once after chunks were added, the cue for the owner to check whether a compaction pays off
+		bool compactdue()
+		{
+			return _grown.load(std::memory_order_relaxed) && _grown.exchange(false);
+		}
+
+		arena_stats stats() const
+		{
+			std::lock_guard<std::mutex> lk(_chunkmut);
+			arena_stats stats;
+
+			for (const ArenaChunk* chunk : _chunks)
+			{
+				++stats.chunks;
+				stats.bytes += chunk->capacity();
+				stats.livebytes += chunk->livebytes();
+			}
+
+			return stats;
+		}
+	};
+}
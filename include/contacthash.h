@@ -0,0 +1,166 @@
+#pragma once
+
+#include <string_view>
+#include <functional>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+namespace User
+{
+	namespace Detail
+	{
+		constexpr uint64_t WYSECRET[4] = { 0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL, 0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL };
+
+		// 64 x 64 -> 128 bit multiply, a_ receives the low and b_ the high half
+		inline void WyMum(uint64_t& a_, uint64_t& b_)
+		{
+#if defined(__SIZEOF_INT128__)
+			__uint128_t r = static_cast<__uint128_t>(a_) * b_;
+			a_ = static_cast<uint64_t>(r);
+			b_ = static_cast<uint64_t>(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+			a_ = _umul128(a_, b_, &b_);
+#else
+			uint64_t ha = a_ >> 32, hb = b_ >> 32, la = static_cast<uint32_t>(a_), lb = static_cast<uint32_t>(b_);
+			uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+			uint64_t t = rl + (rm0 << 32), carry = t < rl;
+			uint64_t lo = t + (rm1 << 32);
+			carry += lo < t;
+			a_ = lo;
+			b_ = rh + (rm0 >> 32) + (rm1 >> 32) + carry;
+#endif
+		}
+
+		inline uint64_t WyMix(uint64_t a_, uint64_t b_)
+		{
+			WyMum(a_, b_);
+			return a_ ^ b_;
+		}
+
+		inline uint64_t WyRead8(const uint8_t* p_) { uint64_t v; std::memcpy(&v, p_, 8); return v; }
+		inline uint64_t WyRead4(const uint8_t* p_) { uint32_t v; std::memcpy(&v, p_, 4); return v; }
+		inline uint64_t WyRead3(const uint8_t* p_, size_t size_) { return (static_cast<uint64_t>(p_[0]) << 16) | (static_cast<uint64_t>(p_[size_ >> 1]) << 8) | p_[size_ - 1]; }
+	}
+
+	// 64 bit wyhash ( final version 4, public domain ) of size_ bytes. Keys up to 16 bytes, which covers most
+	// names and phone numbers, cost two 128 bit multiplies and no loop. The length is mixed into the result, so
+	// chaining calls through seed_ hashes a sequence of fields with unambiguous boundaries
+	inline uint64_t WyHash(const void* data_, size_t size_, uint64_t seed_)
+	{
+		using namespace Detail;
+
+		const uint8_t* p = static_cast<const uint8_t*>(data_);
+		uint64_t a, b;
+
+		seed_ ^= WyMix(seed_ ^ WYSECRET[0], WYSECRET[1]);
+
+		if (size_ <= 16)
+		{
+			if (size_ >= 4)
+			{
+				a = (WyRead4(p) << 32) | WyRead4(p + ((size_ >> 3) << 2));
+				b = (WyRead4(p + size_ - 4) << 32) | WyRead4(p + size_ - 4 - ((size_ >> 3) << 2));
+			}
+			else if (size_ > 0)
+			{
+				a = WyRead3(p, size_);
+				b = 0;
+			}
+			else
+			{
+				a = b = 0;
+			}
+		}
+		else
+		{
+			size_t left = size_;
+
+			if (left >= 48)
+			{
+				uint64_t seed1 = seed_, seed2 = seed_;
+
+				do
+				{
+					seed_ = WyMix(WyRead8(p) ^ WYSECRET[1], WyRead8(p + 8) ^ seed_);
+					seed1 = WyMix(WyRead8(p + 16) ^ WYSECRET[2], WyRead8(p + 24) ^ seed1);
+					seed2 = WyMix(WyRead8(p + 32) ^ WYSECRET[3], WyRead8(p + 40) ^ seed2);
+					p += 48;
+					left -= 48;
+				} while (left >= 48);
+
+				seed_ ^= seed1 ^ seed2;
+			}
+
+			while (left > 16)
+			{
+				seed_ = WyMix(WyRead8(p) ^ WYSECRET[1], WyRead8(p + 8) ^ seed_);
+				p += 16;
+				left -= 16;
+			}
+
+			a = WyRead8(p + left - 16);
+			b = WyRead8(p + left - 8);
+		}
+
+		a ^= WYSECRET[1];
+		b ^= seed_;
+		WyMum(a, b);
+
+		return WyMix(a ^ WYSECRET[0] ^ size_, b ^ WYSECRET[1]);
+	}
+
+	// Field hash policies of the contact store: hash of ( first, last, phone ) as used by hash_name and
+	// hash_contactview. ContactFieldHash is the policy of the store. Phones that pack into a 64 bit key
+	// ( phonekey.h ) are hashed through the key overload
+
+	// Original scheme, XOR of the std::hash of each field. Order insensitive ( "John Smith" and "Smith John"
+	// collide ) and equal fields cancel, kept for comparison
+	struct XorFieldHash
+	{
+		size_t operator()(std::string_view first_, std::string_view last_, std::string_view phone_) const
+		{
+			return std::hash<std::string_view>()(first_) ^ std::hash<std::string_view>()(last_) ^ std::hash<std::string_view>()(phone_);
+		}
+
+		size_t operator()(std::string_view first_, std::string_view last_, uint64_t phonekey_) const
+		{
+			return std::hash<std::string_view>()(first_) ^ std::hash<std::string_view>()(last_) ^ std::hash<uint64_t>()(phonekey_);
+		}
+	};
+
+	// WyHash chained over first, last and phone, every field seeds the next one and its length acts as the
+	// separator, so swapped or equal fields and shifted field boundaries give unrelated hashes
+	struct WyFieldHash
+	{
+		static constexpr uint64_t SEED = 0x9E3779B97F4A7C15ULL;
+
+		size_t operator()(std::string_view first_, std::string_view last_, std::string_view phone_) const
+		{
+			uint64_t hash = WyHash(first_.data(), first_.size(), SEED);
+			hash = WyHash(last_.data(), last_.size(), hash);
+			return static_cast<size_t>(WyHash(phone_.data(), phone_.size(), hash));
+		}
+
+		// A packed phone is one multiply instead of a pass over its text
+		size_t operator()(std::string_view first_, std::string_view last_, uint64_t phonekey_) const
+		{
+			uint64_t hash = WyHash(first_.data(), first_.size(), SEED);
+			hash = WyHash(last_.data(), last_.size(), hash);
+			return static_cast<size_t>(Detail::WyMix(phonekey_ ^ Detail::WYSECRET[2], hash ^ Detail::WYSECRET[3]));
+		}
+	};
+
+	// Field hash of Contacts. The policy is a template parameter of the hashers ( basic_hash_contactview,
+	// basic_hash_name ) and so of the ShardedMap / indexes built on them, but Contacts itself is not a template:
+	// its policy is this compile time alias, picked with the CONTACT_XOR_FIELD_HASH build flag
+#ifdef CONTACT_XOR_FIELD_HASH
+	using ContactFieldHash = XorFieldHash;
+#else
+	using ContactFieldHash = WyFieldHash;
+#endif
+}
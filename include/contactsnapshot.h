@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace User
+{
+	// Binary snapshot of a contact store ( Contacts::saveSnapshot / loadSnapshot ), little endian:
+	//
+	//   SnapshotHeader
+	//   SnapshotRecord[ contacts ]         fixed width, names by index into the name table
+	//   name table ( namebytes )           names entries, each a uint32_t length and the bytes
+	//   phone heap ( phonebytes )          text of the phone numbers that do not pack ( phonekey.h )
+	//
+	// Every distinct first / last name is stored once. A packed phone number is stored as its key only, its text
+	// is generated again on load. The checksum is WyHash chained over SNAPSHOTBLOCK byte blocks of everything after
+	// the header, seeded with the hash of the header itself ( checksum field 0 ), so a reader of the mapped file
+	// checks it in one pass whatever sizes the writer used
+	constexpr char SNAPSHOTMAGIC[8] = { 'C', 'N', 'T', 'S', 'N', 'A', 'P', '1' };
+	constexpr uint32_t SNAPSHOTVERSION = 1;
+	constexpr size_t SNAPSHOTBLOCK = 1 << 20;
+	constexpr uint64_t SNAPSHOTSEED = 0x8BB84B93962EACC9ULL;
+
+	struct SnapshotHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t recordsize; // sizeof( SnapshotRecord ), a layout change without a version change is caught too
+		uint64_t contacts;
+		uint64_t names; // entries of the name table
+		uint64_t namebytes;
+		uint64_t phonebytes;
+		uint64_t checksum;
+	};
+
+	struct SnapshotRecord
+	{
+		uint32_t first; // name table indexes
+		uint32_t last;
+		uint64_t phonekey; // PackPhone of the number, 0 if it is in the phone heap
+		uint32_t phoneoffset; // text in the phone heap when phonekey is 0
+		uint32_t phonesize;
+	};
+
+	static_assert(sizeof(SnapshotHeader) == 56, "snapshot header layout");
+	static_assert(sizeof(SnapshotRecord) == 24, "snapshot record layout");
+}
@@ -0,0 +1,699 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <map>
+#include <string_view>
+#include <cstdint>
+
+#include <flatmap.h>
+
+namespace User
+{
+	// Shard selection uses the high bits of a multiplicative mix so that it does not correlate with
+	// the slot selection of the table inside the shard ( which uses the hash bits directly )
+	inline size_t ShardIndex(size_t hash_, size_t shards_)
+	{
+		uint64_t mixed = static_cast<uint64_t>(hash_) * 0x9E3779B97F4A7C15ULL;
+		return static_cast<size_t>((mixed >> 32) % shards_);
+	}
+
+	// Default for the callbacks of ShardedMap
+	struct NoCallback
+	{
+		template <typename... Args>
+		void operator()(Args&&...) const {}
+	};
+
+	// Lock striped hash map, keys are distributed over N independently locked shards selected by Hash.
+	// Writers touching different shards never contend on the same mutex, so add/update scale with
+	// the number of client threads instead of serializing on one global lock.
+	// Every shard is a FlatMap storing only the values, KeyOf( value ) is the key of a value ( typically a view
+	// into memory owned by the value ). The hash of a key is computed once and picks both shard and slot
+	template <typename Key, typename Value, typename Hash, typename KeyOf>
+	class ShardedMap
+	{
+	private:
+		struct alignas(64) Shard // each shard on its own cache line(s) to avoid false sharing of the mutex
+		{
+			mutable std::mutex mut;
+			FlatMap<Key, Value, Hash, KeyOf> map;
+		};
+
+		std::vector<std::unique_ptr<Shard>> _shards;
+		Hash _hash;
+
+		size_t shardindex(size_t hash_) const
+		{
+			return ShardIndex(hash_, _shards.size());
+		}
+
+	public:
+		explicit ShardedMap(size_t shards_)
+		{
+			if (shards_ == 0)
+				shards_ = 1;
+
+			_shards.reserve(shards_);
+			for (size_t ii = 0; ii < shards_; ++ii)
+				_shards.push_back(std::make_unique<Shard>());
+		}
+
+		ShardedMap(const ShardedMap&) = delete;
+		ShardedMap& operator=(const ShardedMap&) = delete;
+
+		size_t shardcount() const { return _shards.size(); }
+
+		size_t shardof(const Key& key_) const { return shardindex(_hash(key_)); }
+
+		// Returns true ( key inserted ) / false ( key already exists ), key_ must be KeyOf( value_ ).
+		// oninsert_( value ) runs under the shard lock once the key is inserted, so dependent structures
+		// ( secondary indexes ) change atomically with the map. It must not call back into the map
+		template <typename OnInsert = NoCallback>
+		bool insert(const Key& key_, const Value& value_, OnInsert&& oninsert_ = OnInsert())
+		{
+			size_t hash = _hash(key_);
+			Shard& shard = *_shards[shardindex(hash)];
+			std::lock_guard<std::mutex> lk(shard.mut);
+
+			if (!shard.map.insert(key_, hash, value_))
+				return false;
+
+			oninsert_(value_);
+			return true;
+		}
+
+		// As insert, the value is made by make_() under the shard lock once key_ is known to be new, so inserting a
+		// key that exists costs nothing. key_ must be the key of the value made
+		template <typename Make, typename OnInsert = NoCallback>
+		bool insertwith(const Key& key_, Make&& make_, OnInsert&& oninsert_ = OnInsert())
+		{
+			size_t hash = _hash(key_);
+			Shard& shard = *_shards[shardindex(hash)];
+			std::lock_guard<std::mutex> lk(shard.mut);
+
+			if (shard.map.find(key_, hash) != nullptr)
+				return false;
+
+			Value value = make_();
+
+			shard.map.insert(key_, hash, value);
+			oninsert_(value);
+			return true;
+		}
+
+		// Inserts count_ keys taking every shard lock at most once, inserted_[i] tells whether keys_[i] was new.
+		// oninsert_ as for insert. Returns the number of keys inserted
+		template <typename OnInsert = NoCallback>
+		size_t insertbatch(const Key* keys_, const Value* values_, size_t count_, bool* inserted_, OnInsert&& oninsert_ = OnInsert())
+		{
+			return insertbatchwith(keys_, [values_](size_t ii_) { return values_[ii_]; }, count_, inserted_, std::forward<OnInsert>(oninsert_));
+		}
+
+		// As insertbatch, the value of keys_[i] is made by make_( i ) under the shard lock once the key is known to be
+		// new ( see insertwith )
+		template <typename Make, typename OnInsert = NoCallback>
+		size_t insertbatchwith(const Key* keys_, Make&& make_, size_t count_, bool* inserted_, OnInsert&& oninsert_ = OnInsert())
+		{
+			// bucket the key indexes by shard ( counting sort ) so each shard is visited once
+			std::vector<size_t> hashes(count_);
+			std::vector<size_t> shardidx(count_);
+			std::vector<size_t> offsets(_shards.size() + 1, 0);
+
+			for (size_t ii = 0; ii < count_; ++ii)
+			{
+				hashes[ii] = _hash(keys_[ii]);
+				shardidx[ii] = shardindex(hashes[ii]);
+				++offsets[shardidx[ii] + 1];
+			}
+
+			for (size_t ss = 0; ss < _shards.size(); ++ss)
+				offsets[ss + 1] += offsets[ss];
+
+			std::vector<size_t> order(count_);
+			std::vector<size_t> next(offsets.begin(), offsets.end() - 1);
+
+			for (size_t ii = 0; ii < count_; ++ii)
+				order[next[shardidx[ii]]++] = ii;
+
+			size_t total = 0;
+
+			for (size_t ss = 0; ss < _shards.size(); ++ss)
+			{
+				if (offsets[ss] == offsets[ss + 1])
+					continue;
+
+				Shard& shard = *_shards[ss];
+				std::lock_guard<std::mutex> lk(shard.mut);
+
+				shard.map.reserve(shard.map.size() + (offsets[ss + 1] - offsets[ss]));
+
+				for (size_t oo = offsets[ss]; oo < offsets[ss + 1]; ++oo)
+				{
+					size_t ii = order[oo];
+					inserted_[ii] = shard.map.find(keys_[ii], hashes[ii]) == nullptr;
+
+					if (!inserted_[ii])
+						continue;
+
+					Value value = make_(ii);
+
+					shard.map.insert(keys_[ii], hashes[ii], value);
+					oninsert_(value);
+					++total;
+				}
+			}
+
+			return total;
+		}
+
+		bool contains(const Key& key_) const
+		{
+			size_t hash = _hash(key_);
+			const Shard& shard = *_shards[shardindex(hash)];
+			std::lock_guard<std::mutex> lk(shard.mut);
+
+			return shard.map.find(key_, hash) != nullptr;
+		}
+
+		// Replaces old key by new key atomically, even when both keys live in different shards.
+		// Both shard locks are taken together ( std::lock ) so concurrent replaces cannot deadlock.
+		// oldvalue_ ( optional ) receives the value stored with the old key. onreplace_( oldvalue, newvalue ) runs
+		// under both shard locks once replaced, it must not call back into the map.
+		// Returns false if old key does not exist or new key already exists
+		template <typename OnReplace = NoCallback>
+		bool replace(const Key& oldkey_, const Key& newkey_, const Value& newvalue_, Value* oldvalue_ = nullptr,
+			OnReplace&& onreplace_ = OnReplace())
+		{
+			return replacewith(oldkey_, newkey_, [&newvalue_]() { return newvalue_; }, oldvalue_, std::forward<OnReplace>(onreplace_));
+		}
+
+		// As replace, the new value is made by make_() under the shard locks once the replace is known to go through,
+		// so a failed replace costs nothing. newkey_ must be the key of the value made
+		template <typename Make, typename OnReplace = NoCallback>
+		bool replacewith(const Key& oldkey_, const Key& newkey_, Make&& make_, Value* oldvalue_ = nullptr,
+			OnReplace&& onreplace_ = OnReplace())
+		{
+			size_t oldhash = _hash(oldkey_);
+			size_t newhash = _hash(newkey_);
+			size_t oldidx = shardindex(oldhash);
+			size_t newidx = shardindex(newhash);
+			Shard& oldshard = *_shards[oldidx];
+			Shard& newshard = *_shards[newidx];
+
+			std::unique_lock<std::mutex> lk1(oldshard.mut, std::defer_lock);
+			std::unique_lock<std::mutex> lk2(newshard.mut, std::defer_lock);
+
+			if (oldidx == newidx)
+				lk1.lock();
+			else
+				std::lock(lk1, lk2);
+
+			const Value* found = oldshard.map.find(oldkey_, oldhash);
+
+			if (found == nullptr)
+				return false; // key not found to update
+
+			if (newshard.map.find(newkey_, newhash) != nullptr)
+				return false; // new key already exists
+
+			Value oldvalue = *found; // keeps the old value ( and memory viewed by its key ) alive until done
+			Value newvalue = make_();
+
+			oldshard.map.erase(found);
+			newshard.map.insert(newkey_, newhash, newvalue);
+
+			onreplace_(oldvalue, newvalue);
+
+			if (oldvalue_)
+				*oldvalue_ = std::move(oldvalue);
+
+			return true;
+		}
+
+		// Stores newvalue_ under key_ in place of oldvalue_, both must have key_ as key. onreplace_ as for replace.
+		// Returns false if key_ is gone or holds another value by now
+		template <typename OnReplace = NoCallback>
+		bool exchange(const Key& key_, const Value& oldvalue_, const Value& newvalue_, OnReplace&& onreplace_ = OnReplace())
+		{
+			size_t hash = _hash(key_);
+			Shard& shard = *_shards[shardindex(hash)];
+			std::lock_guard<std::mutex> lk(shard.mut);
+
+			Value* found = shard.map.find(key_, hash);
+
+			if (found == nullptr || !(*found == oldvalue_))
+				return false;
+
+			*found = newvalue_; // same key and hash, the slot stays valid
+			onreplace_(oldvalue_, newvalue_);
+
+			return true;
+		}
+
+		// Returns true ( key erased, oldvalue_ receives its value ) / false ( key not found ). onerase_( value ) runs
+		// under the shard lock once the key is erased, as for insert
+		template <typename OnErase = NoCallback>
+		bool erase(const Key& key_, Value* oldvalue_ = nullptr, OnErase&& onerase_ = OnErase())
+		{
+			size_t hash = _hash(key_);
+			Shard& shard = *_shards[shardindex(hash)];
+			std::lock_guard<std::mutex> lk(shard.mut);
+
+			Value* found = shard.map.find(key_, hash);
+
+			if (found == nullptr)
+				return false;
+
+			Value value = *found;
+			shard.map.erase(found);
+			onerase_(value);
+
+			if (oldvalue_ != nullptr)
+				*oldvalue_ = std::move(value);
+
+			return true;
+		}
+
+		// Brings shard shard_ to hold exactly the keys_[i] ( hashes_[i], all of shard shard_ ) under one hold of its lock:
+		// the entries whose key is not among them are erased ( onerase_( value ) ), the keys not in the shard are
+		// inserted as make_( i ) ( oninsert_( value ) ). Callbacks run under the lock, they must not call back into
+		// the map. Returns the number of distinct keys_ that were in the shard already
+		template <typename Make, typename OnInsert, typename OnErase>
+		size_t syncshard(size_t shard_, const Key* keys_, const size_t* hashes_, size_t count_, Make&& make_, OnInsert&& oninsert_,
+			OnErase&& onerase_)
+		{
+			Shard& shard = *_shards[shard_];
+			std::vector<const Value*> kept; // slots of the keys found, sorted to be looked up by address
+			std::vector<size_t> missing;
+			std::vector<Value> stale; // released after the lock
+			std::lock_guard<std::mutex> lk(shard.mut);
+
+			for (size_t ii = 0; ii < count_; ++ii)
+			{
+				const Value* found = shard.map.find(keys_[ii], hashes_[ii]);
+
+				if (found != nullptr)
+					kept.push_back(found);
+				else
+					missing.push_back(ii);
+			}
+
+			std::sort(kept.begin(), kept.end());
+			kept.erase(std::unique(kept.begin(), kept.end()), kept.end());
+
+			// the entries to erase are found by slot address, their keys are neither hashed nor compared
+			if (kept.size() != shard.map.size())
+			{
+				std::vector<const Value*> slots;
+
+				shard.map.foreach([&kept, &slots](const Key&, const Value& value_)
+				{
+					if (!std::binary_search(kept.begin(), kept.end(), &value_))
+						slots.push_back(&value_);
+				});
+
+				// erase() leaves the other slots in place, so the addresses collected stay valid
+				stale.reserve(slots.size());
+
+				for (const Value* slot : slots)
+				{
+					stale.push_back(*slot);
+					shard.map.erase(slot);
+					onerase_(stale.back());
+				}
+			}
+
+			for (size_t ii : missing)
+			{
+				if (shard.map.find(keys_[ii], hashes_[ii]) != nullptr)
+					continue; // repeated in keys_
+
+				Value value = make_(ii);
+
+				shard.map.insert(keys_[ii], hashes_[ii], value);
+				oninsert_(value);
+			}
+
+			return kept.size();
+		}
+
+		size_t size() const
+		{
+			size_t total = 0;
+
+			for (const auto& shard : _shards)
+			{
+				std::lock_guard<std::mutex> lk(shard->mut);
+				total += shard->map.size();
+			}
+
+			return total;
+		}
+
+		// Bytes held by the shard tables, not counting what the values point to
+		size_t memory() const
+		{
+			size_t total = 0;
+
+			for (const auto& shard : _shards)
+			{
+				std::lock_guard<std::mutex> lk(shard->mut);
+				total += sizeof(Shard) + shard->map.memory();
+			}
+
+			return total;
+		}
+
+		// Visits every entry ( key, value ), holding only one shard lock at a time. The visitor must not call back into the map
+		template <typename Visitor>
+		void foreach(Visitor&& visitor_) const
+		{
+			for (const auto& shard : _shards)
+			{
+				std::lock_guard<std::mutex> lk(shard->mut);
+				shard->map.foreach(visitor_);
+			}
+		}
+
+		// Visits the entries of shard shard_ ( 0 .. shards() - 1 ) under its lock, callers that do slow work per
+		// entry copy the values out and release the lock early this way
+		template <typename Visitor>
+		void foreach(size_t shard_, Visitor&& visitor_) const
+		{
+			std::lock_guard<std::mutex> lk(_shards[shard_]->mut);
+			_shards[shard_]->map.foreach(visitor_);
+		}
+
+		size_t shards() const { return _shards.size(); }
+
+		// Copies the value of the n-th entry ( modulo size ) in iteration order, returns false if the map is empty
+		bool nth(size_t n_, Value& value_) const
+		{
+			size_t total = size();
+
+			if (total == 0)
+				return false;
+
+			n_ = n_ % total;
+
+			for (const auto& shard : _shards)
+			{
+				std::lock_guard<std::mutex> lk(shard->mut);
+
+				if (n_ < shard->map.size())
+				{
+					value_ = *shard->map.nth(n_);
+					return true;
+				}
+
+				n_ -= shard->map.size();
+			}
+
+			return false; // map shrank concurrently, caller retries on the next tick
+		}
+	};
+
+	// Lock striped multimap from an attribute to values, the secondary index of a ShardedMap. Keys are views
+	// into the indexed values ( every entry keeps its value and so the viewed memory alive ). Lookups cost
+	// O( matches ), removing one value of a key O( 1 ) however many values share it
+	template <typename Value, typename Key = std::string_view, typename Hash = std::hash<Key>>
+	class ShardedIndex
+	{
+	private:
+		static constexpr size_t LINEARVALUES = 8; // values of a key found by a scan up to this many, by positions above
+
+		// The values of one key, each with the key viewing its own memory. The map key views the first one's
+		struct Values
+		{
+			std::vector<std::pair<Key, Value>> entries;
+			std::unique_ptr<std::unordered_map<Value, size_t>> positions; // value -> index in entries, past LINEARVALUES
+		};
+
+		struct alignas(64) Shard
+		{
+			mutable std::mutex mut;
+			std::unordered_map<Key, Values, Hash> map;
+		};
+
+		std::vector<std::unique_ptr<Shard>> _shards;
+
+		Shard& shardof(const Key& key_) const
+		{
+			return *_shards[ShardIndex(Hash()(key_), _shards.size())];
+		}
+
+	public:
+		explicit ShardedIndex(size_t shards_)
+		{
+			if (shards_ == 0)
+				shards_ = 1;
+
+			_shards.reserve(shards_);
+			for (size_t ii = 0; ii < shards_; ++ii)
+				_shards.push_back(std::make_unique<Shard>());
+		}
+
+		ShardedIndex(const ShardedIndex&) = delete;
+		ShardedIndex& operator=(const ShardedIndex&) = delete;
+
+		void insert(const Key& key_, const Value& value_)
+		{
+			Shard& shard = shardof(key_);
+			std::lock_guard<std::mutex> lk(shard.mut);
+
+			Values& values = shard.map[key_]; // a new key views value_, which is its first entry
+			values.entries.emplace_back(key_, value_);
+
+			if (values.positions)
+				values.positions->emplace(value_, values.entries.size() - 1);
+			else if (values.entries.size() > LINEARVALUES)
+			{
+				values.positions = std::make_unique<std::unordered_map<Value, size_t>>();
+
+				for (size_t ii = 0; ii < values.entries.size(); ++ii)
+					values.positions->emplace(values.entries[ii].second, ii);
+			}
+		}
+
+		// Removes the entry key_ -> value_, returns false if there is none
+		bool erase(const Key& key_, const Value& value_)
+		{
+			Shard& shard = shardof(key_);
+			std::lock_guard<std::mutex> lk(shard.mut);
+
+			auto it = shard.map.find(key_);
+
+			if (it == shard.map.end())
+				return false;
+
+			Values& values = it->second;
+			size_t index = values.entries.size();
+
+			if (values.positions)
+			{
+				auto position = values.positions->find(value_);
+
+				if (position == values.positions->end())
+					return false;
+
+				index = position->second;
+				values.positions->erase(position);
+			}
+			else
+			{
+				for (size_t ii = 0; ii < values.entries.size() && index == values.entries.size(); ++ii)
+				{
+					if (values.entries[ii].second == value_)
+						index = ii;
+				}
+
+				if (index == values.entries.size())
+					return false;
+			}
+
+			// the last entry takes the place of the erased one
+			if (index != values.entries.size() - 1)
+			{
+				values.entries[index] = std::move(values.entries.back());
+
+				if (values.positions)
+					(*values.positions)[values.entries[index].second] = index;
+			}
+
+			values.entries.pop_back();
+
+			if (values.entries.empty())
+				shard.map.erase(it);
+			else if (index == 0)
+			{
+				// the map key viewed the erased value, it is rekeyed to the value now first
+				auto node = shard.map.extract(it);
+				node.key() = node.mapped().entries.front().first;
+				shard.map.insert(std::move(node));
+			}
+
+			return true;
+		}
+
+		// Appends every value stored under key_ to values_
+		void find(const Key& key_, std::vector<Value>& values_) const
+		{
+			const Shard& shard = shardof(key_);
+			std::lock_guard<std::mutex> lk(shard.mut);
+
+			auto it = shard.map.find(key_);
+
+			if (it == shard.map.end())
+				return;
+
+			for (const auto& entry : it->second.entries)
+				values_.push_back(entry.second);
+		}
+
+		size_t size() const
+		{
+			size_t total = 0;
+
+			for (const auto& shard : _shards)
+			{
+				std::lock_guard<std::mutex> lk(shard->mut);
+
+				for (const auto& values : shard->map)
+					total += values.second.entries.size();
+			}
+
+			return total;
+		}
+	};
+
+	// Lock striped ordered map, keys in Less order within each shard. Range scans merge the shards in key order
+	// holding every shard lock ( always taken in shard order, writers only ever hold one ) so a scan sees one
+	// consistent state. A scan of n entries costs O( shards * log N + n * shards )
+	template <typename Key, typename Value, typename Hash, typename Less>
+	class ShardedOrderedIndex
+	{
+	private:
+		using Map = std::map<Key, Value, Less>;
+
+		struct alignas(64) Shard
+		{
+			mutable std::mutex mut;
+			Map map;
+		};
+
+		std::vector<std::unique_ptr<Shard>> _shards;
+		Hash _hash;
+		Less _less;
+
+		Shard& shardof(const Key& key_) const
+		{
+			return *_shards[ShardIndex(_hash(key_), _shards.size())];
+		}
+
+		// Visits the union of the per shard ranges [ first, second ) in merged order, stops when visitor_ returns false
+		template <typename It, typename Before, typename Visitor>
+		static void merge(std::vector<std::pair<It, It>>& ranges_, Before before_, Visitor& visitor_)
+		{
+			while (true)
+			{
+				std::pair<It, It>* next = nullptr;
+
+				for (auto& range : ranges_)
+				{
+					if (range.first != range.second && (next == nullptr || before_(range.first->first, next->first->first)))
+						next = &range;
+				}
+
+				if (next == nullptr || !visitor_(next->first->first, next->first->second))
+					return;
+
+				++next->first;
+			}
+		}
+
+	public:
+		explicit ShardedOrderedIndex(size_t shards_)
+		{
+			if (shards_ == 0)
+				shards_ = 1;
+
+			_shards.reserve(shards_);
+			for (size_t ii = 0; ii < shards_; ++ii)
+				_shards.push_back(std::make_unique<Shard>());
+		}
+
+		ShardedOrderedIndex(const ShardedOrderedIndex&) = delete;
+		ShardedOrderedIndex& operator=(const ShardedOrderedIndex&) = delete;
+
+		void insert(const Key& key_, const Value& value_)
+		{
+			Shard& shard = shardof(key_);
+			std::lock_guard<std::mutex> lk(shard.mut);
+
+			shard.map.emplace(key_, value_);
+		}
+
+		bool erase(const Key& key_)
+		{
+			Shard& shard = shardof(key_);
+			std::lock_guard<std::mutex> lk(shard.mut);
+
+			return shard.map.erase(key_) != 0;
+		}
+
+		// Visits ( key, value ) in ascending order ( descending_ false ) starting after after_, or in descending order
+		// starting before after_. after_ nullptr starts at the first / last key. The scan stops when visitor_ returns
+		// false, the visitor must not call back into the index
+		template <typename Visitor>
+		void scan(const Key* after_, bool descending_, Visitor&& visitor_) const
+		{
+			std::vector<std::unique_lock<std::mutex>> locks;
+			locks.reserve(_shards.size());
+
+			for (const auto& shard : _shards)
+				locks.emplace_back(shard->mut);
+
+			if (!descending_)
+			{
+				std::vector<std::pair<typename Map::const_iterator, typename Map::const_iterator>> ranges;
+
+				for (const auto& shard : _shards)
+				{
+					const Map& map = shard->map;
+					ranges.emplace_back(after_ ? map.upper_bound(*after_) : map.begin(), map.end());
+				}
+
+				merge(ranges, _less, visitor_);
+			}
+			else
+			{
+				std::vector<std::pair<typename Map::const_reverse_iterator, typename Map::const_reverse_iterator>> ranges;
+
+				for (const auto& shard : _shards)
+				{
+					const Map& map = shard->map;
+					ranges.emplace_back(after_ ? typename Map::const_reverse_iterator(map.lower_bound(*after_)) : map.rbegin(), map.rend());
+				}
+
+				merge(ranges, [this](const Key& lhs_, const Key& rhs_) { return _less(rhs_, lhs_); }, visitor_);
+			}
+		}
+
+		size_t size() const
+		{
+			size_t total = 0;
+
+			for (const auto& shard : _shards)
+			{
+				std::lock_guard<std::mutex> lk(shard->mut);
+				total += shard->map.size();
+			}
+
+			return total;
+		}
+	};
+}
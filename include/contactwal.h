@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <string>
+#include <string_view>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+namespace User
+{
+	enum class WalOp : uint8_t
+	{
+		ADD = 1, // first, last, phone
+		UPDATE = 2, // old first, last, phone, new first, last, phone
+		REMOVE = 3 // first, last, phone
+	};
+
+	struct WalConfig
+	{
+		// a sync waits up to this long for more writers to join it. 0 = sync as soon as the previous one is done,
+		// the writers arriving meanwhile still share the next one, which is enough when syncs are fast
+		std::chrono::microseconds groupcommit{ 0 };
+		size_t maxbatchbytes{ 1 << 20 }; // a sync starts right away once this much is waiting
+		bool sync{ true }; // false: entries reach the OS but are not forced to disk, survives a crash of the process only
+	};
+
+	struct wal_stats
+	{
+		uint64_t entries{ 0 }; // appended since the log was opened
+		uint64_t bytes{ 0 };
+		uint64_t syncs{ 0 }; // writes to the file, each followed by one fsync
+		uint64_t maxbatch{ 0 }; // most entries made durable by one sync
+		uint64_t filebytes{ 0 }; // size of the log file, shrinks with truncate
+		bool failed{ false }; // a write or sync failed, nothing is made durable any more
+	};
+
+	// Append only log of contact changes, the file is:
+	//
+	//   "CNTWAL01"
+	//   entries: uint32_t payload size, uint32_t payload checksum, payload ( WalOp, then per field a uint32_t
+	//            length and the bytes )
+	//
+	// Entries get a position ( log sequence number: the bytes appended since the log was opened, up to the end of
+	// the entry, truncation does not reset it ). append() only copies the entry into a buffer, a flusher thread writes everything buffered
+	// with one write and one fsync ( group commit ) and wait() blocks until a position is durable, so concurrent
+	// writers share syncs instead of paying one each. Replay stops at the first torn or corrupt entry, which is
+	// cut off before anything is appended
+	class ContactWal
+	{
+	public:
+		using Visitor = std::function<void(WalOp, const std::string_view* fields_, size_t count_)>;
+
+		static constexpr size_t MAXENTRY = 64 * 1024 * 1024; // larger sizes are corruption
+
+	private:
+		WalConfig _config;
+		std::string _path;
+		int _fd{ -1 };
+
+		mutable std::mutex _mut; // buffer and positions
+		std::condition_variable _flushcv; // flusher: entries waiting / stop
+		std::condition_variable _durablecv; // writers: _durable moved
+		std::string _buffer; // appended, not yet written
+		uint64_t _appended{ 0 }; // position of the last entry appended
+		uint64_t _durable{ 0 }; // entries up to here are synced
+		uint64_t _bufferedentries{ 0 };
+		wal_stats _stats;
+		bool _stop{ false };
+
+		std::mutex _filemut; // file writes and truncation
+		uint64_t _filebase{ 0 }; // position of the first entry in the file
+		uint64_t _written{ 0 }; // position of the end of the file
+		std::atomic<uint64_t> _filebytes{ 0 };
+
+		std::thread _flusher;
+
+		void flushLoop();
+
+	public:
+		explicit ContactWal(const WalConfig& config_ = WalConfig()) : _config(config_) {}
+
+		~ContactWal() { close(); }
+
+		ContactWal(const ContactWal&) = delete;
+		ContactWal& operator=(const ContactWal&) = delete;
+
+		// Opens or creates the log at path_, hands every entry already in it to visitor_ in order ( replayed_
+		// receives their number ) and starts the flusher. Returns false if the file cannot be opened or is not a log
+		bool open(const std::string& path_, const Visitor& visitor_, size_t& replayed_);
+
+		// Writes what is buffered and stops the flusher
+		void close();
+
+		bool isopen() const { return _fd != -1; }
+
+		// Buffers an entry, returns its position. Cheap, meant to be called under the lock that ordered the change
+		uint64_t append(WalOp op_, const std::string_view* fields_, size_t count_);
+
+		// Blocks until the entry at position_ is synced. Returns false if the log failed
+		bool wait(uint64_t position_);
+
+		// Position of the last entry appended
+		uint64_t position() const;
+
+		// Drops the entries up to position_ ( after a snapshot made them redundant ), the entries after it are
+		// copied to a new file which replaces the log. Appends go on meanwhile. Returns false on an I/O error
+		bool truncate(uint64_t position_);
+
+		wal_stats stats() const;
+	};
+}
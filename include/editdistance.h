@@ -0,0 +1,16 @@
+#pragma once
+
+#include <string_view>
+#include <cstddef>
+
+namespace User
+{
+	// Levenshtein distance of a_ and b_ if it is at most maxdistance_, maxdistance_ + 1 otherwise
+	unsigned int BoundedLevenshtein(std::string_view a_, std::string_view b_, unsigned int maxdistance_);
+
+	// BoundedLevenshtein of query_ against count_ candidates, distances_[i] for candidates_[i]. Candidates are
+	// compared in groups of SIMD lanes ( 16 with AVX2, 8 with SSE2, one at a time without either ), a group stops
+	// early once every candidate in it is known to be more than maxdistance_ away
+	void BoundedLevenshteinBatch(std::string_view query_, const std::string_view* candidates_, size_t count_,
+		unsigned int maxdistance_, unsigned int* distances_);
+}
@@ -0,0 +1,270 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CONTACT_FLATMAP_SSE2
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace User
+{
+	// Control bytes of 16 consecutive slots, matched all at once with SSE2 ( a byte loop without it ).
+	// Bit i of a returned mask stands for slot i of the group
+	struct FlatGroup
+	{
+		static constexpr size_t SIZE = 16;
+		static constexpr int8_t EMPTY = -128; // 0x80
+		static constexpr int8_t DELETED = -2; // 0xFE, full slots hold the 7 bit fingerprint 0 .. 127
+
+#if defined(CONTACT_FLATMAP_SSE2)
+		__m128i ctrl;
+
+		explicit FlatGroup(const int8_t* ctrl_) : ctrl(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl_))) {}
+
+		uint32_t match(int8_t fingerprint_) const { return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(fingerprint_)))); }
+		uint32_t matchempty() const { return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(EMPTY)))); }
+		uint32_t matchfree() const { return static_cast<uint32_t>(_mm_movemask_epi8(ctrl)); } // empty or deleted, the sign bit
+#else
+		const int8_t* ctrl;
+
+		explicit FlatGroup(const int8_t* ctrl_) : ctrl(ctrl_) {}
+
+		uint32_t match(int8_t fingerprint_) const
+		{
+			uint32_t mask = 0;
+			for (size_t ii = 0; ii < SIZE; ++ii)
+				mask |= static_cast<uint32_t>(ctrl[ii] == fingerprint_) << ii;
+			return mask;
+		}
+
+		uint32_t matchempty() const { return match(EMPTY); }
+
+		uint32_t matchfree() const
+		{
+			uint32_t mask = 0;
+			for (size_t ii = 0; ii < SIZE; ++ii)
+				mask |= static_cast<uint32_t>(ctrl[ii] < 0) << ii;
+			return mask;
+		}
+#endif
+
+		static size_t lowestbit(uint32_t mask_) // mask_ != 0
+		{
+#if defined(_MSC_VER)
+			unsigned long bit;
+			_BitScanForward(&bit, mask_);
+			return bit;
+#else
+			return static_cast<size_t>(__builtin_ctz(mask_));
+#endif
+		}
+	};
+
+	// Open addressing hash table in the style of a Swiss table. Slots are grouped by 16, every slot has a control
+	// byte with the low 7 bits of its hash ( or empty / deleted ), a lookup compares the fingerprint against a
+	// whole group in one SSE2 instruction and only reads the slots that match. Groups are probed quadratically
+	// from the one selected by the remaining hash bits, the table doubles at 7/8 load.
+	// Only values are stored, KeyOf( value ) returns the key of a value so keys that are views into their value
+	// cost nothing. Hashes are computed by the caller ( Hash is needed only to move values when the table grows ),
+	// so a hash used to pick a shard is not computed twice. Value must be default constructible, free slots hold
+	// Value(). Not thread safe
+	template <typename Key, typename Value, typename Hash, typename KeyOf, typename KeyEqual = std::equal_to<Key>>
+	class FlatMap
+	{
+	private:
+		static constexpr size_t GROUP = FlatGroup::SIZE;
+
+		std::vector<int8_t> _ctrl;
+		std::vector<Value> _slots;
+		size_t _size{ 0 };
+		size_t _deleted{ 0 };
+		Hash _hash;
+		KeyOf _keyof;
+		KeyEqual _equal;
+
+		static int8_t fingerprint(size_t hash_) { return static_cast<int8_t>(hash_ & 0x7F); }
+
+		size_t groups() const { return _slots.size() / GROUP; }
+
+		// Slot of key_ or SIZE_MAX
+		size_t findslot(const Key& key_, size_t hash_) const
+		{
+			if (_slots.empty())
+				return SIZE_MAX;
+
+			size_t mask = groups() - 1;
+			size_t group = (hash_ >> 7) & mask;
+			int8_t print = fingerprint(hash_);
+
+			for (size_t step = 1; ; ++step)
+			{
+				FlatGroup ctrl(&_ctrl[group * GROUP]);
+
+				for (uint32_t match = ctrl.match(print); match != 0; match &= match - 1)
+				{
+					size_t slot = group * GROUP + FlatGroup::lowestbit(match);
+					if (_equal(_keyof(_slots[slot]), key_))
+						return slot;
+				}
+
+				if (ctrl.matchempty() != 0)
+					return SIZE_MAX; // an insert would have stopped here
+
+				group = (group + step) & mask;
+			}
+		}
+
+		// First empty or deleted slot on the probe sequence of hash_, the table is never full
+		size_t freeslot(size_t hash_) const
+		{
+			size_t mask = groups() - 1;
+			size_t group = (hash_ >> 7) & mask;
+
+			for (size_t step = 1; ; ++step)
+			{
+				uint32_t free = FlatGroup(&_ctrl[group * GROUP]).matchfree();
+				if (free != 0)
+					return group * GROUP + FlatGroup::lowestbit(free);
+
+				group = (group + step) & mask;
+			}
+		}
+
+		void place(size_t hash_, Value&& value_)
+		{
+			size_t slot = freeslot(hash_);
+
+			if (_ctrl[slot] == FlatGroup::DELETED)
+				--_deleted;
+
+			_ctrl[slot] = fingerprint(hash_);
+			_slots[slot] = std::move(value_);
+			++_size;
+		}
+
+		// Moves every value into a table of capacity_ slots, which also drops the deleted markers
+		void rehash(size_t capacity_)
+		{
+			std::vector<int8_t> ctrl(capacity_, FlatGroup::EMPTY);
+			std::vector<Value> slots(capacity_);
+
+			ctrl.swap(_ctrl);
+			slots.swap(_slots);
+			_size = 0;
+			_deleted = 0;
+
+			for (size_t ii = 0; ii < slots.size(); ++ii)
+			{
+				if (ctrl[ii] >= 0)
+					place(_hash(_keyof(slots[ii])), std::move(slots[ii]));
+			}
+		}
+
+		static size_t capacityfor(size_t size_)
+		{
+			size_t capacity = GROUP;
+			while (capacity * 7 / 8 < size_)
+				capacity *= 2;
+			return capacity;
+		}
+
+		// Room for one more value
+		void grow()
+		{
+			if (_size + _deleted + 1 <= _slots.size() * 7 / 8)
+				return;
+
+			if (_size + 1 <= _slots.size() * 7 / 16)
+				rehash(_slots.size()); // mostly deleted markers, clean up in place
+			else
+				rehash(std::max(capacityfor(_size + 1), _slots.size() * 2));
+		}
+
+	public:
+		// Inserts value_ under key_ ( which must be KeyOf( value_ ) ) unless the key exists, returns true if inserted
+		bool insert(const Key& key_, size_t hash_, const Value& value_)
+		{
+			if (findslot(key_, hash_) != SIZE_MAX)
+				return false;
+
+			grow();
+			place(hash_, Value(value_));
+			return true;
+		}
+
+		Value* find(const Key& key_, size_t hash_)
+		{
+			size_t slot = findslot(key_, hash_);
+			return slot == SIZE_MAX ? nullptr : &_slots[slot];
+		}
+
+		const Value* find(const Key& key_, size_t hash_) const
+		{
+			size_t slot = findslot(key_, hash_);
+			return slot == SIZE_MAX ? nullptr : &_slots[slot];
+		}
+
+		// Removes the value found by find(), value_ must not be used afterwards
+		void erase(const Value* value_)
+		{
+			size_t slot = static_cast<size_t>(value_ - _slots.data());
+			size_t group = slot / GROUP;
+
+			// a group that still has an empty slot never made a probe continue past it, so the slot can be empty
+			// again. Otherwise lookups must keep probing through it
+			bool empty = FlatGroup(&_ctrl[group * GROUP]).matchempty() != 0;
+
+			_ctrl[slot] = empty ? FlatGroup::EMPTY : FlatGroup::DELETED;
+			_deleted += !empty;
+			_slots[slot] = Value();
+			--_size;
+		}
+
+		void reserve(size_t size_)
+		{
+			size_t capacity = capacityfor(size_);
+			if (capacity > _slots.size())
+				rehash(capacity);
+		}
+
+		size_t size() const { return _size; }
+
+		size_t capacity() const { return _slots.size(); }
+
+		// Bytes held by the control bytes and slots
+		size_t memory() const { return _ctrl.capacity() * sizeof(int8_t) + _slots.capacity() * sizeof(Value); }
+
+		// Visits every ( key, value ) in slot order
+		template <typename Visitor>
+		void foreach(Visitor&& visitor_) const
+		{
+			for (size_t ii = 0; ii < _slots.size(); ++ii)
+			{
+				if (_ctrl[ii] >= 0)
+					visitor_(_keyof(_slots[ii]), _slots[ii]);
+			}
+		}
+
+		// n-th value in slot order, nullptr if n_ >= size()
+		const Value* nth(size_t n_) const
+		{
+			for (size_t ii = 0; ii < _slots.size(); ++ii)
+			{
+				if (_ctrl[ii] >= 0 && n_-- == 0)
+					return &_slots[ii];
+			}
+
+			return nullptr;
+		}
+	};
+}
@@ -0,0 +1,365 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <algorithm>
+#include <utility>
+#include <cstdint>
+#include <functional>
+
+#include <contactstore.h>
+#include <editdistance.h>
+
+namespace User
+{
+	// Trigram inverted index over "first last" names for approximate search. Names are lower cased ( ASCII ) and
+	// padded with a space on both sides, every distinct trigram maps to the ids of the values containing it.
+	// An edit touches at most 3 trigrams, so a name within edit distance k of the query lacks at most 3k of the
+	// distinct query trigrams: candidates come from the 3k + 1 shortest posting lists, are dropped once they miss
+	// more than 3k lists and the rest is verified with BoundedLevenshteinBatch. Queries with no more than 3k
+	// trigrams read every list and can miss names sharing no trigram at all with them.
+	// Names( value ) returns the ( first, last ) name of a value. Erased values are found by a value -> id map and
+	// leave their ids in the posting lists until enough of them piled up to compact the index. Not thread safe, see
+	// ShardedTrigramIndex
+	template <typename Value, typename Names>
+	class TrigramIndex
+	{
+	private:
+		static constexpr size_t MINCOMPACT = 1024; // erased values before a compaction is considered
+		static constexpr uint16_t ERASED = 0; // normalized names have at least the separator
+		static constexpr uint16_t LONGNAME = UINT16_MAX; // length unknown, not length filtered
+
+		std::vector<Value> _values; // id -> value
+		std::vector<uint16_t> _lengths; // id -> normalized name length, apart from the values so the filters stay in cache
+		std::unordered_map<Value, uint32_t> _ids; // live value -> id, erase does not scan a posting list
+		size_t _dead{ 0 };
+		std::unordered_map<uint32_t, std::vector<uint32_t>> _postings;
+		Names _names;
+
+		const std::vector<uint32_t>* postings(uint32_t trigram_) const
+		{
+			auto it = _postings.find(trigram_);
+			return it == _postings.end() ? nullptr : &it->second;
+		}
+
+		// Advances cursor_ to the first id >= id_ in exponentially growing steps, ids probed in increasing order
+		// are usually close to the previous one. Returns true if id_ is there
+		static bool gallop(std::vector<uint32_t>::const_iterator& cursor_, std::vector<uint32_t>::const_iterator end_, uint32_t id_)
+		{
+			size_t step = 1;
+			size_t left = static_cast<size_t>(end_ - cursor_);
+
+			while (step < left && cursor_[step] < id_)
+				step *= 2;
+
+			cursor_ = std::lower_bound(cursor_ + step / 2, cursor_ + std::min(step + 1, left), id_);
+			return cursor_ != end_ && *cursor_ == id_;
+		}
+
+		// Drops the erased ids and renumbers the live values
+		void compact()
+		{
+			std::vector<uint32_t> remap(_values.size(), UINT32_MAX);
+			size_t live = 0;
+
+			for (size_t ii = 0; ii < _values.size(); ++ii)
+			{
+				if (_lengths[ii] == ERASED)
+					continue;
+
+				remap[ii] = static_cast<uint32_t>(live);
+				if (live != ii)
+				{
+					_values[live] = std::move(_values[ii]);
+					_lengths[live] = _lengths[ii];
+				}
+				++live;
+			}
+
+			_values.resize(live);
+			_lengths.resize(live);
+			_dead = 0;
+
+			for (auto& id : _ids)
+				id.second = remap[id.second];
+
+			for (auto it = _postings.begin(); it != _postings.end(); )
+			{
+				std::vector<uint32_t>& list = it->second;
+				size_t kept = 0;
+
+				for (uint32_t id : list)
+				{
+					if (remap[id] != UINT32_MAX)
+						list[kept++] = remap[id];
+				}
+
+				list.resize(kept);
+
+				if (list.empty())
+					it = _postings.erase(it);
+				else
+					++it;
+			}
+		}
+
+	public:
+		static void appendlower(std::string_view text_, std::string& out_)
+		{
+			for (char c : text_)
+				out_.push_back(c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c);
+		}
+
+		// Lower cased "first last"
+		static void normalize(std::string_view first_, std::string_view last_, std::string& name_)
+		{
+			name_.clear();
+			name_.reserve(first_.size() + last_.size() + 1);
+			appendlower(first_, name_);
+			name_.push_back(' ');
+			appendlower(last_, name_);
+		}
+
+		// Distinct trigrams of the space padded name, sorted
+		static void trigrams(std::string_view name_, std::vector<uint32_t>& trigrams_)
+		{
+			trigrams_.clear();
+
+			for (size_t ii = 0; ii < name_.size(); ++ii)
+			{
+				auto at = [&name_](size_t pos_) -> uint32_t
+				{
+					return (pos_ == 0 || pos_ > name_.size()) ? ' ' : static_cast<unsigned char>(name_[pos_ - 1]);
+				};
+
+				trigrams_.push_back((at(ii) << 16) | (at(ii + 1) << 8) | at(ii + 2));
+			}
+
+			std::sort(trigrams_.begin(), trigrams_.end());
+			trigrams_.erase(std::unique(trigrams_.begin(), trigrams_.end()), trigrams_.end());
+		}
+
+		void insert(const Value& value_)
+		{
+			std::string name;
+			std::vector<uint32_t> grams;
+			auto names = _names(value_);
+
+			normalize(names.first, names.second, name);
+			trigrams(name, grams);
+
+			uint32_t id = static_cast<uint32_t>(_values.size());
+			_ids.emplace(value_, id);
+			_values.push_back(value_);
+			_lengths.push_back(static_cast<uint16_t>(std::min<size_t>(name.size(), LONGNAME)));
+
+			for (uint32_t trigram : grams)
+				_postings[trigram].push_back(id);
+		}
+
+		// Returns false if value_ is not indexed
+		bool erase(const Value& value_)
+		{
+			auto it = _ids.find(value_);
+			if (it == _ids.end())
+				return false;
+
+			uint32_t id = it->second;
+			_ids.erase(it);
+
+			_lengths[id] = ERASED;
+			_values[id] = Value(); // releases the value now
+			++_dead;
+
+			if (_dead >= MINCOMPACT && _dead * 2 > _values.size())
+				compact();
+
+			return true;
+		}
+
+		// Appends ( distance, value ) for every value whose normalized name is within maxdistance_ of the normalized
+		// query_, in no particular order
+		void search(std::string_view query_, const std::vector<uint32_t>& querygrams_, unsigned int maxdistance_,
+			std::vector<std::pair<unsigned int, Value>>& matches_) const
+		{
+			std::vector<const std::vector<uint32_t>*> lists;
+
+			for (uint32_t trigram : querygrams_)
+			{
+				if (const std::vector<uint32_t>* list = postings(trigram))
+					lists.push_back(list);
+			}
+
+			std::sort(lists.begin(), lists.end(), [](const std::vector<uint32_t>* lhs_, const std::vector<uint32_t>* rhs_) { return lhs_->size() < rhs_->size(); });
+
+			// trigrams missing from the index are empty lists and the first ones of the 3k + 1 read
+			size_t needed = 3 * static_cast<size_t>(maxdistance_) + 1;
+			size_t missing = querygrams_.size() - lists.size();
+			size_t read = lists.size(); // too few trigrams for the filter to hold, read them all
+
+			if (querygrams_.size() >= needed)
+				read = missing >= needed ? 0 : std::min(lists.size(), needed - missing);
+
+			// posting lists are sorted by id, merging them keeps the candidates sorted
+			std::vector<uint32_t> candidates;
+			for (size_t ii = 0; ii < read; ++ii)
+			{
+				size_t merged = candidates.size();
+				candidates.insert(candidates.end(), lists[ii]->begin(), lists[ii]->end());
+				std::inplace_merge(candidates.begin(), candidates.begin() + merged, candidates.end());
+			}
+
+			// count and length filter: a match lacks at most 3k of the distinct query trigrams. The run length of an id in the
+			// sorted candidates is the number of read lists holding it, the other lists are probed in id order from
+			// where the previous candidate left them
+			std::vector<std::vector<uint32_t>::const_iterator> cursors;
+			for (const std::vector<uint32_t>* list : lists)
+				cursors.push_back(list->begin());
+
+			size_t kept = 0;
+			for (size_t run = 0; run < candidates.size(); )
+			{
+				uint32_t id = candidates[run];
+				size_t end = run;
+				while (end < candidates.size() && candidates[end] == id)
+					++end;
+
+				size_t misses = missing + read - (end - run);
+				run = end;
+
+				size_t length = _lengths[id];
+				if (length == ERASED || (length != LONGNAME && (length + maxdistance_ < query_.size() || length > query_.size() + maxdistance_)))
+					continue; // the lengths alone differ by more than k
+
+				for (size_t ii = read; ii < lists.size() && misses < needed; ++ii)
+				{
+					if (!gallop(cursors[ii], lists[ii]->end(), id))
+						++misses;
+				}
+
+				if (misses < needed)
+					candidates[kept++] = id;
+			}
+
+			candidates.resize(kept);
+
+			if (candidates.empty())
+				return;
+
+			// the normalized names of all candidates in one buffer, views are taken once it stopped growing
+			std::string buffer, name;
+			std::vector<size_t> offsets{ 0 };
+
+			for (uint32_t id : candidates)
+			{
+				auto names = _names(_values[id]);
+				normalize(names.first, names.second, name);
+				buffer += name;
+				offsets.push_back(buffer.size());
+			}
+
+			std::vector<std::string_view> views;
+			views.reserve(candidates.size());
+			for (size_t ii = 0; ii < candidates.size(); ++ii)
+				views.emplace_back(buffer.data() + offsets[ii], offsets[ii + 1] - offsets[ii]);
+
+			std::vector<unsigned int> distances(candidates.size());
+			BoundedLevenshteinBatch(query_, views.data(), views.size(), maxdistance_, distances.data());
+
+			for (size_t ii = 0; ii < candidates.size(); ++ii)
+			{
+				if (distances[ii] <= maxdistance_)
+					matches_.emplace_back(distances[ii], _values[candidates[ii]]);
+			}
+		}
+
+		size_t size() const { return _values.size() - _dead; }
+	};
+
+	// TrigramIndex split into independently locked shards by value, a search visits every shard
+	template <typename Value, typename Names, typename Hash = std::hash<Value>>
+	class ShardedTrigramIndex
+	{
+	private:
+		using Index = TrigramIndex<Value, Names>;
+
+		struct alignas(64) Shard
+		{
+			mutable std::mutex mut;
+			Index index;
+		};
+
+		std::vector<std::unique_ptr<Shard>> _shards;
+		Hash _hash;
+
+		Shard& shardof(const Value& value_) const
+		{
+			return *_shards[ShardIndex(_hash(value_), _shards.size())];
+		}
+
+	public:
+		explicit ShardedTrigramIndex(size_t shards_)
+		{
+			if (shards_ == 0)
+				shards_ = 1;
+
+			_shards.reserve(shards_);
+			for (size_t ii = 0; ii < shards_; ++ii)
+				_shards.push_back(std::make_unique<Shard>());
+		}
+
+		ShardedTrigramIndex(const ShardedTrigramIndex&) = delete;
+		ShardedTrigramIndex& operator=(const ShardedTrigramIndex&) = delete;
+
+		void insert(const Value& value_)
+		{
+			Shard& shard = shardof(value_);
+			std::lock_guard<std::mutex> lk(shard.mut);
+
+			shard.index.insert(value_);
+		}
+
+		bool erase(const Value& value_)
+		{
+			Shard& shard = shardof(value_);
+			std::lock_guard<std::mutex> lk(shard.mut);
+
+			return shard.index.erase(value_);
+		}
+
+		// Up to limit_ ( distance, value ) pairs within maxdistance_ of the "first last" query_, closest first
+		std::vector<std::pair<unsigned int, Value>> search(std::string_view query_, unsigned int maxdistance_, size_t limit_) const
+		{
+			std::string query;
+			std::vector<uint32_t> grams;
+			std::vector<std::pair<unsigned int, Value>> matches;
+
+			Index::appendlower(query_, query);
+			Index::trigrams(query, grams);
+
+			for (const auto& shard : _shards)
+			{
+				std::lock_guard<std::mutex> lk(shard->mut);
+				shard->index.search(query, grams, maxdistance_, matches);
+			}
+
+			auto closer = [](const std::pair<unsigned int, Value>& lhs_, const std::pair<unsigned int, Value>& rhs_) { return lhs_.first < rhs_.first; };
+
+			if (matches.size() > limit_)
+			{
+				std::partial_sort(matches.begin(), matches.begin() + limit_, matches.end(), closer);
+				matches.resize(limit_);
+			}
+			else
+			{
+				std::sort(matches.begin(), matches.end(), closer);
+			}
+
+			return matches;
+		}
+	};
+}
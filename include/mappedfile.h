@@ -0,0 +1,101 @@
+#pragma once
+
+#include <string>
+#include <cstdio>
+#include <cstddef>
+
+namespace User
+{
+	// Read only memory mapping of a regular file ( MapViewOfFile on Windows, mmap elsewhere ).
+	// open() fails for pipes, devices and empty files so callers can fall back to buffered reads.
+	class MappedFile
+	{
+	private:
+		const char* _data{ nullptr };
+		size_t _size{ 0 };
+#ifdef _WIN32
+		void* _file{ nullptr }; // HANDLE
+		void* _mapping{ nullptr }; // HANDLE
+#else
+		int _fd{ -1 };
+#endif
+
+	public:
+		MappedFile() {}
+
+		~MappedFile()
+		{
+			close();
+		}
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		// Returns true ( file mapped ) / false ( not a regular file, empty or cannot be mapped )
+		bool open(const std::string& path_);
+
+		void close();
+
+		bool isopen() const { return _data != nullptr; }
+
+		const char* data() const { return _data; }
+
+		size_t size() const { return _size; }
+	};
+
+	// Read / write shared mapping of a file, created if it does not exist. Changes reach the file through the page
+	// cache ( a crash of the process loses nothing ), flush() forces them to the disk. resize() remaps the file,
+	// data() moves then, so what lives in the file refers to itself by offsets only
+	class WritableMappedFile
+	{
+	private:
+		char* _data{ nullptr };
+		size_t _size{ 0 };
+#ifdef _WIN32
+		void* _file{ nullptr }; // HANDLE
+		void* _mapping{ nullptr }; // HANDLE
+#else
+		int _fd{ -1 };
+#endif
+
+		bool map(size_t size_);
+		void unmap();
+
+	public:
+		WritableMappedFile() {}
+
+		~WritableMappedFile()
+		{
+			close();
+		}
+
+		WritableMappedFile(const WritableMappedFile&) = delete;
+		WritableMappedFile& operator=(const WritableMappedFile&) = delete;
+
+		// Maps path_, a new or smaller file is first extended to minsize_ bytes ( zero filled ). Returns false if
+		// the file cannot be opened, extended or mapped
+		bool open(const std::string& path_, size_t minsize_);
+
+		// Grows or shrinks the file to size_ bytes and maps it again. Returns false on failure, the file is closed then
+		bool resize(size_t size_);
+
+		// Writes the changed pages to the file and forces them to the disk
+		bool flush();
+
+		void close();
+
+		bool isopen() const { return _data != nullptr; }
+
+		char* data() const { return _data; }
+
+		size_t size() const { return _size; }
+	};
+
+	// Forces what was written to a file down to the disk ( fdatasync / _commit ), the FILE* variant flushes
+	// the stream buffer first. Returns false on failure
+	bool SyncFile(int fd_);
+	bool SyncFile(std::FILE* file_);
+
+	// Renames from_ to to_, replacing to_ if it exists ( MoveFileEx on Windows, whose rename does not replace )
+	bool RenameOver(const std::string& from_, const std::string& to_);
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include <contacthash.h>
+#include <mappedfile.h>
+
+namespace User
+{
+	// One file ( stripe ) of a MappedContactStore, little endian:
+	//
+	//   MappedStoreHeader
+	//   MappedStoreSlot[ capacity ]        open addressing table, linear probing from hash & ( capacity - 1 )
+	//   heap                               contacts, each three uint32_t lengths ( first, last, phone ) and the bytes
+	//
+	// Slots refer to the heap by offset, nothing in the file depends on the address it is mapped at. The heap
+	// takes the rest of the file and grows by extending it
+	constexpr char MAPPEDSTOREMAGIC[8] = { 'C', 'N', 'T', 'M', 'A', 'P', '0', '1' };
+	constexpr uint32_t MAPPEDSTOREVERSION = 2;
+	constexpr uint64_t MAPPEDSTORESEED = 0x6A09E667F3BCC908ULL;
+
+	// Hash a contact is stored under: WyHash chained over the text of first, last and phone from MAPPEDSTORESEED.
+	// 64 bits on every platform and independent of the hash of the in memory store ( ContactFieldHash ), the
+	// slots and stripes of a file do not depend on the build that wrote it
+	inline uint64_t MappedStoreHash(std::string_view first_, std::string_view last_, std::string_view phone_)
+	{
+		uint64_t hash = WyHash(first_.data(), first_.size(), MAPPEDSTORESEED);
+		hash = WyHash(last_.data(), last_.size(), hash);
+		return WyHash(phone_.data(), phone_.size(), hash);
+	}
+
+	struct MappedStoreHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t stripe; // index of this file
+		uint32_t stripes; // files of the store
+		uint32_t clean; // 1 once closed, the counts of a file that was not closed are recomputed on open
+		uint64_t capacity; // slots, a power of 2
+		uint64_t count; // contacts
+		uint64_t erased; // erased slots, still probed through
+		uint64_t heapsize; // heap bytes in use
+		uint64_t deadbytes; // heap bytes of erased contacts
+		uint64_t seed; // MAPPEDSTORESEED of the hashes in the slots
+	};
+
+	struct MappedStoreSlot
+	{
+		uint64_t hash;
+		uint64_t entry; // 0 = empty, UINT64_MAX = erased, otherwise heap offset + 1
+	};
+
+	static_assert(sizeof(MappedStoreHeader) == 72, "mapped store header layout");
+	static_assert(sizeof(MappedStoreSlot) == 16, "mapped store slot layout");
+
+	struct mapped_store_stats
+	{
+		size_t stripes{ 0 };
+		size_t contacts{ 0 };
+		size_t filebytes{ 0 };
+		size_t deadbytes{ 0 }; // heap bytes of erased contacts, dropped by the next rewrite of their file
+		size_t rewrites{ 0 }; // files written anew to grow their table or drop dead bytes
+		size_t loaded{ 0 }; // stripes handed to load(), see Contacts( StoreConfig )
+		bool failed{ false }; // a file could not be grown or rewritten, changes are not stored any more
+	};
+
+	// Contacts kept in memory mapped files path.0 .. path.N-1, a contact lives in the stripe its MappedStoreHash
+	// picks. Opening a store maps the files and reads their headers only, pages are read when a stripe is used.
+	// Changes are written in place under the lock of their stripe: the strings are appended to the heap before the
+	// slot refers to them, so a crash of the process leaves no slot pointing at partial strings ( flush() forces
+	// the pages to the disk for a crash of the machine ). A table past 3/4 load, or a heap mostly dead, is written
+	// anew next to its file and renamed over it
+	class MappedContactStore
+	{
+	public:
+		static constexpr size_t MINCAPACITY = 1024; // slots of a new file
+		static constexpr size_t MINHEAP = 64 * 1024; // heap bytes of a new file
+
+	private:
+		struct Stripe
+		{
+			std::mutex mut;
+			WritableMappedFile file;
+			std::string path;
+			std::once_flag loaded;
+		};
+
+		std::vector<std::unique_ptr<Stripe>> _stripes;
+		std::atomic<size_t> _rewrites{ 0 };
+		std::atomic<size_t> _loaded{ 0 };
+		std::atomic<bool> _failed{ false };
+
+		bool openstripe(Stripe& stripe_, uint32_t index_, uint32_t stripes_, bool existing_);
+		size_t stripeof(uint64_t hash_) const { return static_cast<size_t>(((hash_ * 0x9E3779B97F4A7C15ULL) >> 32) % _stripes.size()); }
+		bool rewrite(Stripe& stripe_, uint64_t capacity_, uint64_t heapbytes_);
+		void recover(Stripe& stripe_);
+
+	public:
+		MappedContactStore() {}
+
+		~MappedContactStore() { close(); }
+
+		MappedContactStore(const MappedContactStore&) = delete;
+		MappedContactStore& operator=(const MappedContactStore&) = delete;
+
+		// Opens the store at path_ or creates it with stripes_ files, an existing store keeps its own number of
+		// files. Returns false if a file cannot be mapped or is not a stripe of the store ( magic, version, seed,
+		// index or number of stripes differ )
+		bool open(const std::string& path_, size_t stripes_);
+
+		// Flushes every file and marks it closed
+		void close();
+
+		bool isopen() const { return !_stripes.empty(); }
+
+		// A file could not be grown or rewritten, changes are not stored any more
+		bool failed() const { return _failed; }
+
+		size_t stripes() const { return _stripes.size(); }
+
+		// Stripe of a contact, 64 bit arithmetic so that 32 and 64 bit builds agree
+		size_t stripeof(std::string_view first_, std::string_view last_, std::string_view phone_) const
+		{
+			return stripeof(MappedStoreHash(first_, last_, phone_));
+		}
+
+		// Returns true ( stored ) / false ( already stored, or the store failed )
+		bool insert(std::string_view first_, std::string_view last_, std::string_view phone_);
+
+		// Returns true ( erased ) / false ( not stored )
+		bool erase(std::string_view first_, std::string_view last_, std::string_view phone_);
+
+		// Calls visitor_( first, last, phone ) for every contact of stripe stripe_ under its lock
+		template <typename Visitor>
+		void foreach(size_t stripe_, Visitor&& visitor_) const;
+
+		// Runs load_( stripe_ ) once per stripe, concurrent callers for the same stripe wait until it returned
+		template <typename Load>
+		void load(size_t stripe_, Load&& load_)
+		{
+			std::call_once(_stripes[stripe_]->loaded, [this, stripe_, &load_]()
+			{
+				load_(stripe_);
+				++_loaded;
+			});
+		}
+
+		// Forces every change to the disk, returns false on an I/O error
+		bool flush();
+
+		mapped_store_stats stats() const;
+	};
+
+	template <typename Visitor>
+	void MappedContactStore::foreach(size_t stripe_, Visitor&& visitor_) const
+	{
+		Stripe& stripe = *_stripes[stripe_];
+		std::lock_guard<std::mutex> lk(stripe.mut);
+
+		if (!stripe.file.isopen())
+			return;
+
+		const char* data = stripe.file.data();
+		const MappedStoreHeader* header = reinterpret_cast<const MappedStoreHeader*>(data);
+		const MappedStoreSlot* slots = reinterpret_cast<const MappedStoreSlot*>(data + sizeof(MappedStoreHeader));
+		const char* heap = data + sizeof(MappedStoreHeader) + header->capacity * sizeof(MappedStoreSlot);
+
+		for (uint64_t ii = 0; ii < header->capacity; ++ii)
+		{
+			uint64_t entry = slots[ii].entry;
+
+			if (entry == 0 || entry == UINT64_MAX)
+				continue;
+
+			uint32_t sizes[3];
+			const char* record = heap + entry - 1;
+			std::memcpy(sizes, record, sizeof(sizes));
+
+			const char* first = record + sizeof(sizes);
+			visitor_(std::string_view(first, sizes[0]), std::string_view(first + sizes[0], sizes[1]),
+				std::string_view(first + sizes[0] + sizes[1], sizes[2]));
+		}
+	}
+}
@@ -0,0 +1,235 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+#include <string_view>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+
+#include <flatmap.h>
+#include <contacthash.h>
+#include <contactstore.h>
+
+namespace User
+{
+	struct name_stats
+	{
+		size_t names{ 0 }; // distinct names stored
+		size_t bytes{ 0 }; // bytes of the distinct names
+		uint64_t lookups{ 0 }; // names interned, repeated ones included
+		uint64_t lookupbytes{ 0 }; // bytes of the names interned, what storing every name would have cost
+		size_t memory{ 0 }; // bytes held by the dictionary, see NameDictionary::memory
+	};
+
+	// Concurrent interning of first and last names: every distinct name is stored once and gets a 32 bit id, so
+	// records hold two ids instead of the name bytes and equal names compare as integers. Names are sharded by hash,
+	// looking up a known name only takes the shard's shared lock. id -> name is a lock free two level table.
+	// Names are never removed, the dictionary keeps every name it was given
+	class NameDictionary
+	{
+	public:
+		static constexpr uint32_t BLOCKBITS = 16; // ids per block of the id table
+		static constexpr size_t DEFAULTSHARDS = 64;
+
+	private:
+		static constexpr size_t BLOCKSIZE = static_cast<size_t>(1) << BLOCKBITS;
+		static constexpr size_t BLOCKS = static_cast<size_t>(1) << (32 - BLOCKBITS);
+		static constexpr size_t CHUNKSIZE = 64 * 1024; // name bytes per allocation of a shard
+		static constexpr uint64_t SEED = 0x2D358DCCAA6C78A5ULL;
+
+		// Stored name, the bytes are preceded by their 32 bit length
+		struct Name
+		{
+			const char* data{ nullptr };
+			uint32_t size{ 0 };
+			uint32_t id{ 0 };
+		};
+
+		struct name_key
+		{
+			std::string_view operator()(const Name& name_) const { return std::string_view(name_.data, name_.size); }
+		};
+
+		struct name_hash
+		{
+			size_t operator()(std::string_view name_) const { return static_cast<size_t>(WyHash(name_.data(), name_.size(), SEED)); }
+		};
+
+		struct alignas(64) Shard
+		{
+			mutable std::shared_mutex mut;
+			FlatMap<std::string_view, Name, name_hash, name_key> map;
+			std::vector<std::unique_ptr<char[]>> chunks;
+			char* next{ nullptr };
+			size_t room{ 0 };
+			size_t allocated{ 0 }; // bytes of the chunks
+			size_t bytes{ 0 };
+			std::atomic<uint64_t> lookups{ 0 };
+			std::atomic<uint64_t> lookupbytes{ 0 };
+		};
+
+		std::vector<std::unique_ptr<Shard>> _shards;
+		std::unique_ptr<std::atomic<const char**>[]> _blocks; // id >> BLOCKBITS -> block of BLOCKSIZE names
+		std::atomic<uint32_t> _next{ 0 };
+		std::mutex _blockmut;
+
+		// Copies name_ with its length prefix into the shard's chunks, under the exclusive shard lock
+		static const char* store(Shard& shard_, std::string_view name_)
+		{
+			size_t size = sizeof(uint32_t) + name_.size();
+			char* dest;
+
+			if (size > CHUNKSIZE / 4)
+			{
+				shard_.chunks.emplace_back(new char[size]); // long names do not waste the rest of a chunk
+				shard_.allocated += size;
+				dest = shard_.chunks.back().get();
+			}
+			else
+			{
+				if (shard_.room < size)
+				{
+					shard_.chunks.emplace_back(new char[CHUNKSIZE]);
+					shard_.allocated += CHUNKSIZE;
+					shard_.next = shard_.chunks.back().get();
+					shard_.room = CHUNKSIZE;
+				}
+
+				dest = shard_.next;
+				shard_.next += size;
+				shard_.room -= size;
+			}
+
+			uint32_t length = static_cast<uint32_t>(name_.size());
+			std::memcpy(dest, &length, sizeof(length));
+			std::memcpy(dest + sizeof(length), name_.data(), name_.size());
+			shard_.bytes += name_.size();
+
+			return dest;
+		}
+
+		const char** block(uint32_t id_)
+		{
+			std::atomic<const char**>& slot = _blocks[id_ >> BLOCKBITS];
+			const char** names = slot.load(std::memory_order_acquire);
+
+			if (names == nullptr)
+			{
+				std::lock_guard<std::mutex> lk(_blockmut);
+
+				names = slot.load(std::memory_order_acquire);
+				if (names == nullptr)
+				{
+					names = new const char*[BLOCKSIZE]();
+					slot.store(names, std::memory_order_release);
+				}
+			}
+
+			return names;
+		}
+
+	public:
+		explicit NameDictionary(size_t shards_ = DEFAULTSHARDS) : _blocks(new std::atomic<const char**>[BLOCKS]())
+		{
+			if (shards_ == 0)
+				shards_ = 1;
+
+			_shards.reserve(shards_);
+			for (size_t ii = 0; ii < shards_; ++ii)
+				_shards.push_back(std::make_unique<Shard>());
+		}
+
+		NameDictionary(const NameDictionary&) = delete;
+		NameDictionary& operator=(const NameDictionary&) = delete;
+
+		~NameDictionary()
+		{
+			for (size_t ii = 0; ii < BLOCKS; ++ii)
+				delete[] _blocks[ii].load(std::memory_order_relaxed);
+		}
+
+		// Id of name_, stored first if it is new. Ids are dense in the order names were first seen
+		uint32_t intern(std::string_view name_)
+		{
+			size_t hash = name_hash()(name_);
+			Shard& shard = *_shards[ShardIndex(hash, _shards.size())];
+
+			shard.lookups.fetch_add(1, std::memory_order_relaxed);
+			shard.lookupbytes.fetch_add(name_.size(), std::memory_order_relaxed);
+
+			{
+				std::shared_lock<std::shared_mutex> lk(shard.mut);
+
+				if (const Name* found = shard.map.find(name_, hash))
+					return found->id;
+			}
+
+			std::unique_lock<std::shared_mutex> lk(shard.mut);
+
+			if (const Name* found = shard.map.find(name_, hash))
+				return found->id; // interned by another thread meanwhile
+
+			const char* stored = store(shard, name_);
+			Name name{ stored + sizeof(uint32_t), static_cast<uint32_t>(name_.size()), _next.fetch_add(1, std::memory_order_relaxed) };
+
+			// the id reaches other threads only through the record holding it, which is published after this
+			block(name.id)[name.id & (BLOCKSIZE - 1)] = stored;
+			shard.map.insert(std::string_view(name.data, name.size), hash, name);
+
+			return name.id;
+		}
+
+		// Name of an id returned by intern
+		std::string_view name(uint32_t id_) const
+		{
+			const char* stored = _blocks[id_ >> BLOCKBITS].load(std::memory_order_acquire)[id_ & (BLOCKSIZE - 1)];
+			uint32_t length;
+
+			std::memcpy(&length, stored, sizeof(length));
+			return std::string_view(stored + sizeof(length), length);
+		}
+
+		name_stats stats() const
+		{
+			name_stats stats;
+
+			for (const auto& shard : _shards)
+			{
+				std::shared_lock<std::shared_mutex> lk(shard->mut);
+
+				stats.names += shard->map.size();
+				stats.bytes += shard->bytes;
+				stats.lookups += shard->lookups.load(std::memory_order_relaxed);
+				stats.lookupbytes += shard->lookupbytes.load(std::memory_order_relaxed);
+			}
+
+			stats.memory = memory();
+			return stats;
+		}
+
+		// Bytes held: name chunks, the shard tables and the id table
+		size_t memory() const
+		{
+			size_t total = BLOCKS * sizeof(std::atomic<const char**>);
+
+			for (size_t ii = 0; ii < BLOCKS; ++ii)
+			{
+				if (_blocks[ii].load(std::memory_order_relaxed) != nullptr)
+					total += BLOCKSIZE * sizeof(const char*);
+			}
+
+			for (const auto& shard : _shards)
+			{
+				std::shared_lock<std::shared_mutex> lk(shard->mut);
+
+				total += sizeof(Shard) + shard->map.memory() + shard->allocated;
+			}
+
+			return total;
+		}
+	};
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <string_view>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+
+#include <contacthash.h>
+
+namespace User
+{
+	// Phone numbers in E.164 shape, an optional '+' and 1 .. 15 digits ( country code and national number ), pack
+	// into one 64 bit integer: the digits as a number in bits 0 .. 49, the digit count in bits 50 .. 53 so leading
+	// zeros survive, the '+' in bit 54. The packing is exact, two phones have the same key only if their text is
+	// equal, and a packed key is never 0. Other phones ( formatting characters, extensions, longer numbers ) do not
+	// pack and keep being compared and hashed as text
+	namespace Detail
+	{
+		constexpr uint64_t PHONEDIGITBITS = 50;
+		constexpr uint64_t PHONEPLUSBIT = static_cast<uint64_t>(1) << 54;
+		constexpr size_t PHONEMAXDIGITS = 15;
+
+		// Value of 8 ASCII digits, the first one in the lowest byte ( SWAR, three multiplies and no loop )
+		inline uint64_t ParseEightDigits(uint64_t chars_)
+		{
+			chars_ = ((chars_ & 0x0F0F0F0F0F0F0F0FULL) * 2561) >> 8;
+			chars_ = ((chars_ & 0x00FF00FF00FF00FFULL) * 6553601) >> 16;
+			return ((chars_ & 0x0000FFFF0000FFFFULL) * 42949672960001ULL) >> 32;
+		}
+
+		// True if all 8 bytes are ASCII digits
+		inline bool EightDigits(uint64_t chars_)
+		{
+			return ((chars_ & 0xF0F0F0F0F0F0F0F0ULL) | (((chars_ + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) == 0x3333333333333333ULL;
+		}
+
+		inline uint64_t LoadEight(const char* chars_)
+		{
+			uint64_t value;
+			std::memcpy(&value, chars_, sizeof(value));
+			return value;
+		}
+
+		// 8 digit number whose last count_ ( 0 .. 7 ) chars are the first count_ bytes of chars_ and the others '0'.
+		// The last byte is shifted separately so a shift by 64 stays defined
+		inline uint64_t AlignDigits(uint64_t chars_, size_t count_)
+		{
+			size_t shift = 8 * (7 - count_);
+			uint64_t zeros = ~((~static_cast<uint64_t>(0) << shift) << 8);
+
+			return ((chars_ << shift) << 8) | (0x3030303030303030ULL & zeros);
+		}
+	}
+
+	// Packed key of phone_, 0 if it is not an optional '+' followed by 1 .. 15 digits. The digits are read as two
+	// 8 byte words, right aligned with '0' and checked and converted without a loop or a branch per char. Numbers
+	// of less than 8 digits go through a small buffer instead
+	inline uint64_t PackPhone(std::string_view phone_)
+	{
+		using namespace Detail;
+
+		size_t plus = !phone_.empty() && phone_[0] == '+';
+		size_t digits = phone_.size() - plus;
+		const char* first = phone_.data() + plus;
+		uint64_t high, low;
+
+		if (digits - 1 >= PHONEMAXDIGITS) // also catches 0 digits
+			return 0;
+
+		if (digits >= 8)
+		{
+			high = AlignDigits(LoadEight(first), digits - 8);
+			low = LoadEight(first + digits - 8);
+		}
+		else
+		{
+			char buffer[8];
+			std::memset(buffer, '0', sizeof(buffer));
+			std::memcpy(buffer + sizeof(buffer) - digits, first, digits);
+
+			high = 0x3030303030303030ULL;
+			low = LoadEight(buffer);
+		}
+
+		uint64_t value = ParseEightDigits(high) * 100000000ULL + ParseEightDigits(low);
+		uint64_t valid = static_cast<uint64_t>(EightDigits(high) & EightDigits(low));
+
+		return (value | (static_cast<uint64_t>(digits) << PHONEDIGITBITS) | (plus * PHONEPLUSBIT)) * valid;
+	}
+
+	// Text of a packed key, buffer_ must hold 16 chars. Returns the number of chars written
+	inline size_t UnpackPhone(uint64_t key_, char* buffer_)
+	{
+		using namespace Detail;
+
+		size_t plus = (key_ & PHONEPLUSBIT) != 0;
+		size_t digits = static_cast<size_t>(key_ >> PHONEDIGITBITS) & 0xF;
+		uint64_t value = key_ & ((static_cast<uint64_t>(1) << PHONEDIGITBITS) - 1);
+
+		buffer_[0] = '+';
+		for (size_t ii = plus + digits; ii > plus; --ii, value /= 10)
+			buffer_[ii - 1] = static_cast<char>('0' + value % 10);
+
+		return plus + digits;
+	}
+
+	// Phone number as the store hashes, compares and indexes it: the packed key when the phone packs, else the
+	// text. The text is kept as well, it is what users get back
+	class PhoneKey
+	{
+	private:
+		uint64_t _packed{ 0 };
+		std::string_view _text;
+
+	public:
+		PhoneKey() {}
+
+		explicit PhoneKey(std::string_view text_) : _packed(PackPhone(text_)), _text(text_) {}
+
+		// packed_ must be PackPhone( text_ ), for records that stored it
+		PhoneKey(uint64_t packed_, std::string_view text_) : _packed(packed_), _text(text_) {}
+
+		uint64_t packed() const { return _packed; }
+
+		std::string_view text() const { return _text; }
+
+		bool operator==(const PhoneKey& p_) const
+		{
+			return _packed == p_._packed && (_packed != 0 || _text == p_._text);
+		}
+
+		bool operator!=(const PhoneKey& p_) const { return !(*this == p_); }
+	};
+
+	struct phonekey_hash
+	{
+		static constexpr uint64_t SEED = 0x4B33A62ED433D4A3ULL;
+
+		size_t operator()(const PhoneKey& phone_) const
+		{
+			if (phone_.packed() != 0)
+				return static_cast<size_t>(Detail::WyMix(phone_.packed() ^ Detail::WYSECRET[0], SEED));
+
+			return static_cast<size_t>(WyHash(phone_.text().data(), phone_.text().size(), SEED));
+		}
+	};
+}
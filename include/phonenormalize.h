@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string_view>
+#include <cstddef>
+
+namespace User
+{
+	constexpr size_t E164MAXDIGITS = 15;
+	constexpr size_t E164BUFFER = 1 + E164MAXDIGITS; // '+' and the digits
+
+	// E.164 form of phone_ written to buffer_ ( E164BUFFER chars ): '+', country code and national number without
+	// formatting, "+1 (617) 000-0001" becomes "+16170000001". Spaces, '(', ')', '-', '.' and '/' are dropped, any
+	// other character but a leading '+' makes the number invalid. Numbers starting with '+' or "00" are
+	// international, others are national numbers of defaultcountry_ ( one leading trunk '0' is dropped, and the
+	// trunk '1' of the NANP ), with defaultcountry_ 0 they are invalid. Validation is structural: the country code
+	// must exist as far as its length goes, the national number has 4 digits at least ( exactly 10 for +1 ) and
+	// the whole number at most 15. Characters are classified 16 at a time with SSE2 ( one at a time without it ).
+	// Returns the size written, 0 if phone_ is not a valid number
+	size_t NormalizePhone(std::string_view phone_, unsigned int defaultcountry_, char* buffer_);
+}
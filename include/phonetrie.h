@@ -0,0 +1,391 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <cstdint>
+
+#include <contactstore.h>
+
+namespace User
+{
+	// Digit trie over phone numbers, only the digits of a number are used ( "+1 617-555" is the key 1617555, digits
+	// after the first MAXDIGITS are ignored ). Path compressed as a burst trie: a value is stored at the deepest
+	// existing node of its number together with the remaining digits ( its tail, packed 4 bits per digit ), the
+	// child nodes are only created once more than BURST values with a tail share a node. Sparse numbers therefore
+	// do not pay for a node per digit. Values whose number ends at a node ( empty tail ) have a list of their own,
+	// however many share a number they are never walked by a burst. Nodes and values live in two pools addressed by 32 bit indexes.
+	// Not thread safe, see ShardedPhoneTrie
+	template <typename Value>
+	class PhoneTrie
+	{
+	private:
+		static constexpr uint32_t NONE = UINT32_MAX;
+		static constexpr uint32_t BURST = 16; // values per node before its values are moved into child nodes
+		static constexpr size_t MAXTAIL = 16; // digits in the packed tail of a value
+		static constexpr size_t MAXDIGITS = 64;
+
+		struct Node
+		{
+			uint32_t child[10]; // 0 = no child, node 0 is the root and never a child
+			uint32_t values{ NONE }; // first entry of the values with a tail, moved down by a burst
+			uint32_t count{ 0 }; // entries in values
+			uint32_t ends{ NONE }; // first entry of the values whose number ends here
+			Node() { std::fill(std::begin(child), std::end(child), 0u); }
+		};
+
+		struct Entry
+		{
+			Value value;
+			uint64_t tail; // digit i of the tail in bits 4i .. 4i+3
+			uint32_t next;
+			uint8_t taillen;
+		};
+
+		struct Digits
+		{
+			uint8_t digit[MAXDIGITS];
+			size_t size{ 0 };
+
+			explicit Digits(std::string_view phone_)
+			{
+				for (char c : phone_)
+				{
+					if (c >= '0' && c <= '9' && size < MAXDIGITS)
+						digit[size++] = static_cast<uint8_t>(c - '0');
+				}
+			}
+		};
+
+		std::vector<Node> _nodes;
+		std::vector<Entry> _entries;
+		uint32_t _freeentry{ NONE }; // erased entries are reused
+		size_t _size{ 0 };
+
+		static uint8_t taildigit(const Entry& entry_, size_t idx_) { return static_cast<uint8_t>((entry_.tail >> (4 * idx_)) & 0xF); }
+
+		static uint64_t packtail(const uint8_t* digits_, size_t count_)
+		{
+			uint64_t tail = 0;
+			for (size_t ii = 0; ii < count_; ++ii)
+				tail |= static_cast<uint64_t>(digits_[ii]) << (4 * ii);
+			return tail;
+		}
+
+		// Deepest existing node on the path of digits_, pos_ receives the number of digits consumed
+		uint32_t descend(const Digits& digits_, size_t& pos_) const
+		{
+			uint32_t node = 0;
+
+			for (pos_ = 0; pos_ < digits_.size; ++pos_)
+			{
+				uint32_t child = _nodes[node].child[digits_.digit[pos_]];
+				if (child == 0)
+					break;
+				node = child;
+			}
+
+			return node;
+		}
+
+		uint32_t newnode()
+		{
+			_nodes.emplace_back(); // may reallocate, callers index again afterwards
+			return static_cast<uint32_t>(_nodes.size() - 1);
+		}
+
+		void link(uint32_t node_, uint32_t entry_)
+		{
+			if (_entries[entry_].taillen == 0)
+			{
+				_entries[entry_].next = _nodes[node_].ends;
+				_nodes[node_].ends = entry_;
+				return;
+			}
+
+			_entries[entry_].next = _nodes[node_].values;
+			_nodes[node_].values = entry_;
+			++_nodes[node_].count;
+		}
+
+		// Moves every value of node_ with a tail one level down, bursting the children in turn if needed
+		void burst(uint32_t node_)
+		{
+			uint32_t entry = _nodes[node_].values;
+			_nodes[node_].values = NONE;
+			_nodes[node_].count = 0;
+
+			while (entry != NONE)
+			{
+				uint32_t next = _entries[entry].next;
+				Entry& value = _entries[entry];
+				uint8_t digit = taildigit(value, 0);
+
+				value.tail >>= 4;
+				--value.taillen;
+
+				if (_nodes[node_].child[digit] == 0)
+				{
+					uint32_t child = newnode();
+					_nodes[node_].child[digit] = child;
+				}
+
+				link(_nodes[node_].child[digit], entry);
+				entry = next;
+			}
+
+			uint32_t children[10];
+			std::copy(std::begin(_nodes[node_].child), std::end(_nodes[node_].child), children); // bursts reallocate _nodes
+
+			for (uint32_t child : children)
+			{
+				if (child != 0 && _nodes[child].count > BURST)
+					burst(child);
+			}
+		}
+
+		// Creates child digit_ of node_ and moves the values of node_ whose tail starts with digit_ into it, values
+		// always stay at the deepest existing node of their number
+		uint32_t makechild(uint32_t node_, uint8_t digit_)
+		{
+			uint32_t child = newnode();
+			_nodes[node_].child[digit_] = child;
+
+			for (uint32_t* link = &_nodes[node_].values; *link != NONE; )
+			{
+				uint32_t entry = *link;
+				Entry& value = _entries[entry];
+
+				if (taildigit(value, 0) != digit_)
+				{
+					link = &value.next;
+					continue;
+				}
+
+				*link = value.next;
+				--_nodes[node_].count;
+				value.tail >>= 4;
+				--value.taillen;
+				this->link(child, entry);
+			}
+
+			if (_nodes[child].count > BURST)
+				burst(child);
+
+			return child;
+		}
+
+		// True if the first count_ digits of the entry's tail are digits_
+		static bool tailmatches(const Entry& entry_, const uint8_t* digits_, size_t count_)
+		{
+			if (count_ > entry_.taillen)
+				return false;
+
+			return (entry_.tail & (count_ == 16 ? ~0ULL : ((1ULL << (4 * count_)) - 1))) == packtail(digits_, count_);
+		}
+
+	public:
+		PhoneTrie() : _nodes(1) {}
+
+		void insert(std::string_view phone_, const Value& value_)
+		{
+			Digits digits(phone_);
+			size_t pos = 0;
+			uint32_t node = descend(digits, pos);
+
+			// tails hold at most MAXTAIL digits, longer remainders get nodes down to that length
+			while (digits.size - pos > MAXTAIL)
+			{
+				node = makechild(node, digits.digit[pos++]);
+
+				while (pos < digits.size && _nodes[node].child[digits.digit[pos]] != 0) // children of a burst
+					node = _nodes[node].child[digits.digit[pos++]];
+			}
+
+			uint32_t entry = _freeentry;
+			if (entry != NONE)
+			{
+				_freeentry = _entries[entry].next;
+				_entries[entry].value = value_;
+			}
+			else
+			{
+				entry = static_cast<uint32_t>(_entries.size());
+				_entries.push_back(Entry{ value_, 0, NONE, 0 });
+			}
+
+			_entries[entry].tail = packtail(digits.digit + pos, digits.size - pos);
+			_entries[entry].taillen = static_cast<uint8_t>(digits.size - pos);
+
+			link(node, entry);
+			++_size;
+
+			if (_nodes[node].count > BURST)
+				burst(node);
+		}
+
+		// Removes value_ stored under phone_, returns false if it is not there. Nodes are kept for reuse
+		bool erase(std::string_view phone_, const Value& value_)
+		{
+			Digits digits(phone_);
+			size_t pos = 0;
+			uint32_t node = descend(digits, pos);
+			size_t taillen = digits.size - pos;
+
+			for (uint32_t* link = taillen == 0 ? &_nodes[node].ends : &_nodes[node].values; *link != NONE; link = &_entries[*link].next)
+			{
+				uint32_t entry = *link;
+
+				if (_entries[entry].value == value_ && _entries[entry].taillen == taillen)
+				{
+					*link = _entries[entry].next;
+
+					if (taillen != 0)
+						--_nodes[node].count;
+
+					_entries[entry].value = Value(); // releases the value now
+					_entries[entry].next = _freeentry;
+					_freeentry = entry;
+					--_size;
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		// Appends up to limit_ values whose number starts with the digits of prefix_, in no particular order.
+		// Returns the number of values appended
+		size_t find(std::string_view prefix_, size_t limit_, std::vector<Value>& values_) const
+		{
+			Digits digits(prefix_);
+			size_t pos = 0;
+			uint32_t node = descend(digits, pos);
+			size_t found = 0;
+
+			if (pos < digits.size)
+			{
+				// the prefix ends below the deepest node, only values of that node with a tail can match by it
+				for (uint32_t entry = _nodes[node].values; entry != NONE && found < limit_; entry = _entries[entry].next)
+				{
+					if (tailmatches(_entries[entry], digits.digit + pos, digits.size - pos))
+					{
+						values_.push_back(_entries[entry].value);
+						++found;
+					}
+				}
+
+				return found;
+			}
+
+			std::vector<uint32_t> stack{ node };
+
+			while (!stack.empty() && found < limit_)
+			{
+				const Node& current = _nodes[stack.back()];
+				stack.pop_back();
+
+				for (uint32_t entry = current.ends; entry != NONE && found < limit_; entry = _entries[entry].next, ++found)
+					values_.push_back(_entries[entry].value);
+
+				for (uint32_t entry = current.values; entry != NONE && found < limit_; entry = _entries[entry].next, ++found)
+					values_.push_back(_entries[entry].value);
+
+				for (uint32_t child : current.child)
+				{
+					if (child != 0)
+						stack.push_back(child);
+				}
+			}
+
+			return found;
+		}
+
+		size_t size() const { return _size; }
+
+		// Bytes held by the node and value pools
+		size_t memory() const { return _nodes.capacity() * sizeof(Node) + _entries.capacity() * sizeof(Entry); }
+	};
+
+	// PhoneTrie split into independently locked shards by number, like ShardedIndex. A prefix query visits
+	// every shard, which costs shards * prefix length node steps on top of the matches
+	template <typename Value>
+	class ShardedPhoneTrie
+	{
+	private:
+		struct alignas(64) Shard
+		{
+			mutable std::mutex mut;
+			PhoneTrie<Value> trie;
+		};
+
+		std::vector<std::unique_ptr<Shard>> _shards;
+
+		Shard& shardof(std::string_view phone_) const
+		{
+			return *_shards[ShardIndex(std::hash<std::string_view>()(phone_), _shards.size())];
+		}
+
+	public:
+		explicit ShardedPhoneTrie(size_t shards_)
+		{
+			if (shards_ == 0)
+				shards_ = 1;
+
+			_shards.reserve(shards_);
+			for (size_t ii = 0; ii < shards_; ++ii)
+				_shards.push_back(std::make_unique<Shard>());
+		}
+
+		ShardedPhoneTrie(const ShardedPhoneTrie&) = delete;
+		ShardedPhoneTrie& operator=(const ShardedPhoneTrie&) = delete;
+
+		void insert(std::string_view phone_, const Value& value_)
+		{
+			Shard& shard = shardof(phone_);
+			std::lock_guard<std::mutex> lk(shard.mut);
+
+			shard.trie.insert(phone_, value_);
+		}
+
+		bool erase(std::string_view phone_, const Value& value_)
+		{
+			Shard& shard = shardof(phone_);
+			std::lock_guard<std::mutex> lk(shard.mut);
+
+			return shard.trie.erase(phone_, value_);
+		}
+
+		// Appends up to limit_ values whose number starts with the digits of prefix_, in no particular order
+		size_t find(std::string_view prefix_, size_t limit_, std::vector<Value>& values_) const
+		{
+			size_t found = 0;
+
+			for (const auto& shard : _shards)
+			{
+				if (found == limit_)
+					break;
+
+				std::lock_guard<std::mutex> lk(shard->mut);
+				found += shard->trie.find(prefix_, limit_ - found, values_);
+			}
+
+			return found;
+		}
+
+		size_t memory() const
+		{
+			size_t total = 0;
+
+			for (const auto& shard : _shards)
+			{
+				std::lock_guard<std::mutex> lk(shard->mut);
+				total += sizeof(Shard) + shard->trie.memory();
+			}
+
+			return total;
+		}
+	};
+}
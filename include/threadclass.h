@@ -9,6 +9,9 @@
 #include <mutex>
 #include <condition_variable>
 #include <iostream>
+#include <cstdint>
+#include <functional>
+#include <chrono>
 
 namespace Threading
 {
@@ -115,6 +118,617 @@ namespace Threading
 		}
 	};
 
+	// What a push does when a bounded queue is full
+	enum class QueueFullPolicy { BLOCK, DROP_OLDEST, FAIL };
+
+	// Bounded lock free multi producer / multi consumer queue ( sequence numbered ring, D. Vyukov ).
+	// Producers and consumers only contend on one atomic each, pop moves the value out of the slot.
+	// Consumers that find the queue empty sleep on a condition variable, producers only take its mutex
+	// when a consumer is actually sleeping. Same interface as threadsafe_queue so it can be swapped in
+	template<typename T>
+	class lockfree_queue
+	{
+	private:
+		struct Cell
+		{
+			std::atomic<size_t> seq;
+			T data;
+		};
+
+		std::unique_ptr<Cell[]> _buffer;
+		size_t const _mask;
+		QueueFullPolicy const _policy;
+
+		alignas(64) std::atomic<size_t> _enqueuepos{ 0 };
+		alignas(64) std::atomic<size_t> _dequeuepos{ 0 };
+		alignas(64) std::atomic<size_t> _sleepers{ 0 };
+		std::atomic<uint64_t> _dropped{ 0 };
+		std::atomic<bool> _done{ false };
+		std::mutex _mut;
+		std::condition_variable _data_cond;
+
+		static size_t roundpow2(size_t capacity_)
+		{
+			size_t size = 2;
+			while (size < capacity_)
+				size <<= 1;
+			return size;
+		}
+
+		bool tryenqueue(T& value_)
+		{
+			size_t pos = _enqueuepos.load(std::memory_order_relaxed);
+
+			while (true)
+			{
+				Cell& cell = _buffer[pos & _mask];
+				size_t seq = cell.seq.load(std::memory_order_acquire);
+				intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+
+				if (dif == 0)
+				{
+					if (_enqueuepos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					{
+						cell.data = std::move(value_);
+						cell.seq.store(pos + 1, std::memory_order_release);
+						return true;
+					}
+				}
+				else if (dif < 0)
+				{
+					return false; // full
+				}
+				else
+				{
+					pos = _enqueuepos.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		bool trydequeue(T& value_)
+		{
+			size_t pos = _dequeuepos.load(std::memory_order_relaxed);
+
+			while (true)
+			{
+				Cell& cell = _buffer[pos & _mask];
+				size_t seq = cell.seq.load(std::memory_order_acquire);
+				intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+
+				if (dif == 0)
+				{
+					if (_dequeuepos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					{
+						value_ = std::move(cell.data);
+						cell.seq.store(pos + _mask + 1, std::memory_order_release);
+						return true;
+					}
+				}
+				else if (dif < 0)
+				{
+					return false; // empty
+				}
+				else
+				{
+					pos = _dequeuepos.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		void wakeconsumer()
+		{
+			// pairs with the fetch_add in wait_and_pop, either the consumer sees the new value or we see it sleeping
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+
+			if (_sleepers.load(std::memory_order_relaxed) != 0)
+			{
+				std::lock_guard<std::mutex> lk(_mut);
+				_data_cond.notify_one();
+			}
+		}
+
+	public:
+		explicit lockfree_queue(size_t capacity_ = 65536, QueueFullPolicy policy_ = QueueFullPolicy::BLOCK) :
+			_buffer(new Cell[roundpow2(capacity_)]),
+			_mask(roundpow2(capacity_) - 1),
+			_policy(policy_)
+		{
+			for (size_t ii = 0; ii <= _mask; ++ii)
+				_buffer[ii].seq.store(ii, std::memory_order_relaxed);
+		}
+
+		lockfree_queue(const lockfree_queue&) = delete;
+		lockfree_queue& operator=(const lockfree_queue&) = delete;
+
+		size_t capacity() const { return _mask + 1; }
+
+		// Returns false if the value was not queued ( FAIL policy on a full queue or queue stopped )
+		bool push(T new_value)
+		{
+			while (!tryenqueue(new_value))
+			{
+				if (_done)
+					return false;
+
+				if (_policy == QueueFullPolicy::FAIL)
+				{
+					_dropped.fetch_add(1, std::memory_order_relaxed);
+					return false;
+				}
+
+				if (_policy == QueueFullPolicy::DROP_OLDEST)
+				{
+					T dropped;
+					if (trydequeue(dropped))
+						_dropped.fetch_add(1, std::memory_order_relaxed);
+				}
+				else
+				{
+					std::this_thread::yield(); // BLOCK, wait for consumers to make room
+				}
+			}
+
+			wakeconsumer();
+			return true;
+		}
+
+		void clear()
+		{
+			T value;
+			while (trydequeue(value))
+			{
+			}
+		}
+
+		void wait_and_pop(T& value)
+		{
+			while (!_done)
+			{
+				if (trydequeue(value))
+					return;
+
+				std::unique_lock<std::mutex> lk(_mut);
+				_sleepers.fetch_add(1);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+
+				if (trydequeue(value))
+				{
+					_sleepers.fetch_sub(1);
+					return;
+				}
+
+				_data_cond.wait(lk, [this] { return _done || !empty(); });
+				_sleepers.fetch_sub(1);
+			}
+		}
+
+		bool try_pop(T& value)
+		{
+			return trydequeue(value);
+		}
+
+		void stop()
+		{
+			_done = true;
+
+			std::lock_guard<std::mutex> lk(_mut);
+			_data_cond.notify_all();
+		}
+
+		bool empty() const
+		{
+			return _dequeuepos.load(std::memory_order_acquire) >= _enqueuepos.load(std::memory_order_acquire);
+		}
+
+		// Approximate number of queued values while producers and consumers are running
+		size_t size() const
+		{
+			size_t dequeued = _dequeuepos.load(std::memory_order_acquire);
+			size_t enqueued = _enqueuepos.load(std::memory_order_acquire);
+
+			return enqueued > dequeued ? enqueued - dequeued : 0;
+		}
+
+		// Values rejected ( FAIL ) or discarded ( DROP_OLDEST ) because the queue was full
+		uint64_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+	};
+
+	struct dispatch_stats
+	{
+		size_t queued{ 0 }; // values waiting for the handler
+		uint64_t delivered{ 0 };
+		uint64_t dropped{ 0 }; // lost to the full queue policy
+		double lastlagms{ 0 }; // time between push and the start of the handler, last value
+		double maxlagms{ 0 };
+	};
+
+	// Bounded queue with its own consumer thread, values are handed to the handler in push order.
+	// Used to isolate a slow consumer: it only ever delays its own queue
+	template<typename T>
+	class dispatch_channel
+	{
+	private:
+		struct Item
+		{
+			T value;
+			std::chrono::steady_clock::time_point queued;
+		};
+
+		std::function<void(T&)> _handler;
+		std::function<void(std::vector<T>&)> _batchhandler;
+		size_t _maxbatch{ 1 };
+		std::chrono::microseconds _linger{ 0 };
+		lockfree_queue<Item> _queue;
+		std::atomic<uint64_t> _pushed{ 0 }; // counted before the value is queued, idle() compares it to delivered + dropped
+		std::atomic<uint64_t> _delivered{ 0 }; // counted once the handler returned
+		std::atomic<int64_t> _lastlagus{ 0 };
+		std::atomic<int64_t> _maxlagus{ 0 };
+		std::atomic<bool> _stopped{ false };
+		std::thread _thread; // last member, the thread starts once everything else is constructed
+
+		void recordlag(const Item& item_)
+		{
+			int64_t lagus = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - item_.queued).count();
+			_lastlagus.store(lagus, std::memory_order_relaxed);
+			if (lagus > _maxlagus.load(std::memory_order_relaxed))
+				_maxlagus.store(lagus, std::memory_order_relaxed); // single writer, no CAS needed
+		}
+
+		void run()
+		{
+			Item item;
+			std::vector<T> batch;
+
+			while (true)
+			{
+				_queue.wait_and_pop(item);
+
+				if (_stopped)
+					return;
+
+				recordlag(item);
+
+				if (!_batchhandler)
+				{
+					_handler(item.value);
+					item.value = T();
+
+					_delivered.fetch_add(1, std::memory_order_release);
+					continue;
+				}
+
+				// drain up to _maxbatch values, waiting at most _linger for the batch to fill up
+				batch.push_back(std::move(item.value));
+				auto deadline = std::chrono::steady_clock::now() + _linger;
+
+				while (batch.size() < _maxbatch && !_stopped)
+				{
+					if (_queue.try_pop(item))
+					{
+						batch.push_back(std::move(item.value));
+						continue;
+					}
+
+					auto now = std::chrono::steady_clock::now();
+					if (now >= deadline)
+						break;
+
+					std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(deadline - now, std::chrono::microseconds(100)));
+				}
+
+				_batchhandler(batch);
+
+				_delivered.fetch_add(batch.size(), std::memory_order_release);
+				batch.clear();
+			}
+		}
+
+	public:
+		dispatch_channel(size_t capacity_, QueueFullPolicy policy_, std::function<void(T&)> handler_) :
+			_handler(std::move(handler_)),
+			_queue(capacity_, policy_),
+			_thread(&dispatch_channel::run, this)
+		{}
+
+		// Batch mode, the handler gets up to maxbatch_ values at once. After the first value it waits at most
+		// linger_ for more to arrive, so a trickle of values still gets delivered with bounded latency
+		dispatch_channel(size_t capacity_, QueueFullPolicy policy_, std::function<void(std::vector<T>&)> batchhandler_,
+			size_t maxbatch_, std::chrono::microseconds linger_) :
+			_batchhandler(std::move(batchhandler_)),
+			_maxbatch(std::max<size_t>(1, maxbatch_)),
+			_linger(linger_),
+			_queue(capacity_, policy_),
+			_thread(&dispatch_channel::run, this)
+		{}
+
+		dispatch_channel(const dispatch_channel&) = delete;
+		dispatch_channel& operator=(const dispatch_channel&) = delete;
+
+		~dispatch_channel()
+		{
+			stop();
+		}
+
+		bool push(T value_)
+		{
+			// a rejected value is counted as dropped by the queue
+			_pushed.fetch_add(1, std::memory_order_acq_rel);
+			return _queue.push(Item{ std::move(value_), std::chrono::steady_clock::now() });
+		}
+
+		// True when every value pushed was delivered or dropped ( or the channel stopped ), values popped but still
+		// in the handler count as pending. delivered and dropped are read before pushed: both only follow their push, so the sum can only
+		// reach pushed once nothing is outstanding
+		bool idle() const
+		{
+			if (_stopped)
+				return true; // nothing more is delivered, what is queued is dropped
+
+			uint64_t done = _delivered.load(std::memory_order_acquire) + _queue.dropped();
+
+			return done >= _pushed.load(std::memory_order_acquire);
+		}
+
+		dispatch_stats stats() const
+		{
+			dispatch_stats stats;
+
+			stats.queued = _queue.size();
+			stats.delivered = _delivered.load(std::memory_order_relaxed);
+			stats.dropped = _queue.dropped();
+			stats.lastlagms = _lastlagus.load(std::memory_order_relaxed) / 1000.0;
+			stats.maxlagms = _maxlagus.load(std::memory_order_relaxed) / 1000.0;
+
+			return stats;
+		}
+
+		// Stops the thread after the handler call in progress, values still queued are dropped.
+		// Must not be called from the handler
+		void stop()
+		{
+			if (_stopped.exchange(true))
+				return;
+
+			_queue.stop();
+
+			if (_thread.joinable())
+				_thread.join();
+		}
+	};
+
+	// Worker threads consuming a fixed set of lanes, one lockfree_queue per lane. Items of one lane are
+	// handled in push order by one worker at a time, so routing items by key gives per key ordering no matter
+	// how many workers run. Lanes are spread over the running workers ( lane % workers ) and the worker count
+	// can change at runtime, a per lane consumer mutex hands a lane over from one worker to the next.
+	template<typename T>
+	class keyed_worker_pool
+	{
+	public:
+		using Handler = std::function<void(T&)>;
+		using ThreadInit = std::function<void(size_t worker_)>; // runs first on every worker thread ( e.g. to pin it )
+
+	private:
+		static size_t constexpr BURST = 64; // items handled from one lane before moving to the next
+		static unsigned int constexpr IDLEWAITMS = 10; // bound on the sleep of an idle worker, covers lane hand over
+
+		struct alignas(64) Lane
+		{
+			lockfree_queue<T> queue;
+			std::mutex consumer;
+
+			Lane(size_t capacity_, QueueFullPolicy policy_) : queue(capacity_, policy_)
+			{}
+		};
+
+		struct alignas(64) Worker
+		{
+			std::mutex mut;
+			std::condition_variable cond;
+			std::atomic<bool> sleeping{ false };
+			std::thread thread;
+		};
+
+		Handler _handler;
+		ThreadInit _threadinit;
+		std::vector<std::unique_ptr<Lane>> _lanes;
+		std::vector<std::unique_ptr<Worker>> _workers; // one slot per lane, the first _active ones are running
+		std::atomic<size_t> _active{ 0 };
+		std::atomic<bool> _done{ false };
+		std::mutex _resizemutex;
+		std::atomic<uint64_t> _pushed{ 0 }; // counted before the item is queued, see idle()
+		std::atomic<uint64_t> _handled{ 0 }; // counted once the handler returned
+
+		void wake(size_t worker_)
+		{
+			std::atomic_thread_fence(std::memory_order_seq_cst); // pairs with the fence before the worker sleeps
+			Worker& worker = *_workers[worker_];
+
+			if (worker.sleeping.load(std::memory_order_relaxed))
+			{
+				std::lock_guard<std::mutex> lk(worker.mut);
+				worker.cond.notify_one();
+			}
+		}
+
+		void wakeall()
+		{
+			for (auto& worker : _workers)
+			{
+				std::lock_guard<std::mutex> lk(worker->mut);
+				worker->cond.notify_one();
+			}
+		}
+
+		bool haswork(size_t worker_, size_t active_) const
+		{
+			for (size_t lane = worker_; lane < _lanes.size(); lane += active_)
+			{
+				if (!_lanes[lane]->queue.empty())
+					return true;
+			}
+
+			return false;
+		}
+
+		void run(size_t worker_)
+		{
+			if (_threadinit)
+				_threadinit(worker_);
+
+			T item;
+			Worker& worker = *_workers[worker_];
+
+			while (!_done)
+			{
+				size_t active = _active.load();
+
+				if (worker_ >= active)
+					return; // pool shrank, remaining workers take over our lanes
+
+				bool didwork = false;
+
+				for (size_t lane = worker_; lane < _lanes.size(); lane += active)
+				{
+					std::unique_lock<std::mutex> lk(_lanes[lane]->consumer, std::try_to_lock);
+
+					if (!lk.owns_lock())
+						continue; // previous owner still finishing an item, retry next round
+
+					for (size_t ii = 0; ii < BURST && _lanes[lane]->queue.try_pop(item); ++ii)
+					{
+						_handler(item);
+						_handled.fetch_add(1, std::memory_order_release);
+						didwork = true;
+					}
+				}
+
+				if (didwork)
+					continue;
+
+				std::unique_lock<std::mutex> lk(worker.mut);
+				worker.sleeping = true;
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+
+				if (!_done && worker_ < _active && !haswork(worker_, _active))
+					worker.cond.wait_for(lk, std::chrono::milliseconds(IDLEWAITMS));
+
+				worker.sleeping = false;
+			}
+		}
+
+	public:
+		// lanes_ fixes the maximum number of workers, capacity_ is the queue capacity of every lane
+		keyed_worker_pool(size_t lanes_, size_t capacity_, QueueFullPolicy policy_, Handler handler_, ThreadInit threadinit_ = ThreadInit()) :
+			_handler(std::move(handler_)),
+			_threadinit(std::move(threadinit_))
+		{
+			lanes_ = std::max<size_t>(1, lanes_);
+
+			for (size_t ii = 0; ii < lanes_; ++ii)
+			{
+				_lanes.push_back(std::make_unique<Lane>(capacity_, policy_));
+				_workers.push_back(std::make_unique<Worker>());
+			}
+		}
+
+		keyed_worker_pool(const keyed_worker_pool&) = delete;
+		keyed_worker_pool& operator=(const keyed_worker_pool&) = delete;
+
+		~keyed_worker_pool()
+		{
+			stop();
+		}
+
+		size_t lanes() const { return _lanes.size(); }
+
+		size_t workers() const { return _active.load(); }
+
+		// Starts or stops workers until workers_ ( 1 .. lanes ) are running. Must not be called from the handler
+		void resize(size_t workers_)
+		{
+			std::lock_guard<std::mutex> lk(_resizemutex);
+
+			if (_done)
+				return;
+
+			workers_ = std::min(std::max<size_t>(1, workers_), _lanes.size());
+			size_t active = _active.load();
+
+			if (workers_ > active)
+			{
+				_active = workers_;
+
+				for (size_t ii = active; ii < workers_; ++ii)
+					_workers[ii]->thread = std::thread(&keyed_worker_pool::run, this, ii);
+			}
+			else if (workers_ < active)
+			{
+				_active = workers_;
+				wakeall();
+
+				for (size_t ii = workers_; ii < active; ++ii)
+					_workers[ii]->thread.join();
+			}
+		}
+
+		bool push(size_t lane_, T item_)
+		{
+			size_t lane = lane_ % _lanes.size();
+
+			_pushed.fetch_add(1, std::memory_order_acq_rel); // a rejected item is counted as dropped by its lane
+			bool ret = _lanes[lane]->queue.push(std::move(item_));
+
+			wake(lane % std::max<size_t>(1, _active.load()));
+
+			return ret;
+		}
+
+		bool empty() const
+		{
+			for (const auto& lane : _lanes)
+			{
+				if (!lane->queue.empty())
+					return false;
+			}
+
+			return true;
+		}
+
+		// True when every item pushed was handled or dropped ( or the pool stopped ), unlike empty() an item popped
+		// but still in the handler counts as pending. Same ordering argument as dispatch_channel::idle
+		bool idle() const
+		{
+			if (_done)
+				return true;
+
+			uint64_t done = _handled.load(std::memory_order_acquire);
+
+			for (const auto& lane : _lanes)
+				done += lane->queue.dropped();
+
+			return done >= _pushed.load(std::memory_order_acquire);
+		}
+
+		// Stops all workers, items still queued are dropped
+		void stop()
+		{
+			std::lock_guard<std::mutex> lk(_resizemutex);
+
+			_done = true;
+
+			for (auto& lane : _lanes)
+				lane->queue.stop();
+
+			wakeall();
+
+			for (auto& worker : _workers)
+			{
+				if (worker->thread.joinable())
+					worker->thread.join();
+			}
+		}
+	};
+
 	class join_threads
 	{
 		std::vector<std::thread>& _threads;
@@ -131,4 +745,28 @@ namespace Threading
 			}
 		}
 	};
+
+	// Runs fn_( chunk ) for every chunk 0 .. chunks_ - 1 on threads_ workers ( 0 = hardware concurrency ) pulling
+	// chunks from a shared counter, returns once every chunk is done
+	template <typename Fn>
+	void run_chunks(unsigned int threads_, size_t chunks_, Fn&& fn_)
+	{
+		if (threads_ == 0)
+			threads_ = std::max(1u, std::thread::hardware_concurrency());
+
+		threads_ = static_cast<unsigned int>(std::min<size_t>(threads_, chunks_));
+
+		std::atomic<size_t> nextchunk{ 0 };
+		std::vector<std::thread> workers;
+		join_threads joiner(workers);
+
+		for (unsigned int tt = 0; tt < threads_; ++tt)
+		{
+			workers.emplace_back([&nextchunk, chunks_, &fn_]()
+			{
+				for (size_t cc = nextchunk++; cc < chunks_; cc = nextchunk++)
+					fn_(cc);
+			});
+		}
+	}
 }
\ No newline at end of file
@@ -1,35 +1,170 @@
 #pragma once
 #include <iostream>
+#include <cstring>
 
 #include "Contact.h"
 #include "rapidjson\document.h"
+#include "rapidjson\reader.h"
+#include "rapidjson\istreamwrapper.h"
+#include "rapidjson\memorystream.h"
+#include "rapidjson\filereadstream.h"
+#include "rapidjson\writer.h"
+#include "rapidjson\stringbuffer.h"
+#include "mappedfile.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
 
 using namespace User;
 using namespace rapidjson;
 
-Contacts::Contacts(bool serverupdate_): _joiner(_threads), _done(false), _serverupdate(serverupdate_)
+static size_t NotifyLanes(const NotifyConfig& notify_)
+{
+	if (notify_.maxthreads != 0)
+		return std::max(notify_.maxthreads, notify_.threads);
+
+	return std::max<size_t>(notify_.threads, std::thread::hardware_concurrency());
+}
+
+static size_t NotifyLaneCapacity(const NotifyConfig& notify_)
+{
+	constexpr size_t MINLANECAPACITY = 1024;
+
+	return std::max(MINLANECAPACITY, notify_.queuecapacity / NotifyLanes(notify_));
+}
+
+Contacts::Contacts(bool serverupdate_, size_t shards_, const NotifyConfig& notify_, const StoreConfig& store_): _arena(shards_), _contactmap(shards_),
+	_firstindex(shards_), _lastindex(shards_), _phoneindex(shards_), _phonetrie(shards_), _nameindex(shards_), _fuzzyindex(shards_),
+	_done(false),
+	_notifycpus(notify_.cpus),
+	_notifypool(NotifyLanes(notify_), NotifyLaneCapacity(notify_), notify_.queuepolicy,
+		[this](ContactEventMsg& data_) { notifyObservers(data_); },
+		[this](size_t worker_) { PinNotifyThread(worker_); }),
+	_joiner(_threads), _serverupdate(serverupdate_)
 {
-	_observerlist.clear();
-	_eventqueue.clear();
+	_channels = std::make_shared<const ObserverChannels>();
+	_observerqueuecapacity = notify_.observerqueuecapacity;
+	_observerqueuepolicy = notify_.observerqueuepolicy;
+
+	std::cout << "\nNum threads: " << notify_.threads;
+	_notifypool.resize(notify_.threads);
 
-	StartNotifyThreads();
+	if (!store_.path.empty())
+		openStore(store_);
 
 	if (_serverupdate)
 		StartUpdateThread();
 }
 
+// Maps the store, its contacts are read in stripe by stripe when first needed ( loadStripe ) or by the hydrator
+void Contacts::openStore(const StoreConfig& store_)
+{
+	std::unique_ptr<MappedContactStore> store = std::make_unique<MappedContactStore>();
+
+	if (!store->open(store_.path, store_.stripes != 0 ? store_.stripes : _contactmap.shards()))
+	{
+		_storefailed = true;
+		return;
+	}
+
+	_store = std::move(store);
+
+	if (store_.preload)
+	{
+		_hydrator = std::thread([this]()
+		{
+			run_chunks(0, _store->stripes(), [this](size_t stripe_)
+			{
+				if (!_done)
+					loadStripe(stripe_);
+			});
+		});
+	}
+}
+
+// Adds the contacts of a stripe to the map and indexes, without logging, writing them back or notifying
+void Contacts::loadStripe(size_t stripe_)
+{
+	_store->load(stripe_, [this](size_t stripe_)
+	{
+		std::vector<ContactRecord> records;
+
+		_store->foreach(stripe_, [this, &records](std::string_view first_, std::string_view last_, std::string_view phone_)
+		{
+			records.push_back(_arena.make(first_, last_, phone_));
+		});
+
+		std::vector<ContactView> keys;
+		keys.reserve(records.size());
+
+		for (const auto& record : records)
+			keys.emplace_back(*record);
+
+		std::unique_ptr<bool[]> inserted(new bool[records.size()]);
+		_contactmap.insertbatch(keys.data(), records.data(), records.size(), inserted.get(),
+			[this](const ContactRecord& added_) { indexContact(added_); });
+	});
+}
+
+// Reads in every stripe not read yet, before an operation over all contacts. The stored contacts are the contacts
+// of the instance already, reading them in does not change it
+void Contacts::loadStore() const
+{
+	if (!_store)
+		return;
+
+	Contacts* self = const_cast<Contacts*>(this);
+
+	for (size_t ii = 0; ii < _store->stripes(); ++ii)
+		self->loadStripe(ii);
+}
+
+mapped_store_stats Contacts::storeStats() const
+{
+	mapped_store_stats stats;
+
+	if (_store)
+		stats = _store->stats();
+
+	stats.failed = stats.failed || _storefailed;
+	return stats;
+}
+
+bool Contacts::flushStore()
+{
+	return _store && _store->flush();
+}
+
 bool Contacts::addContact(const Contact& contact_)
 {
-	if (!isContactvalid(contact_))
+	char buffer[E164BUFFER];
+	std::string_view phone;
+
+	if (!isContactvalid(contact_) || !storedPhone(contact_.getphone(), buffer, phone))
 		return false;
 
-	bool ret = addtoContactMap(contact_);
+	ContactView key(contact_.getfirstname(), contact_.getlastname(), phone);
+
+	loadContact(key);
+
+	// the only copy of the attributes, shared from here on by the store and the notifications
+	ContactRecord record;
+
+	uint64_t logged = 0;
+	bool stored = true;
+	bool ret = addtoContactMap(key, [this, &contact_, phone, &record]() { return record = makeRecord(contact_, phone); }, logged, stored)
+		&& syncLog(logged) && stored;
 
 	if (ret)
 	{
 		// Write to notification thread queue about the contact Addition
 	//	std::cout << "\nContact: " << contact_.getfirstname() << " written to notification queue";
-		writetoNotificationQueue(contact_, ContactEvents::ADD);
+		writetoNotificationQueue(record, ContactEvents::ADD);
 	}
 
 	return ret;
@@ -43,215 +178,1330 @@ bool Contacts::isContactvalid(const Contact& contact_)
 	return true;
 }
 
+// Phone number stored for phone_: as given, or its E.164 form written to buffer_ ( E164BUFFER chars ) with phone
+// normalization on. Returns false if normalization is on and phone_ is not a valid number
+bool Contacts::storedPhone(const std::string& phone_, char* buffer_, std::string_view& stored_) const
+{
+	stored_ = phone_;
+
+	if (!_normalizephones.load(std::memory_order_relaxed))
+		return true;
+
+	size_t size = NormalizePhone(phone_, _defaultcountry.load(std::memory_order_relaxed), buffer_);
+
+	stored_ = std::string_view(buffer_, size);
+	return size != 0;
+}
+
 bool Contacts::updateContact(const Contact & oldcontact_, const Contact & newcontact_)
 {
+	char oldbuffer[E164BUFFER], newbuffer[E164BUFFER];
+	std::string_view oldphone, newphone;
+
 	if ( !isContactvalid(oldcontact_) || !isContactvalid(newcontact_) )
 		return false;
 
-	bool ret = updateContactMap(oldcontact_, newcontact_);
+	if (!storedPhone(oldcontact_.getphone(), oldbuffer, oldphone) || !storedPhone(newcontact_.getphone(), newbuffer, newphone))
+		return false;
+
+	ContactView oldview(oldcontact_.getfirstname(), oldcontact_.getlastname(), oldphone);
+	ContactRecord oldrecord;
+
+	loadContact(oldview);
+	loadContact(ContactView(newcontact_.getfirstname(), newcontact_.getlastname(), newphone));
+	uint64_t logged = 0;
+	bool stored = true;
+	bool ret = updateContactMap(oldview, ContactView(newcontact_.getfirstname(), newcontact_.getlastname(), newphone),
+		[this, &newcontact_, newphone]() { return makeRecord(newcontact_, newphone); }, oldrecord, logged, stored) && syncLog(logged) && stored;
 
 	if (ret)
 	{
 		// write to notification thread queue about old contact being updated
 		// It is easy to pass in new contact as well in ContactEventMsg struct but for simplicity
-		// right now just passing old contact
-		ContactEventMsg contactEvent(oldcontact_.getfirstname(), oldcontact_.getlastname(), oldcontact_.getphone(), ContactEvents::UPDATE);
-		_eventqueue.push(contactEvent);
+		// right now just passing old contact ( the record just removed from the store )
+		_notifypool.push(notifyLane(oldview), ContactEventMsg(std::move(oldrecord), ContactEvents::UPDATE));
+
+		compactIfDue();
 	}
 
 	return ret;
 }
 
-// Write to notification thread queue about the update
-void Contacts::writetoNotificationQueue(const Contact & contact_, ContactEvents event_)
+bool Contacts::removeContact(const Contact& contact_)
 {
-	bool notify = false;
+	char buffer[E164BUFFER];
+	std::string_view phone;
+
+	if (!isContactvalid(contact_) || !storedPhone(contact_.getphone(), buffer, phone))
+		return false;
+
+	ContactView key(contact_.getfirstname(), contact_.getlastname(), phone);
+	ContactRecord record;
+	uint64_t logged = 0;
+	bool stored = true;
+
+	loadContact(key);
 
-	if (!_observerseventlist.empty())
+	bool ret = _contactmap.erase(key, &record, [this, &logged, &stored](const ContactRecord& removed_)
 	{
-		if (_observerseventlist.find(event_) != _observerseventlist.end())
-			notify = true;
+		unindexContact(removed_);
+		logged = logRemoval(*removed_);
+		stored = storeContact(removed_.get(), nullptr);
+	}) && syncLog(logged) && stored;
+
+	if (ret)
+	{
+		writetoNotificationQueue(record, ContactEvents::REMOVE);
 	}
 
-	if (!_observerlist.empty())
+	return ret;
+}
+
+// Checked whenever the arena took a new chunk: frees the chunks without records and compacts once the bytes
+// left behind by updates outweigh the live ones
+void Contacts::compactIfDue()
+{
+	constexpr size_t MINCOMPACTBYTES = 16 * ContactArena::CHUNKSIZE; // not worth a pass over the store below
+
+	if (!_arena.compactdue())
+		return;
+
+	_arena.sweep();
+
+	arena_stats stats = _arena.stats();
+	size_t deadbytes = stats.bytes - stats.livebytes;
+
+	if (deadbytes > MINCOMPACTBYTES && deadbytes > stats.livebytes)
+		compactContactStorage();
+}
+
+size_t Contacts::compactContactStorage()
+{
+	std::unique_lock<std::mutex> lk(_compactmutex, std::try_to_lock);
+
+	if (!lk.owns_lock())
+		return 0; // another thread is compacting
+
+	std::unordered_set<const ArenaChunk*> sparse = _arena.sparsechunks();
+	std::vector<ContactRecord> moving;
+
+	if (!sparse.empty())
 	{
-		notify = true;
+		_contactmap.foreach([&sparse, &moving](const ContactView&, const ContactRecord& contact_)
+		{
+			if (sparse.count(contact_->chunk()) != 0)
+				moving.push_back(contact_);
+		});
 	}
 
-	if (notify)
+	size_t moved = 0;
+
+	for (const auto& record : moving)
 	{
-		ContactEventMsg contactEvent(contact_.getfirstname(), contact_.getlastname(), contact_.getphone(), event_);
-		_eventqueue.push(contactEvent);
+		ContactRecord copy = _arena.make(record->getfirstname(), record->getlastname(), record->getphone());
+		moved += relocateContact(record, copy);
 	}
+
+	// pending notifications and records handed out by lookups keep their chunk alive until released
+	moving.clear();
+	_arena.sweep();
+
+	return moved;
 }
 
-std::list<Contact> Contacts::listContacts() const
+// True if any observer is interested in the event
+bool Contacts::hasObservers(ContactEvents event_) const
 {
-	return contactLists();
+	for (const auto& channel : *observerChannels())
+	{
+		if (channel->wants(event_))
+			return true;
+	}
+
+	return false;
 }
 
-void Contacts::registerObserver(ContactObserver *observer_)
+// Pool lane of a contact, all events of one contact go through the same lane and are delivered in order
+size_t Contacts::notifyLane(const ContactView& contact_) const
 {
-	_observerlist.push_back(observer_);
+	uint64_t mixed = static_cast<uint64_t>(hash_contactview()(contact_)) * 0x9E3779B97F4A7C15ULL;
+
+	return static_cast<size_t>((mixed >> 32) % _notifypool.lanes());
 }
 
-void Contacts::unregisterObserver(ContactObserver * observer_)
+// Write to notification thread queue about the update
+void Contacts::writetoNotificationQueue(const ContactRecord& contact_, ContactEvents event_)
 {
-	auto it = std::find(_observerlist.begin(), _observerlist.end(), observer_);
-
-	if (it != _observerlist.end())
-		_observerlist.erase(it);
+	if (hasObservers(event_))
+		_notifypool.push(notifyLane(ContactView(*contact_)), ContactEventMsg(contact_, event_));
 }
 
-void Contacts::notifyObservers()
+std::vector<ContactAddResult> Contacts::addContacts(Span<const Contact> contacts_)
 {
-	while (!_done)
-	{
-		ContactEventMsg data{};
-		_eventqueue.wait_and_pop(data);
+	std::vector<ContactAddResult> results(contacts_.size(), ContactAddResult::INVALID);
+	std::vector<ContactView> keys;
+	std::vector<size_t> valididx;
+	std::unique_ptr<char[]> buffers(new char[contacts_.size() * E164BUFFER]); // stored phones the keys view
 
-		if (!_observerseventlist.empty())
-		{
-			if (_observerseventlist.find(data.getEvent()) != _observerseventlist.end())
-			{
-				for (const auto& obs : _observerseventlist[data.getEvent()])
-					obs();
-			}
-		}
+	valididx.reserve(contacts_.size());
+	keys.reserve(contacts_.size());
+	for (size_t ii = 0; ii < contacts_.size(); ++ii)
+	{
+		std::string_view phone;
 
-		if (!_observerlist.empty())
-		{
-			for (const auto& obs : _observerlist)
-			{
-				//std::cout << "\nIn Contacts event..";
+		if (!isContactvalid(contacts_[ii]) || !storedPhone(contacts_[ii].getphone(), buffers.get() + ii * E164BUFFER, phone))
+			continue;
 
-				if (data.getEvent() == ContactEvents::UPDATE)
-				{
-					obs->OnContactUpdated(Contact(data.getfirstname(), data.getlastname(), data.getphone()));
-				}
-				else if (data.getEvent() == ContactEvents::ADD)
-				{
-				//	std::cout << "\nIn Contacts event ADD.." << typeid(*obs).name();
-					obs->OnContactAdded(Contact(data.getfirstname(), data.getlastname(), data.getphone()));
-				}
-			}
-		}
+		valididx.push_back(ii);
+		keys.emplace_back(contacts_[ii].getfirstname(), contacts_[ii].getlastname(), phone);
 	}
+
+	// records are made only for the contacts that turn out new
+	auto make = [this, &contacts_, &valididx, &keys](size_t ii_) { return makeRecord(contacts_[valididx[ii_]], keys[ii_].getphone()); };
+
+	std::unique_ptr<bool[]> inserted(new bool[valididx.size()]);
+	size_t added = 0;
+	ContactAddResult addedresult = insertRecords(keys, make, inserted.get(), added) ? ContactAddResult::ADDED : ContactAddResult::FAILED;
+
+	for (size_t ii = 0; ii < valididx.size(); ++ii)
+		results[valididx[ii]] = inserted[ii] ? addedresult : ContactAddResult::DUPLICATE;
+
+	return results;
 }
 
-void Contacts::StartNotifyThreads()
+// Batched insert of keys_, the record of keys_[i] is made by make_( i ) under its shard lock once the key is known
+// to be new. inserted_[i] tells whether keys_[i] was added and added_ is increased by their number. The added records
+// reach the observers as batched ADD events. Returns false, without events, if the changes could not be persisted
+bool Contacts::insertRecords(const std::vector<ContactView>& keys_, const std::function<ContactRecord(size_t)>& make_, bool* inserted_,
+	size_t& added_)
 {
-	unsigned long const Hardwarethreads =
-		std::thread::hardware_concurrency();
-	static unsigned long Maxthreads = 1; // for scalability if there are millions of contacts/requests we can scale
-								   // by increasing the number of threads
-	unsigned long const num_threads =
-		std::min(Hardwarethreads != 0 ? Hardwarethreads : 2, Maxthreads);
+	std::vector<ContactRecord> records(keys_.size());
+	uint64_t logged = 0;
+	bool stored = true;
 
-	std::cout << "\nNum threads: " << num_threads;
-	for (unsigned long ii = 0; ii < num_threads; ++ii)
+	loadStore();
+
+	size_t added = _contactmap.insertbatchwith(keys_.data(), [&make_, &records](size_t ii_) { return records[ii_] = make_(ii_); }, keys_.size(), inserted_,
+		[this, &logged, &stored](const ContactRecord& added_)
 	{
-		try
-		{
-			_threads.push_back(std::thread(&Contacts::notifyObservers, this));
-		}
-		catch (...)
-		{
-			_done = true;
-			throw;
-		}
+		indexContact(added_);
+		logged = std::max(logged, logContact(nullptr, *added_));
+		stored = storeContact(nullptr, added_.get()) && stored;
+	});
+
+	added_ += added;
+
+	if (!syncLog(logged) || !stored) // one wait for the whole batch
+		return false;
+
+	if (added != 0 && hasObservers(ContactEvents::ADD))
+	{
+		// the records made, in input order
+		records.erase(std::remove(records.begin(), records.end(), nullptr), records.end());
+		notifyBatch(records, ContactEvents::ADD);
 	}
+
+	return true;
 }
 
-void Contacts::StartUpdateThread()
+// Queues records_ as batched events_, one batch per pool lane keeps the per contact ordering of the single contact events
+void Contacts::notifyBatch(const std::vector<ContactRecord>& records_, ContactEvents event_)
 {
-	try
+	if (records_.empty() || !hasObservers(event_))
+		return;
+
+	std::vector<std::shared_ptr<std::vector<ContactRecord>>> batches(_notifypool.lanes());
+
+	for (const auto& record : records_)
 	{
+		auto& batch = batches[notifyLane(ContactView(*record))];
+		if (!batch)
+			batch = std::make_shared<std::vector<ContactRecord>>();
 
-		_threads.push_back(std::thread(&Contacts::UpdateContactTimerInterval, this, getupdatetimer()));
+		batch->push_back(record);
 	}
-	catch (...)
+
+	for (size_t lane = 0; lane < batches.size(); ++lane)
 	{
-		_done = true;
-		throw;
+		if (batches[lane])
+			_notifypool.push(lane, ContactEventMsg(std::move(batches[lane]), event_)); // one queue push per lane
 	}
 }
 
-void Contacts::UpdateContactTimerInterval(unsigned int interval)
+std::list<Contact> Contacts::listContacts() const
 {
-	uint32_t ii = 0, prevpos = 0;
+	return contactLists();
+}
 
-	while (!_done && _serverupdate)
+std::vector<ContactRecord> Contacts::listContacts(ContactCursor& cursor_, size_t pagesize_, SortOrder order_) const
+{
+	return listPage(nullptr, cursor_, pagesize_, order_);
+}
+
+std::vector<ContactRecord> Contacts::findByLastNamePrefix(const std::string& prefix_, ContactCursor& cursor_, size_t pagesize_,
+	SortOrder order_) const
+{
+	return listPage(&prefix_, cursor_, pagesize_, order_);
+}
+
+// Scans the name index after the cursor ( or from the start of the last name prefix_ range ) and moves the cursor
+// past the returned page
+std::vector<ContactRecord> Contacts::listPage(const std::string* prefix_, ContactCursor& cursor_, size_t pagesize_, SortOrder order_) const
+{
+	std::vector<ContactRecord> contacts;
+
+	loadStore();
+
+	if (cursor_._end || pagesize_ == 0)
+		return contacts;
+
+	bool descending = (order_ == SortOrder::DESCENDING);
+	std::string bound;
+	ContactView after(cursor_._first, cursor_._last, cursor_._phone);
+
+	if (!cursor_._started && prefix_ != nullptr)
 	{
-			auto x = std::chrono::steady_clock::now() + std::chrono::milliseconds(interval);
-			std::this_thread::sleep_until(x);
+		// valid contacts have non empty names, so ( prefix, "", "" ) sorts just before the first contact of the range.
+		// Descending starts before ( next prefix, "", "" ), the next prefix is the prefix with its last byte incremented
+		bound = *prefix_;
+		if (descending)
+		{
+			while (!bound.empty() && static_cast<unsigned char>(bound.back()) == 0xFF)
+				bound.pop_back();
+			if (!bound.empty())
+				++bound.back();
+		}
 
-			ii = ii % _contactmap.size(); // avoid overflow of iterators
+		after = ContactView("", bound, "");
+	}
 
-			auto nextit = std::next(_contactmap.begin(), ii);
-			ii++;
+	bool fromstart = !cursor_._started && (prefix_ == nullptr || bound.empty());
+	bool more = false;
 
-			if (nextit != _contactmap.end())
-			{
-				Contact oldcontact(nextit->first);
-				
-				std::string first = oldcontact.getfirstname() + "XXX";
-				std::string phone = "+7323009261";
+	contacts.reserve(pagesize_);
+	_nameindex.scan(fromstart ? nullptr : &after, descending, [&](const ContactView& key_, const ContactRecord& contact_)
+	{
+		if (prefix_ != nullptr && key_.getlastname().compare(0, prefix_->size(), *prefix_) != 0)
+		{
+			if (descending ? key_.getlastname() < *prefix_ : key_.getlastname() > *prefix_)
+				return false; // past the prefix range
+			return true; // descending from the end of the index, not yet inside the range
+		}
 
-				Contact newcontact(first, oldcontact.getlastname(), phone);
+		if (contacts.size() == pagesize_)
+		{
+			more = true; // only peeked, belongs to the next page
+			return false;
+		}
 
-				bool ret = updateContactMap(oldcontact, newcontact );
+		contacts.push_back(contact_);
+		return true;
+	});
 
-				if (ret)
-				{
-					// Write to notification thread queue about the contact Update
-				//	std::cout << "\nContact: " << contact_.getfirstname() << " written to notification queue";
-					writetoNotificationQueue(oldcontact, ContactEvents::UPDATE);
-				}
-			}
+	cursor_._started = true;
+	cursor_._end = !more;
+
+	if (!contacts.empty())
+	{
+		cursor_._first = contacts.back()->getfirstname();
+		cursor_._last = contacts.back()->getlastname();
+		cursor_._phone = contacts.back()->getphone();
 	}
+
+	return contacts;
 }
 
-bool Contacts::loadContactsFromJSON(const std::string & str_, size_t& count_)
+std::vector<ContactRecord> Contacts::findByFirstName(const std::string& first_) const
 {
-	rapidjson::Document document;
-	document.Parse(str_.c_str());
+	std::vector<ContactRecord> contacts;
+	loadStore();
+	_firstindex.find(first_, contacts);
 
-	if (str_.empty())
-		return false;
+	return contacts;
+}
 
-	if (!document.IsArray()) {
-		return false;
-	}
+std::vector<ContactRecord> Contacts::findByLastName(const std::string& last_) const
+{
+	std::vector<ContactRecord> contacts;
+	loadStore();
+	_lastindex.find(last_, contacts);
+
+	return contacts;
+}
+
+std::vector<ContactRecord> Contacts::findByPhone(const std::string& phone_) const
+{
+	char buffer[E164BUFFER];
+	std::string_view phone;
+	std::vector<ContactRecord> contacts;
+
+	if (!storedPhone(phone_, buffer, phone))
+		phone = phone_; // not a valid number, can only match contacts stored before normalization was enabled
+
+	loadStore();
+	_phoneindex.find(PhoneKey(phone), contacts);
+
+	return contacts;
+}
+
+std::vector<ContactRecord> Contacts::findByPhonePrefix(const std::string& prefix_, size_t limit_) const
+{
+	std::vector<ContactRecord> contacts;
+	loadStore();
+	_phonetrie.find(prefix_, limit_, contacts);
+
+	return contacts;
+}
+
+std::vector<FuzzyMatch> Contacts::fuzzySearch(const std::string& query_, unsigned int maxdistance_, size_t limit_) const
+{
+	std::vector<FuzzyMatch> matches;
+	loadStore();
+
+	for (auto& match : _fuzzyindex.search(query_, maxdistance_, limit_))
+		matches.push_back(FuzzyMatch{ std::move(match.second), match.first });
+
+	return matches;
+}
+
+void Contacts::registerObserver(ContactObserver *observer_)
+{
+	addChannel(std::make_shared<ObserverChannel>(observer_, _observerqueuecapacity, _observerqueuepolicy));
+}
+
+void Contacts::unregisterObserver(ContactObserver * observer_)
+{
+	removeChannels([observer_](const ObserverChannel& channel_) { return channel_.observer() == observer_; });
+}
+
+void Contacts::addChannel(std::shared_ptr<ObserverChannel> channel_)
+{
+	std::lock_guard<std::mutex> lk(_registermutex);
+
+	auto channels = std::make_shared<ObserverChannels>(*_channels);
+	channels->push_back(std::move(channel_));
+
+	std::atomic_store(&_channels, std::shared_ptr<const ObserverChannels>(std::move(channels)));
+}
+
+void Contacts::removeChannels(const std::function<bool(const ObserverChannel&)>& match_)
+{
+	ObserverChannels removed;
 
-	std::vector<std::string> customer;
-	Contact customerid;
-	for (Value::ConstValueIterator itr = document.Begin(); itr != document.End(); ++itr)
 	{
-		const Value& obj = *itr;
-		customer.clear();
-		for (Value::ConstMemberIterator it = obj.MemberBegin(); it != obj.MemberEnd(); ++it)
+		std::lock_guard<std::mutex> lk(_registermutex);
+
+		auto channels = std::make_shared<ObserverChannels>();
+		for (const auto& channel : *_channels)
 		{
-			if (it->value.IsString())
-			{
-				customer.push_back(it->value.GetString());
-				
-	//			std::cout << "\nvalue of member " << it->name.GetString() << " is " << it->value.GetString();
-			}
+			if (match_(*channel))
+				removed.push_back(channel);
+			else
+				channels->push_back(channel);
 		}
-		
-		if ( customer.size() != MAXATTRIBUTES )
-			continue;
 
-		customerid.setfirstname(customer[CustomerAttr::FIRST]);
-		customerid.setlastname(customer[CustomerAttr::LAST]);
-		customerid.setphonenumber(customer[CustomerAttr::PHONE]);
+		std::atomic_store(&_channels, std::shared_ptr<const ObserverChannels>(std::move(channels)));
+	}
 
-		bool ret = addContact(customerid);
+	// waits for a callback in progress, no callback reaches the observer afterwards
+	for (const auto& channel : removed)
+		channel->stop();
+}
 
-		if (ret)
-			count_++;
+void Contacts::registerObserver(ContactBatchObserver* observer_, const BatchConfig& batch_)
+{
+	addChannel(std::make_shared<ObserverChannel>(observer_, batch_, _observerqueuecapacity, _observerqueuepolicy));
+}
+
+void Contacts::unregisterObserver(ContactBatchObserver* observer_)
+{
+	removeChannels([observer_](const ObserverChannel& channel_) { return channel_.observer() == observer_; });
+}
+
+bool Contacts::getObserverStats(const ContactObserver* observer_, dispatch_stats& stats_) const
+{
+	return observerStats(observer_, stats_);
+}
+
+bool Contacts::getObserverStats(const ContactBatchObserver* observer_, dispatch_stats& stats_) const
+{
+	return observerStats(observer_, stats_);
+}
+
+bool Contacts::observerStats(const void* observer_, dispatch_stats& stats_) const
+{
+	for (const auto& channel : *observerChannels())
+	{
+		if (channel->observer() == observer_)
+		{
+			stats_ = channel->stats();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool Contacts::notificationsPending() const
+{
+	if (!_notifypool.idle())
+		return true;
+
+	for (const auto& channel : *observerChannels())
+	{
+		if (!channel->idle())
+			return true;
+	}
+
+	return false;
+}
+
+// Runs on the notification pool, fans the event out to the channel of every interested observer. The channels
+// get copies of the event which share its contact record, each observer then gets it delivered in order on its own thread
+void Contacts::notifyObservers(ContactEventMsg& data)
+{
+	for (const auto& channel : *observerChannels())
+	{
+		if (channel->wants(data.getEvent()))
+			channel->push(data);
+	}
+}
+
+// Runs on the observer's channel thread
+void ObserverChannel::deliver(const ContactEventMsg& data_)
+{
+	if (_function)
+	{
+		// a batch counts as one event per contact for the event observers
+		size_t events = data_.isbatch() ? data_.getbatch().size() : 1;
+
+		for (size_t ii = 0; ii < events; ++ii)
+			_function();
+
+		return;
+	}
+
+	if (data_.getEvent() == ContactEvents::UPDATE)
+	{
+		_observer->OnContactUpdated(ContactView(data_.getcontact()));
+	}
+	else if (data_.getEvent() == ContactEvents::ADD && data_.isbatch())
+	{
+		_observer->OnContactsAdded(data_.getbatch());
+	}
+	else if (data_.getEvent() == ContactEvents::ADD)
+	{
+	//	std::cout << "\nIn Contacts event ADD.." << typeid(*_observer).name();
+		_observer->OnContactAdded(ContactView(data_.getcontact()));
+	}
+	else if (data_.getEvent() == ContactEvents::REMOVE && data_.isbatch())
+	{
+		_observer->OnContactsRemoved(data_.getbatch());
+	}
+	else if (data_.getEvent() == ContactEvents::REMOVE)
+	{
+		_observer->OnContactRemoved(ContactView(data_.getcontact()));
+	}
+}
+
+// Runs on a ContactBatchObserver's channel thread with everything drained from its queue. Consecutive events of
+// the same kind become one callback ( at most _maxbatch contacts ), the views point into the queued events
+void ObserverChannel::deliverbatch(std::vector<ContactEventMsg>& events_)
+{
+	ContactEvents current = ContactEvents::NONE;
+
+	for (const auto& data : events_)
+	{
+		if (data.getEvent() != current)
+		{
+			flushviews(current);
+			current = data.getEvent();
+		}
+
+		if (data.isbatch())
+		{
+			for (const auto& contact : data.getbatch())
+			{
+				_views.emplace_back(*contact);
+				if (_views.size() == _maxbatch)
+					flushviews(current);
+			}
+		}
+		else
+		{
+			_views.emplace_back(data.getcontact());
+			if (_views.size() == _maxbatch)
+				flushviews(current);
+		}
+	}
+
+	flushviews(current);
+}
+
+void ObserverChannel::flushviews(ContactEvents event_)
+{
+	if (_views.empty())
+		return;
+
+	if (event_ == ContactEvents::ADD)
+		_batchobserver->OnContactsAdded(Span<const ContactView>(_views.data(), _views.size()));
+	else if (event_ == ContactEvents::UPDATE)
+		_batchobserver->OnContactsUpdated(Span<const ContactView>(_views.data(), _views.size()));
+	else if (event_ == ContactEvents::REMOVE)
+		_batchobserver->OnContactsRemoved(Span<const ContactView>(_views.data(), _views.size()));
+
+	_views.clear();
+}
+
+// Pins notification thread worker_ to its configured cpu, no-op without NotifyConfig::cpus
+void Contacts::PinNotifyThread(size_t worker_)
+{
+	if (_notifycpus.empty())
+		return;
+
+	unsigned int cpu = _notifycpus[worker_ % _notifycpus.size()];
+
+#ifdef _WIN32
+	SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << cpu);
+#else
+	cpu_set_t cpuset;
+	CPU_ZERO(&cpuset);
+	CPU_SET(cpu, &cpuset);
+	pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+#endif
+}
+
+void Contacts::StartUpdateThread()
+{
+	try
+	{
+
+		_threads.push_back(std::thread(&Contacts::UpdateContactTimerInterval, this, getupdatetimer()));
+	}
+	catch (...)
+	{
+		_done = true;
+		throw;
+	}
+}
+
+void Contacts::UpdateContactTimerInterval(unsigned int interval)
+{
+	uint32_t ii = 0, prevpos = 0;
+
+	loadStore(); // nth picks among every contact
+
+	while (!_done && _serverupdate)
+	{
+			auto x = std::chrono::steady_clock::now() + std::chrono::milliseconds(interval);
+			std::this_thread::sleep_until(x);
+
+			if (_done)
+				break; // the instance is being destroyed
+
+			ContactRecord oldcontact;
+
+			if (_contactmap.nth(ii++, oldcontact)) // nth wraps around the size, no overflow of iterators
+			{
+				std::string first = std::string(oldcontact->getfirstname()) + "XXX";
+				std::string phone = "+7323009261";
+
+				ContactRecord oldrecord;
+				uint64_t logged = 0;
+				bool stored = true;
+
+				bool ret = updateContactMap(ContactView(*oldcontact), ContactView(first, oldcontact->getlastname(), phone),
+					[this, &first, &oldcontact, &phone]() { return _arena.make(first, oldcontact->getlastname(), phone); }, oldrecord, logged, stored)
+					&& syncLog(logged) && stored;
+
+				if (ret)
+				{
+					// Write to notification thread queue about the contact Update
+				//	std::cout << "\nContact: " << contact_.getfirstname() << " written to notification queue";
+					writetoNotificationQueue(oldrecord, ContactEvents::UPDATE);
+
+					compactIfDue();
+				}
+			}
+	}
+}
+
+bool Contacts::loadContactsFromJSON(const std::string & str_, size_t& count_)
+{
+	rapidjson::Document document;
+	document.Parse(str_.c_str());
+
+	if (str_.empty())
+		return false;
+
+	if (!document.IsArray()) {
+		return false;
+	}
+
+	std::vector<std::string> customer;
+	Contact customerid;
+	for (Value::ConstValueIterator itr = document.Begin(); itr != document.End(); ++itr)
+	{
+		const Value& obj = *itr;
+		customer.clear();
+		for (Value::ConstMemberIterator it = obj.MemberBegin(); it != obj.MemberEnd(); ++it)
+		{
+			if (it->value.IsString())
+			{
+				customer.push_back(it->value.GetString());
+				
+	//			std::cout << "\nvalue of member " << it->name.GetString() << " is " << it->value.GetString();
+			}
+		}
+		
+		if ( customer.size() != MAXATTRIBUTES )
+			continue;
+
+		customerid.setfirstname(customer[CustomerAttr::FIRST]);
+		customerid.setlastname(customer[CustomerAttr::LAST]);
+		customerid.setphonenumber(customer[CustomerAttr::PHONE]);
+
+		bool ret = addContact(customerid);
+
+		if (ret)
+			count_++;
+	}
+
+	return !writesFailed();
+}
+
+// SAX handler used by the streaming loaders. It only keeps the attributes of the object currently being
+// parsed, a contact is added as soon as its object closes so memory stays constant regardless of the input size.
+// Same rules as the DOM loader: top level must be an array, an object must have exactly MAXATTRIBUTES direct
+// string members which are taken in order as first name, last name and phone number.
+// Every complete contact is handed to sink_, a callable taking const Contact&.
+template <typename Sink>
+class ContactSAXHandler : public BaseReaderHandler<UTF8<>, ContactSAXHandler<Sink>>
+{
+private:
+	Sink& _sink;
+	size_t _depth; // 1 = inside top level array, 2 = inside a contact object
+	size_t _strings{ 0 }; // direct string members seen in the current object
+	std::string _attr[MAXATTRIBUTES];
+	Contact _customerid;
+
+public:
+	// depth_ 1 parses bare contact objects ( a slice of the top level array or NDJSON lines )
+	explicit ContactSAXHandler(Sink& sink_, size_t depth_ = 0) : _sink(sink_), _depth(depth_)
+	{}
+
+	bool StartArray()
+	{
+		++_depth;
+		return true;
+	}
+
+	bool EndArray(SizeType)
+	{
+		--_depth;
+		return true;
+	}
+
+	bool StartObject()
+	{
+		if (_depth == 0)
+			return false; // top level must be an array
+
+		if (++_depth == 2)
+			_strings = 0;
+
+		return true;
+	}
+
+	bool Key(const char*, SizeType, bool)
+	{
+		return true; // member names are ignored, attributes are positional
+	}
+
+	bool String(const char* str_, SizeType length_, bool)
+	{
+		if (_depth == 0)
+			return false;
+
+		if (_depth == 2)
+		{
+			if (_strings < MAXATTRIBUTES)
+				_attr[_strings].assign(str_, length_); // reuses the capacity of the previous contact
+			++_strings;
+		}
+
+		return true;
+	}
+
+	bool EndObject(SizeType)
+	{
+		if (_depth-- != 2 || _strings != MAXATTRIBUTES)
+			return true;
+
+		_customerid.setfirstname(_attr[CustomerAttr::FIRST]);
+		_customerid.setlastname(_attr[CustomerAttr::LAST]);
+		_customerid.setphonenumber(_attr[CustomerAttr::PHONE]);
+
+		_sink(_customerid);
+
+		return true;
+	}
+
+	bool Default()
+	{
+		return _depth != 0; // scalars at top level are not a contact array
+	}
+};
+
+bool Contacts::loadContactsFromStream(std::istream& stream_, size_t& count_)
+{
+	char buffer[65536];
+	IStreamWrapper is(stream_, buffer, sizeof(buffer));
+	auto sink = [this, &count_](const Contact& contact_) { if (addContact(contact_)) count_++; };
+	ContactSAXHandler<decltype(sink)> handler(sink);
+	Reader reader;
+
+	return !reader.Parse(is, handler).IsError() && !writesFailed();
+}
+
+bool Contacts::loadContactsFromFile(const std::string& path_, size_t& count_)
+{
+	auto sink = [this, &count_](const Contact& contact_) { if (addContact(contact_)) count_++; };
+	ContactSAXHandler<decltype(sink)> handler(sink);
+	Reader reader;
+	MappedFile file;
+
+	if (file.open(path_))
+	{
+		// Parse straight out of the mapping. ParseInsitu is not used since it writes string terminators
+		// into the input, which would copy on write nearly every page of a private mapping
+		MemoryStream ms(file.data(), file.size());
+		return !reader.Parse(ms, handler).IsError() && !writesFailed();
+	}
+
+	// not a regular file ( pipe, device ) or mapping failed, stream it through a fixed size buffer
+	FILE* fp = nullptr;
+#ifdef _WIN32
+	if (fopen_s(&fp, path_.c_str(), "rb") != 0)
+		fp = nullptr;
+#else
+	fp = fopen(path_.c_str(), "rb");
+#endif
+
+	if (fp == nullptr)
+		return false;
+
+	char buffer[65536];
+	FileReadStream is(fp, buffer, sizeof(buffer));
+	bool ret = !reader.Parse(is, handler).IsError();
+
+	fclose(fp);
+
+	return ret && !writesFailed();
+}
+
+// Parses a run of contact objects separated by commas or whitespace, a slice of a top level array or NDJSON lines
+static bool ParseContactChunk(const char* begin_, const char* end_, std::vector<Contact>& contacts_)
+{
+	auto sink = [&contacts_](const Contact& contact_) { contacts_.push_back(contact_); };
+	ContactSAXHandler<decltype(sink)> handler(sink, 1);
+	Reader reader;
+	MemoryStream ms(begin_, static_cast<size_t>(end_ - begin_));
+
+	while (true)
+	{
+		while (ms.Peek() == ',' || ms.Peek() == ' ' || ms.Peek() == '\n' || ms.Peek() == '\r' || ms.Peek() == '\t')
+			ms.Take();
+
+		if (ms.Tell() == static_cast<size_t>(end_ - begin_))
+			return true;
+
+		if (ms.Peek() != '{')
+			return false;
+
+		if (reader.Parse<kParseStopWhenDoneFlag>(ms, handler).IsError())
+			return false;
+	}
+}
+
+static bool IsJSONSpace(char c_)
+{
+	return c_ == ' ' || c_ == '\n' || c_ == '\r' || c_ == '\t';
+}
+
+// Moves p_ forward to the start of the next contact object. NDJSON splits after a newline, which cannot occur inside
+// a JSON string. Arrays split at "}" "," "{" ( whitespace allowed ), the chunk parse rejects the rare false match
+// inside a string and the caller then falls back to a sequential parse
+static const char* NextObjectBoundary(const char* p_, const char* end_, bool ndjson_)
+{
+	const char* start = p_;
+
+	while (p_ < end_)
+	{
+		const char* hit = static_cast<const char*>(memchr(p_, ndjson_ ? '\n' : ',', static_cast<size_t>(end_ - p_)));
+
+		if (hit == nullptr)
+			return end_;
+
+		p_ = hit + 1;
+
+		if (ndjson_)
+			return p_;
+
+		const char* prev = hit;
+		while (prev > start && IsJSONSpace(prev[-1]))
+			--prev;
+
+		const char* nextobj = p_;
+		while (nextobj < end_ && IsJSONSpace(*nextobj))
+			++nextobj;
+
+		if (prev > start && prev[-1] == '}' && nextobj < end_ && *nextobj == '{')
+			return nextobj;
+	}
+
+	return end_;
+}
+
+// Splits a top level JSON array or NDJSON at object boundaries and parses the pieces on threads_ workers into
+// chunks_. Returns false if the input is malformed, chunks_ then holds the contacts parsed before the error
+static bool ParseContactsParallel(const char* data_, size_t size_, unsigned int threads_, std::vector<std::vector<Contact>>& chunks_)
+{
+	constexpr size_t MINCHUNK = 1 << 16; // smaller chunks are not worth a worker
+	const char* begin = data_;
+	const char* end = data_ + size_;
+
+	while (begin < end && IsJSONSpace(*begin))
+		++begin;
+	while (end > begin && (IsJSONSpace(end[-1]) || end[-1] == '\0'))
+		--end;
+
+	if (begin == end)
+		return false;
+
+	bool ndjson = (*begin == '{');
+
+	if (!ndjson)
+	{
+		if (*begin != '[' || end[-1] != ']')
+			return false; // top level must be an array of contacts
+
+		++begin;
+		--end;
+	}
+
+	if (threads_ == 0)
+		threads_ = std::max(1u, std::thread::hardware_concurrency());
+
+	size_t numchunks = std::max<size_t>(1, std::min<size_t>(threads_ * 4, static_cast<size_t>(end - begin) / MINCHUNK));
+
+	std::vector<const char*> bounds{ begin };
+	for (size_t ii = 1; ii < numchunks; ++ii)
+	{
+		const char* target = begin + (end - begin) * ii / numchunks;
+		bounds.push_back(NextObjectBoundary(std::max(target, bounds.back()), end, ndjson));
+	}
+	bounds.push_back(end);
+
+	std::atomic<bool> parsed{ true };
+
+	chunks_.assign(numchunks, std::vector<Contact>());
+	run_chunks(threads_, numchunks, [&](size_t chunk_)
+	{
+		if (!ParseContactChunk(bounds[chunk_], bounds[chunk_ + 1], chunks_[chunk_]))
+			parsed = false;
+	});
+
+	if (!parsed)
+	{
+		// a split landed inside a string or the input is malformed, parse it as one chunk
+		chunks_.assign(1, std::vector<Contact>());
+		return ParseContactChunk(begin, end, chunks_[0]);
 	}
 
 	return true;
-}
\ No newline at end of file
+}
+
+bool Contacts::parseContactsParallel(const char* data_, size_t size_, size_t& count_, unsigned int threads_)
+{
+	std::vector<std::vector<Contact>> chunks;
+	std::atomic<size_t> added{ 0 };
+	std::atomic<bool> durable{ true };
+
+	// phase 1: parse every chunk, nothing is inserted until the whole input parsed
+	bool parsed = ParseContactsParallel(data_, size_, threads_, chunks);
+
+	// phase 2: batched insert, one lock acquisition per shard and one ADD event per chunk
+	run_chunks(threads_, chunks.size(), [&](size_t chunk_)
+	{
+		std::vector<ContactAddResult> results = addContacts(chunks[chunk_]);
+
+		added += std::count(results.begin(), results.end(), ContactAddResult::ADDED);
+
+		if (std::find(results.begin(), results.end(), ContactAddResult::FAILED) != results.end())
+			durable = false;
+
+		std::vector<Contact>().swap(chunks[chunk_]);
+	});
+
+	count_ += added;
+
+	return parsed && durable;
+}
+
+bool Contacts::loadContactsParallel(const std::string& str_, size_t& count_, unsigned int threads_)
+{
+	return parseContactsParallel(str_.data(), str_.size(), count_, threads_);
+}
+
+bool Contacts::loadContactsFromFileParallel(const std::string& path_, size_t& count_, unsigned int threads_)
+{
+	MappedFile file;
+
+	if (!file.open(path_))
+		return loadContactsFromFile(path_, count_); // pipes cannot be split, stream them sequentially
+
+	return parseContactsParallel(file.data(), file.size(), count_, threads_);
+}
+
+// Input contacts of a sync that belong to one shard of the store
+struct SyncShard
+{
+	std::vector<ContactView> keys;
+	std::vector<size_t> hashes;
+	std::vector<const Contact*> contacts;
+};
+
+bool Contacts::syncContacts(const char* data_, size_t size_, sync_report& report_, unsigned int threads_)
+{
+	using Clock = std::chrono::steady_clock;
+	auto ms = [](Clock::duration duration_) { return std::chrono::duration<double, std::milli>(duration_).count(); };
+
+	Clock::time_point start = Clock::now();
+	std::vector<std::vector<Contact>> chunks;
+
+	report_ = sync_report();
+
+	// a partial parse must not remove the contacts after the error
+	if (!ParseContactsParallel(data_, size_, threads_, chunks))
+		return false;
+
+	loadStore(); // contacts not read in yet would be missed by the diff and added again
+
+	Clock::time_point parsed = Clock::now();
+	size_t numshards = _contactmap.shards();
+	std::vector<std::vector<SyncShard>> input(chunks.size());
+	std::atomic<size_t> invalid{ 0 };
+
+	// keys of the valid contacts with the phone number as it would be stored, bucketed by shard
+	run_chunks(threads_, chunks.size(), [&](size_t chunk_)
+	{
+		input[chunk_].resize(numshards);
+
+		for (Contact& contact : chunks[chunk_])
+		{
+			char buffer[E164BUFFER];
+			std::string_view phone;
+
+			if (!isContactvalid(contact) || !storedPhone(contact.getphone(), buffer, phone))
+			{
+				++invalid;
+				continue;
+			}
+
+			if (phone.data() != contact.getphone().data())
+				contact.setphonenumber(std::string(phone));
+
+			ContactView key(contact);
+			size_t hash = hash_contactview()(key);
+			SyncShard& shard = input[chunk_][ShardIndex(hash, numshards)];
+
+			shard.keys.push_back(key);
+			shard.hashes.push_back(hash);
+			shard.contacts.push_back(&contact);
+		}
+	});
+
+	std::vector<std::vector<ContactRecord>> added(numshards), removed(numshards);
+	std::vector<uint64_t> logged(numshards, 0);
+	std::atomic<bool> stored{ true };
+	std::atomic<size_t> unchanged{ 0 };
+
+	run_chunks(threads_, numshards, [&](size_t shard_)
+	{
+		SyncShard shard;
+
+		for (auto& chunk : input)
+		{
+			SyncShard& part = chunk[shard_];
+
+			shard.keys.insert(shard.keys.end(), part.keys.begin(), part.keys.end());
+			shard.hashes.insert(shard.hashes.end(), part.hashes.begin(), part.hashes.end());
+			shard.contacts.insert(shard.contacts.end(), part.contacts.begin(), part.contacts.end());
+			part = SyncShard();
+		}
+
+		unchanged += _contactmap.syncshard(shard_, shard.keys.data(), shard.hashes.data(), shard.keys.size(),
+			[this, &shard](size_t idx_) { return makeRecord(*shard.contacts[idx_], shard.keys[idx_].getphone()); },
+			[&](const ContactRecord& added_)
+			{
+				indexContact(added_);
+				logged[shard_] = std::max(logged[shard_], logContact(nullptr, *added_));
+
+				if (!storeContact(nullptr, added_.get()))
+					stored = false;
+				added[shard_].push_back(added_);
+			},
+			[&](const ContactRecord& removed_)
+			{
+				unindexContact(removed_);
+				logged[shard_] = std::max(logged[shard_], logRemoval(*removed_));
+
+				if (!storeContact(removed_.get(), nullptr))
+					stored = false;
+				removed[shard_].push_back(removed_);
+			});
+	});
+
+	if (!syncLog(*std::max_element(logged.begin(), logged.end())) || !stored) // one wait for the whole sync
+		return false;
+
+	std::vector<ContactRecord> records;
+
+	for (auto& shard : removed)
+		records.insert(records.end(), std::make_move_iterator(shard.begin()), std::make_move_iterator(shard.end()));
+
+	report_.removed = records.size();
+	notifyBatch(records, ContactEvents::REMOVE);
+	records.clear();
+
+	for (auto& shard : added)
+		records.insert(records.end(), std::make_move_iterator(shard.begin()), std::make_move_iterator(shard.end()));
+
+	report_.added = records.size();
+	notifyBatch(records, ContactEvents::ADD);
+
+	for (const auto& chunk : chunks)
+		report_.parsed += chunk.size();
+
+	report_.invalid = invalid;
+	report_.unchanged = unchanged;
+	report_.duplicates = report_.parsed - report_.invalid - report_.unchanged - report_.added;
+
+	Clock::time_point done = Clock::now();
+
+	report_.parsems = ms(parsed - start);
+	report_.applyms = ms(done - parsed);
+	report_.totalms = ms(done - start);
+
+	if (report_.removed != 0)
+		compactIfDue();
+
+	return true;
+}
+
+bool Contacts::syncFromJSON(const std::string& str_, sync_report& report_, unsigned int threads_)
+{
+	return syncContacts(str_.data(), str_.size(), report_, threads_);
+}
+
+bool Contacts::syncFromFile(const std::string& path_, sync_report& report_, unsigned int threads_)
+{
+	MappedFile file;
+
+	if (!file.open(path_))
+		return false; // the input is split like loadContactsFromFileParallel splits it, only mappable files
+
+	return syncContacts(file.data(), file.size(), report_, threads_);
+}
+
+// Buffered JSON text of the exported contacts, handed to output_( data, size ) in blocks. Names and phone numbers
+// rarely need escaping, those are copied in one piece; the others go through rapidjson's Writer, whose per char
+// output is what bounds the throughput otherwise
+template <typename Output>
+class ContactJSONWriter
+{
+private:
+	static constexpr size_t BUFFERSIZE = 65536;
+
+	Output& _output;
+	std::unique_ptr<char[]> _buffer{ new char[BUFFERSIZE] };
+	size_t _used{ 0 };
+	bool _first{ true };
+	StringBuffer _escaped;
+
+	void append(const char* data_, size_t size_)
+	{
+		if (BUFFERSIZE - _used < size_)
+		{
+			flush();
+
+			if (size_ > BUFFERSIZE)
+			{
+				_output(data_, size_);
+				return;
+			}
+		}
+
+		std::memcpy(_buffer.get() + _used, data_, size_);
+		_used += size_;
+	}
+
+	template <size_t N>
+	void append(const char (&text_)[N]) { append(text_, N - 1); }
+
+	void string(std::string_view value_)
+	{
+		for (char ch : value_)
+		{
+			if (static_cast<unsigned char>(ch) < 0x20 || ch == '"' || ch == '\\')
+			{
+				_escaped.Clear();
+				Writer<StringBuffer> writer(_escaped);
+				writer.String(value_.data(), static_cast<SizeType>(value_.size()));
+				append(_escaped.GetString(), _escaped.GetSize());
+				return;
+			}
+		}
+
+		append("\"");
+		append(value_.data(), value_.size());
+		append("\"");
+	}
+
+public:
+	explicit ContactJSONWriter(Output& output_) : _output(output_) { append("["); }
+
+	void contact(const StoredContact& contact_)
+	{
+		if (!_first)
+			append(",\n");
+		_first = false;
+
+		append("{\"first\":");
+		string(contact_.getfirstname());
+		append(",\"last\":");
+		string(contact_.getlastname());
+		append(",\"phone\":");
+		string(contact_.getphone());
+		append("}");
+	}
+
+	void end()
+	{
+		append("]");
+		flush();
+	}
+
+	void flush()
+	{
+		if (_used != 0)
+			_output(_buffer.get(), _used);
+		_used = 0;
+	}
+};
+
+// Writes the contacts of map_ as the array of { "first", "last", "phone" } objects the loaders read. The records of
+// one shard are copied out under its lock and written after it is released, memory stays at one shard of pointers
+template <typename Map, typename Output>
+static void WriteContactsJSON(const Map& map_, Output& output_, size_t& count_)
+{
+	ContactJSONWriter<Output> writer(output_);
+	std::vector<ContactRecord> records;
+
+	for (size_t shard = 0; shard < map_.shards(); ++shard)
+	{
+		records.clear();
+		map_.foreach(shard, [&records](const ContactView&, const ContactRecord& record_) { records.push_back(record_); });
+
+		for (const auto& record : records)
+			writer.contact(*record);
+
+		count_ += records.size();
+	}
+
+	writer.end();
+}
+
+bool Contacts::exportContactsJSON(std::ostream& stream_, size_t& count_) const
+{
+	auto output = [&stream_](const char* data_, size_t size_) { stream_.write(data_, static_cast<std::streamsize>(size_)); };
+
+	loadStore();
+
+	WriteContactsJSON(_contactmap, output, count_);
+
+	return stream_.good();
+}
+
+bool Contacts::exportContactsJSON(const std::string& path_, size_t& count_) const
+{
+	FILE* fp = nullptr;
+#ifdef _WIN32
+	if (fopen_s(&fp, path_.c_str(), "wb") != 0)
+		fp = nullptr;
+#else
+	fp = fopen(path_.c_str(), "wb");
+#endif
+
+	if (fp == nullptr)
+		return false;
+
+	loadStore();
+
+	bool ret = true;
+	auto output = [fp, &ret](const char* data_, size_t size_) { ret = ret && fwrite(data_, 1, size_, fp) == size_; };
+
+	WriteContactsJSON(_contactmap, output, count_);
+
+	return fclose(fp) == 0 && ret;
+}
+
+bool Contacts::openWriteAheadLog(const std::string& path_, size_t& replayed_, const WalConfig& config_)
+{
+	closeWriteAheadLog();
+
+	std::unique_ptr<ContactWal> wal = std::make_unique<ContactWal>(config_);
+
+	// replayed through the regular paths before the log is attached, so replay does not log the entries again.
+	// Changes a snapshot already holds fail as duplicates / unknown old contacts. An update is replayed as a removal
+	// and an add: a checkpoint copies one shard at a time, its snapshot can hold both sides of an update across
+	// shards, or neither, and updateContact would then keep both / lose the new one
+	bool opened = wal->open(path_, [this](WalOp op_, const std::string_view* fields_, size_t)
+	{
+		Contact contact{ std::string(fields_[0]), std::string(fields_[1]), std::string(fields_[2]) };
+
+		if (op_ == WalOp::ADD)
+			addContact(contact);
+		else if (op_ == WalOp::REMOVE)
+			removeContact(contact);
+		else
+		{
+			removeContact(contact);
+			addContact(Contact(std::string(fields_[3]), std::string(fields_[4]), std::string(fields_[5])));
+		}
+	}, replayed_);
+
+	if (!opened)
+		return false;
+
+	_wal = std::move(wal);
+	return true;
+}
+
+void Contacts::closeWriteAheadLog()
+{
+	_wal.reset();
+}
+
+bool Contacts::checkpoint(const std::string& snapshotpath_)
+{
+	if (!_wal)
+		return saveSnapshot(snapshotpath_);
+
+	// changes are logged under their shard lock once applied, everything logged up to here is in the snapshot.
+	// Entries logged after it may be in it as well, replay takes them as already applied
+	uint64_t position = _wal->position();
+
+	return saveSnapshot(snapshotpath_) && _wal->truncate(position);
+}
@@ -0,0 +1,344 @@
+#include "Contact.h"
+#include "contactsnapshot.h"
+#include "mappedfile.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+
+using namespace User;
+using namespace Threading;
+
+namespace
+{
+	constexpr size_t RESTORECHUNK = 64 * 1024; // records built and inserted per task of a restore
+	constexpr uint32_t NONAME = std::numeric_limits<uint32_t>::max();
+
+	uint64_t HeaderHash(SnapshotHeader header_)
+	{
+		header_.checksum = 0;
+		return WyHash(&header_, sizeof(header_), SNAPSHOTSEED);
+	}
+
+	// Buffered writer of the snapshot payload, hashes it in SNAPSHOTBLOCK blocks as it goes
+	class SnapshotWriter
+	{
+	private:
+		std::FILE* _file;
+		std::unique_ptr<char[]> _buffer{ new char[SNAPSHOTBLOCK] };
+		size_t _used{ 0 };
+		uint64_t _checksum;
+		bool _ok{ true };
+
+	public:
+		SnapshotWriter(std::FILE* file_, uint64_t seed_) : _file(file_), _checksum(seed_) {}
+
+		void write(const void* data_, size_t size_)
+		{
+			const char* data = static_cast<const char*>(data_);
+
+			while (size_ != 0)
+			{
+				size_t size = std::min(size_, SNAPSHOTBLOCK - _used);
+
+				std::memcpy(_buffer.get() + _used, data, size);
+				_used += size;
+				data += size;
+				size_ -= size;
+
+				if (_used == SNAPSHOTBLOCK)
+					flush();
+			}
+		}
+
+		void flush()
+		{
+			if (_used == 0)
+				return;
+
+			_checksum = WyHash(_buffer.get(), _used, _checksum);
+			_ok = _ok && std::fwrite(_buffer.get(), 1, _used, _file) == _used;
+			_used = 0;
+		}
+
+		uint64_t checksum() const { return _checksum; }
+
+		bool ok() const { return _ok; }
+	};
+}
+
+bool Contacts::saveSnapshot(const std::string& path_) const
+{
+	std::vector<ContactRecord> records;
+
+	loadStore();
+	records.reserve(_contactmap.size());
+
+	// one shard lock at a time, held only to copy the record pointers out
+	for (size_t shard = 0; shard < _contactmap.shards(); ++shard)
+	{
+		_contactmap.foreach(shard, [&records](const ContactView&, const ContactRecord& record_) { records.push_back(record_); });
+	}
+
+	// restoring spends its time in the secondary indexes, records of one last name next to each other insert
+	// much faster than records in the hash order of the shards
+	std::sort(records.begin(), records.end(), [](const ContactRecord& a_, const ContactRecord& b_)
+	{
+		return a_->lastnameid() != b_->lastnameid() ? a_->lastnameid() < b_->lastnameid() : a_->phonekey() < b_->phonekey();
+	});
+
+	// dictionary ids -> dense name table indexes, the records of the store all intern in _arena.names()
+	const NameDictionary& dictionary = _arena.names();
+	std::vector<uint32_t> nameindex;
+	std::vector<uint32_t> names;
+	uint64_t namebytes = 0;
+	uint64_t phonebytes = 0;
+
+	auto tableindex = [&](uint32_t id_)
+	{
+		if (id_ >= nameindex.size())
+			nameindex.resize(std::max<size_t>(id_ + 1, nameindex.size() * 2), NONAME);
+
+		if (nameindex[id_] == NONAME)
+		{
+			nameindex[id_] = static_cast<uint32_t>(names.size());
+			names.push_back(id_);
+			namebytes += sizeof(uint32_t) + dictionary.name(id_).size();
+		}
+
+		return nameindex[id_];
+	};
+
+	std::vector<SnapshotRecord> table(records.size());
+
+	for (size_t ii = 0; ii < records.size(); ++ii)
+	{
+		const StoredContact& record = *records[ii];
+		SnapshotRecord& entry = table[ii];
+
+		entry.first = tableindex(record.firstnameid());
+		entry.last = tableindex(record.lastnameid());
+		entry.phonekey = record.phonekey();
+		entry.phoneoffset = 0;
+		entry.phonesize = 0;
+
+		if (entry.phonekey == 0)
+		{
+			if (phonebytes + record.size() > std::numeric_limits<uint32_t>::max())
+				return false; // offsets of the phone heap are 32 bit
+
+			entry.phoneoffset = static_cast<uint32_t>(phonebytes);
+			entry.phonesize = static_cast<uint32_t>(record.size());
+			phonebytes += record.size();
+		}
+	}
+
+	SnapshotHeader header;
+	std::memcpy(header.magic, SNAPSHOTMAGIC, sizeof(header.magic));
+	header.version = SNAPSHOTVERSION;
+	header.recordsize = sizeof(SnapshotRecord);
+	header.contacts = table.size();
+	header.names = names.size();
+	header.namebytes = namebytes;
+	header.phonebytes = phonebytes;
+	header.checksum = 0;
+
+	// written next to the target and renamed over it, a crash never leaves a partial snapshot at path_
+	std::string temp = path_ + ".tmp";
+	std::FILE* file = std::fopen(temp.c_str(), "wb");
+
+	if (file == nullptr)
+		return false;
+
+	SnapshotWriter writer(file, HeaderHash(header));
+	bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+
+	writer.write(table.data(), table.size() * sizeof(SnapshotRecord));
+
+	for (uint32_t id : names)
+	{
+		std::string_view name = dictionary.name(id);
+		uint32_t size = static_cast<uint32_t>(name.size());
+
+		writer.write(&size, sizeof(size));
+		writer.write(name.data(), name.size());
+	}
+
+	for (const ContactRecord& record : records)
+	{
+		if (record->phonekey() == 0)
+			writer.write(record->getphone().data(), record->size());
+	}
+
+	writer.flush();
+	header.checksum = writer.checksum();
+
+	// on disk before it replaces the old snapshot, a checkpoint drops the log entries it holds right after
+	ok = ok && writer.ok() && std::fseek(file, 0, SEEK_SET) == 0 && std::fwrite(&header, sizeof(header), 1, file) == 1 && SyncFile(file);
+	ok = std::fclose(file) == 0 && ok;
+
+	if (!ok || !RenameOver(temp, path_))
+	{
+		std::remove(temp.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+bool Contacts::loadSnapshot(const std::string& path_, size_t& count_, unsigned int threads_)
+{
+	MappedFile file;
+
+	if (!file.open(path_) || file.size() < sizeof(SnapshotHeader))
+		return false;
+
+	SnapshotHeader header;
+	std::memcpy(&header, file.data(), sizeof(header));
+
+	if (std::memcmp(header.magic, SNAPSHOTMAGIC, sizeof(header.magic)) != 0 || header.version != SNAPSHOTVERSION ||
+		header.recordsize != sizeof(SnapshotRecord))
+		return false;
+
+	// section sizes checked one by one against what is left, no sum can overflow
+	uint64_t left = file.size() - sizeof(SnapshotHeader);
+
+	if (header.contacts > left / sizeof(SnapshotRecord))
+		return false;
+	left -= header.contacts * sizeof(SnapshotRecord);
+
+	if (header.namebytes > left || header.phonebytes != left - header.namebytes || header.names > header.namebytes / sizeof(uint32_t))
+		return false;
+
+	const char* payload = file.data() + sizeof(SnapshotHeader);
+	size_t payloadsize = file.size() - sizeof(SnapshotHeader);
+	uint64_t checksum = HeaderHash(header);
+
+	for (size_t offset = 0; offset < payloadsize; offset += SNAPSHOTBLOCK)
+		checksum = WyHash(payload + offset, std::min(SNAPSHOTBLOCK, payloadsize - offset), checksum);
+
+	if (checksum != header.checksum)
+		return false;
+
+	const char* recordbytes = payload;
+	const char* namebytes = recordbytes + header.contacts * sizeof(SnapshotRecord);
+	const char* phones = namebytes + header.namebytes;
+
+	std::vector<std::string_view> names(static_cast<size_t>(header.names));
+	size_t pos = 0;
+
+	for (std::string_view& name : names)
+	{
+		uint32_t size;
+
+		if (header.namebytes - pos < sizeof(size))
+			return false;
+
+		std::memcpy(&size, namebytes + pos, sizeof(size));
+		pos += sizeof(size);
+
+		if (size == 0 || header.namebytes - pos < size)
+			return false;
+
+		name = std::string_view(namebytes + pos, size);
+		pos += size;
+	}
+
+	if (pos != header.namebytes)
+		return false;
+
+	size_t contacts = static_cast<size_t>(header.contacts);
+	size_t numchunks = (contacts + RESTORECHUNK - 1) / RESTORECHUNK;
+	std::vector<uint32_t> ids(names.size());
+
+	// names go into the dictionary once, records then take ids instead of interning two names each
+	run_chunks(threads_, (names.size() + RESTORECHUNK - 1) / RESTORECHUNK, [&](size_t chunk_)
+	{
+		size_t end = std::min(names.size(), (chunk_ + 1) * RESTORECHUNK);
+
+		for (size_t ii = chunk_ * RESTORECHUNK; ii < end; ++ii)
+			ids[ii] = _arena.intern(names[ii]);
+	});
+
+	std::vector<std::vector<ContactRecord>> records(numchunks);
+	std::vector<std::vector<ContactView>> keys(numchunks);
+	std::atomic<bool> valid{ true };
+
+	// phase 1: every record is checked and built, nothing is inserted unless the whole snapshot is valid
+	run_chunks(threads_, numchunks, [&](size_t chunk_)
+	{
+		size_t begin = chunk_ * RESTORECHUNK;
+		size_t end = std::min(contacts, begin + RESTORECHUNK);
+
+		records[chunk_].reserve(end - begin);
+		keys[chunk_].reserve(end - begin);
+
+		for (size_t ii = begin; ii < end && valid.load(std::memory_order_relaxed); ++ii)
+		{
+			SnapshotRecord entry;
+			std::memcpy(&entry, recordbytes + ii * sizeof(SnapshotRecord), sizeof(entry));
+
+			if (entry.first >= names.size() || entry.last >= names.size())
+			{
+				valid = false;
+				break;
+			}
+
+			char buffer[16];
+			std::string_view phone;
+			uint64_t phonekey = entry.phonekey;
+
+			if (phonekey != 0)
+			{
+				// the key must be one PackPhone returns, the text generated from it packs to the same key
+				phone = std::string_view(buffer, UnpackPhone(phonekey, buffer));
+
+				if (PackPhone(phone) != phonekey)
+				{
+					valid = false;
+					break;
+				}
+			}
+			else
+			{
+				if (entry.phonesize == 0 || entry.phoneoffset > header.phonebytes || entry.phonesize > header.phonebytes - entry.phoneoffset)
+				{
+					valid = false;
+					break;
+				}
+
+				phone = std::string_view(phones + entry.phoneoffset, entry.phonesize);
+				phonekey = PackPhone(phone);
+			}
+
+			records[chunk_].push_back(_arena.make(ids[entry.first], ids[entry.last], phone, phonekey));
+			keys[chunk_].emplace_back(*records[chunk_].back());
+		}
+	});
+
+	if (!valid)
+		return false;
+
+	std::atomic<size_t> added{ 0 };
+	std::atomic<bool> durable{ true };
+
+	// phase 2: batched insert, one lock acquisition per shard and one ADD event per lane and chunk
+	run_chunks(threads_, numchunks, [&](size_t chunk_)
+	{
+		std::unique_ptr<bool[]> inserted(new bool[records[chunk_].size()]);
+		size_t chunkadded = 0;
+
+		if (!insertRecords(keys[chunk_], [&records, chunk_](size_t ii_) { return records[chunk_][ii_]; }, inserted.get(), chunkadded))
+			durable = false;
+
+		added += chunkadded;
+
+		std::vector<ContactView>().swap(keys[chunk_]);
+		std::vector<ContactRecord>().swap(records[chunk_]);
+	});
+
+	count_ += added;
+
+	return durable;
+}
@@ -0,0 +1,450 @@
+#include "contactwal.h"
+#include "contacthash.h"
+#include "mappedfile.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#endif
+
+using namespace User;
+
+namespace
+{
+	constexpr char WALMAGIC[8] = { 'C', 'N', 'T', 'W', 'A', 'L', '0', '1' };
+	constexpr size_t ENTRYHEADER = 2 * sizeof(uint32_t); // payload size and checksum
+	constexpr size_t MAXFIELDS = 6;
+	constexpr uint64_t WALSEED = 0x5D3E6F1B2A9C4807ULL;
+
+	uint32_t PayloadChecksum(const char* payload_, size_t size_)
+	{
+		return static_cast<uint32_t>(WyHash(payload_, size_, WALSEED));
+	}
+
+#ifdef _WIN32
+	int OpenLog(const std::string& path_)
+	{
+		return _open(path_.c_str(), _O_RDWR | _O_CREAT | _O_APPEND | _O_BINARY, _S_IREAD | _S_IWRITE);
+	}
+
+	bool WriteAll(int fd_, const char* data_, size_t size_)
+	{
+		while (size_ != 0)
+		{
+			int written = _write(fd_, data_, static_cast<unsigned int>(std::min<size_t>(size_, 1 << 30)));
+
+			if (written <= 0)
+				return false;
+
+			data_ += written;
+			size_ -= static_cast<size_t>(written);
+		}
+
+		return true;
+	}
+
+	bool ReadAt(int fd_, uint64_t offset_, char* data_, size_t size_)
+	{
+		if (_lseeki64(fd_, static_cast<__int64>(offset_), SEEK_SET) < 0)
+			return false;
+
+		while (size_ != 0)
+		{
+			int count = _read(fd_, data_, static_cast<unsigned int>(std::min<size_t>(size_, 1 << 30)));
+
+			if (count <= 0)
+				return false;
+
+			data_ += count;
+			size_ -= static_cast<size_t>(count);
+		}
+
+		return true;
+	}
+
+	bool TruncateLog(int fd_, uint64_t size_) { return _chsize_s(fd_, static_cast<__int64>(size_)) == 0; }
+
+	bool LogSize(int fd_, uint64_t& size_)
+	{
+		__int64 size = _filelengthi64(fd_);
+
+		size_ = static_cast<uint64_t>(size);
+		return size >= 0;
+	}
+
+	void CloseLog(int fd_) { _close(fd_); }
+#else
+	int OpenLog(const std::string& path_)
+	{
+		return ::open(path_.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+	}
+
+	bool WriteAll(int fd_, const char* data_, size_t size_)
+	{
+		while (size_ != 0)
+		{
+			ssize_t written = ::write(fd_, data_, size_);
+
+			if (written < 0 && errno == EINTR)
+				continue;
+			if (written <= 0)
+				return false;
+
+			data_ += written;
+			size_ -= static_cast<size_t>(written);
+		}
+
+		return true;
+	}
+
+	bool ReadAt(int fd_, uint64_t offset_, char* data_, size_t size_)
+	{
+		while (size_ != 0)
+		{
+			ssize_t count = ::pread(fd_, data_, size_, static_cast<off_t>(offset_));
+
+			if (count < 0 && errno == EINTR)
+				continue;
+			if (count <= 0)
+				return false;
+
+			data_ += count;
+			size_ -= static_cast<size_t>(count);
+			offset_ += static_cast<uint64_t>(count);
+		}
+
+		return true;
+	}
+
+	bool TruncateLog(int fd_, uint64_t size_) { return ::ftruncate(fd_, static_cast<off_t>(size_)) == 0; }
+
+	bool LogSize(int fd_, uint64_t& size_)
+	{
+		struct stat st;
+
+		if (::fstat(fd_, &st) != 0)
+			return false;
+
+		size_ = static_cast<uint64_t>(st.st_size);
+		return true;
+	}
+
+	void CloseLog(int fd_) { ::close(fd_); }
+#endif
+
+	// Fields of the entry payload at data_, returns false if the payload is not a well formed entry
+	bool ParseEntry(const char* data_, size_t size_, WalOp& op_, std::string_view* fields_, size_t& count_)
+	{
+		if (size_ == 0)
+			return false;
+
+		op_ = static_cast<WalOp>(data_[0]);
+		if (op_ != WalOp::ADD && op_ != WalOp::UPDATE && op_ != WalOp::REMOVE)
+			return false;
+
+		size_t pos = 1;
+		count_ = 0;
+
+		while (pos < size_)
+		{
+			uint32_t length;
+
+			if (count_ == MAXFIELDS || size_ - pos < sizeof(length))
+				return false;
+
+			std::memcpy(&length, data_ + pos, sizeof(length));
+			pos += sizeof(length);
+
+			if (size_ - pos < length)
+				return false;
+
+			fields_[count_++] = std::string_view(data_ + pos, length);
+			pos += length;
+		}
+
+		return count_ == (op_ == WalOp::UPDATE ? 6 : 3);
+	}
+}
+
+bool ContactWal::open(const std::string& path_, const Visitor& visitor_, size_t& replayed_)
+{
+	close();
+
+	uint64_t valid = 0; // bytes of the file up to the last good entry, 0 = no log yet
+	uint64_t filesize = 0;
+	int fd = OpenLog(path_);
+
+	if (fd == -1)
+		return false;
+
+	bool ok = LogSize(fd, filesize);
+
+	// only a missing or empty file makes a new log. An existing log that cannot be mapped ( larger than the address
+	// space of a 32 bit process, or the mapping failed ) fails the open instead of being replaced
+	if (ok && filesize != 0)
+	{
+		MappedFile file;
+
+		ok = file.open(path_) && file.size() >= sizeof(WALMAGIC) && std::memcmp(file.data(), WALMAGIC, sizeof(WALMAGIC)) == 0;
+
+		if (ok)
+		{
+			const char* data = file.data();
+			size_t size = file.size();
+			size_t pos = sizeof(WALMAGIC);
+
+			while (size - pos >= ENTRYHEADER)
+			{
+				uint32_t payload, checksum;
+				std::memcpy(&payload, data + pos, sizeof(payload));
+				std::memcpy(&checksum, data + pos + sizeof(payload), sizeof(checksum));
+
+				WalOp op;
+				std::string_view fields[MAXFIELDS];
+				size_t count;
+
+				if (payload > MAXENTRY || size - pos - ENTRYHEADER < payload || PayloadChecksum(data + pos + ENTRYHEADER, payload) != checksum
+					|| !ParseEntry(data + pos + ENTRYHEADER, payload, op, fields, count))
+					break; // torn by a crash while it was written, or corrupt
+
+				visitor_(op, fields, count);
+				++replayed_;
+				pos += ENTRYHEADER + payload;
+			}
+
+			valid = pos;
+			filesize = size;
+		}
+	}
+
+	if (ok && valid == 0)
+	{
+		// new or empty log
+		ok = WriteAll(fd, WALMAGIC, sizeof(WALMAGIC)) && SyncFile(fd);
+		valid = sizeof(WALMAGIC);
+	}
+	else if (ok && valid < filesize)
+		ok = TruncateLog(fd, valid) && SyncFile(fd); // entries appended now must follow the last good one
+
+	if (!ok)
+	{
+		CloseLog(fd);
+		return false;
+	}
+
+	_fd = fd;
+
+	_path = path_;
+	_buffer.clear();
+	_appended = _durable = valid - sizeof(WALMAGIC);
+	_filebase = 0;
+	_written = _appended;
+	_filebytes = valid;
+	_stats = wal_stats();
+	_stop = false;
+	_flusher = std::thread(&ContactWal::flushLoop, this);
+
+	return true;
+}
+
+void ContactWal::close()
+{
+	if (_fd == -1)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lk(_mut);
+		_stop = true;
+	}
+
+	_flushcv.notify_one();
+	_flusher.join();
+
+	CloseLog(_fd);
+	_fd = -1;
+}
+
+uint64_t ContactWal::append(WalOp op_, const std::string_view* fields_, size_t count_)
+{
+	size_t payload = 1;
+	for (size_t ii = 0; ii < count_; ++ii)
+		payload += sizeof(uint32_t) + fields_[ii].size();
+
+	std::unique_lock<std::mutex> lk(_mut);
+
+	size_t start = _buffer.size();
+	_buffer.resize(start + ENTRYHEADER + payload);
+
+	char* entry = &_buffer[start];
+	char* pos = entry + ENTRYHEADER;
+	uint32_t size = static_cast<uint32_t>(payload);
+
+	*pos++ = static_cast<char>(op_);
+	for (size_t ii = 0; ii < count_; ++ii)
+	{
+		uint32_t length = static_cast<uint32_t>(fields_[ii].size());
+
+		std::memcpy(pos, &length, sizeof(length));
+		std::memcpy(pos + sizeof(length), fields_[ii].data(), length);
+		pos += sizeof(length) + length;
+	}
+
+	uint32_t checksum = PayloadChecksum(entry + ENTRYHEADER, payload);
+	std::memcpy(entry, &size, sizeof(size));
+	std::memcpy(entry + sizeof(size), &checksum, sizeof(checksum));
+
+	_appended += ENTRYHEADER + payload;
+	++_bufferedentries;
+	++_stats.entries;
+	_stats.bytes += ENTRYHEADER + payload;
+
+	// the flusher waits for the first entry, then for a full batch
+	bool wake = start == 0 || (start < _config.maxbatchbytes && _buffer.size() >= _config.maxbatchbytes);
+	uint64_t position = _appended;
+
+	lk.unlock();
+
+	if (wake)
+		_flushcv.notify_one();
+
+	return position;
+}
+
+bool ContactWal::wait(uint64_t position_)
+{
+	std::unique_lock<std::mutex> lk(_mut);
+
+	_durablecv.wait(lk, [this, position_]() { return _durable >= position_ || _stats.failed; });
+
+	return _durable >= position_;
+}
+
+uint64_t ContactWal::position() const
+{
+	std::lock_guard<std::mutex> lk(_mut);
+	return _appended;
+}
+
+void ContactWal::flushLoop()
+{
+	std::string writing;
+	std::unique_lock<std::mutex> lk(_mut);
+
+	while (true)
+	{
+		_flushcv.wait(lk, [this]() { return _stop || !_buffer.empty(); });
+
+		if (_buffer.empty())
+			break; // stopped, nothing left to write
+
+		// group commit: writers arriving within the budget share this sync
+		if (!_stop && _config.groupcommit.count() > 0)
+		{
+			_flushcv.wait_for(lk, _config.groupcommit, [this]() { return _stop || _buffer.size() >= _config.maxbatchbytes; });
+		}
+
+		writing.swap(_buffer);
+		uint64_t target = _appended;
+		uint64_t entries = _bufferedentries;
+		bool failed = _stats.failed;
+
+		_bufferedentries = 0;
+		lk.unlock();
+
+		bool ok = false;
+
+		if (!failed)
+		{
+			std::lock_guard<std::mutex> fl(_filemut);
+
+			ok = WriteAll(_fd, writing.data(), writing.size()) && (!_config.sync || SyncFile(_fd));
+			if (ok)
+			{
+				_written = target;
+				_filebytes = sizeof(WALMAGIC) + (_written - _filebase);
+			}
+		}
+
+		writing.clear();
+		lk.lock();
+
+		if (ok)
+		{
+			_durable = target;
+			++_stats.syncs;
+			_stats.maxbatch = std::max(_stats.maxbatch, entries);
+		}
+		else
+			_stats.failed = true; // what is buffered from now on is dropped
+
+		_durablecv.notify_all();
+	}
+}
+
+bool ContactWal::truncate(uint64_t position_)
+{
+	if (!wait(position_))
+		return false; // the entries to drop are in the file from here on
+
+	std::lock_guard<std::mutex> fl(_filemut);
+
+	if (position_ <= _filebase)
+		return true;
+
+	// the file holds the entries from _filebase to _written, the ones after position_ move to the new file
+	std::string tail(static_cast<size_t>(_written - position_), '\0');
+	std::string temp = _path + ".tmp";
+	bool ok = tail.empty() || ReadAt(_fd, sizeof(WALMAGIC) + (position_ - _filebase), &tail[0], tail.size());
+
+	if (ok)
+	{
+		int fd = OpenLog(temp);
+
+		ok = fd != -1 && TruncateLog(fd, 0) && WriteAll(fd, WALMAGIC, sizeof(WALMAGIC)) && WriteAll(fd, tail.data(), tail.size()) && SyncFile(fd);
+
+		if (fd != -1)
+			CloseLog(fd);
+	}
+
+	// the open log is closed first, Windows cannot replace a file that is open
+	CloseLog(_fd);
+	ok = ok && RenameOver(temp, _path);
+
+	if (ok)
+	{
+		_filebase = position_;
+		_filebytes = sizeof(WALMAGIC) + (_written - _filebase);
+	}
+	else
+		std::remove(temp.c_str());
+
+	_fd = OpenLog(_path);
+
+	if (_fd == -1)
+	{
+		std::lock_guard<std::mutex> lk(_mut);
+		_stats.failed = true;
+		_durablecv.notify_all();
+		return false;
+	}
+
+	return ok;
+}
+
+wal_stats ContactWal::stats() const
+{
+	std::lock_guard<std::mutex> lk(_mut);
+
+	wal_stats stats = _stats;
+	stats.filebytes = _filebytes.load(std::memory_order_relaxed);
+	return stats;
+}
@@ -0,0 +1,218 @@
+#include "editdistance.h"
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define CONTACT_SIMD_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CONTACT_SIMD_SSE2
+#endif
+
+using namespace User;
+
+unsigned int User::BoundedLevenshtein(std::string_view a_, std::string_view b_, unsigned int maxdistance_)
+{
+	size_t lendiff = a_.size() > b_.size() ? a_.size() - b_.size() : b_.size() - a_.size();
+
+	if (lendiff > maxdistance_)
+		return maxdistance_ + 1;
+
+	// one column of the DP matrix, column j holds the distances of every prefix of a_ to b_[ 0, j )
+	std::vector<unsigned int> col(a_.size() + 1);
+	for (size_t ii = 0; ii <= a_.size(); ++ii)
+		col[ii] = static_cast<unsigned int>(ii);
+
+	for (size_t jj = 0; jj < b_.size(); ++jj)
+	{
+		unsigned int diag = col[0];
+		unsigned int colmin = col[0] = static_cast<unsigned int>(jj + 1);
+
+		for (size_t ii = 1; ii <= a_.size(); ++ii)
+		{
+			unsigned int left = col[ii];
+			col[ii] = std::min({ diag + (a_[ii - 1] != b_[jj]), left + 1, col[ii - 1] + 1 });
+			diag = left;
+			colmin = std::min(colmin, col[ii]);
+		}
+
+		if (colmin > maxdistance_)
+			return maxdistance_ + 1; // distances never decrease from one column to the next
+	}
+
+	return std::min(col[a_.size()], maxdistance_ + 1);
+}
+
+#if defined(CONTACT_SIMD_AVX2) || defined(CONTACT_SIMD_SSE2)
+
+namespace
+{
+	// 16 bit lanes, one candidate per lane
+#if defined(CONTACT_SIMD_AVX2)
+	struct Lanes
+	{
+		using V = __m256i;
+		static constexpr size_t N = 16;
+
+		static V set1(int v_) { return _mm256_set1_epi16(static_cast<short>(v_)); }
+		static V load(const uint16_t* p_) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p_)); }
+		static void store(uint16_t* p_, V v_) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p_), v_); }
+		static V add(V a_, V b_) { return _mm256_add_epi16(a_, b_); }
+		static V min(V a_, V b_) { return _mm256_min_epi16(a_, b_); }
+		static V cmpeq(V a_, V b_) { return _mm256_cmpeq_epi16(a_, b_); }
+		static V cmpgt(V a_, V b_) { return _mm256_cmpgt_epi16(a_, b_); }
+		static V select(V mask_, V a_, V b_) { return _mm256_blendv_epi8(b_, a_, mask_); } // mask ? a : b
+		static V andnot(V a_, V b_) { return _mm256_andnot_si256(a_, b_); } // ~a & b
+		static bool none(V mask_) { return _mm256_movemask_epi8(mask_) == 0; }
+	};
+#else
+	struct Lanes
+	{
+		using V = __m128i;
+		static constexpr size_t N = 8;
+
+		static V set1(int v_) { return _mm_set1_epi16(static_cast<short>(v_)); }
+		static V load(const uint16_t* p_) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p_)); }
+		static void store(uint16_t* p_, V v_) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p_), v_); }
+		static V add(V a_, V b_) { return _mm_add_epi16(a_, b_); }
+		static V min(V a_, V b_) { return _mm_min_epi16(a_, b_); }
+		static V cmpeq(V a_, V b_) { return _mm_cmpeq_epi16(a_, b_); }
+		static V cmpgt(V a_, V b_) { return _mm_cmpgt_epi16(a_, b_); }
+		static V select(V mask_, V a_, V b_) { return _mm_or_si128(_mm_and_si128(mask_, a_), _mm_andnot_si128(mask_, b_)); }
+		static V andnot(V a_, V b_) { return _mm_andnot_si128(a_, b_); }
+		static bool none(V mask_) { return _mm_movemask_epi8(mask_) == 0; }
+	};
+#endif
+
+	// Same DP as BoundedLevenshtein, for Lanes::N candidates at once. Column j of lane l is candidate l's
+	// character j, lanes whose candidate is shorter than j keep their last column
+	void LevenshteinLanes(std::string_view query_, const std::string_view* candidates_, size_t count_,
+		unsigned int maxdistance_, unsigned int* distances_, std::vector<uint16_t>& col_, std::vector<uint16_t>& chars_)
+	{
+		using V = Lanes::V;
+		constexpr size_t N = Lanes::N;
+
+		uint16_t lens[N] = {};
+		size_t maxlen = 0;
+
+		for (size_t ll = 0; ll < count_; ++ll)
+		{
+			lens[ll] = static_cast<uint16_t>(candidates_[ll].size());
+			maxlen = std::max(maxlen, candidates_[ll].size());
+		}
+
+		// transpose the candidates, chars_[ j * N + l ] is character j of candidate l
+		chars_.assign(maxlen * N, 0xFFFF);
+		for (size_t ll = 0; ll < count_; ++ll)
+		{
+			for (size_t jj = 0; jj < candidates_[ll].size(); ++jj)
+				chars_[jj * N + ll] = static_cast<unsigned char>(candidates_[ll][jj]);
+		}
+
+		// col_[ i * N + l ] is row i of lane l's current column
+		size_t m = query_.size();
+		col_.resize((m + 1) * N);
+		for (size_t ii = 0; ii <= m; ++ii)
+			Lanes::store(&col_[ii * N], Lanes::set1(static_cast<int>(ii)));
+
+		const V one = Lanes::set1(1);
+		const V limit = Lanes::set1(static_cast<int>(maxdistance_));
+		const V lenv = Lanes::load(lens);
+		V failed = Lanes::set1(0); // lanes already known to be above maxdistance_
+
+		for (size_t jj = 0; jj < maxlen; ++jj)
+		{
+			V active = Lanes::cmpgt(lenv, Lanes::set1(static_cast<int>(jj)));
+			V cj = Lanes::load(&chars_[jj * N]);
+			V diag = Lanes::load(&col_[0]);
+			V up = Lanes::set1(static_cast<int>(jj + 1));
+			V colmin = up;
+
+			Lanes::store(&col_[0], Lanes::select(active, up, diag));
+
+			for (size_t ii = 1; ii <= m; ++ii)
+			{
+				V left = Lanes::load(&col_[ii * N]);
+				V cost = Lanes::andnot(Lanes::cmpeq(cj, Lanes::set1(static_cast<unsigned char>(query_[ii - 1]))), one);
+				V cell = Lanes::min(Lanes::add(diag, cost), Lanes::add(Lanes::min(left, up), one));
+
+				Lanes::store(&col_[ii * N], Lanes::select(active, cell, left));
+				colmin = Lanes::min(colmin, cell);
+				diag = left;
+				up = cell;
+			}
+
+			failed = Lanes::select(active, Lanes::cmpgt(colmin, limit), failed);
+			if (Lanes::none(Lanes::andnot(failed, Lanes::cmpgt(lenv, Lanes::set1(static_cast<int>(jj + 1))))))
+				break; // every candidate still running is above the limit, finished ones are final
+		}
+
+		uint16_t result[N];
+		Lanes::store(result, Lanes::select(failed, Lanes::set1(static_cast<int>(maxdistance_ + 1)), Lanes::load(&col_[m * N])));
+
+		for (size_t ll = 0; ll < count_; ++ll)
+			distances_[ll] = std::min<unsigned int>(result[ll], maxdistance_ + 1);
+	}
+}
+
+void User::BoundedLevenshteinBatch(std::string_view query_, const std::string_view* candidates_, size_t count_,
+	unsigned int maxdistance_, unsigned int* distances_)
+{
+	constexpr size_t MAXLANELENGTH = 0x7FFF; // lane values are signed 16 bit
+
+	std::vector<uint16_t> col;
+	std::vector<uint16_t> chars;
+	std::string_view group[Lanes::N];
+	size_t index[Lanes::N];
+	size_t grouped = 0;
+
+	auto flush = [&]()
+	{
+		unsigned int distances[Lanes::N];
+		LevenshteinLanes(query_, group, grouped, maxdistance_, distances, col, chars);
+
+		for (size_t ll = 0; ll < grouped; ++ll)
+			distances_[index[ll]] = distances[ll];
+		grouped = 0;
+	};
+
+	for (size_t ii = 0; ii < count_; ++ii)
+	{
+		size_t lendiff = query_.size() > candidates_[ii].size() ? query_.size() - candidates_[ii].size() : candidates_[ii].size() - query_.size();
+
+		if (lendiff > maxdistance_)
+		{
+			distances_[ii] = maxdistance_ + 1; // cannot be within the limit
+			continue;
+		}
+
+		if (query_.size() > MAXLANELENGTH || candidates_[ii].size() > MAXLANELENGTH || maxdistance_ >= MAXLANELENGTH)
+		{
+			distances_[ii] = BoundedLevenshtein(query_, candidates_[ii], maxdistance_);
+			continue;
+		}
+
+		group[grouped] = candidates_[ii];
+		index[grouped++] = ii;
+
+		if (grouped == Lanes::N)
+			flush();
+	}
+
+	if (grouped != 0)
+		flush();
+}
+
+#else
+
+void User::BoundedLevenshteinBatch(std::string_view query_, const std::string_view* candidates_, size_t count_,
+	unsigned int maxdistance_, unsigned int* distances_)
+{
+	for (size_t ii = 0; ii < count_; ++ii)
+		distances_[ii] = BoundedLevenshtein(query_, candidates_[ii], maxdistance_);
+}
+
+#endif
@@ -0,0 +1,337 @@
+#include "mappedfile.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace User;
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string& path_)
+{
+	close();
+
+	HANDLE file = CreateFileA(path_.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+
+	if (GetFileType(file) != FILE_TYPE_DISK || !GetFileSizeEx(file, &size) || size.QuadPart == 0
+		|| static_cast<unsigned long long>(size.QuadPart) > static_cast<size_t>(-1))
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+	if (mapping == nullptr)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+	if (view == nullptr)
+	{
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	_file = file;
+	_mapping = mapping;
+	_data = static_cast<const char*>(view);
+	_size = static_cast<size_t>(size.QuadPart);
+
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (_data)
+		UnmapViewOfFile(_data);
+	if (_mapping)
+		CloseHandle(_mapping);
+	if (_file)
+		CloseHandle(_file);
+
+	_data = nullptr;
+	_mapping = nullptr;
+	_file = nullptr;
+	_size = 0;
+}
+
+bool WritableMappedFile::open(const std::string& path_, size_t minsize_)
+{
+	close();
+
+	HANDLE file = CreateFileA(path_.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+
+	if (GetFileType(file) != FILE_TYPE_DISK || !GetFileSizeEx(file, &size) || static_cast<unsigned long long>(size.QuadPart) > static_cast<size_t>(-1))
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	_file = file;
+
+	if (!map(std::max(minsize_, static_cast<size_t>(size.QuadPart))))
+	{
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+bool WritableMappedFile::map(size_t size_)
+{
+	LARGE_INTEGER size;
+	size.QuadPart = static_cast<LONGLONG>(size_);
+
+	// a mapping larger than the file extends it, a smaller file size needs the end of file moved first
+	if (!SetFilePointerEx(_file, size, nullptr, FILE_BEGIN) || !SetEndOfFile(_file))
+		return false;
+
+	HANDLE mapping = CreateFileMappingA(_file, nullptr, PAGE_READWRITE, static_cast<DWORD>(size.QuadPart >> 32),
+		static_cast<DWORD>(size.QuadPart & 0xFFFFFFFF), nullptr);
+
+	if (mapping == nullptr)
+		return false;
+
+	void* view = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+
+	if (view == nullptr)
+	{
+		CloseHandle(mapping);
+		return false;
+	}
+
+	_mapping = mapping;
+	_data = static_cast<char*>(view);
+	_size = size_;
+
+	return true;
+}
+
+void WritableMappedFile::unmap()
+{
+	if (_data)
+		UnmapViewOfFile(_data);
+	if (_mapping)
+		CloseHandle(_mapping);
+
+	_data = nullptr;
+	_mapping = nullptr;
+	_size = 0;
+}
+
+bool WritableMappedFile::resize(size_t size_)
+{
+	unmap();
+
+	if (!map(size_))
+	{
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+bool WritableMappedFile::flush()
+{
+	return _data != nullptr && FlushViewOfFile(_data, 0) && FlushFileBuffers(_file);
+}
+
+void WritableMappedFile::close()
+{
+	unmap();
+
+	if (_file)
+		CloseHandle(_file);
+
+	_file = nullptr;
+}
+
+#else
+
+bool MappedFile::open(const std::string& path_)
+{
+	close();
+
+	int fd = ::open(path_.c_str(), O_RDONLY);
+
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+	{
+		::close(fd);
+		return false;
+	}
+
+	void* view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+
+	if (view == MAP_FAILED)
+	{
+		::close(fd);
+		return false;
+	}
+
+	madvise(view, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL); // parsed front to back once
+
+	_fd = fd;
+	_data = static_cast<const char*>(view);
+	_size = static_cast<size_t>(st.st_size);
+
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (_data)
+		munmap(const_cast<char*>(_data), _size);
+	if (_fd >= 0)
+		::close(_fd);
+
+	_data = nullptr;
+	_fd = -1;
+	_size = 0;
+}
+
+bool WritableMappedFile::open(const std::string& path_, size_t minsize_)
+{
+	close();
+
+	int fd = ::open(path_.c_str(), O_RDWR | O_CREAT, 0644);
+
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+	{
+		::close(fd);
+		return false;
+	}
+
+	_fd = fd;
+
+	if (!map(std::max(minsize_, static_cast<size_t>(st.st_size))))
+	{
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+bool WritableMappedFile::map(size_t size_)
+{
+	struct stat st;
+
+	if (fstat(_fd, &st) != 0 || (static_cast<size_t>(st.st_size) != size_ && ftruncate(_fd, static_cast<off_t>(size_)) != 0))
+		return false;
+
+	void* view = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+
+	if (view == MAP_FAILED)
+		return false;
+
+	_data = static_cast<char*>(view);
+	_size = size_;
+
+	return true;
+}
+
+void WritableMappedFile::unmap()
+{
+	if (_data)
+		munmap(_data, _size);
+
+	_data = nullptr;
+	_size = 0;
+}
+
+bool WritableMappedFile::resize(size_t size_)
+{
+	unmap();
+
+	if (!map(size_))
+	{
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+bool WritableMappedFile::flush()
+{
+	return _data != nullptr && msync(_data, _size, MS_SYNC) == 0;
+}
+
+void WritableMappedFile::close()
+{
+	unmap();
+
+	if (_fd >= 0)
+		::close(_fd);
+
+	_fd = -1;
+}
+
+#endif
+
+bool User::SyncFile(std::FILE* file_)
+{
+#ifdef _WIN32
+	return std::fflush(file_) == 0 && SyncFile(_fileno(file_));
+#else
+	return std::fflush(file_) == 0 && SyncFile(fileno(file_));
+#endif
+}
+
+bool User::SyncFile(int fd_)
+{
+#if defined(_WIN32)
+	return _commit(fd_) == 0;
+#elif defined(__APPLE__)
+	return fsync(fd_) == 0;
+#else
+	return fdatasync(fd_) == 0;
+#endif
+}
+
+bool User::RenameOver(const std::string& from_, const std::string& to_)
+{
+#ifdef _WIN32
+	return MoveFileExA(from_.c_str(), to_.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return std::rename(from_.c_str(), to_.c_str()) == 0;
+#endif
+}
@@ -0,0 +1,454 @@
+#include "mappedstore.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+using namespace User;
+
+namespace
+{
+	constexpr uint64_t ERASEDENTRY = UINT64_MAX;
+	constexpr size_t RECORDHEADER = 3 * sizeof(uint32_t);
+
+	MappedStoreHeader& Header(const WritableMappedFile& file_)
+	{
+		return *reinterpret_cast<MappedStoreHeader*>(file_.data());
+	}
+
+	MappedStoreSlot* Slots(const WritableMappedFile& file_)
+	{
+		return reinterpret_cast<MappedStoreSlot*>(file_.data() + sizeof(MappedStoreHeader));
+	}
+
+	char* Heap(const WritableMappedFile& file_)
+	{
+		return file_.data() + sizeof(MappedStoreHeader) + Header(file_).capacity * sizeof(MappedStoreSlot);
+	}
+
+	uint64_t HeapCapacity(const WritableMappedFile& file_)
+	{
+		return file_.size() - sizeof(MappedStoreHeader) - Header(file_).capacity * sizeof(MappedStoreSlot);
+	}
+
+	size_t FileSize(uint64_t capacity_, uint64_t heapbytes_)
+	{
+		return static_cast<size_t>(sizeof(MappedStoreHeader) + capacity_ * sizeof(MappedStoreSlot) + heapbytes_);
+	}
+
+	// Slots for count_ contacts at half load at most
+	uint64_t CapacityFor(uint64_t count_)
+	{
+		uint64_t capacity = MappedContactStore::MINCAPACITY;
+		while (capacity < 2 * count_)
+			capacity *= 2;
+		return capacity;
+	}
+
+	uint64_t RecordSize(const char* record_)
+	{
+		uint32_t sizes[3];
+		std::memcpy(sizes, record_, sizeof(sizes));
+
+		return RECORDHEADER + uint64_t(sizes[0]) + sizes[1] + sizes[2];
+	}
+
+	bool RecordEquals(const char* record_, std::string_view first_, std::string_view last_, std::string_view phone_)
+	{
+		uint32_t sizes[3];
+		std::memcpy(sizes, record_, sizeof(sizes));
+
+		if (sizes[0] != first_.size() || sizes[1] != last_.size() || sizes[2] != phone_.size())
+			return false;
+
+		const char* text = record_ + RECORDHEADER;
+
+		return std::memcmp(text, first_.data(), first_.size()) == 0 && std::memcmp(text + sizes[0], last_.data(), last_.size()) == 0
+			&& std::memcmp(text + sizes[0] + sizes[1], phone_.data(), phone_.size()) == 0;
+	}
+
+	// Slot of the contact or of the first free slot of its probe sequence ( found_ tells which ), the table always
+	// has an empty slot
+	uint64_t Probe(const WritableMappedFile& file_, uint64_t hash_, std::string_view first_, std::string_view last_, std::string_view phone_,
+		bool& found_)
+	{
+		const MappedStoreSlot* slots = Slots(file_);
+		const char* heap = Heap(file_);
+		uint64_t mask = Header(file_).capacity - 1;
+		uint64_t freeslot = UINT64_MAX;
+
+		for (uint64_t ii = hash_ & mask; ; ii = (ii + 1) & mask)
+		{
+			uint64_t entry = slots[ii].entry;
+
+			if (entry == 0)
+			{
+				found_ = false;
+				return freeslot != UINT64_MAX ? freeslot : ii;
+			}
+
+			if (entry == ERASEDENTRY)
+			{
+				if (freeslot == UINT64_MAX)
+					freeslot = ii;
+			}
+			else if (slots[ii].hash == hash_ && RecordEquals(heap + entry - 1, first_, last_, phone_))
+			{
+				found_ = true;
+				return ii;
+			}
+		}
+	}
+}
+
+bool MappedContactStore::open(const std::string& path_, size_t stripes_)
+{
+	close();
+
+	uint32_t stripes = static_cast<uint32_t>(std::max<size_t>(1, stripes_));
+	bool existing = false;
+
+	// the number of files is the one the store was created with
+	{
+		MappedFile first;
+
+		if (first.open(path_ + ".0"))
+		{
+			MappedStoreHeader header;
+
+			if (first.size() < sizeof(header))
+				return false;
+
+			std::memcpy(&header, first.data(), sizeof(header));
+
+			if (std::memcmp(header.magic, MAPPEDSTOREMAGIC, sizeof(header.magic)) != 0 || header.stripes == 0)
+				return false;
+
+			stripes = header.stripes;
+			existing = true;
+		}
+	}
+
+	_stripes.reserve(stripes);
+
+	for (uint32_t ii = 0; ii < stripes; ++ii)
+	{
+		_stripes.push_back(std::make_unique<Stripe>());
+		_stripes.back()->path = path_ + "." + std::to_string(ii);
+
+		if (!openstripe(*_stripes.back(), ii, stripes, existing))
+		{
+			_stripes.clear();
+			return false;
+		}
+	}
+
+	_rewrites = 0;
+	_loaded = 0;
+	_failed = false;
+
+	return true;
+}
+
+bool MappedContactStore::openstripe(Stripe& stripe_, uint32_t index_, uint32_t stripes_, bool existing_)
+{
+	if (!stripe_.file.open(stripe_.path, FileSize(MINCAPACITY, MINHEAP)))
+		return false;
+
+	MappedStoreHeader& header = Header(stripe_.file);
+
+	if (header.magic[0] == 0 && header.version == 0)
+	{
+		if (existing_)
+			return false; // a file of the store is missing
+
+		std::memcpy(header.magic, MAPPEDSTOREMAGIC, sizeof(header.magic));
+		header.version = MAPPEDSTOREVERSION;
+		header.stripe = index_;
+		header.stripes = stripes_;
+		header.capacity = MINCAPACITY;
+		header.seed = MAPPEDSTORESEED;
+		header.clean = 1;
+	}
+
+	if (std::memcmp(header.magic, MAPPEDSTOREMAGIC, sizeof(header.magic)) != 0 || header.version != MAPPEDSTOREVERSION
+		|| header.seed != MAPPEDSTORESEED || header.stripe != index_ || header.stripes != stripes_
+		|| header.capacity == 0 || (header.capacity & (header.capacity - 1)) != 0
+		|| header.capacity > (stripe_.file.size() - sizeof(MappedStoreHeader)) / sizeof(MappedStoreSlot)
+		|| header.heapsize > HeapCapacity(stripe_.file))
+		return false;
+
+	if (header.clean == 0)
+		recover(stripe_);
+
+	header.clean = 0; // until close
+	return true;
+}
+
+// The process died with the file open: counts are taken from the slots again, slots whose strings are not
+// within the heap in use ( a crash while they were written ) are erased
+void MappedContactStore::recover(Stripe& stripe_)
+{
+	MappedStoreHeader& header = Header(stripe_.file);
+	MappedStoreSlot* slots = Slots(stripe_.file);
+	const char* heap = Heap(stripe_.file);
+	uint64_t livebytes = 0;
+
+	header.count = 0;
+	header.erased = 0;
+
+	for (uint64_t ii = 0; ii < header.capacity; ++ii)
+	{
+		uint64_t entry = slots[ii].entry;
+
+		if (entry == 0)
+			continue;
+
+		if (entry != ERASEDENTRY && (entry - 1 > header.heapsize || header.heapsize - (entry - 1) < RECORDHEADER
+			|| header.heapsize - (entry - 1) < RecordSize(heap + entry - 1)))
+			slots[ii].entry = ERASEDENTRY;
+
+		if (slots[ii].entry == ERASEDENTRY)
+			++header.erased;
+		else
+		{
+			++header.count;
+			livebytes += RecordSize(heap + entry - 1);
+		}
+	}
+
+	header.deadbytes = header.heapsize - livebytes;
+}
+
+void MappedContactStore::close()
+{
+	for (auto& stripe : _stripes)
+	{
+		std::lock_guard<std::mutex> lk(stripe->mut);
+
+		if (!stripe->file.isopen())
+			continue;
+
+		// the pages first, the file is marked closed only once they are on disk
+		if (stripe->file.flush())
+		{
+			Header(stripe->file).clean = 1;
+			stripe->file.flush();
+		}
+
+		stripe->file.close();
+	}
+
+	_stripes.clear();
+}
+
+// Writes the live contacts of the stripe to a new file with capacity_ slots and room for heapbytes_, which
+// replaces the old one. Called with the stripe locked
+bool MappedContactStore::rewrite(Stripe& stripe_, uint64_t capacity_, uint64_t heapbytes_)
+{
+	std::string temp = stripe_.path + ".tmp";
+	WritableMappedFile out;
+
+	std::remove(temp.c_str());
+
+	bool ok = out.open(temp, FileSize(capacity_, heapbytes_));
+
+	if (ok)
+	{
+		const MappedStoreHeader& old = Header(stripe_.file);
+		const MappedStoreSlot* oldslots = Slots(stripe_.file);
+		const char* oldheap = Heap(stripe_.file);
+
+		MappedStoreHeader& header = Header(out);
+		std::memcpy(&header, &old, sizeof(header));
+		header.capacity = capacity_;
+		header.count = 0;
+		header.erased = 0;
+		header.heapsize = 0;
+		header.deadbytes = 0;
+
+		MappedStoreSlot* slots = Slots(out);
+		char* heap = Heap(out);
+		uint64_t mask = capacity_ - 1;
+
+		for (uint64_t ii = 0; ii < old.capacity; ++ii)
+		{
+			uint64_t entry = oldslots[ii].entry;
+
+			if (entry == 0 || entry == ERASEDENTRY)
+				continue;
+
+			uint64_t size = RecordSize(oldheap + entry - 1);
+			uint64_t slot = oldslots[ii].hash & mask;
+
+			while (slots[slot].entry != 0)
+				slot = (slot + 1) & mask;
+
+			std::memcpy(heap + header.heapsize, oldheap + entry - 1, size);
+			slots[slot].hash = oldslots[ii].hash;
+			slots[slot].entry = header.heapsize + 1;
+			header.heapsize += size;
+			++header.count;
+		}
+
+		ok = out.flush();
+		out.close();
+	}
+
+	// the old file is closed first, Windows cannot replace a file that is mapped
+	stripe_.file.close();
+	ok = ok && RenameOver(temp, stripe_.path);
+
+	if (!ok)
+		std::remove(temp.c_str());
+
+	if (!stripe_.file.open(stripe_.path, 0))
+		ok = false;
+
+	if (!ok)
+		_failed = true;
+	else
+		++_rewrites;
+
+	return ok;
+}
+
+bool MappedContactStore::insert(std::string_view first_, std::string_view last_, std::string_view phone_)
+{
+	uint64_t hash = MappedStoreHash(first_, last_, phone_);
+	Stripe& stripe = *_stripes[stripeof(hash)];
+	std::lock_guard<std::mutex> lk(stripe.mut);
+
+	if (_failed || !stripe.file.isopen())
+		return false;
+
+	bool found;
+	Probe(stripe.file, hash, first_, last_, phone_, found);
+
+	if (found)
+		return false;
+
+	uint64_t size = RECORDHEADER + first_.size() + last_.size() + phone_.size();
+
+	{
+		const MappedStoreHeader& header = Header(stripe.file);
+
+		// the table stays at 3/4 load at most, erased slots included
+		if ((header.count + header.erased + 1) * 4 > header.capacity * 3)
+		{
+			uint64_t live = header.heapsize - header.deadbytes;
+
+			if (!rewrite(stripe, CapacityFor(header.count + 1), std::max<uint64_t>(MINHEAP, 2 * (live + size))))
+				return false;
+		}
+		else if (header.heapsize + size > HeapCapacity(stripe.file))
+		{
+			// the heap is the end of the file, it grows in place
+			uint64_t heapbytes = std::max(2 * HeapCapacity(stripe.file), header.heapsize + size);
+
+			if (!stripe.file.resize(FileSize(header.capacity, heapbytes)))
+			{
+				_failed = true;
+				stripe.file.open(stripe.path, 0);
+				return false;
+			}
+		}
+	}
+
+	MappedStoreHeader& header = Header(stripe.file);
+	MappedStoreSlot* slots = Slots(stripe.file);
+	char* record = Heap(stripe.file) + header.heapsize;
+	uint32_t sizes[3] = { static_cast<uint32_t>(first_.size()), static_cast<uint32_t>(last_.size()), static_cast<uint32_t>(phone_.size()) };
+
+	std::memcpy(record, sizes, sizeof(sizes));
+	std::memcpy(record + RECORDHEADER, first_.data(), first_.size());
+	std::memcpy(record + RECORDHEADER + first_.size(), last_.data(), last_.size());
+	std::memcpy(record + RECORDHEADER + first_.size() + last_.size(), phone_.data(), phone_.size());
+
+	uint64_t offset = header.heapsize;
+	header.heapsize += size;
+
+	// the slot is published by its entry, written last
+	uint64_t slot = Probe(stripe.file, hash, first_, last_, phone_, found);
+
+	if (slots[slot].entry == ERASEDENTRY)
+		--header.erased;
+
+	slots[slot].hash = hash;
+	slots[slot].entry = offset + 1;
+	++header.count;
+
+	return true;
+}
+
+bool MappedContactStore::erase(std::string_view first_, std::string_view last_, std::string_view phone_)
+{
+	uint64_t hash = MappedStoreHash(first_, last_, phone_);
+	Stripe& stripe = *_stripes[stripeof(hash)];
+	std::lock_guard<std::mutex> lk(stripe.mut);
+
+	if (_failed || !stripe.file.isopen())
+		return false;
+
+	bool found;
+	uint64_t slot = Probe(stripe.file, hash, first_, last_, phone_, found);
+
+	if (!found)
+		return false;
+
+	MappedStoreHeader& header = Header(stripe.file);
+	MappedStoreSlot* slots = Slots(stripe.file);
+
+	header.deadbytes += RecordSize(Heap(stripe.file) + slots[slot].entry - 1);
+	slots[slot].entry = ERASEDENTRY;
+	--header.count;
+	++header.erased;
+
+	// mostly erased: the file is written again with the live contacts only
+	if (header.deadbytes > MINHEAP && header.deadbytes * 2 > header.heapsize)
+	{
+		uint64_t live = header.heapsize - header.deadbytes;
+		rewrite(stripe, CapacityFor(header.count), std::max<uint64_t>(MINHEAP, 2 * live));
+	}
+
+	return true;
+}
+
+bool MappedContactStore::flush()
+{
+	bool ok = !_failed;
+
+	for (auto& stripe : _stripes)
+	{
+		std::lock_guard<std::mutex> lk(stripe->mut);
+		ok = stripe->file.isopen() && stripe->file.flush() && ok;
+	}
+
+	return ok;
+}
+
+mapped_store_stats MappedContactStore::stats() const
+{
+	mapped_store_stats stats;
+
+	stats.stripes = _stripes.size();
+	stats.rewrites = _rewrites;
+	stats.loaded = _loaded;
+	stats.failed = _failed;
+
+	for (const auto& stripe : _stripes)
+	{
+		std::lock_guard<std::mutex> lk(stripe->mut);
+
+		if (!stripe->file.isopen())
+			continue;
+
+		const MappedStoreHeader& header = Header(stripe->file);
+
+		stats.contacts += static_cast<size_t>(header.count);
+		stats.deadbytes += static_cast<size_t>(header.deadbytes);
+		stats.filebytes += stripe->file.size();
+	}
+
+	return stats;
+}
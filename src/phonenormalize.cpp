@@ -0,0 +1,202 @@
+#include "phonenormalize.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CONTACT_SIMD_SSE2
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+using namespace User;
+
+namespace
+{
+	constexpr size_t BLOCK = 16;
+	constexpr size_t MAXRAWDIGITS = 2 + E164MAXDIGITS; // with the "00" international prefix
+	constexpr size_t MINNATIONALDIGITS = 4;
+	constexpr size_t NANPDIGITS = 10;
+
+	// Bit i stands for char i of a block
+	struct CharClasses
+	{
+		uint32_t digits;
+		uint32_t separators;
+		uint32_t plus;
+	};
+
+#if defined(CONTACT_SIMD_SSE2)
+	CharClasses Classify(const char* block_)
+	{
+		__m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block_));
+
+		// signed compares, bytes >= 0x80 are negative and never digits
+		__m128i digits = _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(chars, _mm_set1_epi8('9' + 1)));
+		__m128i separators = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(chars, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(chars, _mm_set1_epi8('-'))),
+			_mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(chars, _mm_set1_epi8('(')), _mm_cmpeq_epi8(chars, _mm_set1_epi8(')'))),
+				_mm_or_si128(_mm_cmpeq_epi8(chars, _mm_set1_epi8('.')), _mm_cmpeq_epi8(chars, _mm_set1_epi8('/')))));
+
+		return CharClasses{ static_cast<uint32_t>(_mm_movemask_epi8(digits)), static_cast<uint32_t>(_mm_movemask_epi8(separators)),
+			static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(chars, _mm_set1_epi8('+')))) };
+	}
+#else
+	CharClasses Classify(const char* block_)
+	{
+		CharClasses classes{ 0, 0, 0 };
+
+		for (size_t ii = 0; ii < BLOCK; ++ii)
+		{
+			char ch = block_[ii];
+
+			classes.digits |= static_cast<uint32_t>(ch >= '0' && ch <= '9') << ii;
+			classes.separators |= static_cast<uint32_t>(ch == ' ' || ch == '-' || ch == '(' || ch == ')' || ch == '.' || ch == '/') << ii;
+			classes.plus |= static_cast<uint32_t>(ch == '+') << ii;
+		}
+
+		return classes;
+	}
+#endif
+
+	size_t LowestBit(uint32_t mask_) // mask_ != 0
+	{
+#if defined(_MSC_VER)
+		unsigned long bit;
+		_BitScanForward(&bit, mask_);
+		return bit;
+#else
+		return static_cast<size_t>(__builtin_ctz(mask_));
+#endif
+	}
+
+	// Digits of the country code at the start of an international number. Codes are prefix free: 1 and 7 stand
+	// alone, the assigned 2 digit codes are listed by first digit ( bit n for second digit n ), all others have 3
+	size_t CountryCodeLength(const char* digits_)
+	{
+		static const uint16_t TWODIGIT[10] = {
+			0, 0,
+			(1 << 0) | (1 << 7), // 20, 27
+			(1 << 0) | (1 << 1) | (1 << 2) | (1 << 3) | (1 << 4) | (1 << 6) | (1 << 9), // 30 - 34, 36, 39
+			(1 << 0) | (1 << 1) | (1 << 3) | (1 << 4) | (1 << 5) | (1 << 6) | (1 << 7) | (1 << 8) | (1 << 9), // 40, 41, 43 - 49
+			(1 << 1) | (1 << 2) | (1 << 3) | (1 << 4) | (1 << 5) | (1 << 6) | (1 << 7) | (1 << 8), // 51 - 58
+			(1 << 0) | (1 << 1) | (1 << 2) | (1 << 3) | (1 << 4) | (1 << 5) | (1 << 6), // 60 - 66
+			0,
+			(1 << 1) | (1 << 2) | (1 << 4) | (1 << 6), // 81, 82, 84, 86
+			(1 << 0) | (1 << 1) | (1 << 2) | (1 << 3) | (1 << 4) | (1 << 5) | (1 << 8) // 90 - 95, 98
+		};
+
+		if (digits_[0] == '1' || digits_[0] == '7')
+			return 1;
+
+		return (TWODIGIT[digits_[0] - '0'] >> (digits_[1] - '0')) & 1 ? 2 : 3;
+	}
+}
+
+size_t User::NormalizePhone(std::string_view phone_, unsigned int defaultcountry_, char* buffer_)
+{
+	char digits[MAXRAWDIGITS];
+	size_t count = 0;
+	bool plus = false;
+
+	for (size_t pos = 0; pos < phone_.size(); pos += BLOCK)
+	{
+		const char* chars = phone_.data() + pos;
+		char block[BLOCK];
+
+		if (phone_.size() - pos < BLOCK)
+		{
+			// the last block is padded with separators, they drop out like the formatting
+			std::memset(block, ' ', BLOCK);
+			std::memcpy(block, chars, phone_.size() - pos);
+			chars = block;
+		}
+
+		CharClasses classes = Classify(chars);
+
+		if ((classes.digits | classes.separators | classes.plus) != 0xFFFF)
+			return 0; // letters, extensions, other punctuation
+
+		if (classes.plus != 0)
+		{
+			// a single '+' ahead of every digit
+			if (plus || count != 0 || (classes.plus & (classes.plus - 1)) != 0 || (classes.digits & (classes.plus - 1)) != 0)
+				return 0;
+
+			plus = true;
+		}
+
+		for (uint32_t mask = classes.digits; mask != 0; mask &= mask - 1)
+		{
+			if (count == MAXRAWDIGITS)
+				return 0;
+
+			digits[count++] = chars[LowestBit(mask)];
+		}
+	}
+
+	const char* number = digits;
+	size_t country; // digits of the country code
+	size_t national; // digits of the national number
+	size_t size = 1;
+
+	buffer_[0] = '+';
+
+	if (!plus && count >= 2 && digits[0] == '0' && digits[1] == '0')
+	{
+		plus = true; // international prefix
+		number += 2;
+		count -= 2;
+	}
+
+	if (plus)
+	{
+		if (count < 2 || number[0] == '0' || count > E164MAXDIGITS)
+			return 0;
+
+		country = CountryCodeLength(number);
+		national = count > country ? count - country : 0;
+	}
+	else
+	{
+		if (defaultcountry_ == 0 || defaultcountry_ > 999 || count == 0)
+			return 0;
+
+		// trunk prefix of a national number
+		if (number[0] == '0' || (defaultcountry_ == 1 && count == NANPDIGITS + 1 && number[0] == '1'))
+		{
+			++number;
+			--count;
+		}
+
+		char code[3];
+		country = 0;
+		for (unsigned int value = defaultcountry_; value != 0; value /= 10)
+			code[country++] = static_cast<char>('0' + value % 10);
+
+		if (country + count > E164MAXDIGITS)
+			return 0;
+
+		for (size_t ii = country; ii > 0; --ii)
+			buffer_[size++] = code[ii - 1];
+
+		national = count;
+	}
+
+	if (national < MINNATIONALDIGITS)
+		return 0;
+
+	std::memcpy(buffer_ + size, number, count);
+	size += count;
+
+	// NANP: 10 digit national numbers, area codes do not start with 0 or 1
+	if (country == 1 && buffer_[1] == '1' && (national != NANPDIGITS || buffer_[2] < '2'))
+		return 0;
+
+	return size;
+}
@@ -0,0 +1,1666 @@
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <algorithm>
+#include <unordered_set>
+
+#include "Contact.h"
+#include "editdistance.h"
+
+using namespace User;
+
+// Benchmarks are not part of the regular test run, they build to their own binary ( ContactBench.vcxproj ).
+// Start it with [name] to run all of them, or only those whose name contains the given string
+
+void RunShardContentionBenchmark();
+void RunFileLoadBenchmark();
+void RunParallelLoadBenchmark();
+void RunEventQueueBenchmark();
+void RunBatchObserverBenchmark();
+void RunEventAllocationBenchmark();
+void RunSecondaryIndexBenchmark();
+void RunPhonePrefixBenchmark();
+void RunPagingBenchmark();
+void RunFuzzySearchBenchmark();
+void RunHashPolicyBenchmark();
+void RunFlatMapBenchmark();
+void RunContactArenaBenchmark();
+void RunNameDictionaryBenchmark();
+void RunPhoneKeyBenchmark();
+void RunPhoneNormalizationBenchmark();
+void RunSnapshotBenchmark();
+void RunWriteAheadLogBenchmark();
+void RunExportBenchmark();
+void RunSyncBenchmark();
+void RunMappedStoreBenchmark();
+
+void RunBenchmarks(const std::string& filter_)
+{
+	const std::pair<const char*, void(*)()> benchmarks[] = {
+		{ "shard", RunShardContentionBenchmark },
+		{ "fileload", RunFileLoadBenchmark },
+		{ "parallelload", RunParallelLoadBenchmark },
+		{ "queue", RunEventQueueBenchmark },
+		{ "batchobserver", RunBatchObserverBenchmark },
+		{ "eventalloc", RunEventAllocationBenchmark },
+		{ "index", RunSecondaryIndexBenchmark },
+		{ "phoneprefix", RunPhonePrefixBenchmark },
+		{ "paging", RunPagingBenchmark },
+		{ "fuzzy", RunFuzzySearchBenchmark },
+		{ "hash", RunHashPolicyBenchmark },
+		{ "flatmap", RunFlatMapBenchmark },
+		{ "arena", RunContactArenaBenchmark },
+		{ "names", RunNameDictionaryBenchmark },
+		{ "phonekey", RunPhoneKeyBenchmark },
+		{ "normalize", RunPhoneNormalizationBenchmark },
+		{ "snapshot", RunSnapshotBenchmark },
+		{ "wal", RunWriteAheadLogBenchmark },
+		{ "export", RunExportBenchmark },
+		{ "sync", RunSyncBenchmark },
+		{ "mappedstore", RunMappedStoreBenchmark },
+	};
+
+	for (const auto& bench : benchmarks)
+	{
+		if (filter_.empty() || std::string(bench.first).find(filter_) != std::string::npos)
+			bench.second();
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	RunBenchmarks(argc > 1 ? argv[1] : "");
+
+	return 0;
+}
+
+// Heap usage of the whole binary while g_countallocs is set. Replacing operator new is why the benchmarks are a
+// binary of their own ( ContactBench.vcxproj ), the tests run on the default allocator, used to measure the bytes allocated per event
+static std::atomic<bool> g_countallocs{ false };
+static std::atomic<uint64_t> g_allocs{ 0 };
+static std::atomic<uint64_t> g_allocbytes{ 0 };
+
+void* operator new(size_t size_)
+{
+	if (g_countallocs.load(std::memory_order_relaxed))
+	{
+		g_allocs.fetch_add(1, std::memory_order_relaxed);
+		g_allocbytes.fetch_add(size_, std::memory_order_relaxed);
+	}
+
+	void* ptr = std::malloc(size_ ? size_ : 1);
+	if (ptr == nullptr)
+		throw std::bad_alloc();
+
+	return ptr;
+}
+
+void operator delete(void* ptr_) noexcept
+{
+	std::free(ptr_);
+}
+
+void operator delete(void* ptr_, size_t) noexcept
+{
+	std::free(ptr_);
+}
+
+static double ElapsedMs(std::chrono::steady_clock::time_point start_)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_).count();
+}
+
+// Writes count_ unique contacts as a JSON array in the format loadContactsFromJSON accepts
+static void WriteBenchJSON(const std::string& path_, size_t count_)
+{
+	std::ofstream out(path_, std::ios::binary);
+
+	out << "[";
+	for (size_t ii = 0; ii < count_; ++ii)
+	{
+		out << (ii ? ",\n" : "\n") << "{\"first\" : \"First" << ii % 5000 << "\",\"last\" : \"Last" << ii / 5000
+			<< "\",\"phone\" : \"+1" << 6170000000ULL + ii << "\"}";
+	}
+	out << "]\n";
+}
+
+// Synthetic unique contact, thread id and sequence number keep every contact distinct
+static Contact MakeBenchContact(size_t thread_, size_t seq_)
+{
+	return Contact("First" + std::to_string(seq_), "Last" + std::to_string(thread_), "+1617" + std::to_string(thread_ * 10000000 + seq_));
+}
+
+// Measures addContact throughput with 1 to 64 writer threads, for a single locked store ( 1 shard, the
+// previous single _contactmutex behaviour ) and for a sharded store
+void RunShardContentionBenchmark()
+{
+	constexpr size_t PERTHREAD = 20000;
+	const size_t shardconfigs[] = { 1, DEFAULTSHARDS, 64 };
+	const size_t threadconfigs[] = { 1, 2, 4, 8, 16, 32, 64 };
+
+	std::cout << "\n\nShard contention benchmark, " << PERTHREAD << " adds per writer thread";
+	std::cout << "\nshards\twriters\tms\tadds/sec";
+
+	for (size_t shards : shardconfigs)
+	{
+		for (size_t writers : threadconfigs)
+		{
+			Contacts mycontact(false, shards);
+
+			// pre build the contacts so that only the store is measured
+			std::vector<std::vector<Contact>> input(writers);
+			for (size_t tt = 0; tt < writers; ++tt)
+			{
+				input[tt].reserve(PERTHREAD);
+				for (size_t ii = 0; ii < PERTHREAD; ++ii)
+					input[tt].push_back(MakeBenchContact(tt, ii));
+			}
+
+			std::atomic<bool> go{ false };
+			std::vector<std::thread> threads;
+
+			for (size_t tt = 0; tt < writers; ++tt)
+			{
+				threads.emplace_back([&mycontact, &input, &go, tt]()
+				{
+					while (!go)
+						std::this_thread::yield();
+
+					for (const auto& contact : input[tt])
+						mycontact.addContact(contact);
+				});
+			}
+
+			auto start = std::chrono::steady_clock::now();
+			go = true;
+
+			for (auto& th : threads)
+				th.join();
+
+			auto elapsed = ElapsedMs(start);
+			double rate = (writers * PERTHREAD) / (elapsed / 1000.0);
+
+			std::cout << "\n" << shards << "\t" << writers << "\t" << elapsed << "\t" << static_cast<uint64_t>(rate);
+		}
+	}
+
+	std::cout << "\n";
+}
+
+// Compares reading a file into a std::string + loadContactsFromJSON against loadContactsFromFile
+void RunFileLoadBenchmark()
+{
+	const size_t sizes[] = { 1000000, 10000000 };
+	const std::string path = "bench_contacts.json";
+
+	std::cout << "\n\nFile load benchmark";
+	std::cout << "\ncontacts\tstring ms\tfile ms";
+
+	for (size_t size : sizes)
+	{
+		WriteBenchJSON(path, size);
+
+		double stringms = 0, filems = 0;
+		size_t stringcount = 0, filecount = 0;
+
+		{
+			Contacts mycontact;
+			auto start = std::chrono::steady_clock::now();
+
+			std::ifstream in(path, std::ios::binary);
+			std::stringstream buffer;
+			buffer << in.rdbuf();
+			mycontact.loadContactsFromJSON(buffer.str(), stringcount);
+
+			stringms = ElapsedMs(start);
+		}
+
+		{
+			Contacts mycontact;
+			auto start = std::chrono::steady_clock::now();
+
+			mycontact.loadContactsFromFile(path, filecount);
+
+			filems = ElapsedMs(start);
+		}
+
+		std::cout << "\n" << size << "\t" << stringms << "\t" << filems;
+
+		if (stringcount != size || filecount != size)
+			std::cout << "\tCOUNT MISMATCH " << stringcount << " / " << filecount;
+	}
+
+	std::remove(path.c_str());
+	std::cout << "\n";
+}
+
+// Load time of loadContactsFromFileParallel for 1 worker up to the core count
+void RunParallelLoadBenchmark()
+{
+	constexpr size_t CONTACTS = 5000000;
+	const std::string path = "bench_contacts.json";
+	unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+
+	WriteBenchJSON(path, CONTACTS);
+
+	std::cout << "\n\nParallel load benchmark, " << CONTACTS << " contacts";
+	std::cout << "\nworkers\tms\tspeedup";
+
+	double baseline = 0;
+
+	for (unsigned int workers = 1; ; workers = std::min(workers * 2, cores))
+	{
+		Contacts mycontact;
+		size_t count = 0;
+		auto start = std::chrono::steady_clock::now();
+
+		mycontact.loadContactsFromFileParallel(path, count, workers);
+
+		double elapsed = ElapsedMs(start);
+		if (workers == 1)
+			baseline = elapsed;
+
+		std::cout << "\n" << workers << "\t" << elapsed << "\t" << baseline / elapsed;
+
+		if (count != CONTACTS)
+			std::cout << "\tCOUNT MISMATCH " << count;
+
+		if (workers == cores)
+			break;
+	}
+
+	std::remove(path.c_str());
+	std::cout << "\n";
+}
+
+// Pushes events from producers_ threads and pops them on consumers_ threads, returns events per second
+template <typename Queue>
+static double QueueThroughput(Queue& queue_, size_t producers_, size_t consumers_, size_t perproducer_)
+{
+	size_t total = producers_ * perproducer_;
+	std::atomic<size_t> popped{ 0 };
+	std::vector<std::thread> threads;
+	auto start = std::chrono::steady_clock::now();
+
+	for (size_t cc = 0; cc < consumers_; ++cc)
+	{
+		threads.emplace_back([&queue_, &popped, total]()
+		{
+			ContactEventMsg msg;
+
+			while (popped < total)
+			{
+				if (queue_.try_pop(msg))
+					++popped;
+				else
+					std::this_thread::yield();
+			}
+		});
+	}
+
+	for (size_t pp = 0; pp < producers_; ++pp)
+	{
+		threads.emplace_back([&queue_, perproducer_, pp]()
+		{
+			ContactEventMsg msg("First", "Last" + std::to_string(pp), "+16170000001", ContactEvents::ADD);
+
+			for (size_t ii = 0; ii < perproducer_; ++ii)
+				queue_.push(msg);
+		});
+	}
+
+	for (auto& th : threads)
+		th.join();
+
+	return total / (ElapsedMs(start) / 1000.0);
+}
+
+// threadsafe_queue ( mutex + notify per push ) against lockfree_queue for the notification events
+void RunEventQueueBenchmark()
+{
+	constexpr size_t PERPRODUCER = 200000;
+	const size_t configs[][2] = { { 1, 1 }, { 2, 2 }, { 4, 1 }, { 4, 4 }, { 8, 8 } };
+
+	std::cout << "\n\nEvent queue benchmark, " << PERPRODUCER << " events per producer";
+	std::cout << "\nproducers\tconsumers\tthreadsafe_queue ev/s\tlockfree_queue ev/s";
+
+	for (const auto& config : configs)
+	{
+		threadsafe_queue<ContactEventMsg> locked;
+		lockfree_queue<ContactEventMsg> lockfree(DEFAULTQUEUECAPACITY, QueueFullPolicy::BLOCK);
+
+		double lockedrate = QueueThroughput(locked, config[0], config[1], PERPRODUCER);
+		double lockfreerate = QueueThroughput(lockfree, config[0], config[1], PERPRODUCER);
+
+		std::cout << "\n" << config[0] << "\t" << config[1] << "\t" << static_cast<uint64_t>(lockedrate)
+			<< "\t" << static_cast<uint64_t>(lockfreerate);
+	}
+
+	std::cout << "\n";
+}
+
+// Counts the contacts delivered one callback at a time
+class BenchEventObserver : public ContactObserver
+{
+public:
+	std::atomic<size_t> count{ 0 };
+
+	virtual void OnContactAdded(const ContactView& contact_) override { count++; }
+};
+
+// Counts the contacts delivered in batches
+class BenchBatchObserver : public ContactBatchObserver
+{
+public:
+	std::atomic<size_t> count{ 0 };
+
+	virtual void OnContactsAdded(Span<const ContactView> contacts_) override { count += contacts_.size(); }
+};
+
+// Time from the first addContact until the observer has seen every contact, returns events per second
+template <typename Observer, typename... Args>
+static double ObserverThroughput(size_t contacts_, Args&&... args_)
+{
+	Observer observer;
+	NotifyConfig notify;
+	notify.observerqueuecapacity = contacts_; // nothing blocks, only delivery is measured
+	Contacts mycontact(false, DEFAULTSHARDS, notify);
+
+	mycontact.registerObserver(&observer, std::forward<Args>(args_)...);
+
+	std::vector<Contact> input;
+	input.reserve(contacts_);
+	for (size_t ii = 0; ii < contacts_; ++ii)
+		input.push_back(MakeBenchContact(0, ii));
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (const auto& contact : input)
+		mycontact.addContact(contact);
+
+	while (observer.count < contacts_)
+		std::this_thread::yield();
+
+	double elapsed = ElapsedMs(start);
+	mycontact.unregisterObserver(&observer);
+
+	return contacts_ / (elapsed / 1000.0);
+}
+
+// Per event ContactObserver callbacks against ContactBatchObserver with different batch sizes
+void RunBatchObserverBenchmark()
+{
+	constexpr size_t CONTACTS = 500000;
+	const size_t batchsizes[] = { 16, 256, 4096 };
+
+	std::cout << "\n\nBatch observer benchmark, " << CONTACTS << " adds";
+	std::cout << "\nobserver\tmaxbatch\tev/s";
+	std::cout << "\nper event\t1\t" << static_cast<uint64_t>(ObserverThroughput<BenchEventObserver>(CONTACTS));
+
+	for (size_t maxbatch : batchsizes)
+	{
+		BatchConfig batch;
+		batch.maxbatch = maxbatch;
+
+		std::cout << "\nbatch\t" << maxbatch << "\t" << static_cast<uint64_t>(ObserverThroughput<BenchBatchObserver>(CONTACTS, batch));
+	}
+
+	std::cout << "\n";
+}
+
+// Counts the contacts received, reads the attributes like a real observer would
+class BenchReadingObserver : public ContactObserver
+{
+public:
+	std::atomic<size_t> count{ 0 };
+
+	virtual void OnContactAdded(const ContactView& contact_) override
+	{
+		if (!contact_.getphone().empty())
+			count++;
+	}
+};
+
+// Heap bytes and allocations per addContact, from the add through the delivery to every observer. The names are
+// longer than the small string buffer so that every copy of a contact shows up as heap allocations
+void RunEventAllocationBenchmark()
+{
+	constexpr size_t CONTACTS = 100000;
+	const size_t observerconfigs[] = { 0, 1, 4 };
+
+	std::cout << "\n\nEvent allocation benchmark, " << CONTACTS << " adds";
+	std::cout << "\nobservers\tbytes/event\tallocs/event";
+
+	for (size_t observers : observerconfigs)
+	{
+		std::vector<Contact> input;
+		input.reserve(CONTACTS);
+		for (size_t ii = 0; ii < CONTACTS; ++ii)
+			input.push_back(Contact("Firstname-long-enough-" + std::to_string(ii), "Lastname-long-enough-for-the-heap",
+				"+1617" + std::to_string(1000000 + ii)));
+
+		std::vector<BenchReadingObserver> myobservers(observers);
+		Contacts mycontact(false, DEFAULTSHARDS);
+
+		for (auto& observer : myobservers)
+			mycontact.registerObserver(&observer);
+
+		g_allocs = 0;
+		g_allocbytes = 0;
+		g_countallocs = true;
+
+		for (const auto& contact : input)
+			mycontact.addContact(contact);
+
+		for (const auto& observer : myobservers)
+		{
+			while (observer.count < CONTACTS)
+				std::this_thread::yield();
+		}
+
+		g_countallocs = false;
+
+		std::cout << "\n" << observers << "\t" << static_cast<double>(g_allocbytes) / CONTACTS << "\t"
+			<< static_cast<double>(g_allocs) / CONTACTS;
+
+		for (auto& observer : myobservers)
+			mycontact.unregisterObserver(&observer);
+	}
+
+	std::cout << "\n";
+}
+
+// findByFirstName / findByLastName / findByPhone against a scan of listContacts at 10M contacts
+void RunSecondaryIndexBenchmark()
+{
+	constexpr size_t CONTACTS = 10000000;
+	constexpr size_t CHUNK = 100000;
+	constexpr size_t QUERIES = 1000;
+	constexpr size_t SCANS = 3;
+
+	std::cout << "\n\nSecondary index benchmark, " << CONTACTS << " contacts";
+
+	Contacts mycontact;
+	auto start = std::chrono::steady_clock::now();
+
+	// 5000 first names ( 2000 contacts each ), CONTACTS / 5000 last names ( 5000 contacts each ), unique phones
+	std::vector<Contact> chunk;
+	for (size_t base = 0; base < CONTACTS; base += CHUNK)
+	{
+		chunk.clear();
+		for (size_t ii = base; ii < base + CHUNK; ++ii)
+			chunk.emplace_back("First" + std::to_string(ii % 5000), "Last" + std::to_string(ii / 5000), "+1" + std::to_string(6170000000ULL + ii));
+
+		mycontact.addContacts(chunk);
+	}
+
+	std::cout << "\nload ms\t" << ElapsedMs(start);
+	std::cout << "\nquery\tmatches\tindex us/query\tscan us/query";
+
+	auto scan = [&mycontact](auto match_)
+	{
+		size_t matches = 0;
+		for (const auto& contact : mycontact.listContacts())
+			matches += match_(contact);
+		return matches;
+	};
+
+	auto run = [&](const char* name_, auto find_, auto key_, auto match_)
+	{
+		size_t matches = 0;
+		auto start = std::chrono::steady_clock::now();
+
+		for (size_t qq = 0; qq < QUERIES; ++qq)
+			matches += find_(key_(qq * 7919)).size();
+
+		double indexus = ElapsedMs(start) * 1000 / QUERIES;
+
+		start = std::chrono::steady_clock::now();
+		for (size_t qq = 0; qq < SCANS; ++qq)
+		{
+			std::string key = key_(qq * 7919);
+			scan([&key, &match_](const Contact& contact_) { return match_(contact_) == key; });
+		}
+
+		double scanus = ElapsedMs(start) * 1000 / SCANS;
+
+		std::cout << "\n" << name_ << "\t" << matches / QUERIES << "\t" << indexus << "\t" << scanus;
+	};
+
+	run("first", [&mycontact](const std::string& key_) { return mycontact.findByFirstName(key_); },
+		[](size_t ii_) { return "First" + std::to_string(ii_ % 5000); },
+		[](const Contact& contact_) { return contact_.getfirstname(); });
+
+	run("last", [&mycontact](const std::string& key_) { return mycontact.findByLastName(key_); },
+		[](size_t ii_) { return "Last" + std::to_string(ii_ % (CONTACTS / 5000)); },
+		[](const Contact& contact_) { return contact_.getlastname(); });
+
+	run("phone", [&mycontact](const std::string& key_) { return mycontact.findByPhone(key_); },
+		[](size_t ii_) { return "+1" + std::to_string(6170000000ULL + ii_ % CONTACTS); },
+		[](const Contact& contact_) { return contact_.getphone(); });
+
+	std::cout << "\n";
+}
+
+// findByPhonePrefix latency and phone trie memory at 50M contacts with random numbers, 70% +1, 20% +44, 10% +49
+void RunPhonePrefixBenchmark()
+{
+	constexpr size_t CONTACTS = 50000000;
+	constexpr size_t CHUNK = 100000;
+	constexpr size_t QUERIES = 200;
+	const char* prefixes[] = { "+1", "+1617", "+1617555", "+44", "+4420", "+49301234" };
+	const size_t limits[] = { 100, 10000 };
+
+	std::cout << "\n\nPhone prefix benchmark, " << CONTACTS << " contacts";
+
+	Contacts mycontact;
+	uint64_t state = 88172645463325252ULL;
+	std::vector<Contact> chunk;
+
+	for (size_t base = 0; base < CONTACTS; base += CHUNK)
+	{
+		chunk.clear();
+		for (size_t ii = base; ii < base + CHUNK; ++ii)
+		{
+			state ^= state << 13; // xorshift64
+			state ^= state >> 7;
+			state ^= state << 17;
+
+			size_t country = state % 10;
+			std::string phone = country < 7 ? "+1" : (country < 9 ? "+44" : "+49");
+			phone += std::to_string(1000000000ULL + (state >> 8) % 9000000000ULL);
+
+			chunk.emplace_back("First" + std::to_string(ii % 5000), "Last" + std::to_string(ii / 5000), phone);
+		}
+
+		mycontact.addContacts(chunk);
+	}
+
+	std::cout << "\ntrie bytes/contact\t" << static_cast<double>(mycontact.phonePrefixIndexMemory()) / CONTACTS;
+	std::cout << "\nprefix\tlimit\tmatches\tus/query";
+
+	for (const char* prefix : prefixes)
+	{
+		for (size_t limit : limits)
+		{
+			size_t matches = 0;
+			auto start = std::chrono::steady_clock::now();
+
+			for (size_t qq = 0; qq < QUERIES; ++qq)
+				matches = mycontact.findByPhonePrefix(prefix, limit).size();
+
+			std::cout << "\n" << prefix << "\t" << limit << "\t" << matches << "\t" << ElapsedMs(start) * 1000 / QUERIES;
+		}
+	}
+
+	std::cout << "\n";
+}
+
+// Sorted pages of listContacts( cursor, pagesize ) against materializing every contact with listContacts()
+void RunPagingBenchmark()
+{
+	constexpr size_t CONTACTS = 1000000;
+	constexpr size_t CHUNK = 100000;
+	constexpr size_t PAGESIZE = 50;
+	constexpr size_t PAGES = 2000;
+
+	std::cout << "\n\nPaging benchmark, " << CONTACTS << " contacts, " << PAGESIZE << " per page";
+
+	Contacts mycontact;
+	std::vector<Contact> chunk;
+
+	for (size_t base = 0; base < CONTACTS; base += CHUNK)
+	{
+		chunk.clear();
+		for (size_t ii = base; ii < base + CHUNK; ++ii)
+			chunk.emplace_back("First" + std::to_string(ii % 5000), "Last" + std::to_string((ii * 7919) % (CONTACTS / 100)), "+1" + std::to_string(6170000000ULL + ii));
+
+		mycontact.addContacts(chunk);
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	size_t total = mycontact.listContacts().size();
+	std::cout << "\nlistContacts() ms\t" << ElapsedMs(start) << "\t( " << total << " contacts, unsorted )";
+
+	for (SortOrder order : { SortOrder::ASCENDING, SortOrder::DESCENDING })
+	{
+		ContactCursor cursor;
+		start = std::chrono::steady_clock::now();
+
+		for (size_t pp = 0; pp < PAGES && !cursor.atend(); ++pp)
+			mycontact.listContacts(cursor, PAGESIZE, order);
+
+		std::cout << "\n" << (order == SortOrder::ASCENDING ? "ascending" : "descending") << " us/page\t" << ElapsedMs(start) * 1000 / PAGES;
+	}
+
+	const char* prefixes[] = { "Last1", "Last12", "Last1234" };
+
+	for (const char* prefix : prefixes)
+	{
+		ContactCursor cursor;
+		size_t pages = 0, matches = 0;
+		start = std::chrono::steady_clock::now();
+
+		while (!cursor.atend() && pages < PAGES)
+		{
+			matches += mycontact.findByLastNamePrefix(prefix, cursor, PAGESIZE).size();
+			++pages;
+		}
+
+		std::cout << "\nprefix " << prefix << " us/page\t" << ElapsedMs(start) * 1000 / pages << "\t( " << matches << " matches )";
+	}
+
+	std::cout << "\n";
+}
+
+// Name tables for the benchmarks that need realistic looking names: common first names and last names built
+// from three syllables
+static const char* BENCHFIRSTNAMES[] = { "James", "Mary", "Robert", "Patricia", "John", "Jennifer", "Michael", "Linda", "David", "Elizabeth",
+	"William", "Barbara", "Richard", "Susan", "Joseph", "Jessica", "Thomas", "Sarah", "Charles", "Karen", "Daniel", "Nancy",
+	"Matthew", "Lisa", "Anthony", "Margaret", "Mark", "Sandra", "Steven", "Ashley", "Andrew", "Emily", "Joshua", "Michelle",
+	"Kenneth", "Amanda", "Kevin", "Melissa", "Brian", "Stephanie" };
+static const char* BENCHSYLLABLES[] = { "an", "ber", "cal", "dor", "el", "fen", "gar", "hol", "in", "jor", "ken", "lan", "mor", "nel",
+	"ol", "pet", "quin", "ros", "son", "tan", "ul", "ver", "wal", "xan", "yor", "zel", "ford", "ton", "ley", "wick" };
+constexpr size_t BENCHFIRSTNAMECOUNT = sizeof(BENCHFIRSTNAMES) / sizeof(BENCHFIRSTNAMES[0]);
+constexpr size_t BENCHSYLLABLECOUNT = sizeof(BENCHSYLLABLES) / sizeof(BENCHSYLLABLES[0]);
+constexpr size_t BENCHLASTNAMECOUNT = BENCHSYLLABLECOUNT * BENCHSYLLABLECOUNT * BENCHSYLLABLECOUNT;
+
+static std::string BenchLastName(size_t idx_)
+{
+	std::string lastname = BENCHSYLLABLES[idx_ % BENCHSYLLABLECOUNT];
+	lastname += BENCHSYLLABLES[(idx_ / BENCHSYLLABLECOUNT) % BENCHSYLLABLECOUNT];
+	lastname += BENCHSYLLABLES[(idx_ / (BENCHSYLLABLECOUNT * BENCHSYLLABLECOUNT)) % BENCHSYLLABLECOUNT];
+	lastname[0] = static_cast<char>(lastname[0] - 'a' + 'A');
+	return lastname;
+}
+
+// fuzzySearch throughput and recall for queries one or two random edits away from a stored name, against a scan
+// of every name with BoundedLevenshteinBatch
+void RunFuzzySearchBenchmark()
+{
+	constexpr size_t CONTACTS = 10000000;
+	constexpr size_t CHUNK = 100000;
+	constexpr size_t QUERIES = 2000;
+	constexpr size_t SCANS = 3;
+
+	std::cout << "\n\nFuzzy search benchmark, " << CONTACTS << " contacts";
+
+	uint64_t state = 88172645463325252ULL;
+	auto next = [&state]()
+	{
+		state ^= state << 13; // xorshift64
+		state ^= state >> 7;
+		state ^= state << 17;
+		return state;
+	};
+
+	auto name = [](size_t ii_)
+	{
+		return std::make_pair(std::string(BENCHFIRSTNAMES[ii_ % BENCHFIRSTNAMECOUNT]), BenchLastName((ii_ * 2654435761ULL) % BENCHLASTNAMECOUNT));
+	};
+
+	Contacts mycontact;
+	std::vector<Contact> chunk;
+
+	for (size_t base = 0; base < CONTACTS; base += CHUNK)
+	{
+		chunk.clear();
+		for (size_t ii = base; ii < base + CHUNK; ++ii)
+		{
+			auto names = name(ii);
+			chunk.emplace_back(names.first, names.second, "+1" + std::to_string(6170000000ULL + ii));
+		}
+
+		mycontact.addContacts(chunk);
+	}
+
+	std::cout << "\nmax distance\tedits\tqueries/s\trecall";
+
+	for (unsigned int maxdistance : { 1u, 2u })
+	{
+		for (unsigned int edits = 1; edits <= maxdistance; ++edits)
+		{
+			std::vector<std::string> queries, originals;
+
+			for (size_t qq = 0; qq < QUERIES; ++qq)
+			{
+				auto names = name(next() % CONTACTS);
+				std::string original = names.first + " " + names.second;
+				std::string query = original;
+
+				for (unsigned int ee = 0; ee < edits; ++ee)
+				{
+					size_t pos = next() % query.size();
+					char letter = static_cast<char>('a' + next() % 26);
+
+					switch (next() % 3)
+					{
+					case 0: query[pos] = letter; break;
+					case 1: query.insert(query.begin() + pos, letter); break;
+					default: query.erase(pos, 1); break;
+					}
+				}
+
+				queries.push_back(query);
+				originals.push_back(original);
+			}
+
+			size_t found = 0;
+			auto start = std::chrono::steady_clock::now();
+
+			for (size_t qq = 0; qq < QUERIES; ++qq)
+			{
+				for (const auto& match : mycontact.fuzzySearch(queries[qq], maxdistance, 10))
+				{
+					if (std::string(match.contact->getfirstname()) + " " + std::string(match.contact->getlastname()) == originals[qq])
+					{
+						++found;
+						break;
+					}
+				}
+			}
+
+			double ms = ElapsedMs(start);
+			std::cout << "\n" << maxdistance << "\t" << edits << "\t" << static_cast<uint64_t>(QUERIES * 1000 / ms) << "\t"
+				<< static_cast<double>(found) / QUERIES;
+		}
+	}
+
+	// baseline: every name against the query
+	std::vector<std::string> names;
+	names.reserve(CONTACTS);
+	for (const auto& contact : mycontact.listContacts())
+		names.push_back(contact.getfirstname() + " " + contact.getlastname());
+
+	std::vector<std::string_view> views(names.begin(), names.end());
+	std::vector<unsigned int> distances(views.size());
+	auto start = std::chrono::steady_clock::now();
+
+	for (size_t ss = 0; ss < SCANS; ++ss)
+		BoundedLevenshteinBatch("Jennifer Holmorson", views.data(), views.size(), 2, distances.data());
+
+	std::cout << "\nscan queries/s\t" << SCANS * 1000 / ElapsedMs(start) << "\n";
+}
+
+// Collision, bucket and shard statistics of one field hash policy over contacts_
+template <typename FieldHash>
+static void HashPolicyStats(const char* name_, const std::vector<Contact>& contacts_)
+{
+	constexpr size_t SHARDS = 64;
+	basic_hash_contactview<FieldHash> hash;
+	std::vector<ContactView> views;
+	std::vector<size_t> hashes;
+
+	views.reserve(contacts_.size());
+	for (const auto& contact : contacts_)
+		views.emplace_back(contact);
+
+	auto start = std::chrono::steady_clock::now();
+	for (const auto& view : views)
+		hashes.push_back(hash(view));
+	double hashns = ElapsedMs(start) * 1000000 / views.size();
+
+	// different contacts with the same full hash ( the contacts are unique )
+	std::vector<size_t> sorted(hashes);
+	std::sort(sorted.begin(), sorted.end());
+	size_t collisions = sorted.size() - static_cast<size_t>(std::unique(sorted.begin(), sorted.end()) - sorted.begin());
+
+	std::unordered_map<ContactView, size_t, basic_hash_contactview<FieldHash>> map;
+	map.reserve(views.size());
+	for (size_t ii = 0; ii < views.size(); ++ii)
+		map.emplace(views[ii], ii);
+
+	// average number of keys compared by a successful lookup and the longest chain
+	double probes = 0;
+	size_t longest = 0;
+	for (size_t bb = 0; bb < map.bucket_count(); ++bb)
+	{
+		size_t size = map.bucket_size(bb);
+		probes += static_cast<double>(size) * (size + 1) / 2;
+		longest = std::max(longest, size);
+	}
+
+	std::vector<size_t> shards(SHARDS, 0);
+	for (size_t value : hashes)
+		++shards[ShardIndex(value, SHARDS)];
+
+	size_t found = 0;
+	start = std::chrono::steady_clock::now();
+	for (const auto& view : views)
+		found += map.count(view);
+	double lookupns = ElapsedMs(start) * 1000000 / views.size();
+
+	std::cout << "\n" << name_ << "\t" << collisions << "\t" << probes / views.size() << "\t" << longest << "\t"
+		<< static_cast<double>(*std::max_element(shards.begin(), shards.end())) * SHARDS / views.size() << "\t" << hashns << "\t"
+		<< lookupns << ( found == views.size() ? "" : "\tLOOKUP MISMATCH" );
+}
+
+// Field hash policies on household data: family members share last name and phone, some contacts are entered
+// with first and last name swapped, some have the same first and last name
+void RunHashPolicyBenchmark()
+{
+	constexpr size_t CONTACTS = 2000000;
+
+	std::cout << "\n\nHash policy benchmark, " << CONTACTS << " contacts";
+
+	uint64_t state = 88172645463325252ULL;
+	auto next = [&state]()
+	{
+		state ^= state << 13; // xorshift64
+		state ^= state >> 7;
+		state ^= state << 17;
+		return state;
+	};
+
+	std::vector<Contact> contacts;
+	std::unordered_set<Contact, hash_name> unique;
+	contacts.reserve(CONTACTS);
+
+	for (uint64_t household = 0; contacts.size() < CONTACTS; ++household)
+	{
+		// last names skewed towards the common ones, phones numbered by household
+		double skew = static_cast<double>(next() % 1000000) / 1000000;
+		std::string last = BenchLastName(static_cast<size_t>(skew * skew * BENCHLASTNAMECOUNT));
+		std::string phone = "+1617" + std::to_string(5550000000ULL + household);
+		size_t members = 1 + next() % 5;
+
+		for (size_t mm = 0; mm < members && contacts.size() < CONTACTS; ++mm)
+		{
+			std::string first = BENCHFIRSTNAMES[next() % BENCHFIRSTNAMECOUNT];
+			uint64_t kind = next() % 100;
+
+			Contact contact = kind < 2 ? Contact(last, first, phone) : (kind < 3 ? Contact(last, last, phone) : Contact(first, last, phone));
+
+			if (unique.insert(contact).second)
+				contacts.push_back(contact);
+
+			if (kind == 3 && contacts.size() < CONTACTS && unique.insert(Contact(last, first, phone)).second)
+				contacts.emplace_back(last, first, phone); // the same person entered both ways
+		}
+	}
+
+	std::cout << "\npolicy\tcollisions\tprobes/lookup\tlongest chain\tmax/avg shard\tns/hash\tns/lookup";
+
+	HashPolicyStats<XorFieldHash>("xor", contacts);
+	HashPolicyStats<WyFieldHash>("wyhash", contacts);
+
+	std::cout << "\n";
+}
+
+// Store table of ContactView -> ContactRecord: the former node based std::unordered_map against the flat
+// open addressing table of the shards. Heap bytes per contact ( records excluded, they are shared ), build
+// time and lookup latency for present and absent contacts in random order
+void RunFlatMapBenchmark()
+{
+	constexpr size_t CONTACTS = 2000000;
+	constexpr size_t LOOKUPS = 4000000;
+
+	std::cout << "\n\nFlat map benchmark, " << CONTACTS << " contacts";
+
+	ContactArena arena(1);
+	std::vector<ContactRecord> records;
+	std::vector<ContactView> hits, misses;
+	uint64_t state = 88172645463325252ULL;
+
+	records.reserve(CONTACTS);
+	for (size_t ii = 0; ii < CONTACTS; ++ii)
+		records.push_back(arena.make(BENCHFIRSTNAMES[ii % BENCHFIRSTNAMECOUNT], BenchLastName(ii % BENCHLASTNAMECOUNT), "+1" + std::to_string(6170000000ULL + ii)));
+
+	std::vector<Contact> absent;
+	absent.reserve(LOOKUPS);
+	for (size_t ii = 0; ii < LOOKUPS; ++ii)
+	{
+		state ^= state << 13; // xorshift64
+		state ^= state >> 7;
+		state ^= state << 17;
+
+		hits.emplace_back(*records[state % CONTACTS]);
+		absent.emplace_back(BENCHFIRSTNAMES[ii % BENCHFIRSTNAMECOUNT], BenchLastName(state % BENCHLASTNAMECOUNT), "+1" + std::to_string(5080000000ULL + state % CONTACTS));
+	}
+
+	for (const auto& contact : absent)
+		misses.emplace_back(contact);
+
+	std::cout << "\ntable\tbytes/contact\tbuild ns/contact\thit ns/lookup\tmiss ns/lookup";
+
+	hash_contactview hash;
+
+	{
+		std::unordered_map<ContactView, ContactRecord, hash_contactview> map;
+
+		g_allocbytes = 0;
+		g_countallocs = true;
+		auto start = std::chrono::steady_clock::now();
+
+		map.reserve(CONTACTS);
+		for (const auto& record : records)
+			map.emplace(ContactView(*record), record);
+
+		double build = ElapsedMs(start) * 1000000 / CONTACTS;
+		g_countallocs = false;
+
+		size_t found = 0;
+		start = std::chrono::steady_clock::now();
+		for (const auto& view : hits)
+			found += map.count(view);
+		double hit = ElapsedMs(start) * 1000000 / LOOKUPS;
+
+		start = std::chrono::steady_clock::now();
+		for (const auto& view : misses)
+			found += map.count(view);
+		double miss = ElapsedMs(start) * 1000000 / LOOKUPS;
+
+		std::cout << "\nunordered_map\t" << static_cast<double>(g_allocbytes) / CONTACTS << "\t" << build << "\t" << hit << "\t" << miss
+			<< (found == LOOKUPS ? "" : "\tLOOKUP MISMATCH");
+	}
+
+	{
+		FlatMap<ContactView, ContactRecord, hash_contactview, contact_key> map;
+
+		g_allocbytes = 0;
+		g_countallocs = true;
+		auto start = std::chrono::steady_clock::now();
+
+		map.reserve(CONTACTS);
+		for (const auto& record : records)
+		{
+			ContactView view(*record);
+			map.insert(view, hash(view), record);
+		}
+
+		double build = ElapsedMs(start) * 1000000 / CONTACTS;
+		g_countallocs = false;
+
+		size_t found = 0;
+		start = std::chrono::steady_clock::now();
+		for (const auto& view : hits)
+			found += map.find(view, hash(view)) != nullptr;
+		double hit = ElapsedMs(start) * 1000000 / LOOKUPS;
+
+		start = std::chrono::steady_clock::now();
+		for (const auto& view : misses)
+			found += map.find(view, hash(view)) != nullptr;
+		double miss = ElapsedMs(start) * 1000000 / LOOKUPS;
+
+		std::cout << "\nflat map\t" << static_cast<double>(g_allocbytes) / CONTACTS << "\t" << build << "\t" << hit << "\t" << miss
+			<< (found == LOOKUPS ? "" : "\tLOOKUP MISMATCH") << "\t( load " << static_cast<double>(map.size()) / map.capacity() << " )";
+	}
+
+	std::cout << "\n";
+}
+
+// Heap bytes and allocations per stored contact: a record holding three std::string ( the former ContactRecord )
+// against a record whose attributes are appended to the arena, for names within and beyond the small string buffer.
+// Then update churn in a store: arena chunks and bytes before and after compactContactStorage
+void RunContactArenaBenchmark()
+{
+	constexpr size_t CONTACTS = 2000000;
+	constexpr size_t CHURNCONTACTS = 500000;
+
+	std::cout << "\n\nContact arena benchmark, " << CONTACTS << " contacts";
+	std::cout << "\nnames\trecord\tbytes/contact\tallocs/contact\tns/contact";
+
+	for (bool longnames : { false, true })
+	{
+		std::vector<Contact> contacts;
+		contacts.reserve(CONTACTS);
+		for (size_t ii = 0; ii < CONTACTS; ++ii)
+		{
+			std::string last = BenchLastName(ii % BENCHLASTNAMECOUNT);
+			contacts.push_back(Contact(longnames ? BENCHFIRSTNAMES[ii % BENCHFIRSTNAMECOUNT] + std::string("-Alexandra-Maria") : BENCHFIRSTNAMES[ii % BENCHFIRSTNAMECOUNT],
+				longnames ? last + "-Montgomery-Smith" : last, "+1" + std::to_string(6170000000ULL + ii)));
+		}
+
+		const char* names = longnames ? "long" : "short";
+
+		{
+			std::vector<std::shared_ptr<const Contact>> records;
+			records.reserve(CONTACTS);
+
+			g_allocs = 0;
+			g_allocbytes = 0;
+			g_countallocs = true;
+			auto start = std::chrono::steady_clock::now();
+
+			for (const auto& contact : contacts)
+				records.push_back(std::make_shared<const Contact>(contact));
+
+			double ns = ElapsedMs(start) * 1000000 / CONTACTS;
+			g_countallocs = false;
+
+			std::cout << "\n" << names << "\tstd::string\t" << static_cast<double>(g_allocbytes) / CONTACTS << "\t"
+				<< static_cast<double>(g_allocs) / CONTACTS << "\t" << ns;
+		}
+
+		{
+			ContactArena arena(DEFAULTSHARDS);
+			std::vector<ContactRecord> records;
+			records.reserve(CONTACTS);
+
+			g_allocs = 0;
+			g_allocbytes = 0;
+			g_countallocs = true;
+			auto start = std::chrono::steady_clock::now();
+
+			for (const auto& contact : contacts)
+				records.push_back(arena.make(contact.getfirstname(), contact.getlastname(), contact.getphone()));
+
+			double ns = ElapsedMs(start) * 1000000 / CONTACTS;
+			g_countallocs = false;
+
+			std::cout << "\n" << names << "\tarena\t" << static_cast<double>(g_allocbytes) / CONTACTS << "\t"
+				<< static_cast<double>(g_allocs) / CONTACTS << "\t" << ns;
+		}
+	}
+
+	Contacts mycontact;
+
+	std::cout << "\n\nUpdate churn, " << CHURNCONTACTS << " contacts, two thirds of them updated twice";
+	std::cout << "\nstate\tchunks\tMB\tlive MB";
+
+	std::vector<Contact> contacts;
+	contacts.reserve(CHURNCONTACTS);
+	for (size_t ii = 0; ii < CHURNCONTACTS; ++ii)
+		contacts.push_back(Contact("First" + std::to_string(ii), BenchLastName(ii), "+1" + std::to_string(6170000000ULL + ii)));
+
+	mycontact.addContacts(contacts);
+
+	auto printstats = [&mycontact](const char* state_)
+	{
+		arena_stats stats = mycontact.contactStorageStats();
+		std::cout << "\n" << state_ << "\t" << stats.chunks << "\t" << stats.bytes / 1048576.0 << "\t" << stats.livebytes / 1048576.0;
+	};
+
+	printstats("loaded");
+
+	// the chunks of the loaded contacts keep a third of their records
+	for (size_t round = 0; round < 2; ++round)
+	{
+		for (size_t ii = 0; ii < CHURNCONTACTS; ++ii)
+		{
+			if (ii % 3 == 0)
+				continue;
+
+			Contact updated(contacts[ii].getfirstname(), contacts[ii].getlastname(), "+1" + std::to_string(5080000000ULL + round * CHURNCONTACTS + ii));
+			mycontact.updateContact(contacts[ii], updated);
+			contacts[ii] = updated;
+		}
+	}
+
+	printstats("updated");
+
+	auto start = std::chrono::steady_clock::now();
+	size_t moved = mycontact.compactContactStorage();
+	double ms = ElapsedMs(start);
+
+	printstats("compacted");
+	std::cout << "\t( " << moved << " contacts moved in " << ms << " ms )\n";
+}
+
+// Name interning on load: a NDJSON file with repetitive first and last names loaded in parallel, then the distinct
+// names, the dedup ratio and the name bytes per contact as two std::string against two ids plus the dictionary
+void RunNameDictionaryBenchmark()
+{
+	constexpr size_t CONTACTS = 2000000;
+	const std::string path = "bench_names.json";
+
+	{
+		std::ofstream out(path, std::ios::binary);
+		uint64_t state = 88172645463325252ULL;
+
+		for (size_t ii = 0; ii < CONTACTS; ++ii)
+		{
+			state ^= state << 13; // xorshift64
+			state ^= state >> 7;
+			state ^= state << 17;
+
+			double skew = static_cast<double>(state % 1000000) / 1000000; // common last names are much more frequent
+			out << "{\"first\" : \"" << BENCHFIRSTNAMES[(state >> 20) % BENCHFIRSTNAMECOUNT] << "\",\"last\" : \""
+				<< BenchLastName(static_cast<size_t>(skew * skew * BENCHLASTNAMECOUNT)) << "\",\"phone\" : \"+1" << 6170000000ULL + ii << "\"}\n";
+		}
+	}
+
+	Contacts mycontact;
+	size_t count = 0;
+	auto start = std::chrono::steady_clock::now();
+
+	mycontact.loadContactsFromFileParallel(path, count);
+
+	double ms = ElapsedMs(start);
+	name_stats stats = mycontact.nameDictionaryStats();
+	double strings = (static_cast<double>(stats.lookupbytes) + stats.lookups * sizeof(std::string)) / count;
+	double interned = (2 * sizeof(uint32_t) * static_cast<double>(count) + stats.memory) / count;
+
+	std::cout << "\n\nName dictionary benchmark, " << count << " contacts loaded in " << ms << " ms";
+	std::cout << "\ndistinct names\tdedup ratio\tname bytes/contact std::string\tname bytes/contact interned";
+	std::cout << "\n" << stats.names << "\t" << static_cast<double>(stats.lookupbytes) / stats.bytes << "\t" << strings << "\t" << interned << "\n";
+
+	std::remove(path.c_str());
+}
+
+// The former text phone hashing and comparison of the store table, for comparison with the packed keys
+struct text_contactview_hash
+{
+	size_t operator()(const ContactView& view_) const { return WyFieldHash()(view_.getfirstname(), view_.getlastname(), view_.getphone()); }
+};
+
+struct text_contactview_equal
+{
+	bool operator()(const ContactView& lhs_, const ContactView& rhs_) const
+	{
+		return lhs_.getfirstname() == rhs_.getfirstname() && lhs_.getlastname() == rhs_.getlastname() && lhs_.getphone() == rhs_.getphone();
+	}
+};
+
+// Packed phone keys against phone text: parse cost, then insert and lookup in the store table and in the phone
+// index with either representation. Lookups of present and absent contacts in random order, the views are made
+// up front so both sides measure hashing, probing and comparison only
+void RunPhoneKeyBenchmark()
+{
+	constexpr size_t CONTACTS = 2000000;
+	constexpr size_t LOOKUPS = 4000000;
+
+	std::cout << "\n\nPhone key benchmark, " << CONTACTS << " contacts";
+
+	ContactArena arena(1);
+	std::vector<ContactRecord> records;
+	std::vector<Contact> absent;
+	std::vector<ContactView> hits, misses;
+	uint64_t state = 88172645463325252ULL;
+
+	records.reserve(CONTACTS);
+	for (size_t ii = 0; ii < CONTACTS; ++ii)
+		records.push_back(arena.make(BENCHFIRSTNAMES[ii % BENCHFIRSTNAMECOUNT], BenchLastName(ii % BENCHLASTNAMECOUNT), "+1" + std::to_string(6170000000ULL + ii)));
+
+	absent.reserve(LOOKUPS);
+	for (size_t ii = 0; ii < LOOKUPS; ++ii)
+	{
+		state ^= state << 13; // xorshift64
+		state ^= state >> 7;
+		state ^= state << 17;
+
+		hits.emplace_back(*records[state % CONTACTS]);
+		absent.emplace_back(BENCHFIRSTNAMES[ii % BENCHFIRSTNAMECOUNT], BenchLastName(state % BENCHLASTNAMECOUNT), "+1" + std::to_string(5080000000ULL + state % CONTACTS));
+	}
+
+	for (const auto& contact : absent)
+		misses.emplace_back(contact);
+
+	uint64_t sum = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (const auto& contact : absent)
+		sum += PackPhone(contact.getphone());
+	double parse = ElapsedMs(start) * 1000000 / LOOKUPS;
+
+	start = std::chrono::steady_clock::now();
+	for (const auto& contact : absent)
+		sum += WyHash(contact.getphone().data(), contact.getphone().size(), 0);
+	double texthash = ElapsedMs(start) * 1000000 / LOOKUPS;
+
+	std::cout << "\nPackPhone ns/phone\t" << parse << "\t( WyHash of the text " << texthash << ", checksum " << sum % 10 << " )";
+	std::cout << "\ntable\tphone\tinsert ns/contact\thit ns/lookup\tmiss ns/lookup";
+
+	auto table = [&](const char* name_, auto map_, auto hash_)
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		map_.reserve(CONTACTS);
+		for (const auto& record : records)
+		{
+			ContactView view(*record);
+			map_.insert(view, hash_(view), record);
+		}
+
+		double insert = ElapsedMs(start) * 1000000 / CONTACTS;
+
+		size_t found = 0;
+		start = std::chrono::steady_clock::now();
+		for (const auto& view : hits)
+			found += map_.find(view, hash_(view)) != nullptr;
+		double hit = ElapsedMs(start) * 1000000 / LOOKUPS;
+
+		start = std::chrono::steady_clock::now();
+		for (const auto& view : misses)
+			found += map_.find(view, hash_(view)) != nullptr;
+		double miss = ElapsedMs(start) * 1000000 / LOOKUPS;
+
+		std::cout << "\nstore\t" << name_ << "\t" << insert << "\t" << hit << "\t" << miss << (found == LOOKUPS ? "" : "\tLOOKUP MISMATCH");
+	};
+
+	table("text", FlatMap<ContactView, ContactRecord, text_contactview_hash, contact_key, text_contactview_equal>(), text_contactview_hash());
+	table("packed", FlatMap<ContactView, ContactRecord, hash_contactview, contact_key>(), hash_contactview());
+
+	auto index = [&](const char* name_, auto& index_, auto key_)
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		for (const auto& record : records)
+			index_.insert(key_(*record), record);
+
+		double insert = ElapsedMs(start) * 1000000 / CONTACTS;
+
+		std::vector<ContactRecord> found;
+		start = std::chrono::steady_clock::now();
+		for (const auto& view : hits)
+			index_.find(key_(view), found);
+		double hit = ElapsedMs(start) * 1000000 / LOOKUPS;
+
+		start = std::chrono::steady_clock::now();
+		for (const auto& view : misses)
+			index_.find(key_(view), found);
+		double miss = ElapsedMs(start) * 1000000 / LOOKUPS;
+
+		std::cout << "\nindex\t" << name_ << "\t" << insert << "\t" << hit << "\t" << miss << (found.size() == LOOKUPS ? "" : "\tLOOKUP MISMATCH");
+	};
+
+	{
+		ShardedIndex<ContactRecord> text(DEFAULTSHARDS);
+		index("text", text, [](const auto& contact_) { return contact_.getphone(); });
+	}
+
+	{
+		ShardedIndex<ContactRecord, PhoneKey, phonekey_hash> packed(DEFAULTSHARDS);
+		index("packed", packed, [](const auto& contact_) { return ContactView(contact_).getphonekey(); });
+	}
+
+	std::cout << "\n";
+}
+
+// Phone number of contact seq_ in one of the formats seen in exports, the same number for every format
+static std::string BenchFormattedPhone(size_t seq_, size_t format_)
+{
+	std::string digits = std::to_string(6170000000ULL + seq_);
+
+	switch (format_ % 4)
+	{
+		case 0: return "+1" + digits;
+		case 1: return "+1 (" + digits.substr(0, 3) + ") " + digits.substr(3, 3) + "-" + digits.substr(6);
+		case 2: return digits.substr(0, 3) + "." + digits.substr(3, 3) + "." + digits.substr(6);
+		default: return "001 " + digits.substr(0, 3) + " " + digits.substr(3, 3) + " " + digits.substr(6);
+	}
+}
+
+// E.164 normalization: NormalizePhone throughput over mixed formats, then the same file loaded with normalization
+// off and on. Every tenth contact appears a second time with its number formatted differently, only the
+// normalized load recognizes it as a duplicate
+void RunPhoneNormalizationBenchmark()
+{
+	constexpr size_t PHONES = 4000000;
+	constexpr size_t CONTACTS = 1000000;
+	const std::string path = "bench_normalize.json";
+
+	std::cout << "\n\nPhone normalization benchmark";
+
+	std::vector<std::string> phones;
+	phones.reserve(PHONES);
+	for (size_t ii = 0; ii < PHONES; ++ii)
+		phones.push_back(BenchFormattedPhone(ii, ii));
+
+	size_t valid = 0;
+	char buffer[E164BUFFER];
+	auto start = std::chrono::steady_clock::now();
+
+	for (const auto& phone : phones)
+		valid += NormalizePhone(phone, 1, buffer) != 0;
+
+	double ms = ElapsedMs(start);
+
+	std::cout << "\nNormalizePhone ns/phone\t" << ms * 1000000 / PHONES << "\t( " << PHONES / ms / 1000 << " M phones/s, "
+		<< valid << " valid of " << PHONES << " )";
+
+	{
+		std::ofstream out(path, std::ios::binary);
+
+		for (size_t ii = 0; ii < CONTACTS; ++ii)
+		{
+			out << "{\"first\" : \"First" << ii << "\",\"last\" : \"Last" << ii % 1000 << "\",\"phone\" : \"" << BenchFormattedPhone(ii, ii) << "\"}\n";
+			if (ii % 10 == 0)
+				out << "{\"first\" : \"First" << ii << "\",\"last\" : \"Last" << ii % 1000 << "\",\"phone\" : \"" << BenchFormattedPhone(ii, ii + 1) << "\"}\n";
+		}
+	}
+
+	std::cout << "\nnormalization\tcontacts stored\tload ms\tcontacts/s";
+
+	for (bool normalize : { false, true })
+	{
+		Contacts mycontact;
+		size_t count = 0;
+
+		if (normalize)
+			mycontact.EnablePhoneNormalization(1);
+
+		start = std::chrono::steady_clock::now();
+		mycontact.loadContactsFromFileParallel(path, count);
+		ms = ElapsedMs(start);
+
+		std::cout << "\n" << (normalize ? "on" : "off") << "\t" << count << "\t" << ms << "\t" << (CONTACTS + CONTACTS / 10) * 1000 / ms;
+	}
+
+	std::cout << "\n";
+
+	std::remove(path.c_str());
+}
+
+// Restoring a store from a binary snapshot against loading the same contacts from JSON, and the size of both files
+void RunSnapshotBenchmark()
+{
+	constexpr size_t CONTACTS = 2000000;
+	const std::string json = "bench_snapshot.json";
+	const std::string path = "bench_snapshot.snap";
+
+	std::cout << "\n\nSnapshot benchmark, " << CONTACTS << " contacts";
+
+	WriteBenchJSON(json, CONTACTS);
+
+	Contacts mycontact;
+	size_t count = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	mycontact.loadContactsFromFileParallel(json, count);
+	double jsonms = ElapsedMs(start);
+
+	start = std::chrono::steady_clock::now();
+	mycontact.saveSnapshot(path);
+	double savems = ElapsedMs(start);
+
+	auto filesize = [](const std::string& path_)
+	{
+		std::ifstream in(path_, std::ios::binary | std::ios::ate);
+		return static_cast<double>(in.tellg());
+	};
+
+	double jsonmb = filesize(json) / (1024 * 1024);
+	double snapmb = filesize(path) / (1024 * 1024);
+
+	std::cout << "\nstep\tms\tMB\tMB/s\tcontacts/s";
+	std::cout << "\nJSON load\t" << jsonms << "\t" << jsonmb << "\t" << jsonmb * 1000 / jsonms << "\t" << count * 1000 / jsonms;
+	std::cout << "\nsnapshot save\t" << savems << "\t" << snapmb << "\t" << snapmb * 1000 / savems << "\t" << count * 1000 / savems;
+
+	Contacts restored;
+	size_t restoredcount = 0;
+
+	start = std::chrono::steady_clock::now();
+	bool ok = restored.loadSnapshot(path, restoredcount);
+	double loadms = ElapsedMs(start);
+
+	std::cout << "\nsnapshot load\t" << loadms << "\t" << snapmb << "\t" << snapmb * 1000 / loadms << "\t" << restoredcount * 1000 / loadms
+		<< "\t( " << (ok && restoredcount == count ? "all contacts" : "CONTACTS MISSING") << ", " << jsonms / loadms << "x the JSON load )\n";
+
+	std::remove(json.c_str());
+	std::remove(path.c_str());
+}
+
+// addContact throughput with the write-ahead log off and on, for 1 to 16 writer threads and a few group commit
+// budgets. Every add returns only once it is synced, the syncs column shows how many fsyncs the writers shared
+void RunWriteAheadLogBenchmark()
+{
+	constexpr size_t PERTHREAD = 2000;
+	const std::string path = "bench_contacts.wal";
+	const size_t threadconfigs[] = { 1, 4, 16 };
+	const long budgets[] = { -1, 0, 200, 1000 }; // -1 = no log
+
+	std::cout << "\n\nWrite-ahead log benchmark, " << PERTHREAD << " adds per writer thread";
+	std::cout << "\ngroup commit us\twriters\tms\tadds/sec\tsyncs\tadds/sync";
+
+	for (long budget : budgets)
+	{
+		for (size_t threads : threadconfigs)
+		{
+			std::remove(path.c_str());
+
+			Contacts mycontact;
+			size_t replayed = 0;
+			WalConfig config;
+
+			if (budget >= 0)
+			{
+				config.groupcommit = std::chrono::microseconds(budget);
+				mycontact.openWriteAheadLog(path, replayed, config);
+			}
+
+			std::vector<std::thread> writers;
+			auto start = std::chrono::steady_clock::now();
+
+			for (size_t tt = 0; tt < threads; ++tt)
+			{
+				writers.emplace_back([&mycontact, tt]()
+				{
+					for (size_t ii = 0; ii < PERTHREAD; ++ii)
+						mycontact.addContact(MakeBenchContact(tt, ii));
+				});
+			}
+
+			for (auto& writer : writers)
+				writer.join();
+
+			double ms = ElapsedMs(start);
+			wal_stats stats = mycontact.writeAheadLogStats();
+
+			std::cout << "\n" << (budget < 0 ? std::string("off") : std::to_string(budget)) << "\t" << threads << "\t" << ms << "\t"
+				<< threads * PERTHREAD * 1000 / ms << "\t" << stats.syncs << "\t" << (stats.syncs ? static_cast<double>(stats.entries) / stats.syncs : 0);
+		}
+	}
+
+	std::cout << "\n";
+
+	std::remove(path.c_str());
+}
+
+// exportContactsJSON to a file against serializing the copy listContacts() returns, and the heap allocated by each
+void RunExportBenchmark()
+{
+	constexpr size_t CONTACTS = 2000000;
+	const std::string json = "bench_export_in.json";
+	const std::string path = "bench_export.json";
+
+	std::cout << "\n\nJSON export benchmark, " << CONTACTS << " contacts";
+
+	WriteBenchJSON(json, CONTACTS);
+
+	Contacts mycontact;
+	size_t count = 0;
+	mycontact.loadContactsFromFileParallel(json, count);
+	std::remove(json.c_str());
+
+	std::cout << "\nexport\tms\tMB/s\tcontacts/s\theap MB allocated";
+
+	for (bool streaming : { false, true })
+	{
+		size_t exported = 0;
+		g_allocbytes = 0;
+		g_countallocs = true;
+
+		auto start = std::chrono::steady_clock::now();
+
+		if (streaming)
+			mycontact.exportContactsJSON(path, exported);
+		else
+		{
+			// what callers had to do before: copy the store, then write it
+			std::list<Contact> contacts = mycontact.listContacts();
+			std::ofstream out(path, std::ios::binary);
+
+			out << "[";
+			for (const auto& contact : contacts)
+			{
+				out << (exported++ ? "," : "") << "{\"first\":\"" << contact.getfirstname() << "\",\"last\":\"" << contact.getlastname()
+					<< "\",\"phone\":\"" << contact.getphone() << "\"}";
+			}
+			out << "]";
+		}
+
+		double ms = ElapsedMs(start);
+		g_countallocs = false;
+
+		std::ifstream in(path, std::ios::binary | std::ios::ate);
+		double mb = static_cast<double>(in.tellg()) / (1024 * 1024);
+
+		std::cout << "\n" << (streaming ? "exportContactsJSON" : "listContacts + ofstream") << "\t" << ms << "\t" << mb * 1000 / ms << "\t"
+			<< exported * 1000 / ms << "\t" << static_cast<double>(g_allocbytes) / (1024 * 1024);
+	}
+
+	std::cout << "\n";
+
+	std::remove(path.c_str());
+}
+
+// Counts the contacts added and removed, delivered in batches
+class BenchSyncObserver : public ContactBatchObserver
+{
+public:
+	std::atomic<size_t> count{ 0 };
+
+	virtual void OnContactsAdded(Span<const ContactView> contacts_) override { count += contacts_.size(); }
+
+	virtual void OnContactsRemoved(Span<const ContactView> contacts_) override { count += contacts_.size(); }
+};
+
+void RunSyncBenchmark()
+{
+	constexpr size_t CONTACTS = 1000000;
+	constexpr size_t CHANGED = CONTACTS / 100; // dropped from the front of the next export, as many new at its end
+	const std::string current = "bench_sync_current.json";
+	const std::string next = "bench_sync_next.json";
+
+	std::cout << "\n\nIncremental reload benchmark, " << CONTACTS << " contacts, " << CHANGED << " removed and " << CHANGED << " added";
+
+	WriteBenchJSON(current, CONTACTS);
+
+	{
+		std::ofstream out(next, std::ios::binary);
+
+		out << "[";
+		for (size_t ii = CHANGED; ii < CONTACTS + CHANGED; ++ii)
+		{
+			out << (ii != CHANGED ? ",\n" : "\n") << "{\"first\" : \"First" << ii % 5000 << "\",\"last\" : \"Last" << ii / 5000
+				<< "\",\"phone\" : \"+1" << 6170000000ULL + ii << "\"}";
+		}
+		out << "]\n";
+	}
+
+	std::cout << "\nreload\tms\tcontacts after\tevents";
+
+	for (bool sync : { false, true })
+	{
+		BenchSyncObserver observer;
+		NotifyConfig notify;
+		notify.observerqueuecapacity = 2 * CONTACTS;
+		Contacts mycontact(false, DEFAULTSHARDS, notify);
+		size_t count = 0;
+
+		mycontact.loadContactsFromFileParallel(current, count);
+		mycontact.registerObserver(&observer);
+
+		auto start = std::chrono::steady_clock::now();
+		sync_report report;
+
+		if (sync)
+			mycontact.syncFromFile(next, report);
+		else
+			mycontact.loadContactsFromFileParallel(next, count); // re-adds everything, stale contacts stay
+
+		double ms = ElapsedMs(start);
+
+		for (int ii = 0; ii < 1000 && observer.count < 2 * CHANGED; ++ii)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+		std::cout << "\n" << (sync ? "syncFromFile" : "loadContactsFromFileParallel") << "\t" << ms << "\t" << mycontact.listContacts().size()
+			<< "\t" << observer.count;
+
+		if (sync)
+		{
+			std::cout << "\n\tparse " << report.parsems << " ms, diff and apply " << report.applyms << " ms, added " << report.added
+				<< ", removed " << report.removed << ", unchanged " << report.unchanged;
+		}
+
+		mycontact.unregisterObserver(&observer);
+	}
+
+	std::cout << "\n";
+
+	std::remove(current.c_str());
+	std::remove(next.c_str());
+}
+
+// Restart with a memory mapped store against a snapshot load: reopening maps the files, the first add reads in one
+// stripe and the first query over every contact reads in the rest
+void RunMappedStoreBenchmark()
+{
+	constexpr size_t CONTACTS = 2000000;
+	const std::string json = "bench_mappedstore.json";
+	const std::string snapshot = "bench_mappedstore.snap";
+	const std::string path = "bench_mappedstore.store";
+
+	std::cout << "\n\nMapped store benchmark, " << CONTACTS << " contacts";
+
+	WriteBenchJSON(json, CONTACTS);
+
+	StoreConfig config;
+	config.path = path;
+	config.preload = false;
+
+	size_t count = 0;
+	double memoryms = 0, storems = 0;
+	mapped_store_stats stats;
+
+	{
+		Contacts mycontact;
+		auto start = std::chrono::steady_clock::now();
+		mycontact.loadContactsFromFileParallel(json, count);
+		memoryms = ElapsedMs(start);
+		mycontact.saveSnapshot(snapshot);
+	}
+
+	{
+		Contacts mycontact(false, DEFAULTSHARDS, NotifyConfig(), config);
+		size_t stored = 0;
+		auto start = std::chrono::steady_clock::now();
+		mycontact.loadContactsFromFileParallel(json, stored);
+		storems = ElapsedMs(start);
+		stats = mycontact.storeStats();
+	}
+
+	std::cout << "\nJSON load\tmemory " << memoryms << " ms\tmapped store " << storems << " ms\t( " << stats.stripes << " files, "
+		<< stats.filebytes / (1024 * 1024) << " MB, " << stats.rewrites << " rewrites )";
+
+	std::cout << "\nrestart\topen ms\tfirst add ms\tfirst query ms\tcontacts";
+
+	{
+		auto start = std::chrono::steady_clock::now();
+		Contacts restored;
+		size_t restoredcount = 0;
+		restored.loadSnapshot(snapshot, restoredcount);
+		double loadms = ElapsedMs(start);
+		restored.addContact(Contact("Nikola", "Tesla", "+12125550100"));
+		double addms = ElapsedMs(start);
+		size_t found = restored.findByLastName("Tesla").size();
+		double queryms = ElapsedMs(start);
+
+		std::cout << "\nsnapshot\t" << loadms << "\t" << addms << "\t" << queryms << "\t" << restoredcount + found;
+	}
+
+	{
+		auto start = std::chrono::steady_clock::now();
+		Contacts reopened(false, DEFAULTSHARDS, NotifyConfig(), config);
+		double openms = ElapsedMs(start);
+		reopened.addContact(Contact("Nikola", "Tesla", "+12125550100"));
+		double addms = ElapsedMs(start);
+		size_t found = reopened.findByLastName("Tesla").size();
+		double queryms = ElapsedMs(start);
+		stats = reopened.storeStats();
+
+		std::cout << "\nmapped store\t" << openms << "\t" << addms << "\t" << queryms << "\t" << stats.contacts
+			<< "\t( " << (stats.contacts == count + found ? "all contacts" : "CONTACTS MISSING") << " )\n";
+	}
+
+	std::remove(json.c_str());
+	std::remove(snapshot.c_str());
+
+	for (size_t ii = 0; ii < stats.stripes; ++ii)
+		std::remove((path + "." + std::to_string(ii)).c_str());
+}
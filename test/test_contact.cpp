@@ -2,8 +2,14 @@
 
 #include <string>
 #include <iostream>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <algorithm>
+#include <unordered_set>
 
 #include "Contact.h"
+#include "contactsnapshot.h"
 
 using namespace User;
 
@@ -25,11 +31,33 @@ void RunMultiplethreadsAddUpdateTestCase5();
 void RunInvalidContactTestCase6();
 void RunMultipleObserversTestCase7();
 void RunMultiplethreadsAddUpdateTestCase5();
+void RunStreamLoadTestCase8();
+void RunFileLoadTestCase9();
+void RunParallelLoadTestCase10();
+void RunBatchAddTestCase11();
+void RunNotifyPoolOrderingTestCase12();
+void RunSlowObserverIsolationTestCase13();
+void RunBatchObserverTestCase14();
+void RunSecondaryIndexTestCase15();
+void RunPhonePrefixTestCase16();
+void RunSortedListingTestCase17();
+void RunFuzzySearchTestCase18();
+void RunContactHashTestCase19();
+void RunFlatMapTestCase20();
+void RunContactArenaTestCase21();
+void RunNameDictionaryTestCase22();
+void RunPhoneKeyTestCase23();
+void RunPhoneNormalizationTestCase24();
+void RunSnapshotTestCase25();
+void RunWriteAheadLogTestCase26();
+void RunExportTestCase27();
+void RunSyncTestCase28();
+void RunMappedStoreTestCase29();
 
 void UpdateContactThread(Contacts& mycontact);
 void AddContactThread(Contacts& mycontact);
 
-enum TESTCASE { TEST1 = 1, TEST2, TEST3, TEST4, TEST5, TEST6, TEST7 };
+enum TESTCASE { TEST1 = 1, TEST2, TEST3, TEST4, TEST5, TEST6, TEST7, TEST8, TEST9, TEST10, TEST11, TEST12 };
 
 std::mutex  mutexg;
 
@@ -46,7 +74,7 @@ public:
 		std::cout << "\n\nRunning Test Case " << testnum_ << "\n";
 	}
 
-	virtual void OnContactAdded(Contact contact_)
+	virtual void OnContactAdded(const ContactView& contact_) override
 	{
 		std::lock_guard<std::mutex> lk(mutexg);
 
@@ -60,7 +88,7 @@ public:
 
 	void setcount(size_t loadcount_) { _loadcount = loadcount_; }
 
-	virtual void OnContactUpdated(Contact contact_)
+	virtual void OnContactUpdated(const ContactView& contact_) override
 	{
 		std::lock_guard<std::mutex> lk(mutexg);
 
@@ -75,7 +103,7 @@ public:
 
 	~MyContactObserver()
 	{
-		if (_testnum == TESTCASE::TEST1 || _testnum == TESTCASE::TEST4 || _testnum == TESTCASE::TEST6)
+		if (_testnum == TESTCASE::TEST1 || _testnum == TESTCASE::TEST4 || _testnum == TESTCASE::TEST6 || _testnum == TESTCASE::TEST8 || _testnum == TESTCASE::TEST9 || _testnum == TESTCASE::TEST10 || _testnum == TESTCASE::TEST11)
 		{
 			if (_addcount != _loadcount)
 			{
@@ -138,7 +166,7 @@ public:
 
 	void setcount(size_t loadcount_) { _loadcount = loadcount_; }
 
-	virtual void OnContactAdded(Contact contact_)
+	virtual void OnContactAdded(const ContactView& contact_) override
 	{
 		std::lock_guard<std::mutex> lk(mutexg);
 
@@ -171,6 +199,107 @@ public:
 	}
 };
 
+// Checks that the update of a contact is never delivered before its add
+class MyOrderingObserver : public ContactObserver
+{
+private:
+	std::mutex _mut;
+	std::unordered_map<std::string, int> _seen; // phone -> events received
+	size_t _addcount{ 0 }, _updatecount{ 0 }, _outoforder{ 0 };
+
+public:
+	virtual void OnContactAdded(const ContactView& contact_) override
+	{
+		std::lock_guard<std::mutex> lk(_mut);
+
+		if (_seen[std::string(contact_.getphone())]++ != 0)
+			_outoforder++;
+		_addcount++;
+	}
+
+	virtual void OnContactUpdated(const ContactView& contact_) override
+	{
+		std::lock_guard<std::mutex> lk(_mut);
+
+		if (_seen[std::string(contact_.getphone())]++ != 1)
+			_outoforder++;
+		_updatecount++;
+	}
+
+	bool check(size_t expected_)
+	{
+		std::lock_guard<std::mutex> lk(_mut);
+		return _addcount == expected_ && _updatecount == expected_ && _outoforder == 0;
+	}
+};
+
+// Counts adds, optionally spending delay_ in every callback
+class MyCountingObserver : public ContactObserver
+{
+private:
+	std::chrono::milliseconds _delay;
+	std::atomic<size_t> _addcount{ 0 };
+
+public:
+	explicit MyCountingObserver(std::chrono::milliseconds delay_) : _delay(delay_)
+	{}
+
+	virtual void OnContactAdded(const ContactView& contact_) override
+	{
+		std::this_thread::sleep_for(_delay);
+		_addcount++;
+	}
+
+	size_t addcount() const { return _addcount; }
+};
+
+// Counts contacts and callbacks of a batch observer
+class MyBatchObserver : public ContactBatchObserver
+{
+private:
+	std::atomic<size_t> _addcount{ 0 };
+	std::atomic<size_t> _updatecount{ 0 };
+	std::atomic<size_t> _removecount{ 0 };
+	std::atomic<size_t> _callbacks{ 0 };
+	std::atomic<size_t> _maxbatch{ 0 };
+
+	void record(size_t size_)
+	{
+		_callbacks++;
+		if (size_ > _maxbatch)
+			_maxbatch = size_; // called from the one channel thread only
+	}
+
+public:
+	virtual void OnContactsAdded(Span<const ContactView> contacts_) override
+	{
+		record(contacts_.size());
+		for (const auto& contact : contacts_)
+		{
+			if (!contact.getphone().empty())
+				_addcount++;
+		}
+	}
+
+	virtual void OnContactsUpdated(Span<const ContactView> contacts_) override
+	{
+		record(contacts_.size());
+		_updatecount += contacts_.size();
+	}
+
+	virtual void OnContactsRemoved(Span<const ContactView> contacts_) override
+	{
+		record(contacts_.size());
+		_removecount += contacts_.size();
+	}
+
+	size_t addcount() const { return _addcount; }
+	size_t updatecount() const { return _updatecount; }
+	size_t removecount() const { return _removecount; }
+	size_t callbacks() const { return _callbacks; }
+	size_t maxbatch() const { return _maxbatch; }
+};
+
 int main()
 {
 	RunAddContactTestCase1();
@@ -180,6 +309,28 @@ int main()
 	RunMultiplethreadsAddUpdateTestCase5();
     RunInvalidContactTestCase6();
     RunMultipleObserversTestCase7();
+	RunStreamLoadTestCase8();
+	RunFileLoadTestCase9();
+	RunParallelLoadTestCase10();
+	RunBatchAddTestCase11();
+	RunNotifyPoolOrderingTestCase12();
+	RunSlowObserverIsolationTestCase13();
+	RunBatchObserverTestCase14();
+	RunSecondaryIndexTestCase15();
+	RunPhonePrefixTestCase16();
+	RunSortedListingTestCase17();
+	RunFuzzySearchTestCase18();
+	RunContactHashTestCase19();
+	RunFlatMapTestCase20();
+	RunContactArenaTestCase21();
+	RunNameDictionaryTestCase22();
+	RunPhoneKeyTestCase23();
+	RunPhoneNormalizationTestCase24();
+	RunSnapshotTestCase25();
+	RunWriteAheadLogTestCase26();
+	RunExportTestCase27();
+	RunSyncTestCase28();
+	RunMappedStoreTestCase29();
 	//RunLargeJsonTestCase8(); // Need to stress test the library with large number of contact add/update requests
 	                           // Also need to measure the performance of the test with RDTSC or perf or intel vTune
 
@@ -352,4 +503,1454 @@ void UpdateContactThread(Contacts& mycontact)
 	myobserver2.setcount(1);
 	std::this_thread::sleep_for(std::chrono::milliseconds(mycontact.getupdatetimer())); // Wait more than what update contacts waits
 																  // generate updates
-}
\ No newline at end of file
+
+	mycontact.unregisterObserver(&myobserver2); // myobserver2 goes out of scope
+}
+
+void RunStreamLoadTestCase8()
+{
+	MyContactObserver myobserver(TESTCASE::TEST8);
+	Contacts mycontact;
+	size_t result{ 0 };
+
+	mycontact.registerObserver(&myobserver);
+
+	std::istringstream stream(mycontacts);
+	bool ret = mycontact.loadContactsFromStream(stream, result);
+	myobserver.setcount(result);
+
+	if (!ret || result != 9)
+	{
+		std::lock_guard<std::mutex> lk(mutexg);
+		std::cout << "\n\nTEST CASE 8 FAILURE, streaming load added " << result << " of 9 contacts";
+	}
+
+	std::this_thread::yield();
+	std::this_thread::sleep_for(std::chrono::seconds(1));
+}
+
+void RunFileLoadTestCase9()
+{
+	MyContactObserver myobserver(TESTCASE::TEST9);
+	Contacts mycontact;
+	size_t result{ 0 };
+	const std::string path = "test_contacts9.json";
+
+	{
+		std::ofstream out(path, std::ios::binary);
+		out << mycontacts;
+	}
+
+	mycontact.registerObserver(&myobserver);
+
+	bool ret = mycontact.loadContactsFromFile(path, result);
+	myobserver.setcount(result);
+	std::remove(path.c_str());
+
+	if (!ret || result != 9)
+	{
+		std::lock_guard<std::mutex> lk(mutexg);
+		std::cout << "\n\nTEST CASE 9 FAILURE, file load added " << result << " of 9 contacts";
+	}
+
+	std::this_thread::yield();
+	std::this_thread::sleep_for(std::chrono::seconds(1));
+}
+
+void RunParallelLoadTestCase10()
+{
+	MyContactObserver myobserver(TESTCASE::TEST10);
+	Contacts mycontact;
+	size_t result{ 0 };
+
+	mycontact.registerObserver(&myobserver);
+
+	// same contacts as NDJSON plus two new ones, only the new ones must be counted
+	std::string ndjson = "{\"first\" : \"Alexander\",\"last\" : \"Bell\",\"phone\" : \"+16170000001\"}\n"
+		"{\"first\" : \"Nikola\",\"last\" : \"Tesla\",\"phone\" : \"+12125550100\"}\n"
+		"{\"first\" : \"Emile\",\"last\" : \"Berliner\",\"phone\" : \"+12025550111\"}\n";
+
+	bool ret = mycontact.loadContactsParallel(mycontacts, result, 4);
+	ret = mycontact.loadContactsParallel(ndjson, result, 4) && ret;
+	myobserver.setcount(result);
+
+	if (!ret || result != 11 || mycontact.listContacts().size() != 11)
+	{
+		std::lock_guard<std::mutex> lk(mutexg);
+		std::cout << "\n\nTEST CASE 10 FAILURE, parallel load added " << result << " of 11 contacts";
+	}
+
+	std::this_thread::yield();
+	std::this_thread::sleep_for(std::chrono::seconds(1));
+}
+
+void RunBatchAddTestCase11()
+{
+	MyContactObserver myobserver(TESTCASE::TEST11);
+	Contacts mycontact;
+
+	mycontact.registerObserver(&myobserver);
+	mycontact.addContact(Contact("Thomas", "Watson", "+16170000002"));
+
+	std::vector<Contact> batch = { Contact("Alexander", "Bell", "+16170000001"),
+		Contact("Thomas", "Watson", "+16170000002"), // already added
+		Contact("", "Gray", "+18476003599"), // invalid
+		Contact("Antonio", "Meucci", "+17188763245"),
+		Contact("Alexander", "Bell", "+16170000001") }; // duplicate within the batch
+
+	std::vector<ContactAddResult> results = mycontact.addContacts(batch);
+	const ContactAddResult expected[] = { ADDED, DUPLICATE, INVALID, ADDED, DUPLICATE };
+
+	myobserver.setcount(1 + std::count(results.begin(), results.end(), ContactAddResult::ADDED));
+
+	if (results.size() != batch.size() || !std::equal(results.begin(), results.end(), expected))
+	{
+		std::lock_guard<std::mutex> lk(mutexg);
+		std::cout << "\n\nTEST CASE 11 FAILURE, unexpected per contact results of addContacts";
+	}
+
+	std::this_thread::yield();
+	std::this_thread::sleep_for(std::chrono::seconds(1));
+}
+
+void RunNotifyPoolOrderingTestCase12()
+{
+	constexpr size_t CONTACTS = 2000;
+
+	{
+		std::lock_guard<std::mutex> lk(mutexg);
+		std::cout << "\n\nRunning Test Case " << "12\n";
+	}
+
+	MyOrderingObserver myobserver;
+	NotifyConfig notify;
+	notify.threads = 4;
+	notify.maxthreads = 8;
+
+	{
+		Contacts mycontact(false, DEFAULTSHARDS, notify);
+		mycontact.registerObserver(&myobserver);
+
+		for (size_t ii = 0; ii < CONTACTS; ++ii)
+		{
+			Contact contact("First" + std::to_string(ii), "Last", "+1617" + std::to_string(ii));
+
+			mycontact.addContact(contact);
+			mycontact.updateContact(contact, Contact(contact.getfirstname() + "XXX", "Last", "+1718" + std::to_string(ii)));
+
+			if (ii == CONTACTS / 3)
+				mycontact.resizeNotifyPool(1);
+			else if (ii == 2 * CONTACTS / 3)
+				mycontact.resizeNotifyPool(8);
+		}
+	} // destructor waits for the notification queues to drain
+
+	std::lock_guard<std::mutex> lk(mutexg);
+
+	if (myobserver.check(CONTACTS))
+		std::cout << "\n\nTEST CASE 12 SUCCESS";
+	else
+		std::cout << "\n\nTEST CASE 12 FAILURE, events lost or update delivered before add";
+}
+
+void RunSlowObserverIsolationTestCase13()
+{
+	constexpr size_t CONTACTS = 200;
+
+	{
+		std::lock_guard<std::mutex> lk(mutexg);
+		std::cout << "\n\nRunning Test Case " << "13\n";
+	}
+
+	MyCountingObserver slowobserver(std::chrono::milliseconds(5));
+	MyCountingObserver fastobserver(std::chrono::milliseconds(0));
+	Contacts mycontact;
+
+	mycontact.registerObserver(&slowobserver);
+	mycontact.registerObserver(&fastobserver);
+
+	for (size_t ii = 0; ii < CONTACTS; ++ii)
+		mycontact.addContact(Contact("First" + std::to_string(ii), "Last", "+1617" + std::to_string(ii)));
+
+	// the fast observer must get everything long before the slow one ( CONTACTS * 5 ms ) is done
+	for (int ii = 0; ii < 100 && fastobserver.addcount() < CONTACTS; ++ii)
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+	dispatch_stats slowstats, faststats;
+	bool ret = mycontact.getObserverStats(&slowobserver, slowstats) && mycontact.getObserverStats(&fastobserver, faststats);
+
+	mycontact.unregisterObserver(&slowobserver); // drops its backlog
+
+	std::lock_guard<std::mutex> lk(mutexg);
+
+	if (ret && fastobserver.addcount() == CONTACTS && faststats.delivered == CONTACTS && slowstats.delivered < CONTACTS)
+	{
+		std::cout << "\n\nTEST CASE 13 SUCCESS";
+		std::cout << "\nfast observer max lag " << faststats.maxlagms << " ms, slow observer " << slowstats.queued
+			<< " events queued, max lag " << slowstats.maxlagms << " ms";
+	}
+	else
+	{
+		std::cout << "\n\nTEST CASE 13 FAILURE, slow observer delayed the fast one, fast received " << fastobserver.addcount();
+	}
+}
+
+void RunBatchObserverTestCase14()
+{
+	constexpr size_t CONTACTS = 2000;
+	constexpr size_t MAXBATCH = 256;
+
+	{
+		std::lock_guard<std::mutex> lk(mutexg);
+		std::cout << "\n\nRunning Test Case " << "14\n";
+	}
+
+	MyBatchObserver myobserver;
+	Contacts mycontact;
+	BatchConfig batch;
+	batch.maxbatch = MAXBATCH;
+	batch.maxlinger = std::chrono::microseconds(5000);
+
+	mycontact.registerObserver(&myobserver, batch);
+
+	std::vector<Contact> input;
+	for (size_t ii = 0; ii < CONTACTS / 2; ++ii)
+		input.push_back(Contact("First" + std::to_string(ii), "Last", "+1617" + std::to_string(ii)));
+
+	mycontact.addContacts(input); // one batched event
+
+	for (size_t ii = CONTACTS / 2; ii < CONTACTS; ++ii)
+		mycontact.addContact(Contact("First" + std::to_string(ii), "Last", "+1617" + std::to_string(ii)));
+
+	for (size_t ii = 0; ii < CONTACTS / 2; ++ii)
+		mycontact.updateContact(input[ii], Contact("First" + std::to_string(ii), "Updated", "+1617" + std::to_string(ii)));
+
+	for (int ii = 0; ii < 200 && (myobserver.addcount() < CONTACTS || myobserver.updatecount() < CONTACTS / 2); ++ii)
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+	mycontact.unregisterObserver(&myobserver);
+
+	std::lock_guard<std::mutex> lk(mutexg);
+
+	if (myobserver.addcount() == CONTACTS && myobserver.updatecount() == CONTACTS / 2 && myobserver.maxbatch() <= MAXBATCH
+		&& myobserver.callbacks() < CONTACTS)
+	{
+		std::cout << "\n\nTEST CASE 14 SUCCESS";
+		std::cout << "\n" << CONTACTS + CONTACTS / 2 << " events in " << myobserver.callbacks() << " callbacks";
+	}
+	else
+	{
+		std::cout << "\n\nTEST CASE 14 FAILURE, added " << myobserver.addcount() << " updated " << myobserver.updatecount()
+			<< " in " << myobserver.callbacks() << " callbacks";
+	}
+}
+
+void RunSecondaryIndexTestCase15()
+{
+	constexpr size_t WRITERS = 4;
+	constexpr size_t PERWRITER = 500;
+
+	{
+		std::lock_guard<std::mutex> lk(mutexg);
+		std::cout << "\n\nRunning Test Case " << "15\n";
+	}
+
+	Contacts mycontact;
+	std::vector<std::thread> threads;
+
+	// every writer adds its contacts and updates every other one to a new phone number
+	for (size_t tt = 0; tt < WRITERS; ++tt)
+	{
+		threads.emplace_back([&mycontact, tt]()
+		{
+			for (size_t ii = 0; ii < PERWRITER; ++ii)
+			{
+				Contact contact("First" + std::to_string(ii), "Last" + std::to_string(tt), "+1617" + std::to_string(tt * PERWRITER + ii));
+				mycontact.addContact(contact);
+
+				if (ii % 2)
+					mycontact.updateContact(contact, Contact(contact.getfirstname(), contact.getlastname(), "+1508" + std::to_string(tt * PERWRITER + ii)));
+			}
+		});
+	}
+
+	for (auto& th : threads)
+		th.join();
+
+	bool ret = mycontact.findByFirstName("First7").size() == WRITERS && mycontact.findByLastName("Last2").size() == PERWRITER
+		&& mycontact.findByFirstName("Nobody").empty();
+
+	// updated contacts are only found by their new phone number
+	ret = ret && mycontact.findByPhone("+1617" + std::to_string(PERWRITER + 3)).empty();
+
+	auto found = mycontact.findByPhone("+1508" + std::to_string(PERWRITER + 3));
+	ret = ret && found.size() == 1 && found[0]->getfirstname() == "First3" && found[0]->getlastname() == "Last1";
+
+	found = mycontact.findByPhone("+1617" + std::to_string(PERWRITER + 4));
+	ret = ret && found.size() == 1 && found[0]->getfirstname() == "First4";
+
+	// one last name and one phone number shared by many contacts: removing any of them, the first indexed
+	// included, leaves the others found under the name and the number
+	{
+		constexpr size_t SHARED = 1000;
+		Contacts shared;
+
+		for (size_t ii = 0; ii < SHARED; ++ii)
+			shared.addContact(Contact("Shared" + std::to_string(ii), "Smith", "+16175550000"));
+
+		for (size_t ii = 0; ii < SHARED; ii += 3)
+			ret = ret && shared.removeContact(Contact("Shared" + std::to_string(ii), "Smith", "+16175550000"));
+
+		size_t left = SHARED - (SHARED + 2) / 3;
+		found = shared.findByLastName("Smith");
+		ret = ret && found.size() == left && shared.findByPhone("+16175550000").size() == left
+			&& shared.findByFirstName("Shared0").empty() && shared.findByFirstName("Shared1").size() == 1;
+
+		for (const auto& contact : found)
+			ret = ret && contact->getlastname() == "Smith" && contact->getphone() == "+16175550000";
+	}
+
+	std::lock_guard<std::mutex> lk(mutexg);
+
+	if (ret)
+		std::cout << "\n\nTEST CASE 15 SUCCESS";
+	else
+		std::cout << "\n\nTEST CASE 15 FAILURE, index lookups do not match the store";
+}
+
+void RunPhonePrefixTestCase16()
+{
+	{
+		std::lock_guard<std::mutex> lk(mutexg);
+		std::cout << "\n\nRunning Test Case " << "16\n";
+	}
+
+	Contacts mycontact;
+
+	for (size_t ii = 0; ii < 100; ++ii)
+	{
+		mycontact.addContact(Contact("First" + std::to_string(ii), "Boston", "+1617555" + std::to_string(1000 + ii)));
+		mycontact.addContact(Contact("First" + std::to_string(ii), "London", "+44 20 7946 " + std::to_string(1000 + ii)));
+	}
+
+	mycontact.updateContact(Contact("First0", "Boston", "+16175551000"), Contact("First0", "Boston", "+15085551000"));
+
+	bool ret = mycontact.findByPhonePrefix("+1617", 1000).size() == 99 && mycontact.findByPhonePrefix("+1", 1000).size() == 100
+		&& mycontact.findByPhonePrefix("44", 1000).size() == 100 && mycontact.findByPhonePrefix("+44 (20)", 1000).size() == 100
+		&& mycontact.findByPhonePrefix("+44", 10).size() == 10 && mycontact.findByPhonePrefix("+33", 1000).empty()
+		&& mycontact.findByPhonePrefix("", 1000).size() == 200;
+
+	auto found = mycontact.findByPhonePrefix("+1508", 1000);
+	ret = ret && found.size() == 1 && found[0]->getfirstname() == "First0";
+
+	found = mycontact.findByPhonePrefix("+44 20 7946 100", 1000);
+	ret = ret && found.size() == 10;
+	for (const auto& contact : found)
+		ret = ret && contact->getlastname() == "London";
+
+	// a switchboard: many contacts end at the node of one number, next to numbers that continue below it
+	for (size_t ii = 0; ii < 1000; ++ii)
+		mycontact.addContact(Contact("Desk" + std::to_string(ii), "Switchboard", "+1212555"));
+
+	for (size_t ii = 0; ii < 40; ++ii)
+		mycontact.addContact(Contact("Line" + std::to_string(ii), "Switchboard", "+1212555" + std::to_string(1000 + ii)));
+
+	for (size_t ii = 0; ii < 1000; ii += 2)
+		ret = ret && mycontact.removeContact(Contact("Desk" + std::to_string(ii), "Switchboard", "+1212555"));
+
+	ret = ret && mycontact.findByPhonePrefix("+1212555", 2000).size() == 540 && mycontact.findByPhonePrefix("+12125551", 2000).size() == 40
+		&& mycontact.findByPhonePrefix("+121255510", 2000).size() == 40 && mycontact.findByPhonePrefix("+1212", 100).size() == 100;
+
+	std::lock_guard<std::mutex> lk(mutexg);
+
+	if (ret)
+		std::cout << "\n\nTEST CASE 16 SUCCESS";
+	else
+		std::cout << "\n\nTEST CASE 16 FAILURE, phone prefix lookups do not match the store";
+}
+
+void RunSortedListingTestCase17()
+{
+	const char* lastnames[] = { "Smith", "Smythe", "Jones", "Brown", "Smart", "Taylor", "Sm", "Williams" };
+	constexpr size_t PERNAME = 10;
+
+	{
+		std::lock_guard<std::mutex> lk(mutexg);
+		std::cout << "\n\nRunning Test Case " << "17\n";
+	}
+
+	Contacts mycontact;
+	std::vector<std::string> expected; // "last first phone", sorts like the name index for these names
+
+	for (const char* last : lastnames)
+	{
+		for (size_t ii = 0; ii < PERNAME; ++ii)
+		{
+			Contact contact("First" + std::to_string(ii), last, "+1617" + std::to_string(ii));
+			mycontact.addContact(contact);
+			expected.push_back(std::string(last) + " " + contact.getfirstname() + " " + contact.getphone());
+		}
+	}
+
+	std::sort(expected.begin(), expected.end());
+
+	auto key = [](const ContactRecord& contact_) { return std::string(contact_->getlastname()) + " " + std::string(contact_->getfirstname()) + " " + std::string(contact_->getphone()); };
+
+	// page through in both orders
+	std::vector<std::string> ascending, descending;
+	ContactCursor cursor;
+	size_t pages = 0;
+
+	while (!cursor.atend())
+	{
+		for (const auto& contact : mycontact.listContacts(cursor, 7))
+			ascending.push_back(key(contact));
+		++pages;
+	}
+
+	ContactCursor backwards;
+	while (!backwards.atend())
+	{
+		for (const auto& contact : mycontact.listContacts(backwards, 9, SortOrder::DESCENDING))
+			descending.push_back(key(contact));
+	}
+
+	bool ret = ascending == expected && pages == (expected.size() + 6) / 7 && std::equal(descending.rbegin(), descending.rend(), expected.begin())
+		&& descending.size() == expected.size();
+
+	// last name prefix "Sm": Sm, Smart, Smith, Smythe
+	std::vector<std::string> prefixed, prefixeddesc;
+	ContactCursor prefixcursor, prefixdesc, nomatch;
+
+	while (!prefixcursor.atend())
+	{
+		for (const auto& contact : mycontact.findByLastNamePrefix("Sm", prefixcursor, 3))
+			prefixed.push_back(key(contact));
+	}
+
+	while (!prefixdesc.atend())
+	{
+		for (const auto& contact : mycontact.findByLastNamePrefix("Smi", prefixdesc, 4, SortOrder::DESCENDING))
+			prefixeddesc.push_back(key(contact));
+	}
+
+	ret = ret && prefixed.size() == 4 * PERNAME && prefixed.front() == "Sm First0 +16170" && prefixed.back() == "Smythe First9 +16179"
+		&& prefixeddesc.size() == PERNAME && prefixeddesc.front() == "Smith First9 +16179" && prefixeddesc.back() == "Smith First0 +16170"
+		&& mycontact.findByLastNamePrefix("Zz", nomatch, 10).empty() && nomatch.atend();
+
+	// contacts added behind the cursor are skipped, ahead of it they show up on a later page
+	ContactCursor live;
+	auto first = mycontact.listContacts(live, 5);
+	mycontact.addContact(Contact("First0", "Adams", "+15080000000"));
+	mycontact.addContact(Contact("First0", "Zimmer", "+15080000000"));
+
+	size_t rest = 0;
+	std::string lastseen;
+	while (!live.atend())
+	{
+		auto page = mycontact.listContacts(live, 50);
+		rest += page.size();
+		if (!page.empty())
+			lastseen = page.back()->getlastname();
+	}
+
+	ret = ret && first.size() == 5 && first[0]->getlastname() == "Brown" && rest == expected.size() - 5 + 1 && lastseen == "Zimmer";
+
+	std::lock_guard<std::mutex> lk(mutexg);
+
+	if (ret)
+		std::cout << "\n\nTEST CASE 17 SUCCESS";
+	else
+		std::cout << "\n\nTEST CASE 17 FAILURE, sorted pages do not match the store";
+}
+
+void RunFuzzySearchTestCase18()
+{
+	{
+		std::lock_guard<std::mutex> lk(mutexg);
+		std::cout << "\n\nRunning Test Case " << "18\n";
+	}
+
+	Contacts mycontact;
+
+	mycontact.addContact(Contact("Alexander", "Bell", "+15085550100"));
+	mycontact.addContact(Contact("Alexandra", "Bell", "+15085550101"));
+	mycontact.addContact(Contact("Alex", "Bell", "+15085550102"));
+	mycontact.addContact(Contact("Graham", "Bell", "+15085550103"));
+
+	for (size_t ii = 0; ii < 2000; ++ii) // filler sharing trigrams with the queries
+		mycontact.addContact(Contact("First" + std::to_string(ii), "Bellamy", "+1617" + std::to_string(ii)));
+
+	// transposition = 2 edits, case is ignored
+	auto found = mycontact.fuzzySearch("alexnader bell", 2, 10);
+	bool ret = found.size() == 1 && found[0].distance == 2 && found[0].contact->getfirstname() == "Alexander";
+
+	found = mycontact.fuzzySearch("Alexnader Bell", 4, 10);
+	ret = ret && found.size() == 2 && found[0].distance == 2 && found[1].distance == 4 && found[1].contact->getfirstname() == "Alexandra";
+
+	found = mycontact.fuzzySearch("Alexander Bell", 5, 1); // closest only
+	ret = ret && found.size() == 1 && found[0].distance == 0 && mycontact.fuzzySearch("Alexnader Bell", 1, 10).empty()
+		&& mycontact.fuzzySearch("Zebedee Quist", 2, 10).empty();
+
+	// updates replace the indexed name
+	mycontact.updateContact(Contact("Alexander", "Bell", "+15085550100"), Contact("Alexander", "Belle", "+15085550100"));
+	found = mycontact.fuzzySearch("Alexander Bell", 2, 10);
+	ret = ret && mycontact.fuzzySearch("Alexander Bell", 0, 10).empty() && found.size() == 2 && found[0].distance == 1
+		&& found[0].contact->getlastname() == "Belle" && found[1].distance == 2;
+
+	// lots of updates trigger a compaction of the index, the survivors must still be found
+	for (size_t ii = 0; ii < 2000; ++ii)
+		mycontact.updateContact(Contact("First" + std::to_string(ii), "Bellamy", "+1617" + std::to_string(ii)),
+			Contact("First" + std::to_string(ii), "Bellamie", "+1617" + std::to_string(ii)));
+
+	ret = ret && mycontact.fuzzySearch("First1234 Bellamy", 0, 10).empty() && mycontact.fuzzySearch("First1234 Bellamie", 0, 10).size() == 1
+		&& mycontact.fuzzySearch("Frist1234 Bellamie", 2, 10).size() == 1 && mycontact.fuzzySearch("Graham Bel", 1, 10).size() == 1;
+
+	// one name shared by many contacts, every other one removed and compacted away: the others keep being found
+	for (size_t ii = 0; ii < 3000; ++ii)
+		mycontact.addContact(Contact("John", "Smith", "+1212555" + std::to_string(1000 + ii)));
+
+	for (size_t ii = 0; ii < 3000; ii += 2)
+		ret = ret && mycontact.removeContact(Contact("John", "Smith", "+1212555" + std::to_string(1000 + ii)));
+
+	found = mycontact.fuzzySearch("Jon Smith", 1, 5000);
+	ret = ret && found.size() == 1500;
+
+	for (const auto& match : found)
+		ret = ret && match.distance == 1 && (match.contact->getphone().back() - '0') % 2 == 1;
+
+	std::lock_guard<std::mutex> lk(mutexg);
+
+	if (ret)
+		std::cout << "\n\nTEST CASE 18 SUCCESS";
+	else
+		std::cout << "\n\nTEST CASE 18 FAILURE, fuzzy search does not match the store";
+}
+
+void RunContactHashTestCase19()
+{
+	{
+		std::lock_guard<std::mutex> lk(mutexg);
+		std::cout << "\n\nRunning Test Case " << "19\n";
+	}
+
+	basic_hash_name<WyFieldHash> hash;
+	basic_hash_contactview<WyFieldHash> viewhash;
+	Contact contact("John", "Smith", "+16175550100");
+
+	// reference value of wyhash final 4, the hashers of the store ( build time policy ) agree with each other
+	bool ret = WyHash("message digest", 14, 3) == 0x786d1f1df3801df4ULL && hash(contact) == viewhash(ContactView(contact))
+		&& hash_name()(contact) == hash_contactview()(ContactView(contact));
+
+	// swapped fields, equal fields and shifted field boundaries must not collide
+	ret = ret && hash(contact) != hash(Contact("Smith", "John", "+16175550100"))
+		&& hash(Contact("Jo", "hnSmith", "+16175550100")) != hash(Contact("John", "Smith", "+16175550100"))
+		&& hash(Contact("Lee", "Lee", "+1")) != hash(Contact("Kim", "Kim", "+1"))
+		&& hash(Contact("", "", "")) != hash(Contact("", "", " "));
+
+	// the old policy is kept for comparison and shows the problem
+	basic_hash_name<XorFieldHash> xorhash;
+	ret = ret && xorhash(contact) == xorhash(Contact("Smith", "John", "+16175550100"))
+		&& xorhash(Contact("Lee", "Lee", "+1")) == xorhash(Contact("Kim", "Kim", "+1"));
+
+	std::lock_guard<std::mutex> lk(mutexg);
+
+	if (ret)
+		std::cout << "\n\nTEST CASE 19 SUCCESS";
+	else
+		std::cout << "\n\nTEST CASE 19 FAILURE, contact hash does not separate the fields";
+}
+
+void RunFlatMapTestCase20()
+{
+	{
+		std::lock_guard<std::mutex> lk(mutexg);
+		std::cout << "\n\nRunning Test Case " << "20\n";
+	}
+
+	FlatMap<ContactView, ContactRecord, hash_contactview, contact_key> map;
+	hash_contactview hash;
+	std::vector<ContactRecord> records;
+	bool ret = true;
+
+	for (size_t ii = 0; ii < 5000; ++ii)
+		records.push_back(ContactArena::single("First" + std::to_string(ii % 50), "Last" + std::to_string(ii / 50), "+1617" + std::to_string(ii)));
+
+	// inserts, duplicates, then erase and reinsert rounds that leave deleted slots behind
+	for (const auto& record : records)
+		ret = ret && map.insert(ContactView(*record), hash(ContactView(*record)), record);
+
+	ret = ret && !map.insert(ContactView(*records[7]), hash(ContactView(*records[7])), records[7]) && map.size() == records.size();
+
+	for (size_t round = 0; round < 4; ++round)
+	{
+		for (size_t ii = round; ii < records.size(); ii += 3)
+		{
+			ContactView view(*records[ii]);
+			const ContactRecord* found = map.find(view, hash(view));
+			ret = ret && found != nullptr && *found == records[ii];
+			if (found)
+				map.erase(found);
+		}
+
+		for (size_t ii = round; ii < records.size(); ii += 3)
+		{
+			ContactView view(*records[ii]);
+			ret = ret && map.find(view, hash(view)) == nullptr && map.insert(view, hash(view), records[ii]);
+		}
+	}
+
+	Contact absent("First1", "Last1", "+1508");
+	size_t visited = 0;
+	map.foreach([&visited](const ContactView&, const ContactRecord&) { ++visited; });
+
+	ret = ret && map.size() == records.size() && visited == records.size() && map.find(ContactView(absent), hash(ContactView(absent))) == nullptr
+		&& map.nth(records.size() - 1) != nullptr && map.nth(records.size()) == nullptr && map.capacity() * 7 / 8 >= map.size();
+
+	std::lock_guard<std::mutex> lk(mutexg);
+
+	if (ret)
+		std::cout << "\n\nTEST CASE 20 SUCCESS";
+	else
+		std::cout << "\n\nTEST CASE 20 FAILURE, flat map lost or duplicated contacts";
+}
+
+void RunContactArenaTestCase21()
+{
+	{
+		std::lock_guard<std::mutex> lk(mutexg);
+		std::cout << "\n\nRunning Test Case " << "21\n";
+	}
+
+	constexpr size_t CONTACTS = 40000;
+	const std::string extension = ";ext=" + std::string(100, '0'); // ~ 120 bytes per phone number, spreads the contacts over a few chunks
+
+	Contacts mycontact;
+	std::vector<Contact> contacts;
+	bool ret = true;
+
+	for (size_t ii = 0; ii < CONTACTS; ++ii)
+		contacts.push_back(Contact("First" + std::to_string(ii), "Last" + std::to_string(ii), "+1617" + std::to_string(ii) + extension));
+
+	for (const auto& contact : contacts)
+		ret = ret && mycontact.addContact(contact);
+
+	// a record handed out before the compaction keeps its attributes
+	std::vector<ContactRecord> held = mycontact.findByPhone("+16171" + extension);
+	ret = ret && held.size() == 1 && held[0]->getfirstname() == "First1" && held[0]->getlastname() == contacts[1].getlastname();
+
+	// three quarters of the contacts move to new records, their old chunks are left mostly dead
+	for (size_t ii = 0; ii < CONTACTS; ++ii)
+	{
+		if (ii % 4 != 0)
+			ret = ret && mycontact.updateContact(contacts[ii], Contact(contacts[ii].getfirstname(), contacts[ii].getlastname(), "+1508" + std::to_string(ii)));
+	}
+
+	arena_stats before = mycontact.contactStorageStats();
+	size_t moved = mycontact.compactContactStorage();
+	arena_stats after = mycontact.contactStorageStats();
+
+	// the copies replace the moved records, the live bytes do not grow ( pending UPDATE events may still release
+	// old records ) and fit in fewer chunks
+	ret = ret && moved > 0 && after.bytes < before.bytes && after.livebytes <= before.livebytes;
+
+	for (size_t ii = 0; ii < CONTACTS && ret; ++ii)
+	{
+		std::vector<ContactRecord> found = mycontact.findByPhone(ii % 4 == 0 ? contacts[ii].getphone() : "+1508" + std::to_string(ii));
+		ret = found.size() == 1 && found[0]->getfirstname() == contacts[ii].getfirstname() && found[0]->getlastname() == contacts[ii].getlastname()
+			&& mycontact.findByFirstName(contacts[ii].getfirstname()).size() == 1;
+	}
+
+	ret = ret && held[0]->getfirstname() == "First1" && held[0]->getphone() == "+16171" + extension && mycontact.listContacts().size() == CONTACTS;
+
+	// failed updates ( unknown old contact, new contact already stored ) make no record, nothing is interned
+	name_stats names = mycontact.nameDictionaryStats();
+	ret = ret && !mycontact.updateContact(Contact("Nobody", "Unknown", "+15550000000"), Contact("NeverStored", "Unknown", "+15550000001"))
+		&& !mycontact.updateContact(contacts[0], contacts[4]) && mycontact.nameDictionaryStats().lookups == names.lookups;
+
+	// duplicate adds, one by one or batched, make no record either: loading the same contacts again takes no chunk
+	arena_stats loaded = mycontact.contactStorageStats();
+	std::vector<Contact> kept;
+
+	for (size_t ii = 0; ii < CONTACTS; ii += 4)
+		kept.push_back(contacts[ii]);
+
+	for (size_t round = 0; round < 3; ++round)
+	{
+		std::vector<ContactAddResult> results = mycontact.addContacts(kept);
+		ret = ret && std::count(results.begin(), results.end(), ContactAddResult::DUPLICATE) == kept.size() && !mycontact.addContact(kept[round]);
+	}
+
+	ret = ret && mycontact.contactStorageStats().chunks == loaded.chunks && mycontact.nameDictionaryStats().lookups == names.lookups;
+
+	// attributes larger than a chunk share get a chunk of their own
+	std::string longname(ContactArena::CHUNKSIZE / 4, 'y');
+	std::string longphone = "+1999" + std::string(ContactArena::CHUNKSIZE / 4, '9');
+	ret = ret && mycontact.addContact(Contact(longname, "Long", longphone)) && mycontact.findByFirstName(longname).size() == 1
+		&& mycontact.findByPhone(longphone).size() == 1 && mycontact.findByPhone(longphone)[0]->getfirstname().size() == longname.size();
+
+	std::lock_guard<std::mutex> lk(mutexg);
+
+	if (ret)
+		std::cout << "\n\nTEST CASE 21 SUCCESS";
+	else
+		std::cout << "\n\nTEST CASE 21 FAILURE, contact attributes lost by the arena or its compaction";
+}
+
+void RunNameDictionaryTestCase22()
+{
+	{
+		std::lock_guard<std::mutex> lk(mutexg);
+		std::cout << "\n\nRunning Test Case " << "22\n";
+	}
+
+	constexpr size_t THREADS = 8;
+	constexpr size_t NAMES = 5000;
+
+	// every thread interns the shared names in its own order plus names only it uses
+	NameDictionary names;
+	std::vector<std::vector<uint32_t>> ids(THREADS, std::vector<uint32_t>(NAMES));
+	std::vector<std::thread> threads;
+
+	for (size_t tt = 0; tt < THREADS; ++tt)
+	{
+		threads.emplace_back([&names, &ids, tt]()
+		{
+			for (size_t kk = 0; kk < NAMES; ++kk)
+			{
+				size_t idx = (kk * 7 + tt * 131) % NAMES;
+				ids[tt][idx] = names.intern("Name" + std::to_string(idx));
+				names.intern("Thread" + std::to_string(tt) + "_" + std::to_string(kk));
+			}
+		});
+	}
+
+	for (auto& th : threads)
+		th.join();
+
+	std::unordered_set<uint32_t> distinct;
+	bool ret = true;
+
+	for (size_t ii = 0; ii < NAMES; ++ii)
+	{
+		for (size_t tt = 1; tt < THREADS; ++tt)
+			ret = ret && ids[tt][ii] == ids[0][ii];
+
+		distinct.insert(ids[0][ii]);
+		ret = ret && names.name(ids[0][ii]) == "Name" + std::to_string(ii);
+	}
+
+	name_stats stats = names.stats();
+	ret = ret && distinct.size() == NAMES && stats.names == NAMES + THREADS * NAMES && stats.lookups == 2 * THREADS * NAMES;
+
+	// the store interns first and last names, records of the same store compare names by id
+	Contacts mycontact;
+	for (size_t ii = 0; ii < 1000; ++ii)
+		mycontact.addContact(Contact("First" + std::to_string(ii % 10), "Last" + std::to_string(ii % 20), "+1617" + std::to_string(ii)));
+
+	stats = mycontact.nameDictionaryStats();
+	std::vector<ContactRecord> smith = mycontact.findByLastName("Last3");
+	std::vector<ContactRecord> phone = mycontact.findByPhone("+16173");
+
+	ret = ret && stats.names == 30 && stats.lookups == 2000 && stats.lookupbytes > 10 * stats.bytes && smith.size() == 50
+		&& phone.size() == 1 && smith[0]->lastnameid() == phone[0]->lastnameid() && smith[0]->getlastname() == "Last3"
+		&& *ContactArena::single("First3", "Last3", "+16173") == *phone[0]
+		&& std::count_if(smith.begin(), smith.end(), [&phone](const ContactRecord& contact_) { return *contact_ == *phone[0]; }) == 1;
+
+	std::lock_guard<std::mutex> lk(mutexg);
+
+	if (ret)
+		std::cout << "\n\nTEST CASE 22 SUCCESS";
+	else
+		std::cout << "\n\nTEST CASE 22 FAILURE, interned names lost or duplicated";
+}
+
+void RunPhoneKeyTestCase23()
+{
+	{
+		std::lock_guard<std::mutex> lk(mutexg);
+		std::cout << "\n\nRunning Test Case " << "23\n";
+	}
+
+	// E.164 shaped phones pack exactly, leading zeros and the '+' included, anything else does not pack
+	const char* packed[] = { "+16170000001", "16170000001", "+016170000001", "0", "+123456789012345", "+44204549898" };
+	const char* unpacked[] = { "", "+", "1234567890123456", "+1 617 000 0001", "+1(617)0000001", "+1617000000a", "++1617" };
+	std::unordered_set<uint64_t> keys;
+	bool ret = true;
+
+	for (const char* phone : packed)
+	{
+		char text[16];
+		uint64_t key = PackPhone(phone);
+
+		keys.insert(key);
+		ret = ret && key != 0 && std::string(text, UnpackPhone(key, text)) == phone;
+	}
+
+	for (const char* phone : unpacked)
+		ret = ret && PackPhone(phone) == 0;
+
+	ret = ret && keys.size() == sizeof(packed) / sizeof(packed[0]);
+
+	// every byte value in every position, only digits pack
+	for (size_t pos = 0; pos < 15 && ret; ++pos)
+	{
+		for (int ch = 0; ch < 256; ++ch)
+		{
+			std::string phone = "+" + std::string(15, '7');
+			phone[1 + pos] = static_cast<char>(ch);
+			ret = ret && (PackPhone(phone) != 0) == (ch >= '0' && ch <= '9');
+		}
+	}
+
+	// packed and unpacked phones side by side in the store, differently formatted numbers stay different contacts
+	Contacts mycontact;
+	hash_name hash;
+	hash_contactview viewhash;
+	Contact plain("Alexander", "Bell", "+16170000001");
+	Contact formatted("Alexander", "Bell", "+1 (617) 000-0001");
+
+	ret = ret && mycontact.addContact(plain) && mycontact.addContact(formatted) && !mycontact.addContact(plain)
+		&& !mycontact.addContact(formatted) && mycontact.listContacts().size() == 2
+		&& mycontact.findByPhone("+16170000001").size() == 1 && mycontact.findByPhone("+1 (617) 000-0001").size() == 1
+		&& mycontact.findByPhone("16170000001").empty();
+
+	for (const auto& record : mycontact.findByPhone("+16170000001"))
+	{
+		ret = ret && record->phonekey() == PackPhone("+16170000001") && hash(plain) == viewhash(ContactView(*record))
+			&& hash(plain) == viewhash(ContactView(plain)) && ContactView(*record) == ContactView(plain)
+			&& !(ContactView(*record) == ContactView(formatted));
+	}
+
+	ret = ret && mycontact.updateContact(plain, Contact("Alexander", "Bell", "+16170000002"))
+		&& mycontact.findByPhone("+16170000001").empty() && mycontact.findByPhone("+16170000002").size() == 1
+		&& mycontact.updateContact(formatted, Contact("Alexander", "Bell", "+16170000001"))
+		&& mycontact.findByPhone("+1 (617) 000-0001").empty() && mycontact.findByPhone("+16170000001").size() == 1;
+
+	std::lock_guard<std::mutex> lk(mutexg);
+
+	if (ret)
+		std::cout << "\n\nTEST CASE 23 SUCCESS";
+	else
+		std::cout << "\n\nTEST CASE 23 FAILURE, packed phone keys do not match the phone numbers";
+}
+
+void RunPhoneNormalizationTestCase24()
+{
+	{
+		std::lock_guard<std::mutex> lk(mutexg);
+		std::cout << "\n\nRunning Test Case " << "24\n";
+	}
+
+	struct Case
+	{
+		const char* phone;
+		unsigned int defaultcountry;
+		const char* normalized; // empty if not a valid number
+	};
+
+	const Case cases[] = {
+		{ "+1 (617) 000-0001", 0, "+16170000001" }, { "+16170000001", 0, "+16170000001" }, { "617.000.0001", 1, "+16170000001" },
+		{ "1-617-000-0001", 1, "+16170000001" }, { "0044 20 7946 0958", 0, "+442079460958" }, { "020 7946 0958", 44, "+442079460958" },
+		{ "+39 051 203222", 0, "+39051203222" }, { "+683 4002", 0, "+6834002" }, { "  + 3 5 3 / 1 2 3 / 4 5 6 7 8 9  ", 0, "+353123456789" },
+		{ "+1 617 000 000", 0, "" }, { "+1 017 000 0001", 0, "" }, { "+0 123 4567", 0, "" }, { "617-000-0001", 0, "" },
+		{ "+1 617 000 0001 ext 5", 0, "" }, { "+44 20 7946 0958 0000 000", 0, "" }, { "1+617 000 0001", 1, "" }, { "++16170000001", 0, "" },
+		{ "+68 3", 0, "" }, { "", 1, "" }, { "+", 0, "" }
+	};
+
+	bool ret = true;
+
+	for (const Case& test : cases)
+	{
+		char buffer[E164BUFFER];
+		size_t size = NormalizePhone(test.phone, test.defaultcountry, buffer);
+
+		ret = ret && std::string(buffer, size) == test.normalized;
+	}
+
+	// off by default, differently formatted numbers are different contacts until normalization is enabled
+	Contacts mycontact;
+	Contact plain("Alexander", "Bell", "+16170000001");
+
+	ret = ret && mycontact.addContact(Contact("Thomas", "Watson", "(617) 000-0002"));
+
+	mycontact.EnablePhoneNormalization(1);
+
+	size_t count = 0;
+	std::string json = "[{\"first\" : \"Alexander\",\"last\" : \"Bell\",\"phone\" : \"+1 (617) 000-0001\"},"
+		"{\"first\" : \"Alexander\",\"last\" : \"Bell\",\"phone\" : \"617.000.0001\"},"
+		"{\"first\" : \"Elisha\",\"last\" : \"Gray\",\"phone\" : \"+1 847 600 3599 ext 12\"},"
+		"{\"first\" : \"Guglielmo\",\"last\" : \"Marconi\",\"phone\" : \"0039 051 203222\"}]";
+
+	ret = ret && mycontact.loadContactsFromJSON(json, count) && count == 2 && !mycontact.addContact(plain)
+		&& mycontact.addContacts(std::vector<Contact>{ plain, Contact("Elisha", "Gray", "847 600 3599") })
+			== std::vector<ContactAddResult>({ ContactAddResult::DUPLICATE, ContactAddResult::ADDED });
+
+	std::vector<ContactRecord> bell = mycontact.findByPhone("1 617 000 0001");
+	ret = ret && bell.size() == 1 && bell[0]->getphone() == "+16170000001" && mycontact.findByPhone("+39051203222").size() == 1
+		&& mycontact.findByPhone("(617) 000-0002").empty() && mycontact.findByPhone("+1 (847) 600-3599").size() == 1;
+
+	// updates find the old contact by any formatting of its number
+	ret = ret && mycontact.updateContact(Contact("Alexander", "Bell", "617-000-0001"), Contact("Alexander", "Bell", "+1 617 000 0003"))
+		&& mycontact.findByPhone("+16170000003").size() == 1 && mycontact.findByPhone("+16170000001").empty()
+		&& !mycontact.updateContact(Contact("Alexander", "Bell", "+16170000003"), Contact("Alexander", "Bell", "not a number"));
+
+	mycontact.DisablePhoneNormalization();
+
+	ret = ret && mycontact.addContact(Contact("Alexander", "Bell", "+1 617 000 0003")) && mycontact.listContacts().size() == 5;
+
+	std::lock_guard<std::mutex> lk(mutexg);
+
+	if (ret)
+		std::cout << "\n\nTEST CASE 24 SUCCESS";
+	else
+		std::cout << "\n\nTEST CASE 24 FAILURE, phone numbers not normalized to E.164";
+}
+
+// "first last phone" of every contact, sorted: listContacts() order depends on the insertion history of the store
+static std::vector<std::string> SortedContacts(const std::list<Contact>& contacts_)
+{
+	std::vector<std::string> sorted;
+
+	for (const auto& contact : contacts_)
+		sorted.push_back(contact.getfirstname() + " " + contact.getlastname() + " " + contact.getphone());
+
+	std::sort(sorted.begin(), sorted.end());
+	return sorted;
+}
+
+void RunSnapshotTestCase25()
+{
+	{
+		std::lock_guard<std::mutex> lk(mutexg);
+		std::cout << "\n\nRunning Test Case " << "25\n";
+	}
+
+	const std::string path = "test_contacts25.snap";
+	const std::string corrupt = "test_contacts25_corrupt.snap";
+	Contacts mycontact;
+	size_t count = 0;
+
+	// packed phones and phones kept as text, shared names
+	bool ret = mycontact.loadContactsFromJSON(mycontacts, count) && mycontact.addContact(Contact("Alexander", "Bell", "+1 (617) 000-0009"))
+		&& mycontact.addContact(Contact("Alexander", "Graham", "00441632960001")) && mycontact.saveSnapshot(path);
+
+	Contacts restored;
+	size_t restoredcount = 0;
+
+	ret = ret && restored.loadSnapshot(path, restoredcount, 2) && restoredcount == mycontact.listContacts().size()
+		&& SortedContacts(restored.listContacts()) == SortedContacts(mycontact.listContacts()) && restored.findByPhone("+1 (617) 000-0009").size() == 1
+		&& restored.findByFirstName("Alexander").size() == 3 && restored.findByPhonePrefix("+1617", 10).size() == mycontact.findByPhonePrefix("+1617", 10).size();
+
+	// contacts already stored are skipped
+	restoredcount = 0;
+	ret = ret && restored.loadSnapshot(path, restoredcount) && restoredcount == 0 && restored.listContacts().size() == mycontact.listContacts().size();
+
+	std::string bytes;
+	{
+		std::ifstream in(path, std::ios::binary);
+		bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	}
+
+	auto rejected = [&](const std::string& bytes_)
+	{
+		{
+			std::ofstream out(corrupt, std::ios::binary | std::ios::trunc);
+			out.write(bytes_.data(), bytes_.size());
+		}
+
+		Contacts empty;
+		size_t added = 0;
+
+		return !empty.loadSnapshot(corrupt, added) && added == 0 && empty.listContacts().empty();
+	};
+
+	// a flipped byte of the phone heap, of a record and of the magic, a truncated file
+	for (size_t pos : { bytes.size() - 1, sizeof(SnapshotHeader) + 3, static_cast<size_t>(0) })
+	{
+		std::string damaged = bytes;
+		damaged[pos] ^= 0x20;
+		ret = ret && rejected(damaged);
+	}
+
+	ret = ret && rejected(bytes.substr(0, bytes.size() - 1)) && rejected(bytes.substr(0, 10)) && !restored.loadSnapshot("no_such_file.snap", count);
+
+	// an empty store round trips too
+	Contacts empty, emptyrestored;
+	ret = ret && empty.saveSnapshot(corrupt) && emptyrestored.loadSnapshot(corrupt, count) && emptyrestored.listContacts().empty();
+
+	std::remove(path.c_str());
+	std::remove(corrupt.c_str());
+
+	std::lock_guard<std::mutex> lk(mutexg);
+
+	if (ret)
+		std::cout << "\n\nTEST CASE 25 SUCCESS";
+	else
+		std::cout << "\n\nTEST CASE 25 FAILURE, snapshot did not restore the contacts";
+}
+
+void RunWriteAheadLogTestCase26()
+{
+	{
+		std::lock_guard<std::mutex> lk(mutexg);
+		std::cout << "\n\nRunning Test Case " << "26\n";
+	}
+
+	const std::string path = "test_contacts26.wal";
+	const std::string snapshot = "test_contacts26.snap";
+	constexpr size_t WRITERS = 8;
+	constexpr size_t PERWRITER = 100;
+
+	std::remove(path.c_str());
+
+	WalConfig config;
+	config.groupcommit = std::chrono::microseconds(2000);
+
+	std::vector<std::string> expected;
+	size_t replayed = 0;
+	bool ret = true;
+
+	{
+		Contacts mycontact;
+		size_t count = 0;
+
+		ret = ret && mycontact.openWriteAheadLog(path, replayed, config) && replayed == 0 && mycontact.loadContactsFromJSON(mycontacts, count)
+			&& mycontact.updateContact(Contact("Alexander", "Bell", "+16170000001"), Contact("Alexander", "Bell", "+16170000009"))
+			&& !mycontact.addContact(Contact("Thomas", "Watson", "+16170000002"));
+
+		// concurrent writers share syncs
+		std::vector<std::thread> writers;
+		for (size_t tt = 0; tt < WRITERS; ++tt)
+		{
+			writers.emplace_back([&mycontact, tt]()
+			{
+				for (size_t ii = 0; ii < PERWRITER; ++ii)
+					mycontact.addContact(Contact("Writer" + std::to_string(tt), "Log" + std::to_string(ii), "+1212555" + std::to_string(1000 + ii)));
+			});
+		}
+
+		for (auto& writer : writers)
+			writer.join();
+
+		wal_stats stats = mycontact.writeAheadLogStats();
+		ret = ret && !stats.failed && stats.entries == count + 1 + WRITERS * PERWRITER && stats.syncs < stats.entries && stats.maxbatch > 1;
+
+		expected = SortedContacts(mycontact.listContacts());
+	}
+
+	// restart: the log alone brings the contacts back
+	{
+		Contacts mycontact;
+
+		ret = ret && mycontact.openWriteAheadLog(path, replayed) && replayed == expected.size() + 1 && SortedContacts(mycontact.listContacts()) == expected
+			&& mycontact.findByPhone("+16170000009").size() == 1 && mycontact.findByPhone("+16170000001").empty();
+
+		// a checkpoint leaves only what is logged after it
+		ret = ret && mycontact.checkpoint(snapshot) && mycontact.writeAheadLogStats().filebytes == 8
+			&& mycontact.addContact(Contact("Samuel", "Morse", "+16172419877"));
+
+		expected = SortedContacts(mycontact.listContacts());
+	}
+
+	// a torn last entry is dropped, the log stays usable
+	{
+		std::ofstream out(path, std::ios::binary | std::ios::app);
+		out.write("\x30\x00\x00\x00\x01\x02", 6);
+	}
+
+	{
+		Contacts mycontact;
+		size_t count = 0;
+
+		replayed = 0;
+		ret = ret && mycontact.loadSnapshot(snapshot, count) && mycontact.openWriteAheadLog(path, replayed) && replayed == 1
+			&& SortedContacts(mycontact.listContacts()) == expected && mycontact.addContact(Contact("Guglielmo", "Marconi", "+39051203223"));
+	}
+
+	{
+		Contacts mycontact;
+		size_t count = 0;
+
+		replayed = 0;
+		ret = ret && mycontact.loadSnapshot(snapshot, count) && mycontact.openWriteAheadLog(path, replayed) && replayed == 2
+			&& mycontact.listContacts().size() == expected.size() + 1;
+	}
+
+	// checkpoints copy one shard at a time while updates move contacts between shards, so a snapshot can hold both
+	// sides of an update logged after its position, or neither. Replaying the log over it must still give the
+	// contacts as they were: no moved contact lost or brought back
+	{
+		constexpr size_t MOVERS = 20000;
+		constexpr size_t CHECKPOINTS = 5;
+		auto mover = [](size_t ii_, size_t round_) { return Contact("Mover" + std::to_string(ii_), "Shard", "+1313" + std::to_string(round_ * MOVERS + ii_)); };
+
+		std::remove(path.c_str());
+		std::remove(snapshot.c_str());
+
+		WalConfig unsynced;
+		unsynced.sync = false;
+
+		{
+			Contacts mycontact;
+			std::vector<Contact> contacts;
+
+			for (size_t ii = 0; ii < MOVERS; ++ii)
+				contacts.push_back(mover(ii, 0));
+
+			ret = ret && mycontact.openWriteAheadLog(path, replayed, unsynced);
+			mycontact.addContacts(contacts);
+
+			std::atomic<bool> moving{ true };
+			std::thread updater([&]()
+			{
+				for (size_t round = 0; moving; ++round)
+				{
+					for (size_t ii = 0; ii < MOVERS && moving; ++ii)
+						mycontact.updateContact(mover(ii, round), mover(ii, round + 1));
+				}
+			});
+
+			for (size_t ii = 0; ii < CHECKPOINTS; ++ii)
+				ret = ret && mycontact.checkpoint(snapshot);
+
+			moving = false;
+			updater.join();
+
+			expected = SortedContacts(mycontact.listContacts());
+			ret = ret && expected.size() == MOVERS;
+		}
+
+		Contacts mycontact;
+		size_t count = 0;
+
+		ret = ret && mycontact.loadSnapshot(snapshot, count) && mycontact.openWriteAheadLog(path, replayed)
+			&& SortedContacts(mycontact.listContacts()) == expected;
+	}
+
+	// the same two cases made on purpose: the log holds the update Before -> After only, the snapshot holds both
+	// contacts / neither of them
+	{
+		Contact before("Before", "Checkpoint", "+13135550100");
+		Contact after("After", "Checkpoint", "+13135550101");
+		Contact other("Other", "Checkpoint", "+13135550102");
+
+		for (size_t both = 0; both < 2; ++both)
+		{
+			std::remove(path.c_str());
+			std::remove(snapshot.c_str());
+
+			{
+				Contacts mycontact;
+
+				ret = ret && mycontact.openWriteAheadLog(path, replayed) && mycontact.addContact(before)
+					&& mycontact.checkpoint(snapshot) && mycontact.updateContact(before, after);
+			}
+
+			{
+				Contacts mycontact;
+
+				mycontact.addContact(other);
+
+				if (both)
+				{
+					mycontact.addContact(before);
+					mycontact.addContact(after);
+				}
+
+				ret = ret && mycontact.saveSnapshot(snapshot);
+			}
+
+			Contacts mycontact;
+			size_t count = 0;
+
+			replayed = 0;
+			ret = ret && mycontact.loadSnapshot(snapshot, count) && mycontact.openWriteAheadLog(path, replayed) && replayed == 1
+				&& SortedContacts(mycontact.listContacts()) == SortedContacts({ after, other });
+		}
+	}
+
+	// not a log
+	{
+		std::ofstream out(path, std::ios::binary | std::ios::trunc);
+		out << "not a log";
+	}
+
+	Contacts mycontact;
+	ret = ret && !mycontact.openWriteAheadLog(path, replayed);
+
+	std::remove(path.c_str());
+	std::remove(snapshot.c_str());
+
+	std::lock_guard<std::mutex> lk(mutexg);
+
+	if (ret)
+		std::cout << "\n\nTEST CASE 26 SUCCESS";
+	else
+		std::cout << "\n\nTEST CASE 26 FAILURE, write-ahead log lost or replayed contacts wrongly";
+}
+
+void RunExportTestCase27()
+{
+	{
+		std::lock_guard<std::mutex> lk(mutexg);
+		std::cout << "\n\nRunning Test Case " << "27\n";
+	}
+
+	const std::string path = "test_contacts27.json";
+	Contacts mycontact;
+	size_t count = 0;
+
+	// characters JSON escapes survive the round trip
+	bool ret = mycontact.loadContactsFromJSON(mycontacts, count) && mycontact.addContact(Contact("Jean \"Jack\"", "O\\Brien", "+1 617 000 0099"))
+		&& mycontact.addContact(Contact("Ren\xC3\xA9", "Tab\tNew\nLine", "+33 1 23 45 67 89"));
+
+	std::vector<std::string> expected = SortedContacts(mycontact.listContacts());
+	std::ostringstream out;
+	size_t exported = 0;
+
+	ret = ret && mycontact.exportContactsJSON(out, exported) && exported == expected.size();
+
+	Contacts fromstream;
+	count = 0;
+	ret = ret && fromstream.loadContactsFromJSON(out.str(), count) && count == expected.size() && SortedContacts(fromstream.listContacts()) == expected;
+
+	exported = 0;
+	ret = ret && mycontact.exportContactsJSON(path, exported) && exported == expected.size();
+
+	Contacts fromfile;
+	count = 0;
+	ret = ret && fromfile.loadContactsFromFileParallel(path, count, 2) && count == expected.size() && SortedContacts(fromfile.listContacts()) == expected;
+
+	// an empty store exports an empty array, an unwritable path fails
+	Contacts empty;
+	std::ostringstream emptyout;
+	exported = 0;
+	ret = ret && empty.exportContactsJSON(emptyout, exported) && exported == 0 && emptyout.str() == "[]"
+		&& !mycontact.exportContactsJSON("no_such_directory/contacts.json", exported);
+
+	std::remove(path.c_str());
+
+	std::lock_guard<std::mutex> lk(mutexg);
+
+	if (ret)
+		std::cout << "\n\nTEST CASE 27 SUCCESS";
+	else
+		std::cout << "\n\nTEST CASE 27 FAILURE, exported contacts do not load back";
+}
+
+void RunSyncTestCase28()
+{
+	{
+		std::lock_guard<std::mutex> lk(mutexg);
+		std::cout << "\n\nRunning Test Case " << "28\n";
+	}
+
+	const std::string path = "test_contacts28.wal";
+	Contacts mycontact;
+	MyBatchObserver myobserver;
+	size_t count = 0;
+	size_t replayed = 0;
+
+	std::remove(path.c_str());
+
+	bool ret = mycontact.loadContactsFromJSON(mycontacts, count) && mycontact.openWriteAheadLog(path, replayed);
+
+	// the next export: one contact gone, one with a new phone number, one new, one repeated and one invalid
+	Contact gone("Thomas", "Watson", "+16170000002");
+	std::ostringstream out;
+	size_t exported = 0;
+
+	ret = ret && mycontact.removeContact(gone) && mycontact.exportContactsJSON(out, exported) && mycontact.addContact(gone)
+		&& mycontact.updateContact(Contact("Elisha", "Gray", "+18476003599"), Contact("Elisha", "Gray", "+18476003500"));
+
+	std::string next = out.str();
+	next.insert(1, "{\"first\":\"Nikola\",\"last\":\"Tesla\",\"phone\":\"+12125550100\"},{\"first\":\"Nikola\",\"last\":\"Tesla\",\"phone\":\"+12125550100\"},"
+		"{\"first\":\"\",\"last\":\"Nobody\",\"phone\":\"+12125550101\"},");
+
+	mycontact.registerObserver(&myobserver);
+
+	sync_report report;
+	ret = ret && mycontact.syncFromJSON(next, report, 2) && report.parsed == exported + 3 && report.invalid == 1 && report.duplicates == 1
+		&& report.added == 2 && report.removed == 2 && report.unchanged == exported - 1;
+
+	for (int ii = 0; ii < 100 && myobserver.addcount() + myobserver.removecount() < 4; ++ii)
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+	std::vector<std::string> expected = SortedContacts(mycontact.listContacts());
+
+	ret = ret && myobserver.addcount() == 2 && myobserver.removecount() == 2 && mycontact.findByPhone("+16170000002").empty()
+		&& mycontact.findByPhone("+18476003599").size() == 1 && mycontact.findByLastName("Tesla").size() == 1;
+
+	// the same export again changes nothing, a malformed one changes nothing either
+	sync_report again;
+	ret = ret && mycontact.syncFromJSON(next, again) && again.added == 0 && again.removed == 0
+		&& !mycontact.syncFromJSON(next.substr(0, next.size() / 2), again) && SortedContacts(mycontact.listContacts()) == expected;
+
+	mycontact.closeWriteAheadLog();
+
+	// the removals are logged
+	Contacts restarted;
+	count = 0;
+	ret = ret && restarted.loadContactsFromJSON(mycontacts, count) && restarted.openWriteAheadLog(path, replayed)
+		&& SortedContacts(restarted.listContacts()) == expected;
+
+	// an empty export empties the store
+	ret = ret && mycontact.syncFromJSON("[]", again) && again.removed == expected.size() && mycontact.listContacts().empty()
+		&& mycontact.findByLastName("Tesla").empty();
+
+	mycontact.unregisterObserver(&myobserver);
+	std::remove(path.c_str());
+
+	std::lock_guard<std::mutex> lk(mutexg);
+
+	if (ret)
+	{
+		std::cout << "\n\nTEST CASE 28 SUCCESS";
+		std::cout << "\nsync of " << report.parsed << " contacts: parse " << report.parsems << " ms, apply " << report.applyms << " ms";
+	}
+	else
+		std::cout << "\n\nTEST CASE 28 FAILURE, sync did not bring the store to the export";
+}
+
+static void RemoveStore(const std::string& path_, size_t stripes_)
+{
+	for (size_t ii = 0; ii < stripes_; ++ii)
+	{
+		std::string file = path_ + "." + std::to_string(ii);
+
+		std::remove(file.c_str());
+		std::remove((file + ".tmp").c_str());
+	}
+}
+
+void RunMappedStoreTestCase29()
+{
+	{
+		std::lock_guard<std::mutex> lk(mutexg);
+		std::cout << "\n\nRunning Test Case " << "29\n";
+	}
+
+	const std::string path = "test_contacts29.store";
+	const std::string copy = "test_contacts29_copy.store";
+	constexpr size_t STRIPES = 4;
+	constexpr size_t GROWN = 20000;
+
+	RemoveStore(path, STRIPES);
+	RemoveStore(copy, STRIPES);
+
+	StoreConfig config;
+	config.path = path;
+	config.stripes = STRIPES;
+	config.preload = false;
+
+	std::vector<std::string> expected;
+	bool ret = true;
+
+	// the scenarios of the memory store, written through to the files
+	{
+		Contacts mycontact(false, DEFAULTSHARDS, NotifyConfig(), config);
+		size_t count = 0;
+
+		ret = ret && mycontact.loadContactsFromJSON(mycontacts, count) && count == 9 && !mycontact.addContact(Contact("Thomas", "Watson", "+16170000002"))
+			&& mycontact.updateContact(Contact("Alexander", "Bell", "+16170000001"), Contact("Alexander", "Bell", "+16170000009"))
+			&& mycontact.removeContact(Contact("John", "Baird", "+4408458591006")) && mycontact.addContact(Contact("Nikola", "Tesla", "+12125550100"))
+			&& mycontact.findByLastName("Baird").empty() && mycontact.findByPhone("+16170000009").size() == 1;
+
+		mapped_store_stats stats = mycontact.storeStats();
+		expected = SortedContacts(mycontact.listContacts());
+
+		ret = ret && !stats.failed && stats.stripes == STRIPES && stats.contacts == expected.size() && stats.contacts == 9;
+	}
+
+	// reopened: nothing is read until used, a single contact reads only its stripe. An existing store keeps its stripes
+	{
+		config.stripes = 8;
+		Contacts mycontact(false, DEFAULTSHARDS, NotifyConfig(), config);
+
+		mapped_store_stats stats = mycontact.storeStats();
+		ret = ret && stats.stripes == STRIPES && stats.loaded == 0 && stats.contacts == expected.size()
+			&& !mycontact.addContact(Contact("Alexander", "Bell", "+16170000009")) && mycontact.storeStats().loaded == 1
+			&& mycontact.findByPhone("+16170000001").empty() && mycontact.findByFirstName("Thomas").size() == 2
+			&& SortedContacts(mycontact.listContacts()) == expected && mycontact.storeStats().loaded == STRIPES;
+
+		// the tables and heaps grow, removals leave dead bytes that are dropped again
+		std::vector<Contact> contacts;
+		for (size_t ii = 0; ii < GROWN; ++ii)
+			contacts.emplace_back("Grown" + std::to_string(ii % 100), "Store" + std::to_string(ii), "+1212" + std::to_string(5000000 + ii));
+
+		std::vector<ContactAddResult> results = mycontact.addContacts(contacts);
+		ret = ret && std::count(results.begin(), results.end(), ContactAddResult::ADDED) == GROWN;
+
+		for (size_t ii = 0; ii < GROWN; ii += 2)
+			ret = ret && mycontact.removeContact(contacts[ii]);
+
+		stats = mycontact.storeStats();
+		expected = SortedContacts(mycontact.listContacts());
+		ret = ret && !stats.failed && stats.rewrites > 0 && stats.contacts == expected.size() && stats.contacts == 9 + GROWN / 2
+			&& mycontact.flushStore();
+
+		// a copy of files still open ( as a crash leaves them ) has its counts recomputed
+		for (size_t ii = 0; ii < STRIPES; ++ii)
+		{
+			std::ifstream in(path + "." + std::to_string(ii), std::ios::binary);
+			std::ofstream out(copy + "." + std::to_string(ii), std::ios::binary | std::ios::trunc);
+			out << in.rdbuf();
+		}
+	}
+
+	config.stripes = 0;
+	config.preload = true;
+
+	{
+		Contacts mycontact(false, DEFAULTSHARDS, NotifyConfig(), config);
+		ContactCursor cursor;
+
+		ret = ret && SortedContacts(mycontact.listContacts()) == expected && mycontact.findByLastNamePrefix("Store1", cursor, 5).size() == 5;
+	}
+
+	{
+		config.path = copy;
+		Contacts mycontact(false, DEFAULTSHARDS, NotifyConfig(), config);
+
+		ret = ret && mycontact.storeStats().contacts == expected.size() && SortedContacts(mycontact.listContacts()) == expected;
+	}
+
+	// hashed with another seed: the slots cannot be probed, the store is rejected
+	{
+		std::fstream file(copy + ".1", std::ios::binary | std::ios::in | std::ios::out);
+		uint64_t seed = MAPPEDSTORESEED + 1;
+
+		file.seekp(offsetof(MappedStoreHeader, seed));
+		file.write(reinterpret_cast<const char*>(&seed), sizeof(seed));
+	}
+
+	{
+		Contacts mycontact(false, DEFAULTSHARDS, NotifyConfig(), config);
+
+		ret = ret && mycontact.storeStats().failed && mycontact.listContacts().empty();
+	}
+
+	// not a store: the instance stays in memory
+	{
+		std::ofstream out(copy + ".0", std::ios::binary | std::ios::trunc);
+		out << "not a contact store";
+	}
+
+	{
+		Contacts mycontact(false, DEFAULTSHARDS, NotifyConfig(), config);
+
+		ret = ret && mycontact.storeStats().failed && !mycontact.flushStore() && mycontact.addContact(Contact("Nikola", "Tesla", "+12125550100"))
+			&& mycontact.listContacts().size() == 1;
+	}
+
+	RemoveStore(path, STRIPES);
+	RemoveStore(copy, STRIPES);
+
+	std::lock_guard<std::mutex> lk(mutexg);
+
+	if (ret)
+		std::cout << "\n\nTEST CASE 29 SUCCESS";
+	else
+		std::cout << "\n\nTEST CASE 29 FAILURE, mapped store did not keep the contacts";
+}